@@ -18,6 +18,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <ws.h>
 
@@ -111,11 +112,22 @@ void onmessage(ws_cli_conn_t client,
 /**
  * @brief Main routine.
  *
+ * @param argc Argument count.
+ * @param argv Arguments, if the first one is 'epoll' or 'uring', the
+ * clients are served by event loops instead of one thread per client.
+ *
  * @note After invoking @ref ws_socket, this routine never returns,
  * unless if invoked from a different thread.
  */
-int main(void)
+int main(int argc, char **argv)
 {
+	int io_model = WS_IO_THREADS;
+
+	if (argc > 1 && !strcmp(argv[1], "epoll"))
+		io_model = WS_IO_EPOLL;
+	else if (argc > 1 && !strcmp(argv[1], "uring"))
+		io_model = WS_IO_URING;
+
 	ws_socket(&(struct ws_server){
 		/*
 		 * Bind host:
@@ -127,6 +139,8 @@ int main(void)
 		.port = 8080,
 		.thread_loop   = 0,
 		.timeout_ms    = 1000,
+		.io_model      = io_model,
+		.deflate       = 1,
 		.evs.onopen    = &onopen,
 		.evs.onclose   = &onclose,
 		.evs.onmessage = &onmessage
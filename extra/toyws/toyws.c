@@ -39,12 +39,14 @@ typedef unsigned long in_addr_t;
 #endif
 
 #include "toyws.h"
+#include <mask.h>
 
 /*
  * This is a WebSocket 'toy client', made exclusively to work with wsServer.
  *
- * Although it is independent of the wsServer src tree, it is highly limited
- * and therefore not recommended for use with other servers.
+ * Although it is independent of the wsServer src tree (except for the frame
+ * masking routine, src/mask.c), it is highly limited and therefore not
+ * recommended for use with other servers.
  *
  * There are the following restrictions (not limited to):
  * - Fixed handshake header
@@ -189,8 +191,6 @@ int tws_sendframe(struct tws_ctx *ctx, uint8_t *msg, uint64_t size,
 	uint8_t masks[4];
 	uint64_t length;
 	uint8_t hdr_len;
-	size_t count;
-	uint8_t *tmp;
 	uint8_t *p;
 
 	frame[0]  = FRM_FIN | type;
@@ -238,14 +238,11 @@ int tws_sendframe(struct tws_ctx *ctx, uint8_t *msg, uint64_t size,
 		return (-2);
 
 	/* Mask message and send it. */
-	p = calloc(1, size);
+	p = malloc(size ? size : 1);
 	if (!p)
 		return (-3);
 
-	memcpy(p, msg, size);
-
-	for (tmp = p, count = 0; count < size; tmp++, count++)
-		*tmp ^= masks[count % 4];
+	mask_xor(p, msg, size, masks, 0);
 
 	if (send(ctx->fd, p, size, MSG_NOSIGNAL) < 0)
 	{
@@ -16,4 +16,10 @@ unsigned char * base64_encode(const unsigned char *src, size_t len,
 unsigned char * base64_decode(const unsigned char *src, size_t len,
 			      size_t *out_len);
 
+/* Length of the base64 encoding of n bytes, without line feeds. */
+#define BASE64_ENC_LEN(n) (((n) + 2) / 3 * 4)
+
+size_t base64_encode_buf(const unsigned char *src, size_t len,
+			 unsigned char *out);
+
 #endif /* BASE64_H */
@@ -0,0 +1,108 @@
+/*
+ * Copyright (C) 2016-2024  Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file http.h
+ * @brief Incremental HTTP/1.1 upgrade request parser.
+ */
+#ifndef HTTP_H
+#define HTTP_H
+
+	#include <stddef.h>
+	#include <stdint.h>
+
+	/**
+	 * @brief Largest request supported: offsets are 16-bit.
+	 */
+	#define HTTP_MAX_SIZE 65535
+
+	/**
+	 * @brief Max amount of header fields per request.
+	 */
+	#define HTTP_MAX_HEADERS 32
+
+	/**
+	 * @name http_parse() return values
+	 */
+	/**@{*/
+	#define HTTP_ERROR -1 /**< Malformed or too large request. */
+	#define HTTP_MORE   0 /**< Incomplete request.             */
+	#define HTTP_DONE   1 /**< Complete request.               */
+	/**@}*/
+
+	/**
+	 * @name Known header fields
+	 */
+	/**@{*/
+	#define HTTP_HDR_OTHER      0
+	#define HTTP_HDR_HOST       1
+	#define HTTP_HDR_UPGRADE    2
+	#define HTTP_HDR_CONNECTION 3
+	#define HTTP_HDR_ORIGIN     4
+	#define HTTP_HDR_WS_KEY     5
+	#define HTTP_HDR_WS_VERSION 6
+	#define HTTP_HDR_WS_EXT     7
+	#define HTTP_HDR_WS_PROTO   8
+	/**@}*/
+
+	/**
+	 * @name Upgrade request checks, as found by the parser
+	 */
+	/**@{*/
+	#define HTTP_F_UPGRADE    1 /**< Upgrade lists 'websocket'.    */
+	#define HTTP_F_CONNECTION 2 /**< Connection lists 'upgrade'.   */
+	#define HTTP_F_VERSION    4 /**< Sec-WebSocket-Version is 13.  */
+	#define HTTP_F_WEBSOCKET  7 /**< All of them: valid upgrade.   */
+	/**@}*/
+
+	/**
+	 * @brief Header field: both name and value are NUL-terminated
+	 * (in place) and referenced by their offset in the request.
+	 */
+	struct http_header
+	{
+		uint16_t name;  /**< Name offset.            */
+		uint16_t nlen;  /**< Name length.            */
+		uint16_t value; /**< Value offset (trimmed). */
+		uint16_t vlen;  /**< Value length.           */
+		uint8_t id;     /**< Known field, if any.    */
+	};
+
+	/**
+	 * @brief Request parser state and result, initialized with
+	 * http_init(); it never allocates memory.
+	 */
+	struct http_req
+	{
+		size_t max;       /**< Max request size.                   */
+		size_t pos;       /**< Bytes scanned so far.               */
+		size_t line;      /**< Current line offset.                */
+		size_t len;       /**< Request length, once complete.      */
+		uint16_t path;    /**< Request target offset.              */
+		uint16_t plen;    /**< Request target length.              */
+		uint8_t flags;    /**< Upgrade checks (HTTP_F_*).          */
+		int8_t key;       /**< Sec-WebSocket-Key field, -1 if not. */
+		int nhdrs;        /**< Amount of header fields.            */
+		struct http_header hdrs[HTTP_MAX_HEADERS]; /**< Fields.    */
+	};
+
+	extern void http_init(struct http_req *req, size_t max);
+	extern int http_parse(struct http_req *req, char *buf, size_t len);
+	extern int http_list_has(const char *list, const char *tok);
+	extern const char *http_reason(int status);
+
+#endif /* HTTP_H */
@@ -0,0 +1,32 @@
+/*
+ * Copyright (C) 2016-2024  Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file mask.h
+ * @brief WebSocket payload (un)masking.
+ */
+#ifndef MASK_H
+#define MASK_H
+
+	#include <stddef.h>
+	#include <stdint.h>
+
+	extern void mask_xor(unsigned char *dst, const unsigned char *src,
+		size_t len, const uint8_t *masks, uint64_t off);
+	extern const char *mask_kernel(void);
+
+#endif /* MASK_H */
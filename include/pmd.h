@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2016-2024  Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file pmd.h
+ * @brief permessage-deflate (RFC 7692) extension.
+ */
+#ifndef PMD_H
+#define PMD_H
+
+	#include <stdbool.h>
+	#include <stddef.h>
+
+	/*
+	 * Compression itself requires zlib: without it (WS_HAS_DEFLATE
+	 * not defined by the build), the extension is never negotiated.
+	 */
+#ifdef WS_HAS_DEFLATE
+	#include <zlib.h>
+#endif
+
+	/**
+	 * @brief Extension name.
+	 */
+	#define PMD_NAME "permessage-deflate"
+
+	/**
+	 * @brief permessage-deflate parameters: the ones wanted by the
+	 * server or the ones negotiated with a client.
+	 */
+	struct pmd_params
+	{
+		int server_bits;    /**< Server max LZ77 window (8-15).   */
+		bool server_no_ctx; /**< Server resets its context.       */
+		bool client_no_ctx; /**< Client resets its context.       */
+	};
+
+	extern int pmd_negotiate(const char *offers, const struct pmd_params *cfg,
+		struct pmd_params *prm, char *resp, size_t size);
+
+#ifdef WS_HAS_DEFLATE
+	/**
+	 * @brief permessage-deflate state of a connection.
+	 */
+	struct pmd
+	{
+		struct pmd_params prm; /**< Negotiated parameters.           */
+		z_stream def;          /**< Compression stream.              */
+		z_stream inf;          /**< Decompression stream.            */
+		bool def_init;         /**< Compression stream initialized.  */
+		bool inf_init;         /**< Decompression stream initialized.*/
+	};
+
+	extern struct pmd *pmd_create(const struct pmd_params *prm);
+	extern void pmd_free(struct pmd *pmd);
+	extern unsigned char *pmd_compress(struct pmd *pmd, const void *in,
+		size_t len, size_t *out_len);
+	extern unsigned char *pmd_compress_once(int bits, const void *in,
+		size_t len, size_t *out_len);
+	extern int pmd_decompress(struct pmd *pmd, const void *in, size_t len,
+		size_t max, unsigned char **out, size_t *out_len);
+#endif
+
+#endif /* PMD_H */
@@ -70,4 +70,11 @@ int SHA1Input(  SHA1Context *,
 int SHA1Result( SHA1Context *,
                 uint8_t Message_Digest[SHA1HashSize]);
 
+/* Reference block routine. */
+void SHA1ProcessBlock(uint32_t H[SHA1HashSize/4], const uint8_t block[64]);
+
+/* Hardware-accelerated block routines (sha1_simd.c). */
+void sha1_block(uint32_t H[SHA1HashSize/4], const uint8_t block[64]);
+const char *sha1_kernel(void);
+
 #endif
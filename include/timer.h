@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2016-2024  Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file timer.h
+ * @brief Hashed timing wheel.
+ */
+#ifndef TIMER_H
+#define TIMER_H
+
+	#include <stdbool.h>
+	#include <stdint.h>
+
+	/**
+	 * @brief Wheel resolution, in milliseconds.
+	 */
+	#define TIMER_TICK_MS 10
+
+	/**
+	 * @brief Wheel size (power of two): amount of ticks per turn.
+	 */
+	#define TIMER_SLOTS 512
+
+	/**
+	 * @brief Timer, embedded into its owner and initialized with
+	 * timer_init(); it never allocates memory.
+	 */
+	struct timer
+	{
+		struct timer *next;    /**< Next timer in the same slot.     */
+		struct timer *prev;    /**< Previous timer in the same slot. */
+		uint64_t expires;      /**< Expiration tick.                 */
+		void (*fn)(void *arg); /**< Expiration callback.             */
+		void *arg;             /**< Callback argument.               */
+		bool pending;          /**< Armed and not expired yet.       */
+	};
+
+	extern void timer_init(struct timer *t, void (*fn)(void *), void *arg);
+	extern int timer_add(struct timer *t, uint32_t ms);
+	extern bool timer_cancel(struct timer *t);
+
+#endif /* TIMER_H */
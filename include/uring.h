@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2016-2024  Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file uring.h
+ * @brief Minimal io_uring helpers (raw syscalls, no liburing).
+ */
+#ifndef URING_H
+#define URING_H
+
+	/*
+	 * io_uring is Linux-only, and the features used here (multishot
+	 * recv and provided buffer rings) require kernel headers >= 6.0,
+	 * the first to define IORING_RECV_MULTISHOT.
+	 */
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+	#include <linux/io_uring.h>
+#if defined(IORING_RECV_MULTISHOT)
+	#define WS_HAS_URING
+#endif
+#endif
+#endif
+
+#ifdef WS_HAS_URING
+
+	#include <stddef.h>
+	#include <stdint.h>
+
+	/**
+	 * @brief io_uring instance: submission/completion rings and
+	 * an (optional) provided buffers ring.
+	 */
+	struct uring
+	{
+		int fd; /**< io_uring file descriptor. */
+
+		/* Submission queue. */
+		unsigned *sq_head;
+		unsigned *sq_tail;
+		unsigned *sq_mask;
+		unsigned *sq_array;
+		unsigned sq_entries;
+		unsigned sq_local_tail;
+		struct io_uring_sqe *sqes;
+
+		/* Completion queue. */
+		unsigned *cq_head;
+		unsigned *cq_tail;
+		unsigned *cq_mask;
+		struct io_uring_cqe *cqes;
+
+		/* Mappings. */
+		void *sq_ptr;
+		void *cq_ptr;
+		size_t sq_size;
+		size_t cq_size;
+		size_t sqes_size;
+
+		/* Provided buffers. */
+		struct io_uring_buf_ring *br;
+		unsigned char *br_mem;
+		unsigned br_entries;
+		unsigned br_tail;
+		size_t br_buf_size;
+	};
+
+	extern int uring_init(struct uring *r, unsigned entries);
+	extern void uring_free(struct uring *r);
+	extern struct io_uring_sqe *uring_get_sqe(struct uring *r);
+	extern void uring_flush(struct uring *r);
+	extern unsigned uring_sq_pending(struct uring *r);
+	extern int uring_enter(struct uring *r, unsigned to_submit,
+		unsigned min_complete);
+	extern struct io_uring_cqe *uring_peek_cqe(struct uring *r);
+	extern void uring_cqe_seen(struct uring *r);
+	extern int uring_setup_buf_ring(struct uring *r, unsigned entries,
+		size_t buf_size, uint16_t bgid);
+	extern unsigned char *uring_buf(struct uring *r, uint16_t bid);
+	extern void uring_recycle_buf(struct uring *r, uint16_t bid);
+
+#endif /* WS_HAS_URING */
+
+#endif /* URING_H */
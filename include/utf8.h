@@ -34,4 +34,9 @@
 	extern int is_utf8_len(uint8_t *s, size_t len);
 	extern uint32_t is_utf8_len_state(uint8_t *s, size_t len, uint32_t state);
 
+	/* Vectorized validation (utf8_simd.c). */
+	extern uint32_t utf8_validate_state(const uint8_t *s, size_t len,
+		uint32_t state);
+	extern const char *utf8_kernel(void);
+
 #endif
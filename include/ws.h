@@ -30,6 +30,7 @@ extern "C" {
 #endif
 
 	#include <stdbool.h>
+	#include <stddef.h>
 	#include <stdint.h>
 	#include <inttypes.h>
 
@@ -38,12 +39,21 @@ extern "C" {
 	 */
 	/**@{*/
 	/**
-	 * @brief Max clients connected simultaneously.
+	 * @brief Default max clients connected simultaneously, per
+	 * server (see ws_server.max_clients).
 	 */
 #ifndef MAX_CLIENTS
 	#define MAX_CLIENTS    8
 #endif
 
+	/**
+	 * @brief Default amount of pending connections, not accepted
+	 * yet, per listening socket (see ws_server.backlog).
+	 */
+#ifndef WS_BACKLOG
+	#define WS_BACKLOG     1024
+#endif
+
 	/**
 	 * @name Key and message configurations.
 	 */
@@ -56,6 +66,11 @@ extern "C" {
 	 * @brief Maximum frame/message length.
 	 */
 	#define MAX_FRAME_LENGTH (16*1024*1024)
+	/**
+	 * @brief Default max handshake request length (see
+	 * ws_server.handshake_max).
+	 */
+	#define WS_HANDSHAKE_MAX 8192
 	/**
 	 * @brief WebSocket key length.
 	 */
@@ -83,11 +98,36 @@ extern "C" {
 	 */
 	#define WS_HS_REQ      "Sec-WebSocket-Key"
 
+	/**
+	 * @brief Alias for 'Sec-WebSocket-Extensions'.
+	 */
+	#define WS_HS_EXT      "Sec-WebSocket-Extensions"
+
+	/**
+	 * @brief Alias for 'Sec-WebSocket-Protocol'.
+	 */
+	#define WS_HS_PROTO    "Sec-WebSocket-Protocol"
+
 	/**
 	 * @brief Handshake accept message length.
 	 */
 	#define WS_HS_ACCLEN   130
 
+	/**
+	 * @brief Sec-WebSocket-Accept value length (base64 SHA-1).
+	 */
+	#define WS_ACCEPT_LEN  28
+
+	/**
+	 * @brief Max Sec-WebSocket-Extensions response value length.
+	 */
+	#define WS_HS_EXT_LEN  128
+
+	/**
+	 * @brief Max Sec-WebSocket-Protocol response value length.
+	 */
+	#define WS_HS_PROTO_LEN 64
+
 	/**
 	 * @brief Handshake accept message.
 	 */
@@ -96,6 +136,14 @@ extern "C" {
 		"Upgrade: websocket\r\n"               \
 		"Connection: Upgrade\r\n"              \
 		"Sec-WebSocket-Accept: "
+
+	/**
+	 * @brief Max handshake response length, NUL terminator included.
+	 */
+	#define WS_HS_RESP_LEN                                    \
+		(sizeof(WS_HS_ACCEPT) + WS_ACCEPT_LEN + 2 +           \
+		 sizeof(WS_HS_PROTO) + 1 + WS_HS_PROTO_LEN + 2 +      \
+		 sizeof(WS_HS_EXT) + 1 + WS_HS_EXT_LEN + 2 + 2)
 	/**@}*/
 
 	/**
@@ -112,6 +160,11 @@ extern "C" {
 	 */
 	#define WS_FIN_SHIFT  7
 
+	/**
+	 * @brief Frame RSV1: compressed message (permessage-deflate).
+	 */
+	#define WS_RSV1       64
+
 	/**
 	 * @brief Continuation frame.
 	 */
@@ -204,6 +257,71 @@ extern "C" {
 	 * @brief Timeout in milliseconds.
 	 */
 	#define TIMEOUT_MS (500)
+	/**
+	 * @brief Default amount of heartbeat PINGs a client may leave
+	 * unanswered.
+	 */
+	#define WS_PING_THRESHOLD 3
+	/**@}*/
+
+	/**
+	 * @name permessage-deflate
+	 */
+	/**@{*/
+	/**
+	 * @brief Default size (in bytes) of the smallest message to be
+	 * compressed.
+	 */
+	#define WS_DEFLATE_MIN 64
+	/**@}*/
+
+	/**
+	 * @name I/O models
+	 */
+	/**@{*/
+	/**
+	 * @brief One thread per connection, blocking sockets (default).
+	 */
+	#define WS_IO_THREADS 0
+	/**
+	 * @brief Event loop threads driving non-blocking sockets
+	 * through epoll (Linux only, falls back to WS_IO_THREADS
+	 * elsewhere).
+	 */
+	#define WS_IO_EPOLL   1
+	/**
+	 * @brief Event loop threads driving the connections through
+	 * io_uring, with multishot receives into provided buffers
+	 * (Linux >= 6.0 only, falls back to WS_IO_EPOLL when io_uring
+	 * is not available).
+	 */
+	#define WS_IO_URING   2
+	/**@}*/
+
+	/**
+	 * @name Send queue policies
+	 *
+	 * What to do when a client does not keep up with the data sent
+	 * to it and its send queue is full.
+	 */
+	/**@{*/
+	/**
+	 * @brief Aborts the connection (default).
+	 */
+	#define WS_SNDQ_DISCONNECT  0
+	/**
+	 * @brief Drops the oldest messages not sent yet, to make room
+	 * for the new one.
+	 */
+	#define WS_SNDQ_DROP_OLDEST 1
+	/**
+	 * @brief Drops the new message.
+	 */
+	#define WS_SNDQ_DROP_NEWEST 2
+	/**
+	 * @brief Default send queue size, in bytes.
+	 */
+	#define WS_SNDQ_MAX (16 << 20)
 	/**@}*/
 
 	/**
@@ -221,19 +339,27 @@ extern "C" {
 	/**@}*/
 
 	#ifndef AFL_FUZZ
-	#define SEND(client,buf,len) send_all((client), (buf), (len), MSG_NOSIGNAL)
+	#define SEND(client,buf,len) send_all((client), (buf), (len))
+	#define SENDV(client,req) send_req((client), (req))
 	#define RECV(fd,buf,len) recv((fd)->client_sock, (buf), (len), 0)
 	#else
 	#define SEND(client,buf,len) write(fileno(stdout), (buf), (len))
+	#define SENDV(client,req) writev(fileno(stdout), (req)->iov, (req)->iovcnt)
 	#define RECV(fd,buf,len) read((fd)->client_sock, (buf), (len))
 	#endif
 
 	/* Opaque client connection type. */
 	typedef uint64_t ws_cli_conn_t;
 
+	/* Opaque pre-encoded frame type. */
+	typedef struct ws_frame ws_frame_t;
+
 	/* Opaque server instance type. */
 	typedef struct ws_server ws_server_t;
 
+	/* Opaque server instance handle, see ws_init(). */
+	typedef struct ws_instance ws_instance_t;
+
 	/**
 	 * @brief Get server context.
 	 * Set when initializing `.context` in `struct ws_server`.
@@ -250,8 +376,25 @@ extern "C" {
 	 */
 	void *ws_get_connection_context(ws_cli_conn_t client);
 
+	/**
+	 * @brief Handshake request header field, as seen by
+	 * ws_get_headers(): both name and value point into the request
+	 * itself (and are NUL-terminated), nothing is copied.
+	 */
+	struct ws_header
+	{
+		const char *name;  /**< Field name.                   */
+		const char *value; /**< Field value, without spaces.  */
+		size_t name_len;   /**< Name length.                  */
+		size_t value_len;  /**< Value length.                 */
+	};
+
 	/**
 	 * @brief events Web Socket events types.
+	 *
+	 * @note Optional events not used must be NULL: zero-initialize
+	 * the structure (e.g. `struct ws_events evs = {0};`) if it is
+	 * filled field by field.
 	 */
 	struct ws_events
 	{
@@ -269,10 +412,44 @@ extern "C" {
 		 */
 		void (*onmessage)(ws_cli_conn_t client,
 			const unsigned char *msg, uint64_t msg_size, int type);
+		/**
+		 * @brief On handshake event (optional), called once a valid
+		 * upgrade request is complete, before answering it.
+		 *
+		 * The request can be inspected with ws_get_path(),
+		 * ws_get_header() and ws_get_headers(), and a subprotocol
+		 * (one of those offered, see ws_has_subprotocol()) chosen by
+		 * pointing @p subprotocol to its name.
+		 *
+		 * Returns 0 to accept the client, or the HTTP status code
+		 * (4xx or 5xx) to refuse it with, before any further
+		 * resources are allocated for it.
+		 */
+		int (*onhandshake)(ws_cli_conn_t client, const char **subprotocol);
+		/**
+		 * @brief On message chunk event (optional), replaces
+		 * onmessage: called with the (unmasked) payload of text or
+		 * binary messages as it arrives, without buffering the
+		 * whole message.
+		 *
+		 * @p data is not NUL-terminated and is only valid during
+		 * the call; @p is_first and @p is_last mark the message
+		 * boundaries. Streamed messages are not limited by
+		 * MAX_FRAME_LENGTH, but compressed ones are still inflated
+		 * as a whole and delivered as a single chunk. If the client
+		 * leaves in the middle of a message, there is no last chunk.
+		 */
+		void (*onmessage_chunk)(ws_cli_conn_t client,
+			const unsigned char *data, uint64_t len, int type,
+			int is_first, int is_last);
 	};
 
 	/**
 	 * @brief server Web Socket server parameters
+	 *
+	 * @note Fields left zeroed take their defaults: zero-initialize
+	 * the structure (e.g. `struct ws_server srv = {0};`) if it is
+	 * filled field by field, as new fields might be added.
 	 */
 	struct ws_server
 	{
@@ -293,6 +470,105 @@ extern "C" {
 		 * @brief Ping timeout in milliseconds
 		 */
 		uint32_t timeout_ms;
+		/**
+		 * @brief I/O model used to serve the connections, one of
+		 * WS_IO_THREADS (default), WS_IO_EPOLL or WS_IO_URING.
+		 * Other values are refused by ws_init().
+		 */
+		int io_model;
+		/**
+		 * @brief Amount of event loop threads when using an event
+		 * based I/O model. If 0, one per online CPU.
+		 */
+		int io_threads;
+		/**
+		 * @brief Amount of listening sockets bound to the port (with
+		 * SO_REUSEPORT), each with its own accept thread and its own
+		 * part of the clients table. If 0, a single one. Ignored
+		 * where SO_REUSEPORT is not supported.
+		 */
+		int accept_shards;
+		/**
+		 * @brief Whether each new connection goes to the accept
+		 * shard of the CPU that received it (1), with the shard n
+		 * running on the CPU n, or to the one picked by the kernel
+		 * hash of its address (0). Linux only: best used with one
+		 * shard per CPU.
+		 */
+		int accept_steer;
+		/**
+		 * @brief Max amount of pending connections (not accepted
+		 * yet) per listening socket, the listen() backlog. If 0,
+		 * WS_BACKLOG.
+		 */
+		int backlog;
+		/**
+		 * @brief If not 0, new connections are only accepted once
+		 * their first data (the handshake request) arrives, or this
+		 * many milliseconds (rounded up to seconds) after connecting
+		 * (TCP_DEFER_ACCEPT). Linux only.
+		 */
+		uint32_t defer_accept_ms;
+		/**
+		 * @brief Max clients connected simultaneously. If 0,
+		 * MAX_CLIENTS. The clients table grows as needed, so large
+		 * values do not cost memory until actually used.
+		 */
+		int max_clients;
+		/**
+		 * @brief Max amount of bytes queued to a client that does
+		 * not keep up with the data sent to it. If 0, WS_SNDQ_MAX.
+		 * A single message is always accepted by an empty queue.
+		 */
+		size_t sndq_max;
+		/**
+		 * @brief What to do when the send queue of a client is full:
+		 * WS_SNDQ_DISCONNECT (default), WS_SNDQ_DROP_OLDEST or
+		 * WS_SNDQ_DROP_NEWEST. Control frames are never dropped.
+		 * Other values are refused by ws_init().
+		 */
+		int sndq_policy;
+		/**
+		 * @brief Interval, in milliseconds, between the PINGs the
+		 * server sends to each client on its own (heartbeat). If 0,
+		 * no PINGs are sent but those from ws_ping().
+		 */
+		uint32_t ping_interval_ms;
+		/**
+		 * @brief How many heartbeat PINGs a client may leave
+		 * unanswered before being disconnected. If 0,
+		 * WS_PING_THRESHOLD.
+		 */
+		int ping_threshold;
+		/**
+		 * @brief Whether the permessage-deflate extension (RFC 7692)
+		 * offered by the clients is accepted (1) or not (0). Ignored
+		 * if wsServer was built without zlib.
+		 */
+		int deflate;
+		/**
+		 * @brief Messages smaller than this (in bytes) are never
+		 * compressed. If 0, WS_DEFLATE_MIN.
+		 */
+		size_t deflate_min;
+		/**
+		 * @brief Max LZ77 window (in bits, 9 to 15) used to compress
+		 * the messages: smaller windows use less memory per client,
+		 * but compress less. If 0, 15.
+		 */
+		int deflate_window_bits;
+		/**
+		 * @brief Whether the server resets its compression context
+		 * after each message (1), even if the client does not ask
+		 * for it, or not (0).
+		 */
+		int deflate_no_context;
+		/**
+		 * @brief Max length (in bytes, up to 65535) of a handshake
+		 * request, which may arrive in multiple reads. If 0,
+		 * WS_HANDSHAKE_MAX.
+		 */
+		size_t handshake_max;
 		/**
 		 * @brief Server events.
 		 */
@@ -305,10 +581,15 @@ extern "C" {
 	};
 
 	/* Forward declarations. */
+	struct http_req;
+	struct pmd_params;
 
 	/* Internal usage. */
-	extern int get_handshake_accept(char *wsKey, unsigned char **dest);
-	extern int get_handshake_response(char *hsrequest, char **hsresponse);
+	extern int get_handshake_accept(const char *wsKey, char *dest);
+	extern int get_handshake_response(char *hsrequest, char *hsresponse);
+	extern int get_handshake_response_ext(char *hsrequest,
+		const struct http_req *req, const char *proto, char *hsresponse,
+		const struct pmd_params *cfg, struct pmd_params *prm);
 
 	/* External usage. */
 	extern char *ws_getaddress(ws_cli_conn_t client);
@@ -323,12 +604,37 @@ extern "C" {
 		uint64_t size);
 	extern int ws_sendframe_bin_bcast(uint16_t port, const char *msg,
 		uint64_t size);
+	extern ws_frame_t *ws_frame_create(const char *msg, uint64_t size,
+		int type);
+	extern int ws_frame_send(ws_cli_conn_t client, ws_frame_t *frame);
+	extern int ws_frame_send_bcast(uint16_t port, ws_frame_t *frame);
+	extern void ws_frame_release(ws_frame_t *frame);
+	extern int ws_subscribe(ws_cli_conn_t client, const char *topic);
+	extern int ws_subscribe_id(ws_cli_conn_t client, uint64_t topic);
+	extern int ws_unsubscribe(ws_cli_conn_t client, const char *topic);
+	extern int ws_unsubscribe_id(ws_cli_conn_t client, uint64_t topic);
+	extern int ws_publish(const char *topic, const char *msg, uint64_t size,
+		int type);
+	extern int ws_publish_id(uint64_t topic, const char *msg, uint64_t size,
+		int type);
+	extern int ws_publish_frame(const char *topic, ws_frame_t *frame);
+	extern int ws_publish_frame_id(uint64_t topic, ws_frame_t *frame);
 	extern int ws_get_state(ws_cli_conn_t client);
+	extern const char *ws_get_path(ws_cli_conn_t client, size_t *len);
+	extern const char *ws_get_header(ws_cli_conn_t client, const char *name,
+		size_t *len);
+	extern int ws_get_headers(ws_cli_conn_t client, struct ws_header *hdrs,
+		int max);
+	extern int ws_has_subprotocol(ws_cli_conn_t client, const char *proto);
 	extern int ws_close_client(ws_cli_conn_t client);
 	extern int ws_socket(struct ws_server *ws_srv);
+	extern ws_instance_t *ws_init(struct ws_server *ws_srv);
+	extern int ws_start(ws_instance_t *srv);
 
 	/* Ping routines. */
 	extern void ws_ping(ws_cli_conn_t cid, int threshold);
+	extern int ws_get_rtt(ws_cli_conn_t client, uint32_t *rtt,
+		uint32_t *jitter);
 
 #ifdef AFL_FUZZ
 	extern int ws_file(struct ws_events *evs, const char *file);
@@ -84,6 +84,52 @@ unsigned char * base64_encode(const unsigned char *src, size_t len,
 }
 
 
+/**
+ * base64_encode_buf - Base64 encode into a caller provided buffer
+ * @src: Data to be encoded
+ * @len: Length of the data to be encoded
+ * @out: Output buffer, at least BASE64_ENC_LEN(len) + 1 bytes long
+ * Returns: Length of the encoded data
+ *
+ * Unlike base64_encode(), nothing is allocated and no line feeds are
+ * added. The output is nul terminated, the nul terminator is not
+ * included in the returned length.
+ */
+size_t base64_encode_buf(const unsigned char *src, size_t len,
+			 unsigned char *out)
+{
+	unsigned char *pos;
+	const unsigned char *end, *in;
+
+	end = src + len;
+	in = src;
+	pos = out;
+	while (end - in >= 3) {
+		*pos++ = base64_table[in[0] >> 2];
+		*pos++ = base64_table[((in[0] & 0x03) << 4) | (in[1] >> 4)];
+		*pos++ = base64_table[((in[1] & 0x0f) << 2) | (in[2] >> 6)];
+		*pos++ = base64_table[in[2] & 0x3f];
+		in += 3;
+	}
+
+	if (end - in) {
+		*pos++ = base64_table[in[0] >> 2];
+		if (end - in == 1) {
+			*pos++ = base64_table[(in[0] & 0x03) << 4];
+			*pos++ = '=';
+		} else {
+			*pos++ = base64_table[((in[0] & 0x03) << 4) |
+					      (in[1] >> 4)];
+			*pos++ = base64_table[(in[1] & 0x0f) << 2];
+		}
+		*pos++ = '=';
+	}
+
+	*pos = '\0';
+	return pos - out;
+}
+
+
 /**
  * base64_decode - Base64 decode
  * @src: Data to be decoded
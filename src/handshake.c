@@ -16,13 +16,13 @@
  */
 #define _POSIX_C_SOURCE 200809L
 #include <base64.h>
+#include <http.h>
+#include <pmd.h>
 #include <sha1.h>
 #include <ws.h>
 
-#include <stdio.h>
-#include <stdlib.h>
+#include <stdbool.h>
 #include <string.h>
-#include <strings.h>
 
 /**
  * @dir src/
@@ -32,12 +32,22 @@
  * @brief Handshake routines.
  */
 
+/**
+ * @brief Checks if @p c is a base64 digit.
+ */
+static bool is_base64(int c)
+{
+	return ((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') ||
+		(c >= '0' && c <= '9') || c == '+' || c == '/');
+}
+
 /**
  * @brief Gets the field Sec-WebSocket-Accept on response, by
  * an previously informed key.
  *
  * @param wsKey Sec-WebSocket-Key
- * @param dest source to be stored the value.
+ * @param dest source to be stored the value, at least
+ * WS_ACCEPT_LEN + 1 bytes long.
  *
  * @return Returns 0 if success and a negative number
  * otherwise.
@@ -45,63 +55,124 @@
  * @attention This is part of the internal API and is documented just
  * for completeness.
  */
-int get_handshake_accept(char *wsKey, unsigned char **dest)
+int get_handshake_accept(const char *wsKey, char *dest)
 {
-	unsigned char *decoded;            /* Decoded WebSocket key.       */
-	unsigned char hash[SHA1HashSize]; /* SHA-1 Hash.                   */
-	SHA1Context ctx;                  /* SHA-1 Context.                */
-	char *str;                        /* WebSocket key + magic string. */
-	size_t decoded_len;               /* Decoded key length.           */
+	unsigned char hash[SHA1HashSize]; /* SHA-1 Hash.   */
+	SHA1Context ctx;                  /* SHA-1 Context. */
+	int i;                            /* Loop index.    */
 
-	/* Invalid key. */
+	/* 16 bytes key: 22 base64 digits and 2 padding characters. */
 	if (!wsKey || strlen(wsKey) != WS_KEY_LEN ||
 		wsKey[WS_KEY_LEN - 2] != '=' ||
 		wsKey[WS_KEY_LEN - 1] != '=')
 		return (-1);
 
-	decoded = base64_decode((const unsigned char *)wsKey, WS_KEY_LEN,
-		&decoded_len);
-	if (!decoded || decoded_len != 16)
-	{
-		free(decoded);
-		return (-1);
-	}
-	free(decoded);
-
-	str = calloc(1, sizeof(char) * (WS_KEY_LEN + WS_MS_LEN + 1));
-	if (!str)
-		return (-1);
-
-	strncpy(str, wsKey, WS_KEY_LEN);
-	strcat(str, MAGIC_STRING);
+	for (i = 0; i < WS_KEY_LEN - 2; i++)
+		if (!is_base64(wsKey[i]))
+			return (-1);
 
+	/* SHA-1 of the key followed by the magic string. */
 	SHA1Reset(&ctx);
-	SHA1Input(&ctx, (const uint8_t *)str, WS_KEYMS_LEN);
+	SHA1Input(&ctx, (const uint8_t *)wsKey, WS_KEY_LEN);
+	SHA1Input(&ctx, (const uint8_t *)MAGIC_STRING, WS_MS_LEN);
 	SHA1Result(&ctx, hash);
 
-	*dest = base64_encode(hash, SHA1HashSize, NULL);
-	*(*dest + strlen((const char *)*dest) - 1) = '\0';
-	free(str);
+	base64_encode_buf(hash, SHA1HashSize, (unsigned char *)dest);
 	return (0);
 }
 
 /**
- * @brief Finds the ocorrence of @p needle in @p haystack, case
- * insensitive.
+ * @brief Gets the complete response to accomplish a succesfully
+ * handshake, negotiating the permessage-deflate extension if
+ * wanted.
+ *
+ * @param hsrequest  Client request, as parsed into @p req.
+ * @param req        Parsed request.
+ * @param proto      Subprotocol chosen (up to WS_HS_PROTO_LEN
+ *                   bytes), or NULL if none.
+ * @param hsresponse Server response, at least WS_HS_RESP_LEN
+ *                   bytes long.
+ * @param cfg        permessage-deflate server parameters, or NULL
+ *                   if the extension should not be negotiated.
+ * @param prm        Negotiated permessage-deflate parameters: its
+ *                   server_bits is 0 if not negotiated.
  *
- * @param haystack Target string to be searched.
- * @param needle   Substring to search for.
+ * @return Returns the response length if success and a negative
+ * number otherwise.
  *
- * @returns If found, returns a pointer at the beginning of the
- * found substring. Otherwise, returns NULL.
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
  */
-static const char *strstricase(const char *haystack, const char *needle)
+int get_handshake_response_ext(char *hsrequest, const struct http_req *req,
+	const char *proto, char *hsresponse, const struct pmd_params *cfg,
+	struct pmd_params *prm)
 {
-	size_t length;
-	for (length = strlen(needle); *haystack; haystack++)
-		if (!strncasecmp(haystack, needle, length))
-			return haystack;
-	return (NULL);
+	char ext[WS_HS_EXT_LEN]; /* Extensions header.  */
+	size_t len;              /* Field value length. */
+	char *p;                 /* Response position.  */
+	int pmd;                 /* Extension accepted. */
+	int i;                   /* Loop index.         */
+
+	/* Not a (supported) WebSocket upgrade request. */
+	if ((req->flags & HTTP_F_WEBSOCKET) != HTTP_F_WEBSOCKET || req->key < 0)
+		return (-1);
+
+	if (proto && strlen(proto) > WS_HS_PROTO_LEN)
+		return (-1);
+
+	/* Offers may spread over multiple headers. */
+	pmd = 0;
+	if (cfg)
+		prm->server_bits = 0;
+
+	for (i = 0; cfg && !pmd && i < req->nhdrs; i++)
+	{
+		if (req->hdrs[i].id == HTTP_HDR_WS_EXT)
+		{
+			pmd = pmd_negotiate(hsrequest + req->hdrs[i].value, cfg, prm,
+				ext, sizeof(ext));
+		}
+	}
+
+	/* Every length but the extensions one is known in advance. */
+	p = hsresponse;
+	memcpy(p, WS_HS_ACCEPT, sizeof(WS_HS_ACCEPT) - 1);
+	p += sizeof(WS_HS_ACCEPT) - 1;
+
+	if (get_handshake_accept(hsrequest + req->hdrs[req->key].value, p) < 0)
+		return (-1);
+
+	p += WS_ACCEPT_LEN;
+	memcpy(p, "\r\n", 2);
+	p += 2;
+
+	if (proto)
+	{
+		len = strlen(proto);
+		memcpy(p, WS_HS_PROTO ": ", sizeof(WS_HS_PROTO) + 1);
+		p += sizeof(WS_HS_PROTO) + 1;
+		memcpy(p, proto, len);
+		p += len;
+		memcpy(p, "\r\n", 2);
+		p += 2;
+	}
+
+	if (pmd)
+	{
+		len = strlen(ext);
+		memcpy(p, WS_HS_EXT ": ", sizeof(WS_HS_EXT) + 1);
+		p += sizeof(WS_HS_EXT) + 1;
+		memcpy(p, ext, len);
+		p += len;
+		memcpy(p, "\r\n", 2);
+		p += 2;
+	}
+
+	/* Blank line, and the NUL terminator. */
+	memcpy(p, "\r\n", 3);
+	p += 2;
+
+	return ((int)(p - hsresponse));
 }
 
 /**
@@ -109,49 +180,23 @@ static const char *strstricase(const char *haystack, const char *needle)
  * handshake.
  *
  * @param hsrequest  Client request.
- * @param hsresponse Server response.
+ * @param hsresponse Server response, at least WS_HS_RESP_LEN
+ *                   bytes long.
  *
- * @return Returns 0 if success and a negative number
- * otherwise.
+ * @return Returns the response length if success and a negative
+ * number otherwise.
  *
  * @attention This is part of the internal API and is documented just
  * for completeness.
  */
-int get_handshake_response(char *hsrequest, char **hsresponse)
+int get_handshake_response(char *hsrequest, char *hsresponse)
 {
-	unsigned char *accept; /* Accept message.     */
-	char *saveptr;         /* strtok_r() pointer. */
-	char *s;               /* Current string.     */
-	int ret;               /* Return value.       */
-
-	saveptr = NULL;
-	for (s = strtok_r(hsrequest, "\r\n", &saveptr); s != NULL;
-		 s = strtok_r(NULL, "\r\n", &saveptr))
-	{
-		if (strstricase(s, WS_HS_REQ) != NULL)
-			break;
-	}
+	struct http_req req;
 
-	/* Ensure that we have a valid pointer. */
-	if (s == NULL)
+	http_init(&req, HTTP_MAX_SIZE);
+	if (http_parse(&req, hsrequest, strlen(hsrequest)) != HTTP_DONE)
 		return (-1);
 
-	saveptr = NULL;
-	s       = strtok_r(s, " ", &saveptr);
-	s       = strtok_r(NULL, " ", &saveptr);
-
-	ret = get_handshake_accept(s, &accept);
-	if (ret < 0)
-		return (ret);
-
-	*hsresponse = malloc(sizeof(char) * WS_HS_ACCLEN);
-	if (*hsresponse == NULL)
-		return (-1);
-
-	strcpy(*hsresponse, WS_HS_ACCEPT);
-	strcat(*hsresponse, (const char *)accept);
-	strcat(*hsresponse, "\r\n\r\n");
-
-	free(accept);
-	return (0);
+	return (get_handshake_response_ext(hsrequest, &req, NULL, hsresponse,
+		NULL, NULL));
 }
@@ -0,0 +1,303 @@
+/*
+ * Copyright (C) 2016-2024  Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <http.h>
+
+/**
+ * @file http.c
+ * @brief Incremental HTTP/1.1 upgrade request parser.
+ *
+ * The request is parsed as it arrives: each call only scans the
+ * bytes received since the previous one, a complete line at a time,
+ * so a request split over many reads is still parsed in a single
+ * linear pass. The header fields are recorded (and NUL-terminated)
+ * in place, and the ones that matter for the upgrade are checked
+ * along the way.
+ */
+
+/**
+ * @brief Known header fields, by name.
+ */
+static const struct http_known
+{
+	const char *name; /**< Field name.   */
+	size_t len;       /**< Name length.  */
+	uint8_t id;       /**< Field id.     */
+} known[] = {
+	{"Host",                     4, HTTP_HDR_HOST},
+	{"Upgrade",                  7, HTTP_HDR_UPGRADE},
+	{"Connection",              10, HTTP_HDR_CONNECTION},
+	{"Origin",                   6, HTTP_HDR_ORIGIN},
+	{"Sec-WebSocket-Key",       17, HTTP_HDR_WS_KEY},
+	{"Sec-WebSocket-Version",   21, HTTP_HDR_WS_VERSION},
+	{"Sec-WebSocket-Extensions", 24, HTTP_HDR_WS_EXT},
+	{"Sec-WebSocket-Protocol",  22, HTTP_HDR_WS_PROTO}
+};
+
+/**
+ * @brief Checks if @p c is a token character (RFC 7230).
+ */
+static bool is_tchar(int c)
+{
+	return ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+		(c >= '0' && c <= '9') || (c && strchr("!#$%&'*+-.^_`|~", c)));
+}
+
+/**
+ * @brief Identifies the header field @p name, of @p len bytes.
+ *
+ * @return Returns the field id, HTTP_HDR_OTHER if unknown.
+ */
+static uint8_t header_id(const char *name, size_t len)
+{
+	size_t i;
+	for (i = 0; i < sizeof(known) / sizeof(known[0]); i++)
+		if (known[i].len == len && !strncasecmp(name, known[i].name, len))
+			return (known[i].id);
+	return (HTTP_HDR_OTHER);
+}
+
+/**
+ * @brief Checks if the comma separated list @p list has the
+ * token @p tok (case insensitive).
+ *
+ * @return Returns 1 if found, 0 otherwise.
+ */
+int http_list_has(const char *list, const char *tok)
+{
+	size_t len;
+	size_t n;
+
+	len = strlen(tok);
+	while (*list)
+	{
+		while (*list == ' ' || *list == '\t' || *list == ',')
+			list++;
+
+		for (n = 0; list[n] && list[n] != ',' &&
+			list[n] != ' ' && list[n] != '\t'; n++)
+			;
+
+		if (n == len && !strncasecmp(list, tok, len))
+			return (1);
+
+		for (list += n; *list && *list != ','; list++)
+			;
+	}
+	return (0);
+}
+
+/**
+ * @brief Parses the request line ([@p s, @p e) of @p buf): only
+ * 'GET <target> HTTP/1.x', x >= 1, is accepted.
+ *
+ * @return Returns 0 if valid, -1 otherwise.
+ */
+static int parse_request_line(struct http_req *req, char *buf, size_t s,
+	size_t e)
+{
+	size_t t;
+
+	if (e - s < 14 || memcmp(buf + s, "GET ", 4))
+		return (-1);
+
+	/* Target. */
+	for (t = s + 4; t < e && buf[t] != ' '; t++)
+		if ((unsigned char)buf[t] <= ' ' || buf[t] == 0x7f)
+			return (-1);
+
+	if (t == s + 4 || e - t != 9 || memcmp(buf + t, " HTTP/1.", 8) ||
+		buf[e - 1] < '1' || buf[e - 1] > '9')
+	{
+		return (-1);
+	}
+
+	req->path = (uint16_t)(s + 4);
+	req->plen = (uint16_t)(t - s - 4);
+	buf[t]    = '\0';
+	return (0);
+}
+
+/**
+ * @brief Parses a header field line ([@p s, @p e) of @p buf).
+ *
+ * @return Returns 0 if valid, -1 otherwise.
+ */
+static int parse_header(struct http_req *req, char *buf, size_t s, size_t e)
+{
+	struct http_header *h;
+	const char *v;
+	size_t n;
+
+	if (req->nhdrs == HTTP_MAX_HEADERS)
+		return (-1);
+
+	/* Name, obsolete line folding (leading spaces) is not supported. */
+	for (n = s; n < e && is_tchar(buf[n]); n++)
+		;
+	if (n == s || n == e || buf[n] != ':')
+		return (-1);
+
+	h       = &req->hdrs[req->nhdrs];
+	h->name = (uint16_t)s;
+	h->nlen = (uint16_t)(n - s);
+	h->id   = header_id(buf + s, n - s);
+	buf[n]  = '\0';
+
+	/* Value, without the optional white spaces around. */
+	for (n++; n < e && (buf[n] == ' ' || buf[n] == '\t'); n++)
+		;
+	while (e > n && (buf[e - 1] == ' ' || buf[e - 1] == '\t'))
+		e--;
+
+	h->value = (uint16_t)n;
+	h->vlen  = (uint16_t)(e - n);
+	buf[e]   = '\0';
+	v        = buf + n;
+
+	switch (h->id)
+	{
+	case HTTP_HDR_UPGRADE:
+		if (http_list_has(v, "websocket"))
+			req->flags |= HTTP_F_UPGRADE;
+		break;
+	case HTTP_HDR_CONNECTION:
+		if (http_list_has(v, "upgrade"))
+			req->flags |= HTTP_F_CONNECTION;
+		break;
+	case HTTP_HDR_WS_VERSION:
+		if (!strcmp(v, "13"))
+			req->flags |= HTTP_F_VERSION;
+		break;
+	case HTTP_HDR_WS_KEY:
+		if (req->key >= 0)
+			return (-1);
+		req->key = (int8_t)req->nhdrs;
+		break;
+	}
+
+	req->nhdrs++;
+	return (0);
+}
+
+/**
+ * @brief Initializes the request parser @p req.
+ *
+ * @param req Request.
+ * @param max Max request size (up to HTTP_MAX_SIZE).
+ */
+void http_init(struct http_req *req, size_t max)
+{
+	memset(req, 0, sizeof(*req));
+	req->max = (max && max < HTTP_MAX_SIZE) ? max : HTTP_MAX_SIZE;
+	req->key = -1;
+}
+
+/**
+ * @brief Parses the request read so far (@p len bytes of @p buf),
+ * resuming from where the previous call stopped.
+ *
+ * The lines parsed are modified in place (their fields are
+ * NUL-terminated), the bytes past the request are not touched.
+ *
+ * @param req Request.
+ * @param buf Request buffer, every byte read so far.
+ * @param len Amount of bytes read.
+ *
+ * @return Returns HTTP_DONE if the request is complete (its length
+ * is then in req->len), HTTP_MORE if more bytes are needed or
+ * HTTP_ERROR if malformed or larger than allowed.
+ */
+int http_parse(struct http_req *req, char *buf, size_t len)
+{
+	const char *nl;
+	size_t e;
+
+	if (req->len)
+		return (HTTP_DONE);
+
+	while (req->pos < len && req->pos < req->max)
+	{
+		nl = memchr(buf + req->pos, '\n', len - req->pos);
+		if (!nl)
+		{
+			req->pos = len;
+			break;
+		}
+
+		/* Complete line: [req->line, e), without the CR. */
+		req->pos = (size_t)(nl - buf) + 1;
+		if (req->pos > req->max)
+			break;
+
+		e = req->pos - 1;
+		if (e > req->line && buf[e - 1] == '\r')
+			e--;
+
+		/* Empty line: end of request. */
+		if (e == req->line && req->line)
+		{
+			req->len = req->pos;
+			return (HTTP_DONE);
+		}
+
+		if (!req->line)
+		{
+			if (parse_request_line(req, buf, req->line, e) < 0)
+				return (HTTP_ERROR);
+		}
+		else if (parse_header(req, buf, req->line, e) < 0)
+			return (HTTP_ERROR);
+
+		req->line = req->pos;
+	}
+
+	if (req->pos >= req->max)
+		return (HTTP_ERROR);
+
+	return (HTTP_MORE);
+}
+
+/**
+ * @brief Returns the reason phrase of the HTTP status code
+ * @p status, for the ones a server may refuse an upgrade with.
+ */
+const char *http_reason(int status)
+{
+	switch (status)
+	{
+	case 400: return ("Bad Request");
+	case 401: return ("Unauthorized");
+	case 403: return ("Forbidden");
+	case 404: return ("Not Found");
+	case 405: return ("Method Not Allowed");
+	case 406: return ("Not Acceptable");
+	case 408: return ("Request Timeout");
+	case 409: return ("Conflict");
+	case 410: return ("Gone");
+	case 426: return ("Upgrade Required");
+	case 429: return ("Too Many Requests");
+	case 500: return ("Internal Server Error");
+	case 501: return ("Not Implemented");
+	case 503: return ("Service Unavailable");
+	default:
+		return (status < 500 ? "Client Error" : "Server Error");
+	}
+}
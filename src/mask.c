@@ -0,0 +1,273 @@
+/*
+ * Copyright (C) 2016-2024  Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <string.h>
+#include <mask.h>
+
+/**
+ * @file mask.c
+ * @brief WebSocket payload (un)masking.
+ *
+ * Masking and unmasking are the very same operation: a XOR of
+ * every payload byte with the 4-byte masking key. Since the key
+ * repeats every 4 bytes, it can be broadcast to 8, 16 or 32 bytes
+ * and applied a word/vector at a time.
+ *
+ * On x86, the best kernel (AVX2, SSE2 or plain 64-bit words) is
+ * picked at runtime, on the first use. NEON, when available, is
+ * part of the target and is always used.
+ */
+
+/* x86 SIMD kernels, selected at runtime. */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MASK_X86
+#include <immintrin.h>
+#endif
+
+/* ARM NEON kernel. */
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define MASK_NEON
+#include <arm_neon.h>
+#endif
+
+/**
+ * @brief (Un)masking kernel: XORs @p len bytes of @p src with the
+ * 4-byte @p key (already rotated to the first byte) into @p dst.
+ */
+typedef void (*mask_fn)(unsigned char *dst, const unsigned char *src,
+	size_t len, uint32_t key);
+
+/**
+ * @brief Portable kernel, a 64-bit word at a time.
+ *
+ * @param dst Destination buffer (may be the same as @p src).
+ * @param src Source buffer.
+ * @param len Amount of bytes.
+ * @param key Masking key, in memory order.
+ */
+static void mask_word(unsigned char *dst, const unsigned char *src,
+	size_t len, uint32_t key)
+{
+	uint8_t k[4];  /* Key bytes.      */
+	uint64_t k64;  /* Key, as a word. */
+	uint64_t w;    /* Current word.   */
+	size_t i;      /* Loop index.     */
+
+	memcpy(k, &key, sizeof(k));
+	k64 = ((uint64_t)key << 32) | key;
+
+	/* memcpy() keeps it alignment-safe, and compiles to plain loads. */
+	for (i = 0; i + 8 <= len; i += 8)
+	{
+		memcpy(&w, src + i, sizeof(w));
+		w ^= k64;
+		memcpy(dst + i, &w, sizeof(w));
+	}
+
+	for (; i < len; i++)
+		dst[i] = src[i] ^ k[i & 3];
+}
+
+#ifdef MASK_X86
+/**
+ * @brief SSE2 kernel, 16 bytes at a time.
+ *
+ * @param dst Destination buffer (may be the same as @p src).
+ * @param src Source buffer.
+ * @param len Amount of bytes.
+ * @param key Masking key, in memory order.
+ */
+__attribute__((target("sse2")))
+static void mask_sse2(unsigned char *dst, const unsigned char *src,
+	size_t len, uint32_t key)
+{
+	__m128i k;
+	__m128i v;
+	size_t i;
+
+	k = _mm_set1_epi32((int)key);
+	for (i = 0; i + 16 <= len; i += 16)
+	{
+		v = _mm_loadu_si128((const __m128i *)(src + i));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(v, k));
+	}
+
+	/* 16 is a multiple of 4: the key does not need to be rotated. */
+	mask_word(dst + i, src + i, len - i, key);
+}
+
+/**
+ * @brief AVX2 kernel, 32 bytes at a time.
+ *
+ * @param dst Destination buffer (may be the same as @p src).
+ * @param src Source buffer.
+ * @param len Amount of bytes.
+ * @param key Masking key, in memory order.
+ */
+__attribute__((target("avx2")))
+static void mask_avx2(unsigned char *dst, const unsigned char *src,
+	size_t len, uint32_t key)
+{
+	__m256i k;
+	__m256i v;
+	size_t i;
+
+	i = 0;
+	if (len >= 32)
+	{
+		k = _mm256_set1_epi32((int)key);
+		for (; i + 32 <= len; i += 32)
+		{
+			v = _mm256_loadu_si256((const __m256i *)(src + i));
+			_mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(v, k));
+		}
+
+		/*
+		 * GCC does not always emit it before tail calls, and leaving
+		 * the upper halves dirty makes the SSE code that follows
+		 * (such as memcpy()) a lot slower.
+		 */
+		_mm256_zeroupper();
+	}
+
+	mask_word(dst + i, src + i, len - i, key);
+}
+#endif /* MASK_X86 */
+
+#ifdef MASK_NEON
+/**
+ * @brief NEON kernel, 16 bytes at a time.
+ *
+ * @param dst Destination buffer (may be the same as @p src).
+ * @param src Source buffer.
+ * @param len Amount of bytes.
+ * @param key Masking key, in memory order.
+ */
+static void mask_neon(unsigned char *dst, const unsigned char *src,
+	size_t len, uint32_t key)
+{
+	uint8x16_t k;
+	uint8x16_t v;
+	size_t i;
+
+	k = vreinterpretq_u8_u32(vdupq_n_u32(key));
+	for (i = 0; i + 16 <= len; i += 16)
+	{
+		v = vld1q_u8(src + i);
+		vst1q_u8(dst + i, veorq_u8(v, k));
+	}
+
+	mask_word(dst + i, src + i, len - i, key);
+}
+#endif /* MASK_NEON */
+
+/**
+ * @brief (Un)masking kernel description.
+ */
+struct mask_impl
+{
+	const char *name;    /**< Kernel name.               */
+	mask_fn fn;          /**< Kernel routine.            */
+	int (*usable)(void); /**< Runtime check, if needed.  */
+};
+
+#ifdef MASK_X86
+/**
+ * @brief CPUID checks for the x86 kernels.
+ */
+static int has_avx2(void) { return (__builtin_cpu_supports("avx2")); }
+static int has_sse2(void) { return (__builtin_cpu_supports("sse2")); }
+#endif
+
+/**
+ * @brief Available kernels, the best ones first.
+ */
+static const struct mask_impl kernels[] = {
+#ifdef MASK_X86
+	{"avx2", mask_avx2, has_avx2},
+	{"sse2", mask_sse2, has_sse2},
+#endif
+#ifdef MASK_NEON
+	{"neon", mask_neon, NULL},
+#endif
+	{"word", mask_word, NULL}
+};
+
+/**
+ * @brief Kernel in use, NULL until the first (un)masking.
+ */
+static const struct mask_impl *kernel;
+
+/**
+ * @brief Picks the best kernel supported by the running CPU.
+ *
+ * @return Returns the kernel selected.
+ */
+static const struct mask_impl *mask_select(void)
+{
+	const struct mask_impl *k;
+
+	k = __atomic_load_n(&kernel, __ATOMIC_ACQUIRE);
+	if (k)
+		return (k);
+
+#ifdef MASK_X86
+	__builtin_cpu_init();
+#endif
+
+	/* The last one is always usable. */
+	for (k = kernels; k->usable && !k->usable(); k++)
+		;
+
+	/* Racing threads would pick the same kernel anyway. */
+	__atomic_store_n(&kernel, k, __ATOMIC_RELEASE);
+	return (k);
+}
+
+/**
+ * @brief (Un)masks @p len bytes from @p src into @p dst.
+ *
+ * @param dst Destination buffer (may be the same as @p src).
+ * @param src Source (masked or not) bytes.
+ * @param len Amount of bytes.
+ * @param masks Frame masking key (4 bytes).
+ * @param off Payload offset of the first byte, so that a payload
+ * can be handled in multiple spans.
+ */
+void mask_xor(unsigned char *dst, const unsigned char *src,
+	size_t len, const uint8_t *masks, uint64_t off)
+{
+	uint8_t k[4];
+	uint32_t key;
+	int i;
+
+	/* Rotate the key so that it starts at the first byte. */
+	for (i = 0; i < 4; i++)
+		k[i] = masks[(off + i) & 3];
+	memcpy(&key, k, sizeof(key));
+
+	mask_select()->fn(dst, src, len, key);
+}
+
+/**
+ * @brief Returns the name of the (un)masking kernel in use,
+ * such as "avx2", "sse2", "neon" or "word".
+ */
+const char *mask_kernel(void)
+{
+	return (mask_select()->name);
+}
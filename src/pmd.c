@@ -0,0 +1,607 @@
+/*
+ * Copyright (C) 2016-2024  Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <pmd.h>
+
+/**
+ * @file pmd.c
+ * @brief permessage-deflate (RFC 7692) extension.
+ *
+ * Messages are compressed with raw deflate (no zlib header), each
+ * one ending with an empty stored block whose last 4 bytes (always
+ * 0x00 0x00 0xff 0xff) are not sent. Unless 'no context takeover'
+ * is negotiated, each side keeps its LZ77 window across messages.
+ *
+ * Each message is compressed (or not) independently: a message that
+ * would not get smaller is just sent uncompressed, and so is every
+ * message when the client limits the server window to 8 bits, which
+ * zlib does not support.
+ */
+
+/**
+ * @brief Extension offer, as parsed.
+ */
+struct pmd_offer
+{
+	bool valid;         /**< Offer can be accepted.               */
+	bool server_no_ctx; /**< server_no_context_takeover.          */
+	bool client_no_ctx; /**< client_no_context_takeover.          */
+	bool client_bits;   /**< client_max_window_bits.              */
+	int server_bits;    /**< server_max_window_bits, 0 if absent. */
+};
+
+/**
+ * @brief Skips the spaces and tabs at @p s.
+ */
+static const char *skip_ws(const char *s)
+{
+	while (*s == ' ' || *s == '\t')
+		s++;
+	return (s);
+}
+
+/**
+ * @brief Reads a token (RFC 7230) at @p s.
+ *
+ * @param s String.
+ * @param len Token length (0 if there is no token at @p s).
+ *
+ * @return Returns the position right after the token.
+ */
+static const char *get_token(const char *s, size_t *len)
+{
+	const char *start = s;
+
+	while (*s && (strchr("!#$%&'*+-.^_`|~", *s) ||
+		(*s >= '0' && *s <= '9') || (*s >= 'a' && *s <= 'z') ||
+		(*s >= 'A' && *s <= 'Z')))
+		s++;
+
+	*len = (size_t)(s - start);
+	return (s);
+}
+
+/**
+ * @brief Checks if the token @p tok, of @p len bytes, is @p str
+ * (case insensitive).
+ */
+static bool token_is(const char *tok, size_t len, const char *str)
+{
+	return (strlen(str) == len && !strncasecmp(tok, str, len));
+}
+
+/**
+ * @brief Parses a window bits value: an integer between 8 and 15,
+ * without leading zeros.
+ *
+ * @param val Value.
+ * @param len Value length.
+ *
+ * @return Returns the window bits, or -1 if invalid.
+ */
+static int parse_bits(const char *val, size_t len)
+{
+	if (len == 1 && val[0] >= '8' && val[0] <= '9')
+		return (val[0] - '0');
+	if (len == 2 && val[0] == '1' && val[1] >= '0' && val[1] <= '5')
+		return (10 + val[1] - '0');
+	return (-1);
+}
+
+/**
+ * @brief Parses an extension parameter (name @p name and value
+ * @p val, if any) into a permessage-deflate offer @p o.
+ *
+ * @param o Offer.
+ * @param name Parameter name.
+ * @param nlen Name length.
+ * @param val Parameter value, or NULL if none.
+ * @param vlen Value length.
+ *
+ * @return Returns true if the parameter is valid, false otherwise.
+ */
+static bool parse_param(struct pmd_offer *o, const char *name, size_t nlen,
+	const char *val, size_t vlen)
+{
+	int bits;
+
+	if (token_is(name, nlen, "server_no_context_takeover"))
+	{
+		if (val || o->server_no_ctx)
+			return (false);
+		o->server_no_ctx = true;
+	}
+
+	else if (token_is(name, nlen, "client_no_context_takeover"))
+	{
+		if (val || o->client_no_ctx)
+			return (false);
+		o->client_no_ctx = true;
+	}
+
+	else if (token_is(name, nlen, "server_max_window_bits"))
+	{
+		if (!val || o->server_bits || (bits = parse_bits(val, vlen)) < 0)
+			return (false);
+		o->server_bits = bits;
+	}
+
+	/* Its value is just a hint: any window can be inflated. */
+	else if (token_is(name, nlen, "client_max_window_bits"))
+	{
+		if (o->client_bits || (val && parse_bits(val, vlen) < 0))
+			return (false);
+		o->client_bits = true;
+	}
+
+	else
+		return (false);
+
+	return (true);
+}
+
+/**
+ * @brief Parses a single extension offer at @p s, up to the next
+ * comma (or the end of the header).
+ *
+ * @param s Offer start.
+ * @param o Parsed offer: valid only if a well-formed
+ * permessage-deflate offer.
+ *
+ * @return Returns the position of the next offer (or the end).
+ */
+static const char *parse_offer(const char *s, struct pmd_offer *o)
+{
+	const char *name; /* Parameter name.  */
+	const char *val;  /* Parameter value. */
+	size_t nlen;      /* Name length.     */
+	size_t vlen;      /* Value length.    */
+
+	memset(o, 0, sizeof(*o));
+
+	name = skip_ws(s);
+	s    = skip_ws(get_token(name, &nlen));
+	o->valid = token_is(name, nlen, PMD_NAME);
+
+	while (*s == ';')
+	{
+		name = skip_ws(s + 1);
+		s    = skip_ws(get_token(name, &nlen));
+		val  = NULL;
+		vlen = 0;
+
+		if (*s == '=')
+		{
+			s = skip_ws(s + 1);
+
+			/* Quoted values never need escapes here. */
+			if (*s == '"')
+			{
+				val = get_token(s + 1, &vlen);
+				if (*val != '"')
+				{
+					o->valid = false;
+					break;
+				}
+				val = s + 1;
+				s   = skip_ws(val + vlen + 1);
+			}
+			else
+			{
+				val = s;
+				s   = skip_ws(get_token(s, &vlen));
+			}
+
+			/* A parameter given with no value is declined. */
+			if (!vlen)
+			{
+				o->valid = false;
+				break;
+			}
+		}
+
+		if (!nlen || !parse_param(o, name, nlen, val, vlen))
+			o->valid = false;
+	}
+
+	/* Anything else: malformed offer, skip it. */
+	if (*s != ',' && *s != '\0')
+	{
+		o->valid = false;
+		while (*s && *s != ',')
+		{
+			if (*s == '"')
+				for (s++; *s && *s != '"'; s++)
+					;
+			if (*s)
+				s++;
+		}
+	}
+
+	return (*s == ',' ? s + 1 : s);
+}
+
+/**
+ * @brief Picks the first acceptable permessage-deflate offer of a
+ * Sec-WebSocket-Extensions header (@p offers), if any.
+ *
+ * @param offers Header value.
+ * @param cfg Server parameters: max server window and whether the
+ * server always resets its context.
+ * @param prm Negotiated parameters.
+ * @param resp Response header value, if accepted.
+ * @param size Response buffer size.
+ *
+ * @return Returns 1 if an offer was accepted, 0 otherwise.
+ */
+int pmd_negotiate(const char *offers, const struct pmd_params *cfg,
+	struct pmd_params *prm, char *resp, size_t size)
+{
+	struct pmd_offer o;
+	int len;
+
+	while (*offers)
+	{
+		offers = parse_offer(offers, &o);
+		if (!o.valid)
+			continue;
+
+		prm->server_bits = cfg->server_bits;
+		if (o.server_bits && o.server_bits < prm->server_bits)
+			prm->server_bits = o.server_bits;
+
+		prm->server_no_ctx = o.server_no_ctx || cfg->server_no_ctx;
+		prm->client_no_ctx = o.client_no_ctx;
+
+		len = snprintf(resp, size, "%s%s%s", PMD_NAME,
+			prm->server_no_ctx ? "; server_no_context_takeover" : "",
+			prm->client_no_ctx ? "; client_no_context_takeover" : "");
+
+		if (len > 0 && (size_t)len < size &&
+			(o.server_bits || prm->server_bits < 15))
+		{
+			len += snprintf(resp + len, size - (size_t)len,
+				"; server_max_window_bits=%d", prm->server_bits);
+		}
+
+		return (len > 0 && (size_t)len < size);
+	}
+	return (0);
+}
+
+#ifdef WS_HAS_DEFLATE
+
+/**
+ * @brief Last 4 bytes of a message compressed with a sync flush,
+ * not sent.
+ */
+static const unsigned char pmd_tail[4] = {0x00, 0x00, 0xff, 0xff};
+
+/**
+ * @brief Allocates the permessage-deflate state for the negotiated
+ * parameters @p prm. The zlib streams are only initialized on
+ * their first use.
+ *
+ * @param prm Negotiated parameters.
+ *
+ * @return Returns the new state, or NULL if out of memory.
+ */
+struct pmd *pmd_create(const struct pmd_params *prm)
+{
+	struct pmd *pmd;
+
+	pmd = calloc(1, sizeof(*pmd));
+	if (!pmd)
+		return (NULL);
+
+	pmd->prm = *prm;
+	return (pmd);
+}
+
+/**
+ * @brief Releases the permessage-deflate state @p pmd.
+ *
+ * @param pmd State, may be NULL.
+ */
+void pmd_free(struct pmd *pmd)
+{
+	if (!pmd)
+		return;
+
+	if (pmd->def_init)
+		deflateEnd(&pmd->def);
+	if (pmd->inf_init)
+		inflateEnd(&pmd->inf);
+
+	free(pmd);
+}
+
+/**
+ * @brief Initializes the compression stream @p zs for a window of
+ * @p bits bits.
+ *
+ * @param zs zlib stream.
+ * @param bits Window bits (9-15).
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+static int deflate_init(z_stream *zs, int bits)
+{
+	memset(zs, 0, sizeof(*zs));
+	if (deflateInit2(zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -bits,
+		bits - 7 < 8 ? bits - 7 : 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		return (-1);
+	}
+	return (0);
+}
+
+/**
+ * @brief Compresses a message (@p len bytes of @p in) with the
+ * stream @p zs, flushing it to a byte boundary.
+ *
+ * @param zs zlib stream.
+ * @param in Message.
+ * @param len Message length.
+ * @param out_len Compressed length.
+ *
+ * @return Returns the compressed payload, without the sync flush
+ * tail, or NULL if it would not get smaller or on errors.
+ */
+static unsigned char *deflate_msg(z_stream *zs, const void *in, size_t len,
+	size_t *out_len)
+{
+	unsigned char *out;
+	unsigned char *tmp;
+	size_t have;
+	size_t cap;
+
+	cap = deflateBound(zs, len) + 16;
+	out = malloc(cap);
+	if (!out)
+		return (NULL);
+
+	zs->next_in  = (Bytef *)in;
+	zs->avail_in = (uInt)len;
+	have = 0;
+
+	for (;;)
+	{
+		zs->next_out  = out + have;
+		zs->avail_out = (uInt)(cap - have);
+		if (deflate(zs, Z_SYNC_FLUSH) == Z_STREAM_ERROR)
+			goto err;
+
+		have = cap - zs->avail_out;
+		if (!zs->avail_in && zs->avail_out)
+			break;
+
+		tmp = realloc(out, cap * 2);
+		if (!tmp)
+			goto err;
+		out  = tmp;
+		cap *= 2;
+	}
+
+	/* Drop the empty stored block tail. */
+	if (have < 4 || memcmp(out + have - 4, pmd_tail, 4))
+		goto err;
+	have -= 4;
+
+	/* Not worth it: send it uncompressed. */
+	if (have >= len)
+		goto err;
+
+	*out_len = have;
+	return (out);
+err:
+	free(out);
+	return (NULL);
+}
+
+/**
+ * @brief Compresses a message (@p len bytes of @p in).
+ *
+ * @param pmd State.
+ * @param in Message.
+ * @param len Message length.
+ * @param out_len Compressed length.
+ *
+ * @return Returns the compressed payload (to be freed by the caller),
+ * or NULL if the message should be sent uncompressed: when it would
+ * not get smaller, the server window is too small for zlib or on
+ * errors.
+ *
+ * @note The messages must be sent in the very same order they are
+ * compressed.
+ */
+unsigned char *pmd_compress(struct pmd *pmd, const void *in, size_t len,
+	size_t *out_len)
+{
+	unsigned char *out;
+
+	/* zlib does not support 8 bits windows for raw deflate. */
+	if (pmd->prm.server_bits < 9 || (uInt)len != len)
+		return (NULL);
+
+	if (!pmd->def_init)
+	{
+		if (deflate_init(&pmd->def, pmd->prm.server_bits) < 0)
+			return (NULL);
+		pmd->def_init = true;
+	}
+
+	/*
+	 * If not compressed, the client never sees this one, so the
+	 * compression history restarts.
+	 */
+	out = deflate_msg(&pmd->def, in, len, out_len);
+	if (!out || pmd->prm.server_no_ctx)
+		deflateReset(&pmd->def);
+
+	return (out);
+}
+
+/**
+ * @brief Compresses a message (@p len bytes of @p in) on its own,
+ * without any previous context: the result can be sent as is to
+ * every client with server_no_context_takeover and a window of at
+ * least @p bits bits.
+ *
+ * @param bits Window bits.
+ * @param in Message.
+ * @param len Message length.
+ * @param out_len Compressed length.
+ *
+ * @return Returns the compressed payload (to be freed by the caller),
+ * or NULL if the message should be sent uncompressed.
+ */
+unsigned char *pmd_compress_once(int bits, const void *in, size_t len,
+	size_t *out_len)
+{
+	unsigned char *out;
+	z_stream zs;
+
+	if (bits < 9 || (uInt)len != len)
+		return (NULL);
+
+	if (deflate_init(&zs, bits) < 0)
+		return (NULL);
+
+	out = deflate_msg(&zs, in, len, out_len);
+	deflateEnd(&zs);
+	return (out);
+}
+
+/**
+ * @brief Decompresses a message (@p len bytes of @p in).
+ *
+ * @param pmd State.
+ * @param in Compressed payload.
+ * @param len Payload length.
+ * @param max Max message length.
+ * @param out Message, with room for an extra byte (a NUL
+ * terminator) in the end, to be freed by the caller.
+ * @param out_len Message length.
+ *
+ * @return Returns 0 if success, -1 if the payload is invalid and
+ * -2 if the message is too big (or out of memory).
+ */
+int pmd_decompress(struct pmd *pmd, const void *in, size_t len,
+	size_t max, unsigned char **out, size_t *out_len)
+{
+	unsigned char *buf;
+	unsigned char *tmp;
+	bool tail;
+	size_t have;
+	size_t cap;
+	int ret;
+
+	/* Any window up to 15 bits can be inflated with 15 bits. */
+	if (!pmd->inf_init)
+	{
+		if (inflateInit2(&pmd->inf, -15) != Z_OK)
+			return (-2);
+		pmd->inf_init = true;
+	}
+
+	cap = (len < (max >> 2) ? len << 2 : max) + 256;
+	buf = malloc(cap + 1);
+	if (!buf)
+		return (-2);
+
+	pmd->inf.next_in  = (Bytef *)in;
+	pmd->inf.avail_in = (uInt)len;
+	tail = false;
+	have = 0;
+
+	for (;;)
+	{
+		if (have == cap)
+		{
+			if (cap > max)
+			{
+				ret = -2;
+				goto err;
+			}
+			tmp = realloc(buf, cap * 2 + 1);
+			if (!tmp)
+			{
+				ret = -2;
+				goto err;
+			}
+			buf  = tmp;
+			cap *= 2;
+		}
+
+		pmd->inf.next_out  = buf + have;
+		pmd->inf.avail_out = (uInt)(cap - have);
+		ret = inflate(&pmd->inf, Z_SYNC_FLUSH);
+		have = cap - pmd->inf.avail_out;
+
+		/* A final block: the next message starts a new stream. */
+		if (ret == Z_STREAM_END)
+		{
+			inflateReset(&pmd->inf);
+			break;
+		}
+
+		if ((ret != Z_OK && ret != Z_BUF_ERROR) ||
+			(ret == Z_BUF_ERROR && pmd->inf.avail_in && pmd->inf.avail_out))
+		{
+			ret = -1;
+			goto err;
+		}
+
+		if (pmd->inf.avail_in)
+			continue;
+
+		if (!tail)
+		{
+			pmd->inf.next_in  = (Bytef *)pmd_tail;
+			pmd->inf.avail_in = sizeof(pmd_tail);
+			tail = true;
+			continue;
+		}
+
+		if (pmd->inf.avail_out)
+			break;
+	}
+
+	if (have > max)
+	{
+		ret = -2;
+		goto err;
+	}
+
+	if (pmd->prm.client_no_ctx)
+		inflateReset(&pmd->inf);
+
+	*out     = buf;
+	*out_len = have;
+	return (0);
+err:
+	inflateReset(&pmd->inf);
+	free(buf);
+	return (ret);
+}
+
+#endif /* WS_HAS_DEFLATE */
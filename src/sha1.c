@@ -213,7 +213,8 @@ int SHA1Input(    SHA1Context    *context,
  *
  *  Description:
  *      This function will process the next 512 bits of the message
- *      stored in the Message_Block array.
+ *      stored in the Message_Block array, with the fastest block
+ *      routine supported by the CPU (see sha1_simd.c).
  *
  *  Parameters:
  *      None.
@@ -221,6 +222,30 @@ int SHA1Input(    SHA1Context    *context,
  *  Returns:
  *      Nothing.
  *
+ */
+void SHA1ProcessMessageBlock(SHA1Context *context)
+{
+    sha1_block(context->Intermediate_Hash, context->Message_Block);
+    context->Message_Block_Index = 0;
+}
+
+/*
+ *  SHA1ProcessBlock
+ *
+ *  Description:
+ *      This function will process a 512 bits block of the message
+ *      into the intermediate hash H. This is the reference (portable)
+ *      block routine.
+ *
+ *  Parameters:
+ *      H: [in/out]
+ *          The intermediate hash.
+ *      block: [in]
+ *          The 64 bytes block.
+ *
+ *  Returns:
+ *      Nothing.
+ *
  *  Comments:
 
  *      Many of the variable names in this code, especially the
@@ -229,7 +254,7 @@ int SHA1Input(    SHA1Context    *context,
  *
  *
  */
-void SHA1ProcessMessageBlock(SHA1Context *context)
+void SHA1ProcessBlock(uint32_t H[SHA1HashSize/4], const uint8_t block[64])
 {
     const uint32_t K[] =    {       /* Constants defined in SHA-1   */
                             0x5A827999,
@@ -247,10 +272,10 @@ void SHA1ProcessMessageBlock(SHA1Context *context)
      */
     for(t = 0; t < 16; t++)
     {
-        W[t]  = (uint32_t)context->Message_Block[t * 4] << 24;
-        W[t] |= (uint32_t)context->Message_Block[t * 4 + 1] << 16;
-        W[t] |= (uint32_t)context->Message_Block[t * 4 + 2] << 8;
-        W[t] |= (uint32_t)context->Message_Block[t * 4 + 3];
+        W[t]  = (uint32_t)block[t * 4] << 24;
+        W[t] |= (uint32_t)block[t * 4 + 1] << 16;
+        W[t] |= (uint32_t)block[t * 4 + 2] << 8;
+        W[t] |= (uint32_t)block[t * 4 + 3];
     }
 
     for(t = 16; t < 80; t++)
@@ -258,11 +283,11 @@ void SHA1ProcessMessageBlock(SHA1Context *context)
        W[t] = SHA1CircularShift(1,W[t-3] ^ W[t-8] ^ W[t-14] ^ W[t-16]);
     }
 
-    A = context->Intermediate_Hash[0];
-    B = context->Intermediate_Hash[1];
-    C = context->Intermediate_Hash[2];
-    D = context->Intermediate_Hash[3];
-    E = context->Intermediate_Hash[4];
+    A = H[0];
+    B = H[1];
+    C = H[2];
+    D = H[3];
+    E = H[4];
 
     for(t = 0; t < 20; t++)
     {
@@ -307,13 +332,11 @@ void SHA1ProcessMessageBlock(SHA1Context *context)
         A = temp;
     }
 
-    context->Intermediate_Hash[0] += A;
-    context->Intermediate_Hash[1] += B;
-    context->Intermediate_Hash[2] += C;
-    context->Intermediate_Hash[3] += D;
-    context->Intermediate_Hash[4] += E;
-
-    context->Message_Block_Index = 0;
+    H[0] += A;
+    H[1] += B;
+    H[2] += C;
+    H[3] += D;
+    H[4] += E;
 }
 
 /*
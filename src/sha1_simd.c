@@ -0,0 +1,299 @@
+/*
+ * Copyright (C) 2016-2024  Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <stddef.h>
+#include <sha1.h>
+
+/**
+ * @file sha1_simd.c
+ * @brief Hardware-accelerated SHA-1 block processing.
+ *
+ * Each Sec-WebSocket-Accept value costs two SHA-1 blocks, which
+ * the x86 SHA extensions (SHA-NI) and the ARMv8 crypto extensions
+ * process in a fraction of the time of the reference routine: the
+ * 80 rounds are computed 4 at a time, and so is the message
+ * schedule.
+ *
+ * The best routine supported by the CPU is picked at runtime, on
+ * the first use; the reference one (sha1.c) is the fallback.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SHA1_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__GNUC__) && defined(__aarch64__) && \
+	(defined(__linux__) || defined(__APPLE__))
+#define SHA1_ARM
+#include <arm_neon.h>
+#ifdef __linux__
+#include <sys/auxv.h>
+#ifndef HWCAP_SHA1
+#define HWCAP_SHA1 (1 << 5)
+#endif
+#endif
+#ifdef __clang__
+#define SHA1_ARM_TARGET __attribute__((target("crypto")))
+#else
+#define SHA1_ARM_TARGET __attribute__((target("+crypto")))
+#endif
+#endif
+
+/**
+ * @brief Block routine: processes the 64 bytes @p block into the
+ * intermediate hash @p H.
+ */
+typedef void (*sha1_fn)(uint32_t H[SHA1HashSize/4], const uint8_t block[64]);
+
+#ifdef SHA1_X86
+
+/**
+ * @brief SHA-NI rounds 4*@p g to 4*@p g + 3, with the round
+ * function @p f (g / 5).
+ *
+ * The message words of the group are computed in place from the
+ * previous four groups (W[t-16], W[t-14], W[t-8] and W[t-3]), the
+ * next E from the A of 4 rounds ago.
+ */
+#define SHA1_NI_ROUNDS(g, f)                                 \
+	do {                                                     \
+		if ((g) >= 4)                                        \
+		{                                                    \
+			w = _mm_sha1msg1_epu32(m[(g) & 3], m[((g) + 1) & 3]); \
+			w = _mm_xor_si128(w, m[((g) + 2) & 3]);          \
+			m[(g) & 3] = _mm_sha1msg2_epu32(w, m[((g) + 3) & 3]); \
+		}                                                    \
+		if (g)                                               \
+			e = _mm_sha1nexte_epu32(e_prev, m[(g) & 3]);     \
+		else                                                 \
+			e = _mm_add_epi32(e, m[0]);                      \
+		e_prev = abcd;                                       \
+		abcd   = _mm_sha1rnds4_epu32(abcd, e, f);            \
+	} while (0)
+
+/**
+ * @brief SHA-NI block routine.
+ *
+ * @param H Intermediate hash.
+ * @param block 64 bytes block.
+ */
+__attribute__((target("sha,sse4.1")))
+static void sha1_shani(uint32_t H[SHA1HashSize/4], const uint8_t block[64])
+{
+	__m128i abcd_save; /* Hash (A to D) before the block. */
+	__m128i e_save;    /* Hash (E) before the block.      */
+	__m128i e_prev;    /* A from the previous rounds.     */
+	__m128i abcd;      /* Working A to D.                 */
+	__m128i bswap;     /* Big-endian words shuffle.       */
+	__m128i m[4];      /* Last 16 message words.          */
+	__m128i e;         /* Working E.                      */
+	__m128i w;         /* New message words.              */
+	int i;             /* Loop index.                     */
+
+	bswap = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+	/* A in the highest lane, E as the highest lane. */
+	abcd = _mm_loadu_si128((const __m128i *)H);
+	abcd = _mm_shuffle_epi32(abcd, 0x1B);
+	e    = _mm_set_epi32((int)H[4], 0, 0, 0);
+
+	abcd_save = abcd;
+	e_save    = e;
+	e_prev    = e;
+
+	for (i = 0; i < 4; i++)
+	{
+		m[i] = _mm_loadu_si128((const __m128i *)(block + 16 * i));
+		m[i] = _mm_shuffle_epi8(m[i], bswap);
+	}
+
+	SHA1_NI_ROUNDS(0,  0); SHA1_NI_ROUNDS(1,  0); SHA1_NI_ROUNDS(2,  0);
+	SHA1_NI_ROUNDS(3,  0); SHA1_NI_ROUNDS(4,  0); SHA1_NI_ROUNDS(5,  1);
+	SHA1_NI_ROUNDS(6,  1); SHA1_NI_ROUNDS(7,  1); SHA1_NI_ROUNDS(8,  1);
+	SHA1_NI_ROUNDS(9,  1); SHA1_NI_ROUNDS(10, 2); SHA1_NI_ROUNDS(11, 2);
+	SHA1_NI_ROUNDS(12, 2); SHA1_NI_ROUNDS(13, 2); SHA1_NI_ROUNDS(14, 2);
+	SHA1_NI_ROUNDS(15, 3); SHA1_NI_ROUNDS(16, 3); SHA1_NI_ROUNDS(17, 3);
+	SHA1_NI_ROUNDS(18, 3); SHA1_NI_ROUNDS(19, 3);
+
+	/* Add the block result to the hash. */
+	e    = _mm_sha1nexte_epu32(e_prev, e_save);
+	abcd = _mm_add_epi32(abcd, abcd_save);
+
+	abcd = _mm_shuffle_epi32(abcd, 0x1B);
+	_mm_storeu_si128((__m128i *)H, abcd);
+	H[4] = (uint32_t)_mm_extract_epi32(e, 3);
+}
+
+/**
+ * @brief CPUID check for the SHA-NI routine.
+ */
+static int has_shani(void)
+{
+	return (__builtin_cpu_supports("sha") &&
+		__builtin_cpu_supports("sse4.1"));
+}
+
+#endif /* SHA1_X86 */
+
+#ifdef SHA1_ARM
+
+/**
+ * @brief ARMv8 crypto extensions block routine.
+ *
+ * @param H Intermediate hash.
+ * @param block 64 bytes block.
+ */
+SHA1_ARM_TARGET
+static void sha1_armv8(uint32_t H[SHA1HashSize/4], const uint8_t block[64])
+{
+	static const uint32_t K[4] = {
+		0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6
+	};
+
+	uint32x4_t abcd_save; /* Hash (A to D) before the block. */
+	uint32x4_t abcd;      /* Working A to D.                 */
+	uint32x4_t m[4];      /* Last 16 message words.          */
+	uint32x4_t wk;        /* Message words plus constant.    */
+	uint32_t e_next;      /* E of the next rounds.           */
+	uint32_t e;           /* Working E.                      */
+	int g;                /* Rounds group (4 rounds).        */
+
+	abcd_save = abcd = vld1q_u32(H);
+	e = H[4];
+
+	for (g = 0; g < 4; g++)
+	{
+		m[g] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(block + 16 * g)));
+	}
+
+	for (g = 0; g < 20; g++)
+	{
+		/* W[t-16], W[t-14], W[t-8] and W[t-3]. */
+		if (g >= 4)
+		{
+			m[g & 3] = vsha1su1q_u32(
+				vsha1su0q_u32(m[g & 3], m[(g + 1) & 3], m[(g + 2) & 3]),
+				m[(g + 3) & 3]);
+		}
+
+		wk     = vaddq_u32(m[g & 3], vdupq_n_u32(K[g / 5]));
+		e_next = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+
+		if (g < 5)
+			abcd = vsha1cq_u32(abcd, e, wk);
+		else if (g >= 10 && g < 15)
+			abcd = vsha1mq_u32(abcd, e, wk);
+		else
+			abcd = vsha1pq_u32(abcd, e, wk);
+
+		e = e_next;
+	}
+
+	vst1q_u32(H, vaddq_u32(abcd, abcd_save));
+	H[4] += e;
+}
+
+/**
+ * @brief HWCAP check for the ARMv8 routine.
+ */
+static int has_armv8(void)
+{
+#ifdef __linux__
+	return (!!(getauxval(AT_HWCAP) & HWCAP_SHA1));
+#else
+	return (1);
+#endif
+}
+
+#endif /* SHA1_ARM */
+
+/**
+ * @brief Block routine description.
+ */
+struct sha1_impl
+{
+	const char *name;    /**< Routine name.             */
+	sha1_fn fn;          /**< Block routine.            */
+	int (*usable)(void); /**< Runtime check, if needed. */
+};
+
+/**
+ * @brief Available block routines, the best ones first.
+ */
+static const struct sha1_impl kernels[] = {
+#ifdef SHA1_X86
+	{"sha-ni", sha1_shani, has_shani},
+#endif
+#ifdef SHA1_ARM
+	{"armv8",  sha1_armv8, has_armv8},
+#endif
+	{"ref",    SHA1ProcessBlock, NULL}
+};
+
+/**
+ * @brief Block routine in use, NULL until the first block.
+ */
+static const struct sha1_impl *kernel;
+
+/**
+ * @brief Picks the best block routine supported by the running CPU.
+ *
+ * @return Returns the routine selected.
+ */
+static const struct sha1_impl *sha1_select(void)
+{
+	const struct sha1_impl *k;
+
+	k = __atomic_load_n(&kernel, __ATOMIC_ACQUIRE);
+	if (k)
+		return (k);
+
+#ifdef SHA1_X86
+	__builtin_cpu_init();
+#endif
+
+	/* The last one is always usable. */
+	for (k = kernels; k->usable && !k->usable(); k++)
+		;
+
+	/* Racing threads would pick the same routine anyway. */
+	__atomic_store_n(&kernel, k, __ATOMIC_RELEASE);
+	return (k);
+}
+
+/**
+ * @brief Processes the 64 bytes @p block into the intermediate
+ * hash @p H, just like SHA1ProcessBlock(), but much faster when
+ * the CPU has SHA instructions.
+ *
+ * @param H Intermediate hash.
+ * @param block 64 bytes block.
+ */
+void sha1_block(uint32_t H[SHA1HashSize/4], const uint8_t block[64])
+{
+	sha1_select()->fn(H, block);
+}
+
+/**
+ * @brief Returns the name of the SHA-1 block routine in use
+ * ("sha-ni", "armv8" or "ref").
+ */
+const char *sha1_kernel(void)
+{
+	return (sha1_select()->name);
+}
@@ -0,0 +1,316 @@
+/*
+ * Copyright (C) 2016-2024  Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stddef.h>
+#include <time.h>
+#include <timer.h>
+
+/**
+ * @file timer.c
+ * @brief Hashed timing wheel.
+ *
+ * A single thread serves all the timers: each one is hashed into
+ * the slot of its expiration tick (modulo the wheel size), so
+ * that adding and cancelling a timer are O(1), whatever the amount
+ * of timers. Each tick, the thread walks a single slot and runs
+ * the callbacks of the timers already expired (the others wait for
+ * the next turn of the wheel).
+ *
+ * The thread is only started on the first use, and only wakes up
+ * (every tick) while there are timers armed.
+ */
+
+/**
+ * @brief Timing wheel.
+ */
+static struct timer_wheel
+{
+	struct timer *slots[TIMER_SLOTS]; /**< Timers, by expiration tick.  */
+	struct timer *expired;            /**< Expired, callbacks pending.  */
+	uint64_t tick;                    /**< Next tick to be processed.   */
+	unsigned armed;                   /**< Amount of timers armed.      */
+	struct timer *running;            /**< Timer whose callback runs.   */
+	pthread_t thread;                 /**< Wheel thread.                */
+	bool started;                     /**< Wheel thread started.        */
+	pthread_mutex_t mtx;              /**< Wheel lock.                  */
+	pthread_cond_t cnd;               /**< New timer armed.             */
+	pthread_cond_t cnd_run;           /**< Callback finished.           */
+} wheel = {
+	.mtx     = PTHREAD_MUTEX_INITIALIZER,
+	.cnd     = PTHREAD_COND_INITIALIZER,
+	.cnd_run = PTHREAD_COND_INITIALIZER
+};
+
+/**
+ * @brief Returns the current tick, from a monotonic clock.
+ */
+static uint64_t timer_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (((uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000) /
+		TIMER_TICK_MS);
+}
+
+/**
+ * @brief Removes the timer @p t from its slot.
+ *
+ * @param t Timer (armed).
+ *
+ * @note Must be called with the wheel lock held.
+ */
+static void timer_unlink(struct timer *t)
+{
+	if (t->prev)
+		t->prev->next = t->next;
+	else if (wheel.expired == t)
+		wheel.expired = t->next;
+	else
+		wheel.slots[t->expires & (TIMER_SLOTS - 1)] = t->next;
+
+	if (t->next)
+		t->next->prev = t->prev;
+
+	t->pending = false;
+	wheel.armed--;
+}
+
+/**
+ * @brief Runs the callbacks of the expired timers of a given wheel
+ * @p slot, as of the tick @p now.
+ *
+ * The expired timers are first moved, in a single pass, from the
+ * slot to the expired list, and then have their callbacks run one
+ * by one. They remain armed while in the expired list, so they can
+ * still be cancelled or re-armed meanwhile. The slot is only walked
+ * again if timers expiring now were added to it while the callbacks
+ * ran.
+ *
+ * @param slot Wheel slot.
+ * @param now Current tick.
+ *
+ * @note Must be called with the wheel lock held, which is released
+ * while the callbacks run.
+ */
+static void timer_expire(struct timer **slot, uint64_t now)
+{
+	struct timer *next;
+	struct timer *t;
+
+	for (;;)
+	{
+		for (t = *slot; t; t = next)
+		{
+			next = t->next;
+			if (t->expires > now)
+				continue;
+
+			if (t->prev)
+				t->prev->next = t->next;
+			else
+				*slot = t->next;
+
+			if (t->next)
+				t->next->prev = t->prev;
+
+			t->prev = NULL;
+			t->next = wheel.expired;
+			if (wheel.expired)
+				wheel.expired->prev = t;
+			wheel.expired = t;
+		}
+
+		if (!wheel.expired)
+			break;
+
+		while ((t = wheel.expired) != NULL)
+		{
+			timer_unlink(t);
+			wheel.running = t;
+
+			/* clang-format off */
+			pthread_mutex_unlock(&wheel.mtx);
+				t->fn(t->arg);
+			pthread_mutex_lock(&wheel.mtx);
+			/* clang-format on */
+
+			wheel.running = NULL;
+			pthread_cond_broadcast(&wheel.cnd_run);
+		}
+	}
+}
+
+/**
+ * @brief Wheel thread: advances the wheel every tick, while there
+ * are timers armed.
+ *
+ * @param p Unused.
+ *
+ * @return Never returns.
+ */
+static void *timer_thread(void *p)
+{
+	struct timespec ts;
+	uint64_t now;
+
+	(void)p;
+	pthread_mutex_lock(&wheel.mtx);
+
+	for (;;)
+	{
+		while (!wheel.armed)
+			pthread_cond_wait(&wheel.cnd, &wheel.mtx);
+
+		now = timer_now();
+
+		/* A whole turn (or more) late: each slot is visited once. */
+		if (now - wheel.tick >= TIMER_SLOTS)
+			wheel.tick = now - TIMER_SLOTS + 1;
+
+		for (; wheel.tick <= now; wheel.tick++)
+			timer_expire(&wheel.slots[wheel.tick & (TIMER_SLOTS - 1)], now);
+
+		/* Sleep for a tick. */
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += TIMER_TICK_MS * 1000000L;
+		if (ts.tv_nsec >= 1000000000)
+		{
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&wheel.cnd, &wheel.mtx, &ts);
+	}
+
+	return (NULL);
+}
+
+/**
+ * @brief Initializes the timer @p t, that calls @p fn(@p arg) from
+ * the wheel thread when it expires.
+ *
+ * @param t Timer.
+ * @param fn Expiration callback.
+ * @param arg Callback argument.
+ */
+void timer_init(struct timer *t, void (*fn)(void *), void *arg)
+{
+	t->next    = NULL;
+	t->prev    = NULL;
+	t->expires = 0;
+	t->fn      = fn;
+	t->arg     = arg;
+	t->pending = false;
+}
+
+/**
+ * @brief Arms the timer @p t to expire in @p ms milliseconds (rounded
+ * up to the wheel resolution), re-arming it if already armed.
+ *
+ * @param t Timer.
+ * @param ms Time, in milliseconds.
+ *
+ * @return Returns 0 if success, -1 if the wheel thread could not be
+ * started.
+ */
+int timer_add(struct timer *t, uint32_t ms)
+{
+	struct timer **slot;
+	int ret;
+
+	ret = 0;
+	pthread_mutex_lock(&wheel.mtx);
+
+	if (!wheel.started)
+	{
+		wheel.tick = timer_now();
+		if (pthread_create(&wheel.thread, NULL, timer_thread, NULL))
+		{
+			ret = -1;
+			goto out;
+		}
+		pthread_detach(wheel.thread);
+		wheel.started = true;
+	}
+
+	if (t->pending)
+		timer_unlink(t);
+
+	/* Never in a slot already processed. */
+	t->expires = timer_now() +
+		((uint64_t)ms + TIMER_TICK_MS - 1) / TIMER_TICK_MS;
+	if (t->expires < wheel.tick)
+		t->expires = wheel.tick;
+
+	slot = &wheel.slots[t->expires & (TIMER_SLOTS - 1)];
+	t->prev = NULL;
+	t->next = *slot;
+	if (*slot)
+		(*slot)->prev = t;
+	*slot = t;
+
+	t->pending = true;
+	if (!wheel.armed++)
+		pthread_cond_signal(&wheel.cnd);
+out:
+	pthread_mutex_unlock(&wheel.mtx);
+	return (ret);
+}
+
+/**
+ * @brief Cancels the timer @p t, if armed.
+ *
+ * If its callback is running, waits for it to finish (unless called
+ * from the callback itself): once this returns, the callback is not
+ * running and will not run, even if it re-armed the timer, so the
+ * timer owner can be released.
+ *
+ * @param t Timer.
+ *
+ * @return Returns true if the timer was armed, false otherwise.
+ */
+bool timer_cancel(struct timer *t)
+{
+	bool pending;
+	bool self;
+
+	pending = false;
+	self    = false;
+
+	pthread_mutex_lock(&wheel.mtx);
+
+	if (wheel.started)
+		self = pthread_equal(pthread_self(), wheel.thread);
+
+	for (;;)
+	{
+		if (t->pending)
+		{
+			timer_unlink(t);
+			pending = true;
+		}
+
+		if (self || wheel.running != t)
+			break;
+
+		pthread_cond_wait(&wheel.cnd_run, &wheel.mtx);
+	}
+
+	pthread_mutex_unlock(&wheel.mtx);
+	return (pending);
+}
@@ -0,0 +1,338 @@
+/*
+ * Copyright (C) 2016-2024  Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+#define _GNU_SOURCE
+#include <uring.h>
+
+/**
+ * @dir src/
+ * @brief io_uring routines directory
+ *
+ * @file uring.c
+ * @brief Minimal io_uring helpers.
+ *
+ * Just enough of io_uring to drive the WS_IO_URING event loops:
+ * ring setup, SQE/CQE handling and provided buffer rings, all
+ * through raw syscalls, so that wsServer keeps not depending on
+ * external libraries (such as liburing).
+ */
+
+#ifdef WS_HAS_URING
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * @brief Load with acquire semantics.
+ */
+#define LOAD_ACQ(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+
+/**
+ * @brief Store with release semantics.
+ */
+#define STORE_REL(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/**
+ * @brief Creates a new io_uring instance with (at least) @p entries
+ * submission queue entries.
+ *
+ * @param r Ring to be initialized.
+ * @param entries Submission queue size.
+ *
+ * @return Returns 0 if success, a negative number otherwise (such
+ * as when io_uring is not supported or not allowed).
+ */
+int uring_init(struct uring *r, unsigned entries)
+{
+	struct io_uring_params p;
+	unsigned char *sq;
+	unsigned char *cq;
+
+	memset(r, 0, sizeof(*r));
+	memset(&p, 0, sizeof(p));
+
+	/* Give some room to the completions of multishot requests. */
+	p.flags      = IORING_SETUP_CQSIZE;
+	p.cq_entries = entries * 4;
+
+	r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+	if (r->fd < 0)
+		return (-1);
+
+	/* We rely on a single mmap for both rings and on not losing CQEs. */
+	if (!(p.features & IORING_FEAT_SINGLE_MMAP) ||
+		!(p.features & IORING_FEAT_NODROP))
+	{
+		close(r->fd);
+		return (-1);
+	}
+
+	r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (r->cq_size > r->sq_size)
+		r->sq_size = r->cq_size;
+	r->cq_size = r->sq_size;
+
+	r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ptr == MAP_FAILED)
+		goto err0;
+	r->cq_ptr = r->sq_ptr;
+
+	r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->sqes = mmap(NULL, r->sqes_size, PROT_READ|PROT_WRITE,
+		MAP_SHARED|MAP_POPULATE, r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+		goto err1;
+
+	sq = r->sq_ptr;
+	cq = r->cq_ptr;
+
+	r->sq_head    = (unsigned *)(sq + p.sq_off.head);
+	r->sq_tail    = (unsigned *)(sq + p.sq_off.tail);
+	r->sq_mask    = (unsigned *)(sq + p.sq_off.ring_mask);
+	r->sq_array   = (unsigned *)(sq + p.sq_off.array);
+	r->sq_entries = p.sq_entries;
+	r->sq_local_tail = *r->sq_tail;
+
+	r->cq_head = (unsigned *)(cq + p.cq_off.head);
+	r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	r->cqes    = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return (0);
+
+err1:
+	munmap(r->sq_ptr, r->sq_size);
+err0:
+	close(r->fd);
+	return (-1);
+}
+
+/**
+ * @brief Releases all the resources of a given ring @p r.
+ *
+ * @param r Ring to be released.
+ */
+void uring_free(struct uring *r)
+{
+	if (r->br)
+		munmap(r->br, r->br_entries * sizeof(struct io_uring_buf));
+	free(r->br_mem);
+	munmap(r->sqes, r->sqes_size);
+	munmap(r->sq_ptr, r->sq_size);
+	close(r->fd);
+}
+
+/**
+ * @brief Gets the next free submission queue entry, already
+ * zeroed. The entry is only visible to the kernel after the
+ * next uring_flush().
+ *
+ * @param r Ring.
+ *
+ * @return Returns the SQE, or NULL if the submission queue
+ * is full.
+ *
+ * @note Callers that share the ring between threads must
+ * serialize the calls to this routine and uring_flush().
+ */
+struct io_uring_sqe *uring_get_sqe(struct uring *r)
+{
+	struct io_uring_sqe *sqe;
+	unsigned idx;
+
+	if (uring_sq_pending(r) >= r->sq_entries)
+		return (NULL);
+
+	idx = r->sq_local_tail & *r->sq_mask;
+	sqe = &r->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	r->sq_array[idx] = idx;
+	r->sq_local_tail++;
+	return (sqe);
+}
+
+/**
+ * @brief Makes all the entries obtained with uring_get_sqe() so far
+ * visible to the kernel, to be submitted by the next uring_enter().
+ *
+ * @param r Ring.
+ */
+void uring_flush(struct uring *r)
+{
+	STORE_REL(r->sq_tail, r->sq_local_tail);
+}
+
+/**
+ * @brief Returns the amount of entries obtained with uring_get_sqe()
+ * and not consumed by the kernel yet.
+ *
+ * @param r Ring.
+ *
+ * @return Returns the amount of pending entries.
+ */
+unsigned uring_sq_pending(struct uring *r)
+{
+	return (r->sq_local_tail - LOAD_ACQ(r->sq_head));
+}
+
+/**
+ * @brief Submits @p to_submit entries already flushed with
+ * uring_flush() and optionally waits for @p min_complete
+ * completions.
+ *
+ * @param r Ring.
+ * @param to_submit Amount of entries to submit.
+ * @param min_complete Amount of completions to wait for.
+ *
+ * @return Returns the amount of entries submitted, or a negative
+ * number if error (errno is set accordingly).
+ */
+int uring_enter(struct uring *r, unsigned to_submit, unsigned min_complete)
+{
+	return ((int)syscall(__NR_io_uring_enter, r->fd, to_submit, min_complete,
+		min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0));
+}
+
+/**
+ * @brief Returns the next completion queue entry, if any.
+ *
+ * @param r Ring.
+ *
+ * @return Returns the CQE or NULL if there is none. Once handled,
+ * the CQE must be released with uring_cqe_seen().
+ */
+struct io_uring_cqe *uring_peek_cqe(struct uring *r)
+{
+	unsigned head;
+
+	head = *r->cq_head;
+	if (head == LOAD_ACQ(r->cq_tail))
+		return (NULL);
+
+	return (&r->cqes[head & *r->cq_mask]);
+}
+
+/**
+ * @brief Releases the CQE previously returned by uring_peek_cqe().
+ *
+ * @param r Ring.
+ */
+void uring_cqe_seen(struct uring *r)
+{
+	STORE_REL(r->cq_head, *r->cq_head + 1);
+}
+
+/**
+ * @brief Sets up a provided buffers ring with @p entries buffers of
+ * @p buf_size bytes each, in the buffer group @p bgid.
+ *
+ * @param r Ring.
+ * @param entries Amount of buffers (power of 2).
+ * @param buf_size Size of each buffer.
+ * @param bgid Buffer group id.
+ *
+ * @return Returns 0 if success, a negative number otherwise.
+ */
+int uring_setup_buf_ring(struct uring *r, unsigned entries,
+	size_t buf_size, uint16_t bgid)
+{
+	struct io_uring_buf_reg reg;
+	size_t ring_size;
+	unsigned i;
+
+	ring_size = entries * sizeof(struct io_uring_buf);
+	r->br = mmap(NULL, ring_size, PROT_READ|PROT_WRITE,
+		MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+	if (r->br == MAP_FAILED)
+	{
+		r->br = NULL;
+		return (-1);
+	}
+
+	r->br_mem = malloc(entries * buf_size);
+	if (!r->br_mem)
+		goto err;
+
+	memset(&reg, 0, sizeof(reg));
+	reg.ring_addr    = (uint64_t)(uintptr_t)r->br;
+	reg.ring_entries = entries;
+	reg.bgid         = bgid;
+
+	if (syscall(__NR_io_uring_register, r->fd, IORING_REGISTER_PBUF_RING,
+			&reg, 1) < 0)
+	{
+		goto err;
+	}
+
+	r->br_entries  = entries;
+	r->br_buf_size = buf_size;
+	r->br_tail     = 0;
+
+	for (i = 0; i < entries; i++)
+		uring_recycle_buf(r, (uint16_t)i);
+
+	return (0);
+err:
+	free(r->br_mem);
+	munmap(r->br, ring_size);
+	r->br_mem = NULL;
+	r->br     = NULL;
+	return (-1);
+}
+
+/**
+ * @brief Gets the address of the provided buffer @p bid.
+ *
+ * @param r Ring.
+ * @param bid Buffer id, as informed in the CQE flags.
+ *
+ * @return Returns the buffer address.
+ */
+unsigned char *uring_buf(struct uring *r, uint16_t bid)
+{
+	return (r->br_mem + (size_t)bid * r->br_buf_size);
+}
+
+/**
+ * @brief Gives the provided buffer @p bid back to the kernel.
+ *
+ * @param r Ring.
+ * @param bid Buffer id.
+ */
+void uring_recycle_buf(struct uring *r, uint16_t bid)
+{
+	struct io_uring_buf *buf;
+
+	buf       = &r->br->bufs[r->br_tail & (r->br_entries - 1)];
+	buf->addr = (uint64_t)(uintptr_t)uring_buf(r, bid);
+	buf->len  = (uint32_t)r->br_buf_size;
+	buf->bid  = bid;
+
+	r->br_tail++;
+	STORE_REL(&r->br->tail, (uint16_t)r->br_tail);
+}
+
+#else
+
+/* ISO C requires a translation unit to contain at least one declaration. */
+typedef int uring_unsupported;
+
+#endif /* WS_HAS_URING */
@@ -0,0 +1,493 @@
+/*
+ * Copyright (C) 2016-2024  Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#include <string.h>
+#include <utf8.h>
+
+/**
+ * @file utf8_simd.c
+ * @brief Vectorized UTF-8 validation.
+ *
+ * The bulk of a span is validated by a SIMD kernel implementing the
+ * 'lookup' algorithm from John Keiser and Daniel Lemire ("Validating
+ * UTF-8 In Less Than One Instruction Per Byte", also used by
+ * simdjson): each byte is classified by three 16-entry table lookups
+ * (high and low nibbles of the previous byte, high nibble of the
+ * current one) whose AND flags every invalid 2-byte pattern, the
+ * remaining cases being handled by checking the continuation bytes
+ * expected after 3 and 4-byte leads. Pure ASCII blocks are skipped
+ * right away.
+ *
+ * The Hoehrmann DFA (utf8.c) is still used for the few bytes around
+ * the span boundaries, so that the same state can be carried across
+ * continuation frames.
+ *
+ * On x86, the best kernel (AVX2, SSSE3 or an ASCII-skipping DFA) is
+ * picked at runtime, on the first use.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define UTF8_X86
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief Validation kernel: checks if the @p len bytes of @p s are
+ * complete and valid UTF-8.
+ */
+typedef int (*utf8_fn)(const uint8_t *s, size_t len);
+
+/**
+ * @brief ASCII-skipping DFA kernel: skips the ASCII runs a 64-bit
+ * word at a time and runs the DFA over the rest.
+ *
+ * @param s Input bytes.
+ * @param len Amount of bytes.
+ *
+ * @return Returns 1 if valid, 0 otherwise.
+ */
+static int utf8_word(const uint8_t *s, size_t len)
+{
+	uint32_t state; /* DFA state.    */
+	uint64_t w;     /* Current word. */
+	size_t n;       /* Chunk size.   */
+	size_t i;       /* Loop index.   */
+
+	state = UTF8_ACCEPT;
+	for (i = 0; i < len; i += n)
+	{
+		if (state == UTF8_ACCEPT)
+		{
+			for (; i + 8 <= len; i += 8)
+			{
+				memcpy(&w, s + i, sizeof(w));
+				if (w & 0x8080808080808080ULL)
+					break;
+			}
+			if (i == len)
+				break;
+		}
+
+		n = (len - i < 16) ? len - i : 16;
+		state = is_utf8_len_state((uint8_t *)s + i, n, state);
+		if (state == UTF8_REJECT)
+			return (0);
+	}
+	return (state == UTF8_ACCEPT);
+}
+
+#ifdef UTF8_X86
+
+/* Error classes of a (previous byte, current byte) pair. */
+#define TOO_SHORT      (1 << 0) /* Lead/ASCII followed by lead/ASCII. */
+#define TOO_LONG       (1 << 1) /* ASCII followed by continuation.    */
+#define OVERLONG_3     (1 << 2) /* Overlong 3-byte sequence.          */
+#define TOO_LARGE      (1 << 3) /* Above U+10FFFF.                    */
+#define SURROGATE      (1 << 4) /* U+D800..U+DFFF.                    */
+#define OVERLONG_2     (1 << 5) /* Overlong 2-byte sequence.          */
+#define TOO_LARGE_1000 (1 << 6) /* Above U+10FFFF (F4 9x..F4 Bx).     */
+#define OVERLONG_4     (1 << 6) /* Overlong 4-byte sequence.          */
+#define TWO_CONTS      (1 << 7) /* Two continuations in a row.        */
+#define CARRY          (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+/**
+ * @brief Lookup table indexed by the high nibble of the previous byte.
+ */
+static const uint8_t byte1_high[16] = {
+	/* 0_______: ASCII. */
+	TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+	TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+	/* 10______: continuation. */
+	TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+	/* 1100____ and 1101____: 2-byte lead. */
+	TOO_SHORT | OVERLONG_2,
+	TOO_SHORT,
+	/* 1110____: 3-byte lead. */
+	TOO_SHORT | OVERLONG_3 | SURROGATE,
+	/* 1111____: 4-byte lead. */
+	TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+};
+
+/**
+ * @brief Lookup table indexed by the low nibble of the previous byte.
+ */
+static const uint8_t byte1_low[16] = {
+	/* ____0000 */
+	CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+	/* ____0001 */
+	CARRY | OVERLONG_2,
+	/* ____001_ */
+	CARRY,
+	CARRY,
+	/* ____0100 */
+	CARRY | TOO_LARGE,
+	/* ____0101, ____011_ and ____1___ */
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	/* ____1101 */
+	CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+	CARRY | TOO_LARGE | TOO_LARGE_1000,
+	CARRY | TOO_LARGE | TOO_LARGE_1000
+};
+
+/**
+ * @brief Lookup table indexed by the high nibble of the current byte.
+ */
+static const uint8_t byte2_high[16] = {
+	/* 0_______: ASCII. */
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+	/* 1000____ */
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 |
+		OVERLONG_4,
+	/* 1001____ */
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+	/* 101_____ */
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+	TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,
+	/* 11______: lead. */
+	TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+};
+
+/**
+ * @brief Maximum values of the last bytes of a block that does
+ * not end in the middle of a sequence.
+ */
+static const uint8_t incomplete_max[32] = {
+	255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 255, 255, 255,
+	255, 255, 255, 255, 255, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1
+};
+
+/**
+ * @brief Checks a 16-byte block @p in, @p prev being the previous
+ * block.
+ *
+ * @return Returns a non-zero vector if invalid.
+ */
+__attribute__((target("ssse3")))
+static inline __m128i utf8_check_ssse3(__m128i in, __m128i prev)
+{
+	const __m128i nib = _mm_set1_epi8(0x0F);
+	__m128i prev1;
+	__m128i prev2;
+	__m128i prev3;
+	__m128i sc;
+	__m128i must23;
+
+	prev1 = _mm_alignr_epi8(in, prev, 15);
+	prev2 = _mm_alignr_epi8(in, prev, 14);
+	prev3 = _mm_alignr_epi8(in, prev, 13);
+
+	sc = _mm_and_si128(
+		_mm_and_si128(
+			_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)byte1_high),
+				_mm_and_si128(_mm_srli_epi16(prev1, 4), nib)),
+			_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)byte1_low),
+				_mm_and_si128(prev1, nib))),
+		_mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)byte2_high),
+			_mm_and_si128(_mm_srli_epi16(in, 4), nib)));
+
+	/* Third and fourth bytes of 3 and 4-byte sequences. */
+	must23 = _mm_or_si128(
+		_mm_subs_epu8(prev2, _mm_set1_epi8(0xE0 - 0x80)),
+		_mm_subs_epu8(prev3, _mm_set1_epi8(0xF0 - 0x80)));
+
+	must23 = _mm_and_si128(must23, _mm_set1_epi8((char)0x80));
+	return (_mm_xor_si128(must23, sc));
+}
+
+/**
+ * @brief SSSE3 kernel, 16 bytes at a time.
+ *
+ * @param s Input bytes.
+ * @param len Amount of bytes.
+ *
+ * @return Returns 1 if valid, 0 otherwise.
+ */
+__attribute__((target("ssse3")))
+static int utf8_ssse3(const uint8_t *s, size_t len)
+{
+	__m128i prev_inc; /* Previous block incomplete. */
+	uint8_t tail[16]; /* Last (partial) block.      */
+	__m128i prev;     /* Previous block.            */
+	__m128i err;      /* Errors found so far.       */
+	__m128i max;      /* Incomplete block max.      */
+	__m128i in;       /* Current block.             */
+	size_t i;         /* Loop index.                */
+
+	prev     = _mm_setzero_si128();
+	prev_inc = _mm_setzero_si128();
+	err      = _mm_setzero_si128();
+	max      = _mm_loadu_si128((const __m128i *)(incomplete_max + 16));
+
+	for (i = 0; i < len; i += 16)
+	{
+		/* Zero padding is ASCII, a truncated sequence is an error. */
+		if (len - i >= 16)
+			in = _mm_loadu_si128((const __m128i *)(s + i));
+		else
+		{
+			memset(tail, 0, sizeof(tail));
+			memcpy(tail, s + i, len - i);
+			in = _mm_loadu_si128((const __m128i *)tail);
+		}
+
+		/* ASCII fast path. */
+		if (!_mm_movemask_epi8(in))
+		{
+			err      = _mm_or_si128(err, prev_inc);
+			prev_inc = _mm_setzero_si128();
+		}
+		else
+		{
+			err      = _mm_or_si128(err, utf8_check_ssse3(in, prev));
+			prev_inc = _mm_subs_epu8(in, max);
+		}
+		prev = in;
+	}
+
+	err = _mm_or_si128(err, prev_inc);
+	return (_mm_movemask_epi8(
+		_mm_cmpeq_epi8(err, _mm_setzero_si128())) == 0xFFFF);
+}
+
+/**
+ * @brief Checks a 32-byte block @p in, @p prev being the previous
+ * block.
+ *
+ * @return Returns a non-zero vector if invalid.
+ */
+__attribute__((target("avx2")))
+static inline __m256i utf8_check_avx2(__m256i in, __m256i prev)
+{
+	const __m256i nib = _mm256_set1_epi8(0x0F);
+	__m256i prev1;
+	__m256i prev2;
+	__m256i prev3;
+	__m256i shift;
+	__m256i sc;
+	__m256i must23;
+
+	/* Lanes are 128-bit: shift the upper half of prev in first. */
+	shift = _mm256_permute2x128_si256(prev, in, 0x21);
+	prev1 = _mm256_alignr_epi8(in, shift, 15);
+	prev2 = _mm256_alignr_epi8(in, shift, 14);
+	prev3 = _mm256_alignr_epi8(in, shift, 13);
+
+	sc = _mm256_and_si256(
+		_mm256_and_si256(
+			_mm256_shuffle_epi8(_mm256_broadcastsi128_si256(
+				_mm_loadu_si128((const __m128i *)byte1_high)),
+				_mm256_and_si256(_mm256_srli_epi16(prev1, 4), nib)),
+			_mm256_shuffle_epi8(_mm256_broadcastsi128_si256(
+				_mm_loadu_si128((const __m128i *)byte1_low)),
+				_mm256_and_si256(prev1, nib))),
+		_mm256_shuffle_epi8(_mm256_broadcastsi128_si256(
+			_mm_loadu_si128((const __m128i *)byte2_high)),
+			_mm256_and_si256(_mm256_srli_epi16(in, 4), nib)));
+
+	/* Third and fourth bytes of 3 and 4-byte sequences. */
+	must23 = _mm256_or_si256(
+		_mm256_subs_epu8(prev2, _mm256_set1_epi8(0xE0 - 0x80)),
+		_mm256_subs_epu8(prev3, _mm256_set1_epi8(0xF0 - 0x80)));
+
+	must23 = _mm256_and_si256(must23, _mm256_set1_epi8((char)0x80));
+	return (_mm256_xor_si256(must23, sc));
+}
+
+/**
+ * @brief AVX2 kernel, 32 bytes at a time.
+ *
+ * @param s Input bytes.
+ * @param len Amount of bytes.
+ *
+ * @return Returns 1 if valid, 0 otherwise.
+ */
+__attribute__((target("avx2")))
+static int utf8_avx2(const uint8_t *s, size_t len)
+{
+	__m256i prev_inc; /* Previous block incomplete. */
+	uint8_t tail[32]; /* Last (partial) block.      */
+	__m256i prev;     /* Previous block.            */
+	__m256i err;      /* Errors found so far.       */
+	__m256i max;      /* Incomplete block max.      */
+	__m256i in;       /* Current block.             */
+	size_t i;         /* Loop index.                */
+	int ret;          /* Return value.              */
+
+	prev     = _mm256_setzero_si256();
+	prev_inc = _mm256_setzero_si256();
+	err      = _mm256_setzero_si256();
+	max      = _mm256_loadu_si256((const __m256i *)incomplete_max);
+
+	for (i = 0; i < len; i += 32)
+	{
+		/* Zero padding is ASCII, a truncated sequence is an error. */
+		if (len - i >= 32)
+			in = _mm256_loadu_si256((const __m256i *)(s + i));
+		else
+		{
+			memset(tail, 0, sizeof(tail));
+			memcpy(tail, s + i, len - i);
+			in = _mm256_loadu_si256((const __m256i *)tail);
+		}
+
+		/* ASCII fast path. */
+		if (!_mm256_movemask_epi8(in))
+		{
+			err      = _mm256_or_si256(err, prev_inc);
+			prev_inc = _mm256_setzero_si256();
+		}
+		else
+		{
+			err      = _mm256_or_si256(err, utf8_check_avx2(in, prev));
+			prev_inc = _mm256_subs_epu8(in, max);
+		}
+		prev = in;
+	}
+
+	err = _mm256_or_si256(err, prev_inc);
+	ret = _mm256_testz_si256(err, err);
+
+	/* Keep the SSE code that follows from paying for dirty YMM halves. */
+	_mm256_zeroupper();
+	return (ret);
+}
+
+/**
+ * @brief CPUID checks for the x86 kernels.
+ */
+static int has_avx2(void) { return (__builtin_cpu_supports("avx2")); }
+static int has_ssse3(void) { return (__builtin_cpu_supports("ssse3")); }
+
+#endif /* UTF8_X86 */
+
+/**
+ * @brief Validation kernel description.
+ */
+struct utf8_impl
+{
+	const char *name;    /**< Kernel name.              */
+	utf8_fn fn;          /**< Kernel routine.           */
+	int (*usable)(void); /**< Runtime check, if needed. */
+};
+
+/**
+ * @brief Available kernels, the best ones first.
+ */
+static const struct utf8_impl kernels[] = {
+#ifdef UTF8_X86
+	{"avx2",  utf8_avx2,  has_avx2},
+	{"ssse3", utf8_ssse3, has_ssse3},
+#endif
+	{"word",  utf8_word,  NULL}
+};
+
+/**
+ * @brief Kernel in use, NULL until the first validation.
+ */
+static const struct utf8_impl *kernel;
+
+/**
+ * @brief Picks the best kernel supported by the running CPU.
+ *
+ * @return Returns the kernel selected.
+ */
+static const struct utf8_impl *utf8_select(void)
+{
+	const struct utf8_impl *k;
+
+	k = __atomic_load_n(&kernel, __ATOMIC_ACQUIRE);
+	if (k)
+		return (k);
+
+#ifdef UTF8_X86
+	__builtin_cpu_init();
+#endif
+
+	/* The last one is always usable. */
+	for (k = kernels; k->usable && !k->usable(); k++)
+		;
+
+	/* Racing threads would pick the same kernel anyway. */
+	__atomic_store_n(&kernel, k, __ATOMIC_RELEASE);
+	return (k);
+}
+
+/**
+ * @brief Validates the @p len bytes of @p s as the continuation of
+ * a UTF-8 text that left the DFA in @p state, just like
+ * is_utf8_len_state(), but much faster.
+ *
+ * @param s Input bytes.
+ * @param len Amount of bytes.
+ * @param state DFA state left by the previous bytes, UTF8_ACCEPT
+ * for a brand new text.
+ *
+ * @return Returns the new DFA state: UTF8_ACCEPT if the text is
+ * valid so far, UTF8_REJECT if invalid, or any other state if it
+ * ends in the middle of a sequence.
+ */
+uint32_t utf8_validate_state(const uint8_t *s, size_t len, uint32_t state)
+{
+	size_t end; /* End of the SIMD part. */
+	size_t i;   /* Loop index.           */
+	size_t j;   /* Loop index.           */
+
+	/* Finish the sequence left open by the previous span. */
+	for (i = 0; i < len && state != UTF8_ACCEPT && state != UTF8_REJECT; i++)
+		state = is_utf8_len_state((uint8_t *)s + i, 1, state);
+
+	if (state != UTF8_ACCEPT)
+		return (state);
+
+	/*
+	 * Leave the last sequence, which may be incomplete, to the
+	 * DFA: a sequence has up to 3 continuation bytes.
+	 */
+	end = len;
+	for (j = len; j > i && len - j < 4; j--)
+	{
+		if ((s[j - 1] & 0xC0) != 0x80)
+		{
+			end = j - 1;
+			break;
+		}
+	}
+
+	if (end > i && !utf8_select()->fn(s + i, end - i))
+		return (UTF8_REJECT);
+
+	return (is_utf8_len_state((uint8_t *)s + end, len - end, UTF8_ACCEPT));
+}
+
+/**
+ * @brief Returns the name of the UTF-8 validation kernel in use,
+ * such as "avx2", "ssse3" or "word".
+ */
+const char *utf8_kernel(void)
+{
+	return (utf8_select()->name);
+}
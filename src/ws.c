@@ -15,6 +15,9 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>
  */
 #define _POSIX_C_SOURCE 200809L
+#ifdef __linux__
+#define _GNU_SOURCE /* CPU affinity of the accept shards. */
+#endif
 #include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
@@ -24,6 +27,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 #include <sys/time.h>
 
@@ -32,15 +36,37 @@
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <netdb.h>
+#include <poll.h>
+#include <sys/uio.h>
 #else
 #include <winsock2.h>
 #include <ws2tcpip.h>
 #include <windows.h>
 typedef int socklen_t;
+struct iovec
+{
+	void *iov_base;
+	size_t iov_len;
+};
 #endif
 /* clang-format on */
 
+/* Event loop (WS_IO_EPOLL) and accept4() are only available on Linux. */
+#ifdef __linux__
+#include <sys/epoll.h>
+#define WS_HAS_EPOLL
+#define WS_HAS_ACCEPT4
+#endif
+
+/* Accept shards steering (see ws_server.accept_steer). */
+#if defined(__linux__) && defined(SO_ATTACH_REUSEPORT_CBPF)
+#include <linux/filter.h>
+#include <sched.h>
+#define WS_HAS_STEER
+#endif
+
 /* Windows and macOS seems to not have MSG_NOSIGNAL */
 #ifndef MSG_NOSIGNAL
 #define MSG_NOSIGNAL 0
@@ -48,6 +74,11 @@ typedef int socklen_t;
 
 #include <unistd.h>
 
+#include <http.h>
+#include <mask.h>
+#include <pmd.h>
+#include <timer.h>
+#include <uring.h>
 #include <utf8.h>
 #include <ws.h>
 
@@ -60,59 +91,241 @@ typedef int socklen_t;
  */
 
 /**
- * @brief Client socks.
+ * @brief Amount of PINGs whose send time is kept (power of two): PONGs
+ * older than that do not count for the RTT.
+ */
+#define WS_PING_TS 4
+
+struct ws_conn_cold;
+struct ws_frame_data;
+struct ws_evloop;
+struct ws_instance;
+struct ws_part;
+struct ws_snd;
+struct ws_sub;
+
+/**
+ * @brief Client socks: only what every frame and broadcast needs,
+ * within two cache lines (on 64-bit Linux), so that scanning the
+ * clients table is cheap. Everything else is in its cold part.
  */
 struct ws_connection
 {
 	int client_sock; /**< Client socket FD.        */
 	int state;       /**< WebSocket current state. */
+	ws_cli_conn_t client_id;
 
-	/* wsServer structure copy. */
-	struct ws_server ws_srv;
-
-	/* Timeout thread and locks. */
-	pthread_mutex_t mtx_state;
-	pthread_cond_t cnd_state_close;
-	pthread_t thrd_tout;
-	bool close_thrd;
+	/* Server instance this client belongs to. */
+	struct ws_instance *srv;
 
 	/* Send lock. */
 	pthread_mutex_t mtx_snd;
 
-	/* IP address and port. */
-	char ip[1025]; /* NI_MAXHOST. */
-	char port[32]; /* NI_MAXSERV. */
+	/*
+	 * Send queue: data not sent yet, protected by the send lock (or
+	 * by the loop mutex on io_uring).
+	 */
+	struct ws_snd *snd_head;
+	struct ws_snd *snd_tail;
+	size_t snd_bytes; /* Bytes queued.                          */
+	bool snd_busy;    /* The queue head is being sent.          */
+	bool closing;     /* Being torn down, no more data accepted. */
+	bool snd_thrd;    /* Queue writer thread started.           */
+
+#ifdef WS_HAS_URING
+	bool recv_armed;        /* Multishot recv is alive (WS_IO_URING). */
+#endif
+#ifdef WS_HAS_EPOLL
+	/* Event loop state. */
+	uint32_t ep_events;     /* epoll events (WS_IO_EPOLL).    */
+	struct ws_evloop *loop; /* Owner event loop.              */
+#endif
+
+	/* Frame data, kept across events on event based I/O models. */
+	struct ws_frame_data *wfd;
+
+#ifdef WS_HAS_DEFLATE
+	/* permessage-deflate state, NULL if not negotiated. */
+	struct pmd *pmd;
+#endif
+
+	/* Cold part. */
+	struct ws_conn_cold *cold;
+};
+
+/**
+ * @brief Client socks, cold part: what is only needed to open and
+ * close a connection, for the heartbeat or on user request.
+ */
+struct ws_conn_cold
+{
+	/* Close time-out and state lock. */
+	pthread_mutex_t mtx_state;
+	struct timer tmr_close;
+	bool close_armed;
 
-	/* Ping/Pong IDs and locks. */
+	/* Queue writer thread (WS_IO_THREADS), started on demand. */
+	pthread_cond_t cnd_snd;
+	pthread_t thrd_snd;
+
+	/*
+	 * Peer address, as returned by accept(), and its IP address and
+	 * port as text, only formatted once asked for.
+	 */
+	union
+	{
+		struct sockaddr sa;
+		struct sockaddr_in in4;
+		struct sockaddr_in6 in6;
+	} peer;
+	socklen_t peer_len;
+	bool peer_fmt;  /* ip and port already formatted. */
+	char ip[64];    /* IPv6 plus scope, at most.      */
+	char port[8];
+
+	/* Ping/Pong IDs, RTT estimation and locks. */
 	int32_t last_pong_id;
 	int32_t current_ping_id;
+	uint64_t ping_ts[WS_PING_TS]; /* Send time of the last PINGs (us). */
+	uint32_t srtt;                /* Smoothed RTT (us), 0 if unknown.  */
+	uint32_t rttvar;              /* RTT variation (us).               */
 	pthread_mutex_t mtx_ping;
+	struct timer tmr_ping;        /* Heartbeat.                        */
 
 	/* Connection context */
 	void *connection_context;
 
-	ws_cli_conn_t client_id;
+#ifdef WS_HAS_DEFLATE
+	/* Compressed sends lock, also guards the pmd pointer. */
+	pthread_mutex_t mtx_pmd;
+#endif
+
+	/* Topics subscribed, protected by the topics lock. */
+	struct ws_sub *subs;
+	bool subs_closed; /* No more subscriptions accepted. */
+
+	/*
+	 * Clients table slot, slot generation (incremented each time the
+	 * slot is reused), next free slot (if free) and the partition
+	 * the slot belongs to.
+	 */
+	uint32_t slot;
+	uint32_t gen;
+	int32_t next_free;
+	struct ws_part *part;
+
+	/* Handshake request, only during onhandshake and onopen. */
+	struct ws_frame_data *hs_wfd;
 };
 
 static struct ws_connection *get_client_by_cid(ws_cli_conn_t cid);
 
 /**
- * @brief Clients list.
+ * @name Clients table.
+ *
+ * The connections live in fixed-size chunks, allocated on demand
+ * and never released, so that a connection never moves. Each chunk
+ * belongs to a partition (one per accept shard), that keeps its
+ * slots not in use in a free list of its own.
+ *
+ * A chunk is cache line aligned and holds only the hot part of its
+ * connections: their cold parts are allocated apart.
+ */
+/**@{*/
+#define WS_CHUNK_SHIFT 8
+#define WS_CHUNK_SIZE  (1 << WS_CHUNK_SHIFT)
+#define WS_MAX_CHUNKS  4096
+#define WS_CACHE_LINE  64
+
+static struct ws_connection *client_chunks[WS_MAX_CHUNKS];
+static uint32_t client_slots; /* Allocated slots. */
+static pthread_mutex_t tbl_mutex = PTHREAD_MUTEX_INITIALIZER;
+/**@}*/
+
+/**
+ * @brief Clients table partition.
+ */
+struct ws_part
+{
+	pthread_mutex_t mtx;     /**< Free list lock.  */
+	int32_t free;            /**< Free list head.  */
+	struct ws_instance *srv; /**< Owner instance.  */
+};
+
+/**
+ * @brief Accept shard: a listening socket, its accept loop and its
+ * partition of the clients table.
+ */
+struct ws_shard
+{
+	int sock;                /**< Listening socket.         */
+	int idx;                 /**< Shard index.              */
+	struct ws_part part;     /**< Clients table partition.  */
+	struct ws_instance *srv; /**< Server instance.          */
+	pthread_t thread;        /**< Accept thread.            */
+	uint32_t backoff_ms;     /**< Accept retry back-off.    */
+#ifdef WS_HAS_EPOLL
+	int next_loop;           /**< Next loop to be assigned. */
+#endif
+};
+
+/**
+ * @brief Server instance: everything owned by a single ws_init()
+ * call, so that servers on different ports share no state.
+ */
+struct ws_instance
+{
+	struct ws_server ws_srv;    /**< Server parameters.           */
+	pthread_mutex_t mtx;        /**< Clients (open/close) lock.   */
+	unsigned active_clients;    /**< Clients being served.        */
+	struct ws_shard *shards;    /**< Accept shards.               */
+	int nshards;                /**< Amount of accept shards.     */
+	uint32_t nchunks;           /**< Table chunks owned.          */
+	uint16_t chunks[WS_MAX_CHUNKS]; /**< Their indexes.           */
+	struct ws_instance *next;   /**< Next instance.               */
+#ifdef WS_HAS_EPOLL
+	struct ws_evloop *loops;    /**< Event loops.                 */
+	int nloops;                 /**< Amount of event loops.       */
+#endif
+};
+
+/**
+ * @brief Server instances, newest first. Instances are never
+ * released, so the list is only locked to add one.
+ */
+static struct ws_instance *instances;
+static pthread_mutex_t inst_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief Returns the client at the slot @p idx of the clients table.
+ */
+#define CLIENT_AT(idx) \
+	(&client_chunks[(idx) >> WS_CHUNK_SHIFT][(idx) & (WS_CHUNK_SIZE - 1)])
+
+/**
+ * @brief Returns the amount of allocated slots on the clients table.
  */
-static struct ws_connection client_socks[MAX_CLIENTS];
+#define CLIENT_SLOTS() __atomic_load_n(&client_slots, __ATOMIC_ACQUIRE)
 
 /**
- * @brief Timeout to a single send().
+ * @brief Returns the client at the (instance-relative) slot @p idx
+ * of the clients table part owned by the instance @p srv.
  */
-static uint32_t timeout;
+#define SRV_CLIENT_AT(srv, idx) \
+	CLIENT_AT(((uint32_t)(srv)->chunks[(idx) >> WS_CHUNK_SHIFT] \
+		<< WS_CHUNK_SHIFT) | ((idx) & (WS_CHUNK_SIZE - 1)))
+
+/**
+ * @brief Returns the amount of slots owned by the instance @p srv.
+ */
+#define SRV_SLOTS(srv) \
+	(__atomic_load_n(&(srv)->nchunks, __ATOMIC_ACQUIRE) << WS_CHUNK_SHIFT)
 
 /**
  * @brief Client validity macro
  */
-#define CLIENT_VALID(cli)                          \
-	((cli) != NULL && (cli) >= &client_socks[0] && \
-		(cli) <= &client_socks[MAX_CLIENTS - 1] && \
-		(cli)->client_sock > -1)
+#define CLIENT_VALID(cli) \
+	((cli) != NULL && (cli)->client_sock > -1)
 
 
 /**
@@ -124,7 +337,7 @@ void *ws_get_server_context(ws_cli_conn_t cli)
 	struct ws_connection *client = get_client_by_cid(cli);
 	if (!CLIENT_VALID(client))
 		return NULL;
-	return client->ws_srv.context;
+	return client->srv->ws_srv.context;
 }
 
 /**
@@ -135,7 +348,14 @@ void ws_set_connection_context(ws_cli_conn_t client, void *ptr)
 	struct ws_connection *cli = get_client_by_cid(client);
 	if (!CLIENT_VALID(cli))
 		return;
-	cli->connection_context = ptr;
+
+	/* The slot may have been reused since the lookup. */
+	/* clang-format off */
+	pthread_mutex_lock(&cli->cold->mtx_state);
+		if (__atomic_load_n(&cli->client_id, __ATOMIC_ACQUIRE) == client)
+			cli->cold->connection_context = ptr;
+	pthread_mutex_unlock(&cli->cold->mtx_state);
+	/* clang-format on */
 }
 
 /**
@@ -144,11 +364,53 @@ void ws_set_connection_context(ws_cli_conn_t client, void *ptr)
 void *ws_get_connection_context(ws_cli_conn_t client)
 {
 	struct ws_connection *cli = get_client_by_cid(client);
+	void *ptr;
+
 	if (!CLIENT_VALID(cli))
 		return NULL;
-	return cli->connection_context;
+
+	/* clang-format off */
+	pthread_mutex_lock(&cli->cold->mtx_state);
+		ptr = NULL;
+		if (__atomic_load_n(&cli->client_id, __ATOMIC_ACQUIRE) == client)
+			ptr = cli->cold->connection_context;
+	pthread_mutex_unlock(&cli->cold->mtx_state);
+	/* clang-format on */
+
+	return (ptr);
 }
 
+/**
+ * Frame state data
+ *
+ * This structure holds the current data for handling the
+ * received frames.
+ */
+struct frame_state_data
+{
+	unsigned char *msg_data; /* Data frame.                */
+	unsigned char *msg_ctrl; /* Control frame.             */
+	uint8_t masks_data[4];   /* Masks data frame array.    */
+	uint8_t masks_ctrl[4];   /* Masks control frame array. */
+	uint64_t msg_idx_data;   /* Current msg index.         */
+	uint64_t msg_idx_ctrl;   /* Current msg index.         */
+	uint64_t frame_length;   /* Frame length.              */
+	uint64_t frame_size;     /* Current frame size.        */
+#ifdef VALIDATE_UTF8
+	uint32_t utf8_state;     /* Current UTF-8 state.       */
+#endif
+	int32_t pong_id;         /* Current PONG id.           */
+	uint8_t opcode;          /* Frame opcode.              */
+	uint8_t is_fin;          /* Is FIN frame flag.         */
+	uint8_t mask;            /* Mask.                      */
+	uint8_t compressed;      /* Compressed message (RSV1). */
+	uint8_t stream;          /* Streamed message.          */
+	uint8_t stream_sent;     /* A chunk was delivered.     */
+	uint64_t stream_left;    /* Frame payload left.        */
+	uint64_t stream_off;     /* Frame payload delivered.   */
+	int cur_byte;            /* Current frame byte.        */
+};
+
 /**
  * @brief WebSocket frame data
  */
@@ -157,7 +419,11 @@ struct ws_frame_data
 	/**
 	 * @brief Frame read.
 	 */
-	unsigned char frm[MESSAGE_LENGTH];
+	unsigned char *frm;
+	/**
+	 * @brief Frame read buffer size.
+	 */
+	size_t frm_size;
 	/**
 	 * @brief Processed message at the moment.
 	 */
@@ -186,17 +452,20 @@ struct ws_frame_data
 	 * @brief Error flag, set when a read was not possible.
 	 */
 	int error;
+	/**
+	 * @brief Frame state of the message being received.
+	 */
+	struct frame_state_data fsd;
+	/**
+	 * @brief Handshake request, parsed as it arrives.
+	 */
+	struct http_req hs;
 	/**
 	 * @brief Client connection structure.
 	 */
 	struct ws_connection *client;
 };
 
-/**
- * @brief Global mutex.
- */
-static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
-
 /**
  * @brief Issues an error message and aborts the program.
  *
@@ -209,1657 +478,5785 @@ static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 		exit(-1);  \
 	} while (0);
 
-static struct ws_connection *get_client_by_cid(ws_cli_conn_t cid)
-{
-	pthread_mutex_lock(&mutex);
-	for (int i = 0; i < MAX_CLIENTS; i++)
-	{
-		if (client_socks[i].client_id == cid)
-		{
-			pthread_mutex_unlock(&mutex);
-			return &client_socks[i];
-		}
-	}
-	pthread_mutex_unlock(&mutex);
-	return NULL;
-}
 /**
- * @brief Shutdown and close a given socket.
+ * @brief Given a client id @p cid, returns its client connection.
  *
- * @param fd Socket file descriptor to be closed.
+ * A client id holds the client slot (lower 32-bits) and the slot
+ * generation (upper 32-bits), so the lookup is constant-time and
+ * lock-free, and ids of clients that are gone (whose slots were
+ * reused) are refused.
+ *
+ * @param cid Client id.
+ *
+ * @return Returns the client connection, or NULL if @p cid is
+ * not valid.
  *
  * @attention This is part of the internal API and is documented just
  * for completeness.
  */
-static void close_socket(int fd)
+static struct ws_connection *get_client_by_cid(ws_cli_conn_t cid)
 {
-#ifndef _WIN32
-	shutdown(fd, SHUT_RDWR);
-	close(fd);
-#else
-	closesocket(fd);
-#endif
-}
-
-
-static uint64_t cid_generator = 1;
+	struct ws_connection *cli;
+	uint32_t slot;
 
-static pthread_mutex_t cid_mutex = PTHREAD_MUTEX_INITIALIZER;
-
-static uint64_t get_next_cid()
-{
-	uint64_t next_cid;
+	slot = (uint32_t)cid;
+	if (slot >= CLIENT_SLOTS())
+		return (NULL);
 
-	pthread_mutex_lock(&cid_mutex);
-	next_cid = cid_generator++;
-	pthread_mutex_unlock(&cid_mutex);
+	cli = CLIENT_AT(slot);
+	if (__atomic_load_n(&cli->client_id, __ATOMIC_ACQUIRE) != cid)
+		return (NULL);
 
-	return next_cid;
+	return (cli);
 }
 
 /**
- * @brief Returns the current client state for a given
- * client @p client.
+ * @brief Initializes the locks of the client slot @p cli.
  *
- * @param client Client structure.
+ * Slots are never released, so their locks are initialized only
+ * once, when the slot is allocated, and never destroyed: a thread
+ * that looked the client up right before it was closed may still
+ * take them.
  *
- * @return Returns the client state, -1 otherwise.
+ * @param cli Client slot.
  *
  * @attention This is part of the internal API and is documented just
  * for completeness.
  */
-static int get_client_state(struct ws_connection *client)
+static void client_sync_init(struct ws_connection *cli)
 {
-	int state;
-
-	if (!CLIENT_VALID(client))
-		return (-1);
-
-	pthread_mutex_lock(&client->mtx_state);
-	state = client->state;
-	pthread_mutex_unlock(&client->mtx_state);
-	return (state);
+	if (pthread_mutex_init(&cli->cold->mtx_state, NULL))
+		panic("Error on allocating close mutex");
+	if (pthread_mutex_init(&cli->mtx_snd, NULL))
+		panic("Error on allocating send mutex");
+	if (pthread_cond_init(&cli->cold->cnd_snd, NULL))
+		panic("Error on allocating send condition var\n");
+	if (pthread_mutex_init(&cli->cold->mtx_ping, NULL))
+		panic("Error on allocating ping/pong mutex");
+#ifdef WS_HAS_DEFLATE
+	if (pthread_mutex_init(&cli->cold->mtx_pmd, NULL))
+		panic("Error on allocating deflate mutex");
+#endif
 }
 
 /**
- * @brief Set a state @p state to the client index
- * @p client.
+ * @brief Grows the clients table by one chunk, whose slots are
+ * given to the partition @p part.
  *
- * @param client Client structure.
- * @param state State to be set.
+ * @param part Clients table partition.
  *
- * @return Returns 0 if success, -1 otherwise.
+ * @note Must be called with the partition mutex held.
  *
  * @attention This is part of the internal API and is documented just
  * for completeness.
  */
-static int set_client_state(struct ws_connection *client, int state)
+static void client_grow(struct ws_part *part)
 {
-	if (!CLIENT_VALID(client))
-		return (-1);
+	struct ws_connection *chunk;
+	struct ws_conn_cold *cold;
+	struct ws_instance *srv;
+	uint32_t base;
+	void *raw;
+	int i;
 
-	if (state < 0 || state > 3)
-		return (-1);
+	if (CLIENT_SLOTS() >> WS_CHUNK_SHIFT >= WS_MAX_CHUNKS)
+		return;
 
-	pthread_mutex_lock(&client->mtx_state);
-	client->state = state;
-	pthread_mutex_unlock(&client->mtx_state);
-	return (0);
+	raw  = calloc(1, WS_CHUNK_SIZE * sizeof(*chunk) + WS_CACHE_LINE - 1);
+	cold = calloc(WS_CHUNK_SIZE, sizeof(*cold));
+	if (!raw || !cold)
+		goto out;
+
+	chunk = (struct ws_connection *)(((uintptr_t)raw + WS_CACHE_LINE - 1) &
+		~(uintptr_t)(WS_CACHE_LINE - 1));
+
+	/* clang-format off */
+	pthread_mutex_lock(&tbl_mutex);
+		base = client_slots;
+		if (base >> WS_CHUNK_SHIFT < WS_MAX_CHUNKS)
+		{
+			for (i = 0; i < WS_CHUNK_SIZE; i++)
+			{
+				chunk[i].client_sock = -1;
+				chunk[i].cold        = &cold[i];
+				cold[i].slot         = base + i;
+				cold[i].part         = part;
+				cold[i].next_free    = (i < WS_CHUNK_SIZE - 1) ?
+					(int32_t)(base + i + 1) : part->free;
+				client_sync_init(&chunk[i]);
+			}
+
+			/* Publish the chunk only after initializing it. */
+			client_chunks[base >> WS_CHUNK_SHIFT] = chunk;
+			__atomic_store_n(&client_slots, base + WS_CHUNK_SIZE,
+				__ATOMIC_RELEASE);
+
+			/* The owner instance scans it on its broadcasts. */
+			srv = part->srv;
+			srv->chunks[srv->nchunks] = (uint16_t)(base >> WS_CHUNK_SHIFT);
+			__atomic_store_n(&srv->nchunks, srv->nchunks + 1,
+				__ATOMIC_RELEASE);
+
+			part->free = (int32_t)base;
+			raw        = NULL;
+			cold       = NULL;
+		}
+	pthread_mutex_unlock(&tbl_mutex);
+	/* clang-format on */
+
+	/* Table full. */
+out:
+	free(raw);
+	free(cold);
 }
 
 /**
- * @brief Send a given message @p buf on a socket @p sockfd.
+ * @brief Gets a free slot from the partition @p part of the clients
+ * table, growing it if necessary.
  *
- * @param client Target client.
- * @param buf Message to be sent.
- * @param len Message length.
- * @param flags Send flags.
+ * @param part Clients table partition.
  *
- * @return If success (i.e: all message was sent), returns
- * the amount of bytes sent. Otherwise, -1.
+ * @return Returns a free client, or NULL if there is none.
  *
- * @note Technically this shouldn't be necessary, since send() should
- * block until all content is sent, since _we_ don't use 'O_NONBLOCK'.
- * However, it was reported (issue #22 on GitHub) that this was
- * happening, so just to be cautious, I will keep using this routine.
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
  */
-static ssize_t send_all(
-	struct ws_connection *client, const void *buf, size_t len, int flags)
+static struct ws_connection *client_alloc(struct ws_part *part)
 {
-	const char *p;
-	ssize_t ret;
-	ssize_t r;
+	struct ws_connection *cli = NULL;
 
-	ret = 0;
-
-	/* Sanity check. */
-	if (!CLIENT_VALID(client))
-		return (-1);
-
-	p = buf;
 	/* clang-format off */
-	pthread_mutex_lock(&client->mtx_snd);
-		while (len)
+	pthread_mutex_lock(&part->mtx);
+		if (part->free < 0)
+			client_grow(part);
+
+		if (part->free >= 0)
 		{
-			r = send(client->client_sock, p, len, flags);
-			if (r == -1)
-			{
-				pthread_mutex_unlock(&client->mtx_snd);
-				return (-1);
-			}
-			p   += r;
-			len -= r;
-			ret += r;
+			cli        = CLIENT_AT((uint32_t)part->free);
+			part->free = cli->cold->next_free;
+
+			/* Generation 0 is never used, so a client id is never 0. */
+			if (++cli->cold->gen == 0)
+				cli->cold->gen = 1;
 		}
-	pthread_mutex_unlock(&client->mtx_snd);
+	pthread_mutex_unlock(&part->mtx);
 	/* clang-format on */
-	return (ret);
+	return (cli);
 }
 
 /**
- * @brief Close client connection (no close handshake, this should
- * be done earlier), set appropriate state and destroy mutexes.
+ * @brief Gives the slot of a (no longer used) client @p cli back
+ * to its partition of the clients table.
  *
- * @param client Client connection.
- * @param lock Should lock the global mutex?.
+ * @param cli Client connection.
  *
  * @attention This is part of the internal API and is documented just
  * for completeness.
  */
-static void close_client(struct ws_connection *client, int lock)
+static void client_release(struct ws_connection *cli)
 {
-	if (!CLIENT_VALID(client))
-		return;
-
-	set_client_state(client, WS_STATE_CLOSED);
-
-	close_socket(client->client_sock);
+	struct ws_part *part = cli->cold->part;
 
-	/* Destroy client mutexes and clear fd 'slot'. */
 	/* clang-format off */
-	if (lock)
-		pthread_mutex_lock(&mutex);
-			client->client_sock = -1;
-			pthread_cond_destroy(&client->cnd_state_close);
-			pthread_mutex_destroy(&client->mtx_state);
-			pthread_mutex_destroy(&client->mtx_snd);
-			pthread_mutex_destroy(&client->mtx_ping);
-	if (lock)
-		pthread_mutex_unlock(&mutex);
+	pthread_mutex_lock(&part->mtx);
+		cli->cold->next_free = part->free;
+		part->free           = (int32_t)cli->cold->slot;
+	pthread_mutex_unlock(&part->mtx);
 	/* clang-format on */
 }
-
 /**
- * @brief Close time-out thread.
- *
- * For a given client, this routine sleeps until
- * TIMEOUT_MS and closes the connection or returns
- * sooner if already closed connection.
- *
- * @param p ws_connection/ws_cli_conn_t Structure Pointer.
+ * @brief Shutdown and close a given socket.
  *
- * @return Always NULL.
+ * @param fd Socket file descriptor to be closed.
  *
  * @attention This is part of the internal API and is documented just
  * for completeness.
  */
-static void *close_timeout(void *p)
+static void close_socket(int fd)
 {
-	struct ws_connection *conn = p;
-	struct timespec ts;
-	int state;
-
-	pthread_mutex_lock(&conn->mtx_state);
-
-	clock_gettime(CLOCK_REALTIME, &ts);
-	ts.tv_nsec += MS_TO_NS(TIMEOUT_MS);
-
-	/* Normalize the time. */
-	while (ts.tv_nsec >= 1000000000)
-	{
-		ts.tv_sec++;
-		ts.tv_nsec -= 1000000000;
-	}
-
-	while (conn->state != WS_STATE_CLOSED &&
-		   pthread_cond_timedwait(&conn->cnd_state_close, &conn->mtx_state, &ts) !=
-			   ETIMEDOUT)
-		;
-
-	state = conn->state;
-	pthread_mutex_unlock(&conn->mtx_state);
-
-	/* If already closed. */
-	if (state == WS_STATE_CLOSED)
-		goto quit;
-
-	DEBUG("Timer expired, closing client %d\n", conn->client_sock);
-
-	close_client(conn, 1);
-quit:
-	return (NULL);
+#ifndef _WIN32
+	shutdown(fd, SHUT_RDWR);
+	close(fd);
+#else
+	closesocket(fd);
+#endif
 }
 
 /**
- * @brief For a valid client index @p client, starts
- * the timeout thread and set the current state
- * to 'CLOSING'.
+ * @brief Shutdown a given socket, without closing it.
  *
- * @param client Client connection.
+ * The thread (or event loop) that owns the connection then wakes
+ * up with an EOF and releases it: this is the only safe way to
+ * abort a connection from other threads.
  *
- * @return Returns 0 if success, -1 otherwise.
+ * @param fd Socket file descriptor to be shut down.
  *
  * @attention This is part of the internal API and is documented just
  * for completeness.
  */
-static int start_close_timeout(struct ws_connection *client)
+static void shutdown_socket(int fd)
 {
-	if (!CLIENT_VALID(client))
-		return (-1);
-
-	pthread_mutex_lock(&client->mtx_state);
-
-	if (client->state != WS_STATE_OPEN)
-		goto out;
-
-	client->state = WS_STATE_CLOSING;
-
-	if (pthread_create(&client->thrd_tout, NULL, close_timeout, client))
-	{
-		pthread_mutex_unlock(&client->mtx_state);
-		panic("Unable to create timeout thread\n");
-	}
-	client->close_thrd = true;
-out:
-	pthread_mutex_unlock(&client->mtx_state);
-	return (0);
-}
-
-/**
- * @brief Sets the IP address relative to a client connection opened
- * by the server and save inside the client structure.
- *
- * @param client Client connection.
- */
-static void set_client_address(struct ws_connection *client)
-{
-	struct sockaddr_storage addr;
-	socklen_t hlen = sizeof(addr);
-
-	if (!CLIENT_VALID(client))
-		return;
-
-	memset(client->ip,   0, sizeof(client->ip));
-	memset(client->port, 0, sizeof(client->port));
-
-	if (getpeername(client->client_sock, (struct sockaddr *)&addr, &hlen) < 0)
-		return;
-
-	getnameinfo((struct sockaddr *)&addr, hlen,
-		client->ip,   sizeof(client->ip),
-		client->port, sizeof(client->port),
-		NI_NUMERICHOST|NI_NUMERICSERV);
+#ifndef _WIN32
+	shutdown(fd, SHUT_RDWR);
+#else
+	shutdown(fd, SD_BOTH);
+#endif
 }
 
 /**
- * @brief Gets the IP address relative to a client connection opened
- * by the server.
+ * @brief Assigns a new client id to a freshly allocated client
+ * @p cli, accordingly with its slot and generation.
  *
- * @param client Client connection.
+ * The connection context of the previous client of the slot is
+ * cleared along, under the state lock: a thread that looked that
+ * client up can no longer set it on the new one.
  *
- * @return Pointer the ip address, or NULL if fails.
+ * @param cli Client connection.
  *
- * @note The returned string is static, no need to free up memory.
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
  */
-char *ws_getaddress(ws_cli_conn_t client)
+static void set_client_id(struct ws_connection *cli)
 {
-	struct ws_connection *cli = get_client_by_cid(client);
-	if (!CLIENT_VALID(cli))
-		return (NULL);
-
-	return (cli->ip);
+	/* clang-format off */
+	pthread_mutex_lock(&cli->cold->mtx_state);
+		cli->cold->connection_context = NULL;
+		__atomic_store_n(&cli->client_id,
+			((uint64_t)cli->cold->gen << 32) | cli->cold->slot,
+			__ATOMIC_RELEASE);
+	pthread_mutex_unlock(&cli->cold->mtx_state);
+	/* clang-format on */
 }
 
 /**
- * @brief Gets the IP port relative to a client connection opened
- * by the server.
+ * @brief Returns the current client state for a given
+ * client @p client.
  *
- * @param client Client connection.
+ * @param client Client structure.
  *
- * @return Pointer the port, or NULL if fails.
+ * @return Returns the client state, -1 otherwise.
  *
- * @note The returned string is static, no need to free up memory.
+ * @note The state is only changed with the state lock held, but
+ * read without it: broadcasts check the state of every client.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
  */
-char *ws_getport(ws_cli_conn_t client)
+static int get_client_state(struct ws_connection *client)
 {
-	struct ws_connection *cli = get_client_by_cid(client);
-	if (!CLIENT_VALID(cli))
-		return (NULL);
+	if (!CLIENT_VALID(client))
+		return (-1);
 
-	return (cli->port);
+	return (__atomic_load_n(&client->state, __ATOMIC_ACQUIRE));
 }
 
 /**
- * @brief Creates and send an WebSocket frame with some payload data.
- *
- * This routine is intended to be used to create a websocket frame for
- * a given type e sending to the client. For higher level routines,
- * please check @ref ws_sendframe_txt and @ref ws_sendframe_bin.
- *
- * @param client Target to be send. If NULL, broadcast the message.
- * @param msg    Message to be send.
- * @param size   Binary message size.
- * @param type   Frame type.
- * @param port   Server listen port to broadcast message (if any).
+ * @brief Set a state @p state to the client index
+ * @p client.
  *
- * @return Returns the number of bytes written, -1 if error.
+ * @param client Client structure.
+ * @param state State to be set.
  *
- * @note If @p size is -1, it is assumed that a text frame is being sent,
- * otherwise, a binary frame. In the later case, the @p size is used.
+ * @return Returns 0 if success, -1 otherwise.
  *
  * @attention This is part of the internal API and is documented just
  * for completeness.
  */
-static int ws_sendframe_internal(struct ws_connection *client, const char *msg,
-	uint64_t size, int type, uint16_t port)
+static int set_client_state(struct ws_connection *client, int state)
 {
-	unsigned char *response;   /* Response data.     */
-	unsigned char frame[10];   /* Frame.             */
-	uint8_t idx_first_rData;   /* Index data.        */
-	struct ws_connection *cli; /* Client.            */
-	int idx_response;          /* Index response.    */
-	ssize_t send_ret;          /* Ret send function  */
-	uint64_t length;           /* Message length.    */
-	ssize_t output;            /* Bytes sent.        */
-	uint64_t i;                /* Loop index.        */
-
-	/*
-	 * Check if there is a valid condition before proceeding.
-	 *
-	 * Valid ones:
-	 * client == true  && port == 0
-	 *     -> send to single client
-	 *
-	 * client == false && port != 0
-	 *      -> send to all clients within single port
-	 *
-	 * Other options are invalid!
-	 */
-
-	if (client)
-	{
-		if (port != 0)
-			return (-1);
-	}
-	else
-	{
-		if (port == 0)
-			return (-1);
-	}
-
-	frame[0] = (WS_FIN | type);
-	length = (uint64_t)size;
-
-	/* Split the size between octets. */
-	if (length <= 125)
-	{
-		frame[1] = length & 0x7F;
-		idx_first_rData = 2;
-	}
-
-	/* Size between 126 and 65535 bytes. */
-	else if (length >= 126 && length <= 65535)
-	{
-		frame[1] = 126;
-		frame[2] = (length >> 8) & 255;
-		frame[3] = length & 255;
-		idx_first_rData = 4;
-	}
-
-	/* More than 65535 bytes. */
-	else
-	{
-		frame[1] = 127;
-		frame[2] = (unsigned char)((length >> 56) & 255);
-		frame[3] = (unsigned char)((length >> 48) & 255);
-		frame[4] = (unsigned char)((length >> 40) & 255);
-		frame[5] = (unsigned char)((length >> 32) & 255);
-		frame[6] = (unsigned char)((length >> 24) & 255);
-		frame[7] = (unsigned char)((length >> 16) & 255);
-		frame[8] = (unsigned char)((length >> 8) & 255);
-		frame[9] = (unsigned char)(length & 255);
-		idx_first_rData = 10;
-	}
-
-	/* Add frame bytes. */
-	idx_response = 0;
-	response = malloc(sizeof(unsigned char) * (idx_first_rData + length + 1));
-	if (!response)
+	if (!CLIENT_VALID(client))
 		return (-1);
 
-	for (i = 0; i < idx_first_rData; i++)
-	{
-		response[i] = frame[i];
-		idx_response++;
-	}
+	if (state < 0 || state > 3)
+		return (-1);
 
-	/* Add data bytes. */
-	for (i = 0; i < length; i++)
-	{
-		response[idx_response] = msg[i];
-		idx_response++;
-	}
+	pthread_mutex_lock(&client->cold->mtx_state);
+	__atomic_store_n(&client->state, state, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&client->cold->mtx_state);
+	return (0);
+}
 
-	response[idx_response] = '\0';
+/**
+ * @brief Encoded frame (header and payload), or any other data, to
+ * be sent to one or more clients: shared by their send queues and
+ * released by the last one.
+ */
+struct ws_frame
+{
+	unsigned refs;        /**< References.                  */
+	size_t len;           /**< Data length.                 */
+	bool ctrl;            /**< Control data, never dropped. */
+	unsigned char data[]; /**< Data.                        */
+};
 
-	/* Send to the client if there is one. */
-	output = 0;
-	if (client && port == 0)
-	{
-		output = SEND(client, response, idx_response);
-		goto skip_broadcast;
-	}
+/**
+ * @brief Send queue entry.
+ */
+struct ws_snd
+{
+	struct ws_snd *next;  /**< Next in queue.               */
+	struct ws_frame *buf; /**< Data to be sent.             */
+	size_t off;           /**< Amount of data already sent. */
+	bool ctrl;            /**< Control data, never dropped. */
+};
 
-	/* clang-format off */
-	pthread_mutex_lock(&mutex);
-		/* Do broadcast. */
-		for (i = 0; i < MAX_CLIENTS; i++)
-		{
-			cli = &client_socks[i];
+/**
+ * @brief Send request: data to be sent to one or more clients.
+ */
+struct ws_sndreq
+{
+	struct iovec iov[2];   /**< Data buffers.                     */
+	int iovcnt;            /**< Amount of buffers.                */
+	size_t len;            /**< Data length.                      */
+	bool ctrl;             /**< Control data, never dropped.      */
+	struct ws_frame *buf;  /**< Data copy, made once if needed.   */
+	const char *msg;       /**< Payload, if it can be compressed. */
+	uint64_t msg_len;      /**< Payload length.                   */
+	int type;              /**< Frame type.                       */
+	bool shared;           /**< Sent to many clients.             */
+	struct ws_frame *zbuf; /**< Compressed once, if shared.       */
+	int zbits;             /**< zbuf window, -1 if not worth it.  */
+	ws_cli_conn_t cid;     /**< Recipient id, 0 if not checked.   */
+};
 
-			if ((cli->client_sock > -1) &&
-				get_client_state(cli) == WS_STATE_OPEN &&
-				(cli->ws_srv.port == port))
-			{
-				if ((send_ret = SEND(cli, response, idx_response)) != -1)
-					output += send_ret;
-				else
-				{
-					output = -1;
-					break;
-				}
-			}
-		}
-	pthread_mutex_unlock(&mutex);
-	/* clang-format on */
+static uint8_t frame_header(unsigned char *frame, uint64_t length, int type);
+#ifdef WS_HAS_EPOLL
+static void evloop_update(struct ws_connection *client);
+#endif
+#ifdef WS_HAS_URING
+static ssize_t uring_send(struct ws_connection *client,
+	struct ws_sndreq *req);
+#endif
 
-skip_broadcast:
-	free(response);
-	return ((int)output);
+/**
+ * @brief Initializes an empty send request @p req.
+ *
+ * @param req Send request.
+ * @param ctrl Control data (never dropped by the send queues) or not.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static void sndreq_init(struct ws_sndreq *req, bool ctrl)
+{
+	req->iovcnt = 0;
+	req->len    = 0;
+	req->ctrl   = ctrl;
+	req->buf    = NULL;
+	req->msg    = NULL;
+	req->shared = false;
+	req->zbuf   = NULL;
+	req->zbits  = 0;
+	req->cid    = 0;
 }
 
 /**
- * @brief Send an WebSocket frame with some payload data.
+ * @brief Checks if the send request @p req was meant to a previous
+ * client of the slot of @p client: the client it was looked up for
+ * closed meanwhile, and the slot might have been reused.
  *
- * @param client Target to be send. If NULL, broadcast the message.
- * @param msg    Message to be send.
- * @param size   Binary message size.
- * @param type   Frame type.
+ * @param client Client connection.
+ * @param req Send request.
  *
- * @return Returns the number of bytes written, -1 if error.
+ * @return Returns true if the request is stale, false otherwise.
  *
- * @note If @p size is -1, it is assumed that a text frame is being sent,
- * otherwise, a binary frame. In the later case, the @p size is used.
+ * @note Must be called with the queue (or compression) lock held:
+ * close_client() invalidates the client id before taking them.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
  */
-int ws_sendframe(ws_cli_conn_t client, const char *msg, uint64_t size, int type)
+static bool sndreq_stale(struct ws_connection *client,
+	const struct ws_sndreq *req)
 {
-	struct ws_connection *cli = get_client_by_cid(client);
-	if (!CLIENT_VALID(cli))
-		return (-1);
-	return ws_sendframe_internal(cli, msg, size, type, 0);
+	return (req->cid &&
+		__atomic_load_n(&client->client_id, __ATOMIC_ACQUIRE) != req->cid);
 }
 
 /**
- * @brief Send an WebSocket frame with some payload data to all clients
- * connected into the same port.
+ * @brief Appends @p len bytes of @p data to the send request @p req.
  *
- * @param port   Server listen port to broadcast message.
- * @param msg    Message to be send.
- * @param size   Binary message size.
- * @param type   Frame type.
+ * The data is not copied: it must be kept alive until the request
+ * is done.
  *
- * @return Returns the number of bytes written, -1 if error.
+ * @param req Send request.
+ * @param data Data to be appended.
+ * @param len Data length.
  *
- * @note If @p size is -1, it is assumed that a text frame is being sent,
- * otherwise, a binary frame. In the later case, the @p size is used.
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
  */
-int ws_sendframe_bcast(uint16_t port, const char *msg, uint64_t size, int type)
+static void sndreq_add(struct ws_sndreq *req, const void *data, size_t len)
 {
-	return ws_sendframe_internal(NULL, msg, size, type, port);
+	req->iov[req->iovcnt].iov_base = (void *)data;
+	req->iov[req->iovcnt].iov_len  = len;
+	req->iovcnt++;
+	req->len += len;
 }
 
 /**
- * @brief Given a PONG message, decodes the content
- * as a int32_t number that corresponds to our
- * PONG id.
+ * @brief Initializes a send request @p req with a whole message:
+ * header (encoded into @p frame) and payload (@p msg, not copied).
  *
- * @param msg Content to be decoded.
+ * Data messages are kept as such, so that they can be compressed
+ * for the clients that negotiated permessage-deflate.
  *
- * @return Returns the PONG id.
+ * @param req Send request.
+ * @param frame Header buffer, at least 10 bytes long.
+ * @param msg Message.
+ * @param size Message size.
+ * @param type Frame type.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
  */
-static inline int32_t pong_msg_to_int32(uint8_t *msg)
+static void sndreq_msg(struct ws_sndreq *req, unsigned char *frame,
+	const char *msg, uint64_t size, int type)
 {
-	int32_t pong_id;
-	/* Decodes as big-endian. */
-	pong_id = (msg[3] << 0) | (msg[2] << 8) | (msg[1] << 16) | (msg[0] << 24);
-	return (pong_id);
+	/* Control frames (CLOSE, PING and PONG) are never dropped. */
+	sndreq_init(req, type >= WS_FR_OP_CLSE);
+	sndreq_add(req, frame, frame_header(frame, size, type));
+	sndreq_add(req, msg, (size_t)size);
+
+	if (type == WS_FR_OP_TXT || type == WS_FR_OP_BIN)
+	{
+		req->msg     = msg;
+		req->msg_len = size;
+		req->type    = type;
+	}
 }
 
 /**
- * @brief Given a PING id, encodes the content to be sent
- * as payload of a PING frame.
+ * @brief Drops a reference to the shared data @p buf, releasing
+ * it if that was the last one.
  *
- * @param ping_id PING id to be encoded.
- * @param msg Target buffer.
+ * @param buf Shared data, may be NULL.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
  */
-static inline void int32_to_ping_msg(int32_t ping_id, uint8_t *msg)
+static void frame_release(struct ws_frame *buf)
 {
-	/* Encodes as big-endian. */
-	msg[0] = (ping_id >> 24);
-	msg[1] = (ping_id >> 16);
-	msg[2] = (ping_id >>  8);
-	msg[3] = (ping_id >>  0);
+	if (buf && !__atomic_sub_fetch(&buf->refs, 1, __ATOMIC_ACQ_REL))
+		free(buf);
 }
 
 /**
- * @brief Send a ping message and close if the client surpasses
- * the threshold imposed.
+ * @brief Returns a new reference to a copy of the data of the send
+ * request @p req.
  *
- * @param cli Client to be sent.
- * @param threshold How many pings can miss?.
- * @param lock Should lock global mutex or not?.
+ * The data is only copied on the first call: every client a request
+ * is queued to shares the same copy.
+ *
+ * @param req Send request.
+ *
+ * @return Returns the shared data, or NULL if out of memory.
  *
  * @attention This is part of the internal API and is documented just
  * for completeness.
  */
-static void send_ping_close(struct ws_connection *cli, int threshold, int lock)
+static struct ws_frame *sndreq_buf(struct ws_sndreq *req)
 {
-	uint8_t ping_msg[4];
+	struct ws_frame *buf;
+	size_t len;
+	int i;
 
-	if (!CLIENT_VALID(cli) || get_client_state(cli) != WS_STATE_OPEN)
-		return;
+	if (!req->buf)
+	{
+		buf = malloc(sizeof(*buf) + req->len);
+		if (!buf)
+			return (NULL);
+
+		for (len = 0, i = 0; i < req->iovcnt; len += req->iov[i].iov_len, i++)
+			if (req->iov[i].iov_len)
+				memcpy(buf->data + len, req->iov[i].iov_base, req->iov[i].iov_len);
+
+		/* The request itself holds the first reference. */
+		buf->len  = len;
+		buf->ctrl = req->ctrl;
+		buf->refs = 1;
+		req->buf  = buf;
+	}
 
-	/* clang-format off */
-	pthread_mutex_lock(&cli->mtx_ping);
+	__atomic_add_fetch(&req->buf->refs, 1, __ATOMIC_RELAXED);
+	return (req->buf);
+}
 
-		cli->current_ping_id++;
-		int32_to_ping_msg(cli->current_ping_id, ping_msg);
-
-		/* Send PING. */
-		ws_sendframe_internal(cli, (const char*)ping_msg, sizeof(ping_msg),
-			WS_FR_OP_PING, 0);
-
-		/* Check previous PONG: if greater than threshold, abort. */
-		if ((cli->current_ping_id - cli->last_pong_id) > threshold) {
-			DEBUG("Closing, reason: many unanswered PINGs\n");
-			close_client(cli, lock);
-		}
+/**
+ * @brief Initializes a send request @p req with an already encoded
+ * @p frame, which is shared (never copied) by every client the
+ * request is queued to.
+ *
+ * @param req Send request.
+ * @param frame Encoded frame.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static void sndreq_frame(struct ws_sndreq *req, struct ws_frame *frame)
+{
+	sndreq_init(req, frame->ctrl);
+	sndreq_add(req, frame->data, frame->len);
 
-	pthread_mutex_unlock(&cli->mtx_ping);
-	/* clang-format on */
+	/* Released by sndreq_done(). */
+	__atomic_add_fetch(&frame->refs, 1, __ATOMIC_RELAXED);
+	req->buf = frame;
 }
 
 /**
- * @brief Sends a PING frame to the client @p cli with threshold
- * @p threshold.
+ * @brief Releases the resources of a send request @p req that
+ * is done.
  *
- * This routine sends a PING to a single client pointed to by
- * @p cli or a broadcast PING if @p cli is NULL. If the specified
- * client does not respond up to @p threshold PINGs, the connection
- * is aborted.
+ * @param req Send request.
  *
- * ws_ping() is not automatic: the user who wants to send keep-alive
- * PINGs *must* call this routine in a timely manner, whether on
- * a different thread or inside an event.
- *
- * See examples/ping/ping.c for a minimal example usage.
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static void sndreq_done(struct ws_sndreq *req)
+{
+	frame_release(req->buf);
+	frame_release(req->zbuf);
+	req->buf  = NULL;
+	req->zbuf = NULL;
+}
+
+/**
+ * @brief Removes an entry from the send queue of a given @p client.
  *
- * @param cli       Client to be sent, if NULL, broadcast.
- * @param threshold How many ignored PINGs should tolerate? (should be
- *                  positive and greater than 0).
+ * @param client Client connection.
+ * @param prev Entry that precedes the one to be removed, or NULL
+ * to remove the head.
  *
- * @note It should be noted that the time between each call to
- * ws_ping() is the timeout itself for receiving the PONG.
+ * @note Must be called with the queue lock held.
  *
- * It is also important to note that for devices with unstable
- * connections (such as a weak WiFi signal or 3/4/5G from a cell phone),
- * a threshold greater than 1 is advisable.
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
  */
-void ws_ping(ws_cli_conn_t client, int threshold)
+static void sndq_remove(struct ws_connection *client, struct ws_snd *prev)
 {
-	struct ws_connection *cli = get_client_by_cid(client);
-	int i;
-
-	/* Sanity check. */
-	if (threshold <= 0)
-		return;
+	struct ws_snd *snd;
 
-	/* PING a single client. */
-	if (cli)
-		send_ping_close(cli, threshold, 1);
+	snd = prev ? prev->next : client->snd_head;
 
-	/* PING broadcast. */
+	if (prev)
+		prev->next = snd->next;
 	else
-	{
-		/* clang-format off */
-		pthread_mutex_lock(&mutex);
-			for (i = 0; i < MAX_CLIENTS; i++)
-				send_ping_close(&client_socks[i], threshold, 0);
-		pthread_mutex_unlock(&mutex);
-		/* clang-format on */
-	}
+		client->snd_head = snd->next;
+
+	if (client->snd_tail == snd)
+		client->snd_tail = prev;
+
+	client->snd_bytes -= snd->buf->len - snd->off;
+	frame_release(snd->buf);
+	free(snd);
 }
 
 /**
- * @brief Sends a WebSocket text frame.
+ * @brief Accounts @p n bytes of the send queue head of a given
+ * @p client as sent, removing it once completely sent.
  *
- * @param client Target to be send.
- * @param msg    Message to be send, null terminated.
+ * @param client Client connection.
+ * @param n Amount of bytes sent.
  *
- * @return Returns the number of bytes written, -1 if error.
+ * @note Must be called with the queue lock held.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
  */
-int ws_sendframe_txt(ws_cli_conn_t client, const char *msg)
+static void sndq_sent(struct ws_connection *client, size_t n)
 {
-	return ws_sendframe(client, msg, (uint64_t)strlen(msg), WS_FR_OP_TXT);
+	struct ws_snd *snd = client->snd_head;
+
+	snd->off          += n;
+	client->snd_bytes -= n;
+
+	if (snd->off == snd->buf->len)
+		sndq_remove(client, NULL);
 }
 
 /**
- * @brief Sends a broadcast WebSocket text frame.
+ * @brief Discards everything queued to a given @p client, except
+ * for the queue head if it is being sent.
  *
- * @param port Server listen port to broadcast message.
- * @param msg  Message to be send, null terminated.
+ * @param client Client connection.
  *
- * @return Returns the number of bytes written, -1 if error.
+ * @note Must be called with the queue lock held.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
  */
-int ws_sendframe_txt_bcast(uint16_t port, const char *msg)
+static void sndq_clear(struct ws_connection *client)
 {
-	return ws_sendframe_bcast(port, msg, (uint64_t)strlen(msg), WS_FR_OP_TXT);
+	struct ws_snd *prev;
+
+	prev = client->snd_busy ? client->snd_head : NULL;
+	while (prev ? prev->next : client->snd_head)
+		sndq_remove(client, prev);
 }
 
 /**
- * @brief Sends a WebSocket binary frame.
+ * @brief Drops the oldest messages queued to a given @p client
+ * until @p len more bytes fit in @p max bytes.
  *
- * @param client Target to be send.
- * @param msg    Message to be send.
- * @param size   Binary message size.
+ * Control frames and messages already (partially) sent or being
+ * sent are never dropped.
  *
- * @return Returns the number of bytes written, -1 if error.
- */
-int ws_sendframe_bin(ws_cli_conn_t client, const char *msg, uint64_t size)
-{
-	return ws_sendframe(client, msg, size, WS_FR_OP_BIN);
-}
-
-/**
- * @brief Sends a broadcast WebSocket binary frame.
+ * @param client Client connection.
+ * @param len Amount of bytes to make room for.
+ * @param max Queue size.
  *
- * @param port Server listen port to broadcast message.
- * @param msg  Message to be send.
- * @param size Binary message size.
+ * @return Returns 0 if there is room enough, -1 otherwise.
  *
- * @return Returns the number of bytes written, -1 if error.
+ * @note Must be called with the queue lock held.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
  */
-int ws_sendframe_bin_bcast(uint16_t port, const char *msg, uint64_t size)
+static int sndq_drop_oldest(struct ws_connection *client, size_t len,
+	size_t max)
 {
-	return ws_sendframe_bcast(port, msg, size, WS_FR_OP_BIN);
+	struct ws_snd *prev;
+	struct ws_snd *snd;
+
+	prev = NULL;
+	while (client->snd_bytes + len > max)
+	{
+		snd = prev ? prev->next : client->snd_head;
+		if (!snd)
+			return (-1);
+
+		if (snd->ctrl || snd->off || (!prev && client->snd_busy))
+			prev = snd;
+		else
+			sndq_remove(client, prev);
+	}
+	return (0);
 }
 
 /**
- * @brief For a given @p client, gets the current state for
- * the connection, or -1 if invalid.
+ * @brief Aborts the connection of a given @p client from its send
+ * path: everything queued is discarded, no more data is accepted
+ * and the socket is shut down, so that its owner releases it.
  *
  * @param client Client connection.
  *
- * @return Returns the connection state or -1 if
- * invalid @p client.
+ * @note Must be called with the queue lock held.
  *
- * @see WS_STATE_CONNECTING
- * @see WS_STATE_OPEN
- * @see WS_STATE_CLOSING
- * @see WS_STATE_CLOSED
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
  */
-int ws_get_state(ws_cli_conn_t client)
+static void sndq_abort(struct ws_connection *client)
 {
-	struct ws_connection *cli = get_client_by_cid(client);
-	if (!CLIENT_VALID(cli))
-		return -1;
-	return (get_client_state(cli));
+	sndq_clear(client);
+	client->closing = true;
+	shutdown_socket(client->client_sock);
 }
 
 /**
- * @brief Close the client connection for the given @p
- * client with normal close code (1000) and no reason
- * string.
+ * @brief Queues what is left of the send request @p req (@p sent
+ * bytes were already sent) to a given @p client.
+ *
+ * If the queue is full, the configured policy applies: the new
+ * message or the oldest ones are dropped, or the connection is
+ * aborted. A message is always accepted by an empty queue, and
+ * control frames are never refused.
  *
  * @param client Client connection.
+ * @param req Send request.
+ * @param sent Amount of bytes of @p req already sent.
  *
- * @return Returns 0 on success, -1 otherwise.
+ * @return Returns the request length if queued, 0 if dropped,
+ * or -1 if the connection was aborted.
  *
- * @note If the client did not send a close frame in
- * TIMEOUT_MS milliseconds, the server will close the
- * connection with error code (1002).
+ * @note Must be called with the queue lock held.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
  */
-int ws_close_client(ws_cli_conn_t client)
+static ssize_t sndq_push(struct ws_connection *client,
+	struct ws_sndreq *req, size_t sent)
 {
-	struct ws_connection *cli = get_client_by_cid(client);
+	struct ws_snd *snd;
+	size_t left;
+	size_t max;
 
-	unsigned char clse_code[2];
-	int cc;
+	left = req->len - sent;
+	max  = client->srv->ws_srv.sndq_max;
 
-	/* Check if client is a valid and connected client. */
-	if (!CLIENT_VALID(cli) || cli->client_sock == -1)
-		return (-1);
+	if (client->snd_head && !req->ctrl && client->snd_bytes + left > max)
+	{
+		switch (client->srv->ws_srv.sndq_policy)
+		{
+		case WS_SNDQ_DROP_NEWEST:
+			return (0);
+		case WS_SNDQ_DROP_OLDEST:
+			if (sndq_drop_oldest(client, left, max) < 0)
+				return (0);
+			break;
+		default:
+			DEBUG("Send queue full, closing client %d\n", client->client_sock);
+			sndq_abort(client);
+			return (-1);
+		}
+	}
 
-	/*
-	 * Instead of using do_close(), we use this to avoid using
-	 * msg_ctrl buffer from wfd and avoid a race condition
-	 * if this is invoked asynchronously.
-	 */
-	cc = WS_CLSE_NORMAL;
-	clse_code[0] = (cc >> 8);
-	clse_code[1] = (cc & 0xFF);
-	if (ws_sendframe(
-			client, (const char *)clse_code, sizeof(char) * 2, WS_FR_OP_CLSE) < 0)
+	snd = malloc(sizeof(*snd));
+	if (!snd || !(snd->buf = sndreq_buf(req)))
 	{
-		DEBUG("An error has occurred while sending closing frame!\n");
+		DEBUG("Unable to queue data, out of memory!\n");
+		free(snd);
+		sndq_abort(client);
 		return (-1);
 	}
 
-	/*
-	 * Starts the timeout thread: if the client did not send
-	 * a close frame in TIMEOUT_MS milliseconds, the server
-	 * will close the connection with error code (1002).
-	 */
-	start_close_timeout(cli);
-	return (0);
+	snd->off  = sent;
+	snd->ctrl = req->ctrl;
+	snd->next = NULL;
+
+	if (client->snd_tail)
+		client->snd_tail->next = snd;
+	else
+		client->snd_head = snd;
+	client->snd_tail = snd;
+
+	client->snd_bytes += left;
+	return ((ssize_t)req->len);
 }
 
+/*
+ * Windows has no MSG_DONTWAIT: there, everything is sent by the
+ * send queue writer thread.
+ */
+#ifdef MSG_DONTWAIT
 /**
- * @brief Checks is a given opcode @p frame
- * belongs to a control frame or not.
+ * @brief Sends, with a single syscall, (part of) the @p iovcnt
+ * buffers of @p iov on the socket @p fd.
  *
- * @param frame Frame opcode to be checked.
+ * @param fd Socket.
+ * @param iov Buffers to be sent.
+ * @param iovcnt Amount of buffers.
+ * @param flags Send flags.
  *
- * @return Returns 1 if is a control frame, 0 otherwise.
+ * @return Returns the amount of bytes sent, or -1 if error.
  *
  * @attention This is part of the internal API and is documented just
  * for completeness.
  */
-static inline int is_control_frame(int frame)
+static ssize_t send_iov(int fd, struct iovec *iov, int iovcnt, int flags)
 {
-	return (
-		frame == WS_FR_OP_CLSE || frame == WS_FR_OP_PING || frame == WS_FR_OP_PONG);
+	struct msghdr msg;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov    = iov;
+	msg.msg_iovlen = iovcnt;
+	return (sendmsg(fd, &msg, flags));
 }
 
 /**
- * @brief Checks is a given opcode @p opcode is valid or not.
+ * @brief Sends as much as possible of the send request @p req to
+ * a given @p client, without blocking.
  *
- * @param opcode Frame opcode to be checked.
+ * @param client Target client.
+ * @param req Send request.
  *
- * @return Returns 1 if valid, 0 otherwise.
+ * @return Returns the amount of bytes sent, or -1 if error.
  *
  * @attention This is part of the internal API and is documented just
  * for completeness.
  */
-static inline int is_valid_frame(int opcode)
+static ssize_t send_nowait(struct ws_connection *client,
+	const struct ws_sndreq *req)
 {
-	return (
-		opcode == WS_FR_OP_TXT  || opcode == WS_FR_OP_BIN  ||
-		opcode == WS_FR_OP_CONT || opcode == WS_FR_OP_PING ||
-		opcode == WS_FR_OP_PONG || opcode == WS_FR_OP_CLSE
-	);
+	struct iovec iov[2];
+	struct iovec *v;
+	size_t sent;
+	size_t r;
+	ssize_t n;
+	int cnt;
+
+	memcpy(iov, req->iov, sizeof(iov));
+	v    = iov;
+	cnt  = req->iovcnt;
+	sent = 0;
+
+	while (cnt)
+	{
+		/* Skip what was already sent (or empty). */
+		if (!v->iov_len)
+		{
+			v++;
+			cnt--;
+			continue;
+		}
+
+		n = send_iov(client->client_sock, v, cnt, MSG_NOSIGNAL|MSG_DONTWAIT);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				break;
+			return (-1);
+		}
+		sent += (size_t)n;
+
+		/* Advance over the buffers sent, even partially. */
+		for (r = (size_t)n; r && r >= v->iov_len; v++, cnt--)
+			r -= v->iov_len;
+
+		if (r)
+		{
+			v->iov_base = (char *)v->iov_base + r;
+			v->iov_len -= r;
+		}
+	}
+	return ((ssize_t)sent);
 }
+#endif
 
 /**
- * @brief Do the handshake process.
+ * @brief Send queue writer (WS_IO_THREADS): sends everything
+ * queued to a given client, until the connection is closed.
  *
- * @param wfd Websocket Frame Data.
+ * Started on demand, when the client does not keep up with the
+ * data sent to it for the first time.
  *
- * @return Returns 0 if success, a negative number otherwise.
+ * @param p Client connection.
+ *
+ * @return Always NULL.
  *
  * @attention This is part of the internal API and is documented just
  * for completeness.
  */
-static int do_handshake(struct ws_frame_data *wfd)
+static void *sndq_writer(void *p)
 {
-	char *response; /* Handshake response message. */
-	char *p;        /* Last request line pointer.  */
-	ssize_t n;      /* Read/Write bytes.           */
-
-	/* Read the very first client message. */
-	if ((n = RECV(wfd->client, wfd->frm, sizeof(wfd->frm) - 1)) < 0)
-		return (-1);
+	struct ws_connection *client = p;
+	struct ws_snd *snd;
+	ssize_t n;
 
-	/* Advance our pointers before the first next_byte(). */
-	p = strstr((const char *)wfd->frm, "\r\n\r\n");
-	if (p == NULL)
+	pthread_mutex_lock(&client->mtx_snd);
+	while (1)
 	{
-		DEBUG("An empty line with \\r\\n was expected!\n");
-		return (-1);
-	}
-	wfd->amt_read = n;
-	wfd->cur_pos = (size_t)((ptrdiff_t)(p - (char *)wfd->frm)) + 4;
+		while (!client->snd_head && !client->closing)
+			pthread_cond_wait(&client->cold->cnd_snd, &client->mtx_snd);
 
-	/* Get response. */
-	if (get_handshake_response((char *)wfd->frm, &response) < 0)
-	{
-		DEBUG("Cannot get handshake response, request was: %s\n", wfd->frm);
-		return (-1);
-	}
+		snd = client->snd_head;
+		if (!snd)
+			break;
 
-	/* Valid request. */
-	DEBUG("Handshaked, response: \n"
-		  "------------------------------------\n"
-		  "%s"
-		  "------------------------------------\n",
-		response);
+		/* The head is kept while being sent, without the lock. */
+		client->snd_busy = true;
+		pthread_mutex_unlock(&client->mtx_snd);
 
-	/* Send handshake. */
-	if (SEND(wfd->client, response, strlen(response)) < 0)
-	{
-		free(response);
-		DEBUG("As error has occurred while handshaking!\n");
-		return (-1);
-	}
+		n = send(client->client_sock, (const char *)snd->buf->data + snd->off,
+			snd->buf->len - snd->off, MSG_NOSIGNAL);
 
-	/* Change state. */
-	set_client_state(wfd->client, WS_STATE_OPEN);
+		pthread_mutex_lock(&client->mtx_snd);
+		client->snd_busy = false;
 
-	/* Trigger events and clean up buffers. */
-	wfd->client->ws_srv.evs.onopen(wfd->client->client_id);
-	free(response);
-	return (0);
+		if (n > 0)
+			sndq_sent(client, (size_t)n);
+		else if (n < 0 && errno == EINTR)
+			continue;
+		else
+		{
+			DEBUG("Unable to send data to the client, closing...\n");
+			sndq_abort(client);
+		}
+	}
+	pthread_mutex_unlock(&client->mtx_snd);
+	return (NULL);
 }
 
 /**
- * @brief Sends a close frame, accordingly with the @p close_code
- * or the message inside @p wfd.
+ * @brief Sends the send request @p req to a given @p client, without
+ * ever blocking on it.
  *
- * @param wfd Websocket Frame Data.
- * @param close_code Websocket close code.
+ * If nothing is queued, the data is sent right away. Whatever the
+ * socket does not accept is queued (see sndq_push()) and sent by the
+ * I/O side: the event loop that serves the client or, on
+ * WS_IO_THREADS, a writer thread started on demand. This way, a
+ * client that does not keep up with the data sent to it does not
+ * hold the others (or the caller) back.
  *
- * @return Returns 0 if success, a negative number otherwise.
+ * @param client Target client.
+ * @param req Send request.
  *
- * @attention This is part of the internal API and is documented just
+ * @return Returns the request length if sent or queued, 0 if
+ * dropped by the send queue policy, or -1 if error.
+ *
+ * @note Technically a blocking send() should never send less than
+ * asked, but it was reported (issue #22 on GitHub) that this was
+ * happening: partial sends are always handled.
+ *
+ * @attention This is part of the internal API and is documented just
  * for completeness.
  */
-static int do_close(struct ws_frame_data *wfd, int close_code)
+static ssize_t send_req(struct ws_connection *client, struct ws_sndreq *req)
 {
-	int cc; /* Close code.           */
+	ssize_t ret;
+	ssize_t n;
 
-	/* If custom close-code. */
-	if (close_code != -1)
-	{
-		cc = close_code;
-		goto custom_close;
-	}
+	/* Sanity check. */
+	if (!CLIENT_VALID(client))
+		return (-1);
 
-	/* If empty or have a close reason, just re-send. */
-	if (wfd->frame_size == 0 || wfd->frame_size > 2)
-		goto send;
+#ifdef WS_HAS_URING
+	if (client->srv->ws_srv.io_model == WS_IO_URING)
+		return (uring_send(client, req));
+#endif
 
-	/* Parse close code and check if valid, if not, we issue an protocol error.
-	 */
-	if (wfd->frame_size == 1)
-		cc = wfd->msg_ctrl[0];
-	else
-		cc = ((int)wfd->msg_ctrl[0]) << 8 | wfd->msg_ctrl[1];
+	ret = -1;
+	n   = 0;
 
-	/* Check if it's not valid, if so, we send a protocol error (1002). */
-	if ((cc < 1000 || cc > 1003) && (cc < 1007 || cc > 1011) &&
-		(cc < 3000 || cc > 4999))
-	{
-		cc = WS_CLSE_PROTERR;
+	/* clang-format off */
+	pthread_mutex_lock(&client->mtx_snd);
+		if (client->closing || sndreq_stale(client, req))
+			goto out;
 
-	custom_close:
-		wfd->msg_ctrl[0] = (cc >> 8);
-		wfd->msg_ctrl[1] = (cc & 0xFF);
+#ifdef MSG_DONTWAIT
+		/* Nothing queued: try to send right away. */
+		if (!client->snd_head)
+		{
+			n = send_nowait(client, req);
+			if (n < 0)
+				goto out;
 
-		if (ws_sendframe(wfd->client->client_id, (const char *)wfd->msg_ctrl, sizeof(char) * 2,
-				WS_FR_OP_CLSE) < 0)
+			ret = n;
+			if ((size_t)n == req->len)
+				goto out;
+		}
+#endif
+
+		ret = sndq_push(client, req, (size_t)n);
+		if (ret <= 0)
+			goto out;
+
+#ifdef WS_HAS_EPOLL
+		if (client->srv->ws_srv.io_model == WS_IO_EPOLL)
 		{
-			DEBUG("An error has occurred while sending closing frame!\n");
-			return (-1);
+			evloop_update(client);
+			goto out;
 		}
-		return (0);
-	}
+#endif
 
-	/* Send the data inside wfd->msg_ctrl. */
-send:
-	if (ws_sendframe(wfd->client->client_id, (const char *)wfd->msg_ctrl, wfd->frame_size,
-			WS_FR_OP_CLSE) < 0)
-	{
-		DEBUG("An error has occurred while sending closing frame!\n");
-		return (-1);
-	}
-	return (0);
+		if (client->snd_thrd)
+			pthread_cond_signal(&client->cold->cnd_snd);
+		else if (!pthread_create(&client->cold->thrd_snd, NULL, sndq_writer,
+			client))
+		{
+			client->snd_thrd = true;
+		}
+		else
+		{
+			DEBUG("Unable to create the send queue thread!\n");
+			sndq_abort(client);
+			ret = -1;
+		}
+out:
+	pthread_mutex_unlock(&client->mtx_snd);
+	/* clang-format on */
+	return (ret);
 }
 
 /**
- * @brief Send a pong frame in response to a ping frame.
- *
- * Accordingly to the RFC, a pong frame must have the same
- * data payload as the ping frame, so we just send a
- * ordinary frame with PONG opcode.
- *
- * @param wfd Websocket frame data.
- *
- * @param frame_size Pong frame size.
+ * @brief Send a given message @p buf on a socket @p sockfd.
  *
- * @return Returns 0 if success and a negative number
- * otherwise.
+ * @param client Target client.
+ * @param buf Message to be sent.
+ * @param len Message length.
  *
- * @attention This is part of the internal API and is documented just
- * for completeness.
+ * @return If success (i.e: all message was sent or queued), returns
+ * the amount of bytes sent. Otherwise, -1.
  */
-static int do_pong(struct ws_frame_data *wfd, uint64_t frame_size)
+static ssize_t send_all(
+	struct ws_connection *client, const void *buf, size_t len)
 {
-	if (ws_sendframe(
-			wfd->client->client_id, (const char *)wfd->msg_ctrl, frame_size, WS_FR_OP_PONG) < 0)
-	{
-		wfd->error = 1;
-		DEBUG("An error has occurred while ponging!\n");
-		return (-1);
-	}
-	return (0);
+	struct ws_sndreq req;
+	ssize_t ret;
+
+	/* Not a frame (such as the handshake response), never dropped. */
+	sndreq_init(&req, true);
+	sndreq_add(&req, buf, len);
+
+	ret = send_req(client, &req);
+	sndreq_done(&req);
+	return (ret);
 }
 
+#ifdef WS_HAS_EPOLL
 /**
- * @brief Read a chunk of bytes and return the next byte
- * belonging to the frame.
- *
- * @param wfd Websocket Frame Data.
+ * @brief Event loop: a thread driving a set of non-blocking
+ * connections through epoll or io_uring.
+ */
+struct ws_evloop
+{
+	int epfd;          /**< epoll file descriptor. */
+	pthread_t thread;  /**< Event loop thread.     */
+#ifdef WS_HAS_URING
+	struct uring ring;               /**< io_uring instance.         */
+	pthread_mutex_t mtx_sq;          /**< Submission and send lock.  */
+	struct __kernel_timespec snd_ts; /**< Send timeout.              */
+#endif
+};
+#endif
+
+/**
+ * @brief Locks the send queue of a given @p client: the send lock,
+ * or the loop mutex on io_uring.
  *
- * @return Returns the byte read, or -1 if error.
+ * @param client Client connection.
  *
  * @attention This is part of the internal API and is documented just
  * for completeness.
  */
-static inline int next_byte(struct ws_frame_data *wfd)
+static void sndq_lock(struct ws_connection *client)
 {
-	ssize_t n;
-
-	/* If empty or full. */
-	if (wfd->cur_pos == 0 || wfd->cur_pos == wfd->amt_read)
+#ifdef WS_HAS_URING
+	if (client->srv->ws_srv.io_model == WS_IO_URING)
 	{
-		if ((n = RECV(wfd->client, wfd->frm, sizeof(wfd->frm))) <= 0)
-		{
-			wfd->error = 1;
-			DEBUG("An error has occurred while trying to read next byte\n");
-			return (-1);
-		}
-		wfd->amt_read = (size_t)n;
-		wfd->cur_pos = 0;
+		pthread_mutex_lock(&client->loop->mtx_sq);
+		return;
 	}
-	return (wfd->frm[wfd->cur_pos++]);
+#endif
+	pthread_mutex_lock(&client->mtx_snd);
 }
 
 /**
- * @brief Skips @p frame_size bytes of the current frame.
- *
- * @param wfd Websocket Frame Data.
- * @param frame_size Amount of bytes to be skipped.
+ * @brief Unlocks the send queue of a given @p client.
  *
- * @return Returns 0 if success, a negative number
- * otherwise.
+ * @param client Client connection.
  *
  * @attention This is part of the internal API and is documented just
  * for completeness.
  */
-static int skip_frame(struct ws_frame_data *wfd, uint64_t frame_size)
+static void sndq_unlock(struct ws_connection *client)
 {
-	uint64_t i;
-	for (i = 0; i < frame_size; i++)
+#ifdef WS_HAS_URING
+	if (client->srv->ws_srv.io_model == WS_IO_URING)
 	{
-		if (next_byte(wfd) == -1)
-		{
-			wfd->error = 1;
-			return (-1);
-		}
+		pthread_mutex_unlock(&client->loop->mtx_sq);
+		return;
 	}
-	return (0);
+#endif
+	pthread_mutex_unlock(&client->mtx_snd);
 }
 
+static void topic_leave_all(struct ws_connection *client);
+
 /**
- * @brief Adds two uint64_t numbers detecting overflow.
+ * @brief Close client connection (no close handshake, this should
+ * be done earlier), set appropriate state and release its slot.
  *
- * @param a Left operand.
- * @param b Right operand.
- * @param out Result pointer.
+ * The client id is invalidated first, so that no new lookup finds
+ * the client while it is being torn down.
  *
- * @return Returns true if there is no overflow, false otherwise.
- */
-static bool checked_add_u64(uint64_t a, uint64_t b, uint64_t *out)
-{
-	if (a > UINT64_MAX - b)
-		return (false);
-	*out = a + b;
-	return (true);
-}
-
-/**
- * Frame state data
+ * @param client Client connection.
+ * @param lock Should lock the global mutex?.
  *
- * This structure holds the current data for handling the
- * received frames.
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
  */
-struct frame_state_data
+static void close_client(struct ws_connection *client, int lock)
 {
-	unsigned char *msg_data; /* Data frame.                */
-	unsigned char *msg_ctrl; /* Control frame.             */
-	uint8_t masks_data[4];   /* Masks data frame array.    */
-	uint8_t masks_ctrl[4];   /* Masks control frame array. */
-	uint64_t msg_idx_data;   /* Current msg index.         */
-	uint64_t msg_idx_ctrl;   /* Current msg index.         */
-	uint64_t frame_length;   /* Frame length.              */
-	uint64_t frame_size;     /* Current frame size.        */
-#ifdef VALIDATE_UTF8
-	uint32_t utf8_state;     /* Current UTF-8 state.       */
+	if (!CLIENT_VALID(client))
+		return;
+
+	__atomic_store_n(&client->client_id, 0, __ATOMIC_RELEASE);
+
+	topic_leave_all(client);
+
+	set_client_state(client, WS_STATE_CLOSED);
+
+	close_socket(client->client_sock);
+
+	/*
+	 * Nothing else is being sent at this point, but a sender that
+	 * looked the client up earlier may still be queueing (and be
+	 * refused).
+	 */
+	/* clang-format off */
+	sndq_lock(client);
+		client->snd_busy = false;
+		sndq_clear(client);
+	sndq_unlock(client);
+
+#ifdef WS_HAS_DEFLATE
+	pthread_mutex_lock(&client->cold->mtx_pmd);
+		pmd_free(client->pmd);
+		__atomic_store_n(&client->pmd, NULL, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&client->cold->mtx_pmd);
 #endif
-	int32_t pong_id;         /* Current PONG id.           */
-	uint8_t opcode;          /* Frame opcode.              */
-	uint8_t is_fin;          /* Is FIN frame flag.         */
-	uint8_t mask;            /* Mask.                      */
-	int cur_byte;            /* Current frame byte.        */
-};
+	/* clang-format on */
+
+	/* Clear fd 'slot'. */
+	/* clang-format off */
+	if (lock)
+		pthread_mutex_lock(&client->srv->mtx);
+			client->client_sock = -1;
+	if (lock)
+		pthread_mutex_unlock(&client->srv->mtx);
+	/* clang-format on */
+
+	__atomic_sub_fetch(&client->srv->active_clients, 1, __ATOMIC_RELEASE);
+
+	client_release(client);
+}
 
 /**
- * @brief Validates TXT frames if UTF8 validation is enabled.
- * If the content is not valid, the connection is aborted.
+ * @brief Close time-out callback, run by the timer wheel.
  *
- * @param wfd WebSocket frame data.
- * @param fsd Frame state data.
+ * Once TIMEOUT_MS expires, shuts down the connection of a
+ * given client, if not closed yet.
  *
- * @return Always 0.
+ * @param p ws_connection/ws_cli_conn_t Structure Pointer.
  *
  * @attention This is part of the internal API and is documented just
  * for completeness.
  */
-static int validate_utf8_txt(struct ws_frame_data *wfd,
-	struct frame_state_data *fsd)
+static void close_timeout(void *p)
 {
-#ifdef VALIDATE_UTF8
-	/* UTF-8 Validate partial (or not) frame. */
-	if (wfd->frame_type != WS_FR_OP_TXT)
-		return (0);
+	struct ws_connection *conn = p;
+	int state;
 
-	if (fsd->is_fin)
-	{
-		if (is_utf8_len_state(
-			fsd->msg_data + (fsd->msg_idx_data - fsd->frame_length),
-			fsd->frame_length, fsd->utf8_state) != UTF8_ACCEPT)
-		{
-			DEBUG("Dropping invalid complete message!\n");
-			wfd->error = 1;
-			do_close(wfd, WS_CLSE_INVUTF8);
-		}
+	pthread_mutex_lock(&conn->cold->mtx_state);
+	state = conn->state;
+	pthread_mutex_unlock(&conn->cold->mtx_state);
 
-		return (0);
-	}
+	/* If already closed. */
+	if (state == WS_STATE_CLOSED)
+		return;
 
-	/* Check current state for a CONT or initial TXT frame. */
-	fsd->utf8_state =
-		is_utf8_len_state(fsd->msg_data +
-			(fsd->msg_idx_data - fsd->frame_length),
-			fsd->frame_length, fsd->utf8_state);
+	DEBUG("Timer expired, closing client %d\n", conn->client_sock);
 
-	/* We can be in any state, except reject. */
-	if (fsd->utf8_state == UTF8_REJECT)
-	{
-		DEBUG("Dropping invalid cont/initial frame!\n");
-		wfd->error = 1;
-		do_close(wfd, WS_CLSE_INVUTF8);
-	}
-#endif
-	return (0);
+	/*
+	 * Only shutdown the socket: the thread (or event loop) that owns
+	 * the connection wakes up with an EOF and releases it properly.
+	 */
+	shutdown_socket(conn->client_sock);
 }
 
 /**
- * @brief Handle PONG frames in response to our PING
- * (or not, unsolicited is possible too).
+ * @brief Arms the close time-out of a given @p client, if not
+ * armed yet and the connection is not closed.
  *
- * @param wfd WebSocket frame data.
- * @param fsd Frame state data.
+ * @param client Client connection.
  *
- * @return Always 0.
+ * @note Must be called with the state lock held.
  *
  * @attention This is part of the internal API and is documented just
  * for completeness.
  */
-static int handle_pong_frame(struct ws_frame_data *wfd,
-	struct frame_state_data *fsd)
+static void arm_close_timeout(struct ws_connection *client)
 {
-	fsd->is_fin = 0;
+	if (client->cold->close_armed || client->state == WS_STATE_CLOSED)
+		return;
 
-	/* If there is no content and/or differs the size, ignore it. */
-	if (fsd->frame_size != sizeof(wfd->client->last_pong_id))
-		return (0);
+	if (timer_add(&client->cold->tmr_close, TIMEOUT_MS) < 0)
+	{
+		pthread_mutex_unlock(&client->cold->mtx_state);
+		panic("Unable to start the timer thread\n");
+	}
+	client->cold->close_armed = true;
+}
+
+/**
+ * @brief For a valid client index @p client, arms
+ * the close time-out and set the current state
+ * to 'CLOSING'.
+ *
+ * @param client Client connection.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int start_close_timeout(struct ws_connection *client)
+{
+	if (!CLIENT_VALID(client))
+		return (-1);
+
+	pthread_mutex_lock(&client->cold->mtx_state);
+
+	if (client->state != WS_STATE_OPEN)
+		goto out;
+
+	__atomic_store_n(&client->state, WS_STATE_CLOSING, __ATOMIC_RELEASE);
+	arm_close_timeout(client);
+out:
+	pthread_mutex_unlock(&client->cold->mtx_state);
+	return (0);
+}
+
+/**
+ * @brief Sets the peer address of a client connection opened by the
+ * server, as returned by accept(): it is only formatted as text (see
+ * format_client_address()) if asked for.
+ *
+ * @param client Client connection.
+ * @param sa Peer address.
+ * @param salen Peer address length.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static void set_client_address(struct ws_connection *client,
+	const struct sockaddr_storage *sa, socklen_t salen)
+{
+	struct ws_conn_cold *cold = client->cold;
+
+	if (salen > sizeof(cold->peer))
+		salen = 0;
+
+	/* clang-format off */
+	pthread_mutex_lock(&cold->mtx_state);
+		memcpy(&cold->peer, sa, salen);
+		cold->peer_len = salen;
+		__atomic_store_n(&cold->peer_fmt, false, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&cold->mtx_state);
+	/* clang-format on */
+}
+
+/**
+ * @brief Formats the IP address and port of a given @p client as
+ * text, once.
+ *
+ * @param client Client connection.
+ * @param cid Client id @p client was looked up for.
+ *
+ * @return Returns 0 if success, -1 if the client closed meanwhile
+ * (and its slot might hold the address of another one).
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int format_client_address(struct ws_connection *client,
+	ws_cli_conn_t cid)
+{
+	struct ws_conn_cold *cold = client->cold;
+
+	if (__atomic_load_n(&cold->peer_fmt, __ATOMIC_ACQUIRE))
+		goto out;
+
+	/* clang-format off */
+	pthread_mutex_lock(&cold->mtx_state);
+		if (!cold->peer_fmt)
+		{
+			if (!cold->peer_len || getnameinfo(&cold->peer.sa, cold->peer_len,
+				cold->ip, sizeof(cold->ip), cold->port, sizeof(cold->port),
+				NI_NUMERICHOST|NI_NUMERICSERV))
+			{
+				cold->ip[0]   = '\0';
+				cold->port[0] = '\0';
+			}
+			__atomic_store_n(&cold->peer_fmt, true, __ATOMIC_RELEASE);
+		}
+	pthread_mutex_unlock(&cold->mtx_state);
+	/* clang-format on */
+out:
+	/* The id is invalidated before the slot can be reused. */
+	if (__atomic_load_n(&client->client_id, __ATOMIC_ACQUIRE) != cid)
+		return (-1);
+	return (0);
+}
+
+/**
+ * @brief Gets the IP address relative to a client connection opened
+ * by the server.
+ *
+ * @param client Client connection.
+ *
+ * @return Pointer the ip address, or NULL if fails.
+ *
+ * @note The returned string is static, no need to free up memory.
+ */
+char *ws_getaddress(ws_cli_conn_t client)
+{
+	struct ws_connection *cli = get_client_by_cid(client);
+	if (!CLIENT_VALID(cli))
+		return (NULL);
+
+	if (format_client_address(cli, client) < 0)
+		return (NULL);
+	return (cli->cold->ip);
+}
+
+/**
+ * @brief Gets the IP port relative to a client connection opened
+ * by the server.
+ *
+ * @param client Client connection.
+ *
+ * @return Pointer the port, or NULL if fails.
+ *
+ * @note The returned string is static, no need to free up memory.
+ */
+char *ws_getport(ws_cli_conn_t client)
+{
+	struct ws_connection *cli = get_client_by_cid(client);
+	if (!CLIENT_VALID(cli))
+		return (NULL);
+
+	if (format_client_address(cli, client) < 0)
+		return (NULL);
+	return (cli->cold->port);
+}
+
+/**
+ * @brief Encodes the header of a (non-fragmented and unmasked) frame
+ * of type @p type and @p length bytes of payload into @p frame.
+ *
+ * @param frame Header buffer, at least 10 bytes long.
+ * @param length Payload length.
+ * @param type Frame type.
+ *
+ * @return Returns the header length.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static uint8_t frame_header(unsigned char *frame, uint64_t length, int type)
+{
+	uint8_t idx_first_rData; /* Index data. */
+
+	frame[0] = (WS_FIN | type);
+
+	/* Split the size between octets. */
+	if (length <= 125)
+	{
+		frame[1] = length & 0x7F;
+		idx_first_rData = 2;
+	}
+
+	/* Size between 126 and 65535 bytes. */
+	else if (length >= 126 && length <= 65535)
+	{
+		frame[1] = 126;
+		frame[2] = (length >> 8) & 255;
+		frame[3] = length & 255;
+		idx_first_rData = 4;
+	}
+
+	/* More than 65535 bytes. */
+	else
+	{
+		frame[1] = 127;
+		frame[2] = (unsigned char)((length >> 56) & 255);
+		frame[3] = (unsigned char)((length >> 48) & 255);
+		frame[4] = (unsigned char)((length >> 40) & 255);
+		frame[5] = (unsigned char)((length >> 32) & 255);
+		frame[6] = (unsigned char)((length >> 24) & 255);
+		frame[7] = (unsigned char)((length >> 16) & 255);
+		frame[8] = (unsigned char)((length >> 8) & 255);
+		frame[9] = (unsigned char)(length & 255);
+		idx_first_rData = 10;
+	}
+
+	return (idx_first_rData);
+}
+
+#ifdef WS_HAS_DEFLATE
+/**
+ * @brief Compresses the message of the send request @p req and
+ * sends it to a given @p client, which negotiated permessage-deflate.
+ *
+ * @param client Client connection.
+ * @param req Send request.
+ *
+ * @return Returns the number of bytes written (or queued), -1 if
+ * error.
+ *
+ * @note Must be called with the compression lock held.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static ssize_t send_deflated(struct ws_connection *client,
+	struct ws_sndreq *req)
+{
+	unsigned char frame[10]; /* Frame header.       */
+	struct ws_sndreq zreq;   /* Compressed request. */
+	unsigned char *z;        /* Compressed payload. */
+	size_t zlen;             /* Compressed length.  */
+	ssize_t ret;             /* Bytes sent.         */
+
+	z = pmd_compress(client->pmd, req->msg, (size_t)req->msg_len, &zlen);
+	if (!z)
+		return (SENDV(client, req));
+
+	sndreq_init(&zreq, false);
+	sndreq_add(&zreq, frame, frame_header(frame, zlen, req->type));
+	sndreq_add(&zreq, z, zlen);
+	frame[0] |= WS_RSV1;
+	zreq.cid = req->cid;
+
+	ret = SENDV(client, &zreq);
+	sndreq_done(&zreq);
+	free(z);
+	return (ret);
+}
+
+/**
+ * @brief Sends the shared send request @p req to a given @p client,
+ * which negotiated permessage-deflate with server_no_context_takeover.
+ *
+ * Such clients do not depend on any previous message: the message
+ * is compressed only once, on the first of them, and the compressed
+ * frame is shared by all the others whose window is not smaller.
+ *
+ * @param client Client connection.
+ * @param req Send request.
+ *
+ * @return Returns the number of bytes written (or queued), -1 if
+ * error.
+ *
+ * @note Must be called with the compression lock held.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static ssize_t send_deflated_shared(struct ws_connection *client,
+	struct ws_sndreq *req)
+{
+	struct ws_sndreq zreq; /* Compressed request. */
+	struct ws_frame *buf;  /* Compressed frame.   */
+	unsigned char *z;      /* Compressed payload. */
+	size_t zlen;           /* Compressed length.  */
+	uint8_t hdr;           /* Header length.      */
+	ssize_t ret;           /* Bytes sent.         */
+	int bits;              /* Client window.      */
+
+	/* zlib does not support 8 bits windows for raw deflate. */
+	bits = client->pmd->prm.server_bits;
+	if (bits < 9)
+		return (SENDV(client, req));
+
+	if (!req->zbits)
+	{
+		req->zbits = -1;
+		z = pmd_compress_once(bits, req->msg, (size_t)req->msg_len, &zlen);
+		if (z && (buf = malloc(sizeof(*buf) + 10 + zlen)) != NULL)
+		{
+			hdr = frame_header(buf->data, zlen, req->type);
+			buf->data[0] |= WS_RSV1;
+			memcpy(buf->data + hdr, z, zlen);
+
+			/* The request itself holds the first reference. */
+			buf->len   = hdr + zlen;
+			buf->ctrl  = false;
+			buf->refs  = 1;
+			req->zbuf  = buf;
+			req->zbits = bits;
+		}
+		free(z);
+	}
+
+	/* Not worth it. */
+	if (req->zbits < 0)
+		return (SENDV(client, req));
+
+	/* Compressed with a window larger than this client accepts. */
+	if (req->zbits > bits)
+		return (send_deflated(client, req));
+
+	sndreq_frame(&zreq, req->zbuf);
+	zreq.cid = req->cid;
+	ret = SENDV(client, &zreq);
+	sndreq_done(&zreq);
+	return (ret);
+}
+#endif
+
+/**
+ * @brief Sends the send request @p req to a given @p client,
+ * compressing it if worth it.
+ *
+ * @param client Client connection.
+ * @param req Send request.
+ *
+ * @return Returns the number of bytes written (or queued), -1 if
+ * error.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static ssize_t send_msg(struct ws_connection *client, struct ws_sndreq *req)
+{
+#ifdef WS_HAS_DEFLATE
+	ssize_t ret;
+
+	if (req->msg && req->msg_len >= client->srv->ws_srv.deflate_min &&
+		__atomic_load_n(&client->pmd, __ATOMIC_ACQUIRE))
+	{
+		/*
+		 * The client decompresses the messages in the order they are
+		 * compressed: both compression and queueing must be atomic.
+		 * The lock also keeps the state from being released, but the
+		 * client might have closed (and its slot be reused) since it
+		 * was looked up: compressing for the new one would break its
+		 * stream.
+		 */
+		/* clang-format off */
+		pthread_mutex_lock(&client->cold->mtx_pmd);
+			if (sndreq_stale(client, req))
+				ret = -1;
+			else if (!client->pmd)
+				ret = SENDV(client, req);
+			else if (req->shared && client->pmd->prm.server_no_ctx)
+				ret = send_deflated_shared(client, req);
+			else
+				ret = send_deflated(client, req);
+		pthread_mutex_unlock(&client->cold->mtx_pmd);
+		/* clang-format on */
+
+		return (ret);
+	}
+#endif
+	return (SENDV(client, req));
+}
+
+/**
+ * @brief Given a listen @p port, returns the server instance
+ * listening on it.
+ *
+ * @param port Server listen port.
+ *
+ * @return Returns the server instance, or NULL if none.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static struct ws_instance *get_instance_by_port(uint16_t port)
+{
+	struct ws_instance *srv;
+
+	srv = __atomic_load_n(&instances, __ATOMIC_ACQUIRE);
+	while (srv && srv->ws_srv.port != port)
+		srv = srv->next;
+
+	return (srv);
+}
+
+/**
+ * @brief Sends the send request @p req to the clients whose ids are
+ * in @p cids, taken as a snapshot of the recipients.
+ *
+ * No lock is held meanwhile, so that compressing for a client does
+ * not stall the others: clients that are gone (or no longer open)
+ * since the snapshot are skipped.
+ *
+ * @param cids Client ids.
+ * @param n Amount of client ids.
+ * @param req Send request.
+ *
+ * @return Returns the number of bytes written (or queued).
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static ssize_t send_cids(const ws_cli_conn_t *cids, size_t n,
+	struct ws_sndreq *req)
+{
+	struct ws_connection *cli; /* Client.           */
+	ssize_t send_ret;          /* Ret send function */
+	ssize_t output;            /* Bytes sent.       */
+	size_t i;                  /* Loop index.       */
+
+	output = 0;
+	for (i = 0; i < n; i++)
+	{
+		cli = get_client_by_cid(cids[i]);
+		if (!CLIENT_VALID(cli) || get_client_state(cli) != WS_STATE_OPEN)
+			continue;
+
+		req->cid = cids[i];
+		if ((send_ret = send_msg(cli, req)) > 0)
+			output += send_ret;
+	}
+	req->cid = 0;
+
+	return (output);
+}
+
+/**
+ * @brief Sends the send request @p req to all the clients connected
+ * into the port @p port.
+ *
+ * Only the clients of the server instance listening on @p port are
+ * scanned, one chunk of the clients table at a time: the ids of its
+ * open clients are taken under the instance lock, and the request
+ * is sent to them once it is released. A client that fails (or has
+ * its connection aborted by its send queue policy) does not stop
+ * the broadcast.
+ *
+ * @param port Server listen port to broadcast the request.
+ * @param req Send request.
+ *
+ * @return Returns the number of bytes written (or queued).
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static ssize_t send_bcast(uint16_t port, struct ws_sndreq *req)
+{
+	ws_cli_conn_t cids[WS_CHUNK_SIZE]; /* Chunk recipients.  */
+	struct ws_connection *cli;         /* Client.            */
+	struct ws_instance *srv;           /* Server instance.   */
+	ssize_t output;                    /* Bytes sent.        */
+	uint32_t slots;                    /* Instance slots.    */
+	uint32_t i;                        /* Loop index.        */
+	size_t n;                          /* Chunk recipients.  */
+
+	output = 0;
+	req->shared = true;
+
+	srv = get_instance_by_port(port);
+	if (!srv)
+		return (0);
+
+	slots = SRV_SLOTS(srv);
+	for (i = 0; i < slots; )
+	{
+		n = 0;
+
+		/* clang-format off */
+		pthread_mutex_lock(&srv->mtx);
+			do
+			{
+				cli = SRV_CLIENT_AT(srv, i);
+
+				if ((cli->client_sock > -1) &&
+					get_client_state(cli) == WS_STATE_OPEN)
+				{
+					cids[n++] = __atomic_load_n(&cli->client_id,
+						__ATOMIC_ACQUIRE);
+				}
+			} while (++i & (WS_CHUNK_SIZE - 1));
+		pthread_mutex_unlock(&srv->mtx);
+		/* clang-format on */
+
+		output += send_cids(cids, n, req);
+	}
+
+	return (output);
+}
+
+/**
+ * @brief Creates and send an WebSocket frame with some payload data.
+ *
+ * This routine is intended to be used to create a websocket frame for
+ * a given type e sending to the client. For higher level routines,
+ * please check @ref ws_sendframe_txt and @ref ws_sendframe_bin.
+ *
+ * @param client Target to be send. If NULL, broadcast the message.
+ * @param cid    Client id @p client was looked up for, 0 if none.
+ * @param msg    Message to be send.
+ * @param size   Binary message size.
+ * @param type   Frame type.
+ * @param port   Server listen port to broadcast message (if any).
+ *
+ * @return Returns the number of bytes written (or queued), -1 if error.
+ *
+ * @note If @p size is -1, it is assumed that a text frame is being sent,
+ * otherwise, a binary frame. In the later case, the @p size is used.
+ *
+ * @note Sending never blocks: whatever a client does not accept right
+ * away is queued, and a broadcast shares a single copy of the frame
+ * among all the clients that need one.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int ws_sendframe_internal(struct ws_connection *client,
+	ws_cli_conn_t cid, const char *msg, uint64_t size, int type, uint16_t port)
+{
+	unsigned char frame[10]; /* Frame.            */
+	struct ws_sndreq req;    /* Header + payload. */
+	ssize_t output;          /* Bytes sent.       */
+
+	/*
+	 * Check if there is a valid condition before proceeding.
+	 *
+	 * Valid ones:
+	 * client == true  && port == 0
+	 *     -> send to single client
+	 *
+	 * client == false && port != 0
+	 *      -> send to all clients within single port
+	 *
+	 * Other options are invalid!
+	 */
+
+	if (client)
+	{
+		if (port != 0)
+			return (-1);
+	}
+	else
+	{
+		if (port == 0)
+			return (-1);
+	}
+
+	/*
+	 * Header on the stack, payload straight from the caller: only
+	 * copied (once) if some client needs it to be queued.
+	 */
+	sndreq_msg(&req, frame, msg, size, type);
+	req.cid = cid;
+
+	/* Send to the client if there is one. */
+	if (client)
+		output = send_msg(client, &req);
+	else
+		output = send_bcast(port, &req);
+
+	sndreq_done(&req);
+	return ((int)output);
+}
+
+/**
+ * @brief Send an WebSocket frame with some payload data.
+ *
+ * @param client Target to be send. If NULL, broadcast the message.
+ * @param msg    Message to be send.
+ * @param size   Binary message size.
+ * @param type   Frame type.
+ *
+ * @return Returns the number of bytes written, -1 if error.
+ *
+ * @note If @p size is -1, it is assumed that a text frame is being sent,
+ * otherwise, a binary frame. In the later case, the @p size is used.
+ */
+int ws_sendframe(ws_cli_conn_t client, const char *msg, uint64_t size, int type)
+{
+	struct ws_connection *cli = get_client_by_cid(client);
+	if (!CLIENT_VALID(cli))
+		return (-1);
+	return ws_sendframe_internal(cli, client, msg, size, type, 0);
+}
+
+/**
+ * @brief Send an WebSocket frame with some payload data to all clients
+ * connected into the same port.
+ *
+ * @param port   Server listen port to broadcast message.
+ * @param msg    Message to be send.
+ * @param size   Binary message size.
+ * @param type   Frame type.
+ *
+ * @return Returns the number of bytes written, -1 if error.
+ *
+ * @note If @p size is -1, it is assumed that a text frame is being sent,
+ * otherwise, a binary frame. In the later case, the @p size is used.
+ */
+int ws_sendframe_bcast(uint16_t port, const char *msg, uint64_t size, int type)
+{
+	return ws_sendframe_internal(NULL, 0, msg, size, type, port);
+}
+
+/**
+ * @brief Creates a pre-encoded WebSocket frame, to be sent as many
+ * times (and to as many clients) as needed.
+ *
+ * The header is encoded and the payload copied only once: sending
+ * the frame (see @ref ws_frame_send and @ref ws_frame_send_bcast)
+ * never copies it again, the clients that cannot send it right away
+ * just keep a reference to it in their send queues.
+ *
+ * @param msg  Message to be send.
+ * @param size Message size.
+ * @param type Frame type.
+ *
+ * @return Returns the frame, or NULL if error (out of memory or a
+ * control frame larger than 125 bytes).
+ *
+ * @note The frame must be released with @ref ws_frame_release once
+ * no longer needed. It is safe to do so even while it is still
+ * queued to some clients.
+ */
+ws_frame_t *ws_frame_create(const char *msg, uint64_t size, int type)
+{
+	unsigned char hdr[10];  /* Frame header.  */
+	struct ws_frame *frame; /* Encoded frame. */
+	uint8_t hlen;           /* Header length. */
+
+	/* Control frames payloads are limited to 125 bytes. */
+	if (type >= WS_FR_OP_CLSE && size > 125)
+		return (NULL);
+
+	if (size > SIZE_MAX - sizeof(*frame) - sizeof(hdr))
+		return (NULL);
+
+	frame = malloc(sizeof(*frame) + sizeof(hdr) + (size_t)size);
+	if (!frame)
+		return (NULL);
+
+	hlen = frame_header(hdr, size, type);
+	memcpy(frame->data, hdr, hlen);
+	if (size)
+		memcpy(frame->data + hlen, msg, (size_t)size);
+
+	frame->len  = hlen + (size_t)size;
+	frame->ctrl = (type >= WS_FR_OP_CLSE);
+	frame->refs = 1;
+	return (frame);
+}
+
+/**
+ * @brief Sends a pre-encoded @p frame (see @ref ws_frame_create) to
+ * a given @p client.
+ *
+ * @param client Target to be send.
+ * @param frame  Frame to be send.
+ *
+ * @return Returns the number of bytes written (or queued), -1 if error.
+ */
+int ws_frame_send(ws_cli_conn_t client, ws_frame_t *frame)
+{
+	struct ws_connection *cli = get_client_by_cid(client);
+	struct ws_sndreq req;
+	ssize_t output;
+
+	if (!CLIENT_VALID(cli) || !frame)
+		return (-1);
+
+	sndreq_frame(&req, frame);
+	req.cid = client;
+	output = SENDV(cli, &req);
+	sndreq_done(&req);
+	return ((int)output);
+}
+
+/**
+ * @brief Sends a pre-encoded @p frame (see @ref ws_frame_create) to
+ * all clients connected into the same port.
+ *
+ * @param port  Server listen port to broadcast the frame.
+ * @param frame Frame to be send.
+ *
+ * @return Returns the number of bytes written (or queued), -1 if error.
+ */
+int ws_frame_send_bcast(uint16_t port, ws_frame_t *frame)
+{
+	struct ws_sndreq req;
+	ssize_t output;
+
+	if (!port || !frame)
+		return (-1);
+
+	sndreq_frame(&req, frame);
+	output = send_bcast(port, &req);
+	sndreq_done(&req);
+	return ((int)output);
+}
+
+/**
+ * @brief Releases a pre-encoded @p frame created by
+ * @ref ws_frame_create.
+ *
+ * @param frame Frame to be released, may be NULL.
+ *
+ * @note The frame is only actually freed once every client it was
+ * queued to is done with it.
+ */
+void ws_frame_release(ws_frame_t *frame)
+{
+	frame_release(frame);
+}
+
+/**
+ * @name Topics (publish/subscribe).
+ *
+ * Topics are identified either by name or by a numeric id (two
+ * distinct namespaces) and live in a hash table that grows as
+ * needed. Each subscription belongs to two lists: the subscribers
+ * of its topic, walked by the publishes, and the subscriptions of
+ * its client, released when the client goes away. A topic only
+ * exists while it has subscribers.
+ */
+/**@{*/
+
+/**
+ * @brief Topic subscription.
+ */
+struct ws_sub
+{
+	struct ws_topic *topic;       /**< Topic subscribed.            */
+	struct ws_connection *client; /**< Subscriber.                  */
+	struct ws_sub *t_prev;        /**< Previous topic subscriber.   */
+	struct ws_sub *t_next;        /**< Next topic subscriber.       */
+	struct ws_sub *c_next;        /**< Next client subscription.    */
+};
+
+/**
+ * @brief Topic.
+ */
+struct ws_topic
+{
+	struct ws_topic *next; /**< Next topic in the same bucket. */
+	struct ws_sub *subs;   /**< Subscribers.                   */
+	uint64_t hash;         /**< Topic hash.                    */
+	uint64_t id;           /**< Numeric id, if not named.      */
+	bool named;            /**< Named or numeric topic.        */
+	char name[];           /**< Topic name, if named.          */
+};
+
+#define WS_TOPICS_INIT 64 /* Initial amount of buckets. */
+
+static struct ws_topic **topics; /* Buckets.         */
+static size_t topics_size;       /* Amount of buckets. */
+static size_t topics_count;      /* Amount of topics.  */
+static pthread_rwlock_t topics_lock = PTHREAD_RWLOCK_INITIALIZER;
+/**@}*/
+
+/**
+ * @brief Hashes a topic @p name (FNV-1a) or, if NULL, a numeric
+ * topic @p id.
+ *
+ * @param name Topic name, or NULL.
+ * @param id Topic id, if not named.
+ *
+ * @return Returns the topic hash.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static uint64_t topic_hash(const char *name, uint64_t id)
+{
+	uint64_t h;
+
+	if (!name)
+		return ((id ^ (id >> 33)) * 0x9E3779B97F4A7C15ULL);
+
+	for (h = 0xCBF29CE484222325ULL; *name; name++)
+		h = (h ^ (unsigned char)*name) * 0x100000001B3ULL;
+	return (h);
+}
+
+/**
+ * @brief Looks up the topic @p name (or @p id, if @p name is NULL)
+ * with the hash @p hash.
+ *
+ * @param name Topic name, or NULL.
+ * @param id Topic id, if not named.
+ * @param hash Topic hash.
+ *
+ * @return Returns the topic, or NULL if it does not exist.
+ *
+ * @note Must be called with the topics lock held.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static struct ws_topic *topic_find(const char *name, uint64_t id,
+	uint64_t hash)
+{
+	struct ws_topic *t;
+
+	if (!topics)
+		return (NULL);
+
+	for (t = topics[hash & (topics_size - 1)]; t; t = t->next)
+	{
+		if (t->hash != hash || t->named != (name != NULL))
+			continue;
+		if (name ? !strcmp(t->name, name) : t->id == id)
+			return (t);
+	}
+	return (NULL);
+}
+
+/**
+ * @brief Doubles the amount of buckets of the topics table (or
+ * allocates it, if empty).
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ *
+ * @note Must be called with the topics lock held for writing.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int topics_grow(void)
+{
+	struct ws_topic **tbl;
+	struct ws_topic *next;
+	struct ws_topic *t;
+	size_t size;
+	size_t i;
+
+	size = topics_size ? topics_size * 2 : WS_TOPICS_INIT;
+	tbl  = calloc(size, sizeof(*tbl));
+	if (!tbl)
+		return (-1);
+
+	for (i = 0; i < topics_size; i++)
+	{
+		for (t = topics[i]; t; t = next)
+		{
+			next = t->next;
+			t->next = tbl[t->hash & (size - 1)];
+			tbl[t->hash & (size - 1)] = t;
+		}
+	}
+
+	free(topics);
+	topics      = tbl;
+	topics_size = size;
+	return (0);
+}
+
+/**
+ * @brief Gets the topic @p name (or @p id, if @p name is NULL),
+ * creating it if it does not exist yet.
+ *
+ * @param name Topic name, or NULL.
+ * @param id Topic id, if not named.
+ *
+ * @return Returns the topic, or NULL if out of memory.
+ *
+ * @note Must be called with the topics lock held for writing.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static struct ws_topic *topic_get(const char *name, uint64_t id)
+{
+	struct ws_topic *t;
+	uint64_t hash;
+	size_t len;
+
+	hash = topic_hash(name, id);
+	if ((t = topic_find(name, id, hash)) != NULL)
+		return (t);
+
+	if (topics_count >= topics_size && topics_grow() < 0)
+		return (NULL);
+
+	len = name ? strlen(name) + 1 : 0;
+	t   = malloc(sizeof(*t) + len);
+	if (!t)
+		return (NULL);
+
+	t->subs  = NULL;
+	t->hash  = hash;
+	t->id    = id;
+	t->named = (name != NULL);
+	if (name)
+		memcpy(t->name, name, len);
+
+	t->next = topics[hash & (topics_size - 1)];
+	topics[hash & (topics_size - 1)] = t;
+	topics_count++;
+	return (t);
+}
+
+/**
+ * @brief Releases a topic @p t that has no subscribers anymore.
+ *
+ * @param t Topic.
+ *
+ * @note Must be called with the topics lock held for writing.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static void topic_put(struct ws_topic *t)
+{
+	struct ws_topic **pt;
+
+	if (t->subs)
+		return;
+
+	for (pt = &topics[t->hash & (topics_size - 1)]; *pt != t;
+		pt = &(*pt)->next)
+		;
+
+	*pt = t->next;
+	topics_count--;
+	free(t);
+}
+
+/**
+ * @brief Removes the subscription @p sub from its topic (releasing
+ * the topic if it was the last one) and frees it.
+ *
+ * @param sub Subscription, already removed from its client list.
+ *
+ * @note Must be called with the topics lock held for writing.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static void topic_unlink(struct ws_sub *sub)
+{
+	if (sub->t_prev)
+		sub->t_prev->t_next = sub->t_next;
+	else
+		sub->topic->subs = sub->t_next;
+
+	if (sub->t_next)
+		sub->t_next->t_prev = sub->t_prev;
+
+	topic_put(sub->topic);
+	free(sub);
+}
+
+/**
+ * @brief Subscribes a given @p client to the topic @p name (or
+ * @p id, if @p name is NULL).
+ *
+ * @param client Client connection.
+ * @param name Topic name, or NULL.
+ * @param id Topic id, if not named.
+ *
+ * @return Returns 0 if success (or already subscribed), -1
+ * otherwise.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int topic_subscribe(ws_cli_conn_t client, const char *name,
+	uint64_t id)
+{
+	struct ws_connection *cli;
+	struct ws_topic *t;
+	struct ws_sub *sub;
+	int ret;
+
+	cli = get_client_by_cid(client);
+	if (!CLIENT_VALID(cli))
+		return (-1);
+
+	ret = -1;
+
+	/* clang-format off */
+	pthread_rwlock_wrlock(&topics_lock);
+		/* Closed (and maybe reused) since the lookup? */
+		if (cli->cold->subs_closed ||
+			__atomic_load_n(&cli->client_id, __ATOMIC_ACQUIRE) != client ||
+			(t = topic_get(name, id)) == NULL)
+		{
+			goto out;
+		}
+
+		/* Already subscribed? */
+		for (sub = cli->cold->subs; sub && sub->topic != t; sub = sub->c_next)
+			;
+
+		ret = 0;
+		if (sub)
+			goto out;
+
+		sub = malloc(sizeof(*sub));
+		if (!sub)
+		{
+			topic_put(t);
+			ret = -1;
+			goto out;
+		}
+
+		sub->topic  = t;
+		sub->client = cli;
+		sub->t_prev = NULL;
+		sub->t_next = t->subs;
+		if (t->subs)
+			t->subs->t_prev = sub;
+		t->subs = sub;
+
+		sub->c_next     = cli->cold->subs;
+		cli->cold->subs = sub;
+out:
+	pthread_rwlock_unlock(&topics_lock);
+	/* clang-format on */
+	return (ret);
+}
+
+/**
+ * @brief Unsubscribes a given @p client from the topic @p name (or
+ * @p id, if @p name is NULL).
+ *
+ * @param client Client connection.
+ * @param name Topic name, or NULL.
+ * @param id Topic id, if not named.
+ *
+ * @return Returns 0 if success, -1 if not subscribed.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int topic_unsubscribe(ws_cli_conn_t client, const char *name,
+	uint64_t id)
+{
+	struct ws_connection *cli;
+	struct ws_sub **psub;
+	struct ws_sub *sub;
+	struct ws_topic *t;
+	int ret;
+
+	cli = get_client_by_cid(client);
+	if (!CLIENT_VALID(cli))
+		return (-1);
+
+	ret = -1;
+
+	/* clang-format off */
+	pthread_rwlock_wrlock(&topics_lock);
+		t = topic_find(name, id, topic_hash(name, id));
+		if (!t)
+			goto out;
+
+		for (psub = &cli->cold->subs; *psub && (*psub)->topic != t;
+			psub = &(*psub)->c_next)
+			;
+
+		if ((sub = *psub) != NULL)
+		{
+			*psub = sub->c_next;
+			topic_unlink(sub);
+			ret = 0;
+		}
+out:
+	pthread_rwlock_unlock(&topics_lock);
+	/* clang-format on */
+	return (ret);
+}
+
+/**
+ * @brief Unsubscribes a given @p client from all its topics, for
+ * good: no more subscriptions are accepted.
+ *
+ * @param client Client connection.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static void topic_leave_all(struct ws_connection *client)
+{
+	struct ws_sub *sub;
+
+	/* clang-format off */
+	pthread_rwlock_wrlock(&topics_lock);
+		client->cold->subs_closed = true;
+		while ((sub = client->cold->subs) != NULL)
+		{
+			client->cold->subs = sub->c_next;
+			topic_unlink(sub);
+		}
+	pthread_rwlock_unlock(&topics_lock);
+	/* clang-format on */
+}
+
+/**
+ * @brief Sends the send request @p req to all the subscribers of
+ * the topic @p name (or @p id, if @p name is NULL).
+ *
+ * Only the subscribers are visited, and they all share the same
+ * copy of the frame if they need one. Their ids are taken under the
+ * topics lock, and the request is sent once it is released.
+ *
+ * @param name Topic name, or NULL.
+ * @param id Topic id, if not named.
+ * @param req Send request.
+ *
+ * @return Returns the number of bytes written (or queued), -1 if
+ * error.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static ssize_t topic_publish(const char *name, uint64_t id,
+	struct ws_sndreq *req)
+{
+	ws_cli_conn_t local[WS_CHUNK_SIZE];
+	ws_cli_conn_t *cids;
+	struct ws_sub *sub;
+	struct ws_topic *t;
+	ssize_t output;
+	size_t n;
+
+	cids = local;
+	n    = 0;
+	req->shared = true;
+
+	/* clang-format off */
+	pthread_rwlock_rdlock(&topics_lock);
+		t = topic_find(name, id, topic_hash(name, id));
+		for (sub = t ? t->subs : NULL; sub; sub = sub->t_next)
+			n++;
+
+		if (n > WS_CHUNK_SIZE && !(cids = malloc(n * sizeof(*cids))))
+		{
+			pthread_rwlock_unlock(&topics_lock);
+			return (-1);
+		}
+
+		n = 0;
+		for (sub = t ? t->subs : NULL; sub; sub = sub->t_next)
+		{
+			if (get_client_state(sub->client) != WS_STATE_OPEN)
+				continue;
+
+			cids[n++] = __atomic_load_n(&sub->client->client_id,
+				__ATOMIC_ACQUIRE);
+		}
+	pthread_rwlock_unlock(&topics_lock);
+	/* clang-format on */
+
+	output = 0;
+	if (n)
+		output = send_cids(cids, n, req);
+	if (cids != local)
+		free(cids);
+
+	return (output);
+}
+
+/**
+ * @brief Subscribes a given @p client to the topic named @p topic.
+ *
+ * @param client Client connection.
+ * @param topic  Topic name.
+ *
+ * @return Returns 0 if success (or already subscribed), -1 otherwise.
+ *
+ * @note Named and numeric (see @ref ws_subscribe_id) topics are
+ * distinct, even if the name looks like a number. Subscriptions
+ * end when the client disconnects.
+ */
+int ws_subscribe(ws_cli_conn_t client, const char *topic)
+{
+	if (!topic)
+		return (-1);
+	return (topic_subscribe(client, topic, 0));
+}
+
+/**
+ * @brief Subscribes a given @p client to the numeric topic @p topic.
+ *
+ * @param client Client connection.
+ * @param topic  Topic id.
+ *
+ * @return Returns 0 if success (or already subscribed), -1 otherwise.
+ */
+int ws_subscribe_id(ws_cli_conn_t client, uint64_t topic)
+{
+	return (topic_subscribe(client, NULL, topic));
+}
+
+/**
+ * @brief Unsubscribes a given @p client from the topic named @p topic.
+ *
+ * @param client Client connection.
+ * @param topic  Topic name.
+ *
+ * @return Returns 0 if success, -1 otherwise (such as if not
+ * subscribed).
+ */
+int ws_unsubscribe(ws_cli_conn_t client, const char *topic)
+{
+	if (!topic)
+		return (-1);
+	return (topic_unsubscribe(client, topic, 0));
+}
+
+/**
+ * @brief Unsubscribes a given @p client from the numeric topic
+ * @p topic.
+ *
+ * @param client Client connection.
+ * @param topic  Topic id.
+ *
+ * @return Returns 0 if success, -1 otherwise (such as if not
+ * subscribed).
+ */
+int ws_unsubscribe_id(ws_cli_conn_t client, uint64_t topic)
+{
+	return (topic_unsubscribe(client, NULL, topic));
+}
+
+/**
+ * @brief Sends a WebSocket frame to all the subscribers of the topic
+ * named @p topic.
+ *
+ * @param topic Topic name.
+ * @param msg   Message to be send.
+ * @param size  Message size.
+ * @param type  Frame type.
+ *
+ * @return Returns the number of bytes written (or queued), -1 if error.
+ */
+int ws_publish(const char *topic, const char *msg, uint64_t size, int type)
+{
+	unsigned char frame[10];
+	struct ws_sndreq req;
+	ssize_t output;
+
+	if (!topic)
+		return (-1);
+
+	sndreq_msg(&req, frame, msg, size, type);
+
+	output = topic_publish(topic, 0, &req);
+	sndreq_done(&req);
+	return ((int)output);
+}
+
+/**
+ * @brief Sends a WebSocket frame to all the subscribers of the
+ * numeric topic @p topic.
+ *
+ * @param topic Topic id.
+ * @param msg   Message to be send.
+ * @param size  Message size.
+ * @param type  Frame type.
+ *
+ * @return Returns the number of bytes written (or queued), -1 if error.
+ */
+int ws_publish_id(uint64_t topic, const char *msg, uint64_t size, int type)
+{
+	unsigned char frame[10];
+	struct ws_sndreq req;
+	ssize_t output;
+
+	sndreq_msg(&req, frame, msg, size, type);
+
+	output = topic_publish(NULL, topic, &req);
+	sndreq_done(&req);
+	return ((int)output);
+}
+
+/**
+ * @brief Sends a pre-encoded @p frame (see @ref ws_frame_create) to
+ * all the subscribers of the topic named @p topic.
+ *
+ * @param topic Topic name.
+ * @param frame Frame to be send.
+ *
+ * @return Returns the number of bytes written (or queued), -1 if error.
+ */
+int ws_publish_frame(const char *topic, ws_frame_t *frame)
+{
+	struct ws_sndreq req;
+	ssize_t output;
+
+	if (!topic || !frame)
+		return (-1);
+
+	sndreq_frame(&req, frame);
+	output = topic_publish(topic, 0, &req);
+	sndreq_done(&req);
+	return ((int)output);
+}
+
+/**
+ * @brief Sends a pre-encoded @p frame (see @ref ws_frame_create) to
+ * all the subscribers of the numeric topic @p topic.
+ *
+ * @param topic Topic id.
+ * @param frame Frame to be send.
+ *
+ * @return Returns the number of bytes written (or queued), -1 if error.
+ */
+int ws_publish_frame_id(uint64_t topic, ws_frame_t *frame)
+{
+	struct ws_sndreq req;
+	ssize_t output;
+
+	if (!frame)
+		return (-1);
+
+	sndreq_frame(&req, frame);
+	output = topic_publish(NULL, topic, &req);
+	sndreq_done(&req);
+	return ((int)output);
+}
+
+/**
+ * @brief Returns the current time, in microseconds, from a
+ * monotonic clock.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000);
+}
+
+/**
+ * @brief Given a PONG message, decodes the content
+ * as a int32_t number that corresponds to our
+ * PONG id.
+ *
+ * @param msg Content to be decoded.
+ *
+ * @return Returns the PONG id.
+ */
+static inline int32_t pong_msg_to_int32(uint8_t *msg)
+{
+	int32_t pong_id;
+	/* Decodes as big-endian. */
+	pong_id = (msg[3] << 0) | (msg[2] << 8) | (msg[1] << 16) | (msg[0] << 24);
+	return (pong_id);
+}
+
+/**
+ * @brief Given a PING id, encodes the content to be sent
+ * as payload of a PING frame.
+ *
+ * @param ping_id PING id to be encoded.
+ * @param msg Target buffer.
+ */
+static inline void int32_to_ping_msg(int32_t ping_id, uint8_t *msg)
+{
+	/* Encodes as big-endian. */
+	msg[0] = (ping_id >> 24);
+	msg[1] = (ping_id >> 16);
+	msg[2] = (ping_id >>  8);
+	msg[3] = (ping_id >>  0);
+}
+
+/**
+ * @brief Send a ping message and close if the client surpasses
+ * the threshold imposed.
+ *
+ * @param cli Client to be sent.
+ * @param threshold How many pings can miss?.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static void send_ping_close(struct ws_connection *cli, int threshold)
+{
+	struct ws_conn_cold *cold;
+	uint8_t ping_msg[4];
+
+	if (!CLIENT_VALID(cli) || get_client_state(cli) != WS_STATE_OPEN)
+		return;
+
+	cold = cli->cold;
+
+	/* clang-format off */
+	pthread_mutex_lock(&cold->mtx_ping);
+
+		cold->current_ping_id++;
+		int32_to_ping_msg(cold->current_ping_id, ping_msg);
+		cold->ping_ts[cold->current_ping_id & (WS_PING_TS - 1)] = now_us();
+
+		/* Send PING. */
+		ws_sendframe_internal(cli, 0, (const char*)ping_msg,
+			sizeof(ping_msg), WS_FR_OP_PING, 0);
+
+		/* Check previous PONG: if greater than threshold, abort. */
+		if ((cold->current_ping_id - cold->last_pong_id) > threshold) {
+			DEBUG("Closing, reason: many unanswered PINGs\n");
+			shutdown_socket(cli->client_sock);
+		}
+
+	pthread_mutex_unlock(&cold->mtx_ping);
+	/* clang-format on */
+}
+
+/**
+ * @brief Heartbeat callback, run by the timer wheel every
+ * ping interval: sends a PING to a given client and schedules
+ * the next one.
+ *
+ * @param p ws_connection/ws_cli_conn_t Structure Pointer.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static void heartbeat(void *p)
+{
+	struct ws_connection *cli = p;
+
+	if (get_client_state(cli) != WS_STATE_OPEN)
+		return;
+
+	send_ping_close(cli, cli->srv->ws_srv.ping_threshold);
+	timer_add(&cli->cold->tmr_ping, cli->srv->ws_srv.ping_interval_ms);
+}
+
+/**
+ * @brief Sends a PING frame to the client @p cli with threshold
+ * @p threshold.
+ *
+ * This routine sends a PING to a single client pointed to by
+ * @p cli or a broadcast PING if @p cli is NULL. If the specified
+ * client does not respond up to @p threshold PINGs, the connection
+ * is aborted.
+ *
+ * ws_ping() is not automatic: the user who wants to send keep-alive
+ * PINGs *must* call this routine in a timely manner, whether on
+ * a different thread or inside an event. Alternatively, the server
+ * can send them on its own, see ws_server::ping_interval_ms.
+ *
+ * See examples/ping/ping.c for a minimal example usage.
+ *
+ * @param cli       Client to be sent, if NULL, broadcast.
+ * @param threshold How many ignored PINGs should tolerate? (should be
+ *                  positive and greater than 0).
+ *
+ * @note It should be noted that the time between each call to
+ * ws_ping() is the timeout itself for receiving the PONG.
+ *
+ * It is also important to note that for devices with unstable
+ * connections (such as a weak WiFi signal or 3/4/5G from a cell phone),
+ * a threshold greater than 1 is advisable.
+ */
+void ws_ping(ws_cli_conn_t client, int threshold)
+{
+	struct ws_connection *cli = get_client_by_cid(client);
+	struct ws_instance *srv;
+	uint32_t slots;
+	uint32_t i;
+
+	/* Sanity check. */
+	if (threshold <= 0)
+		return;
+
+	/* PING a single client. */
+	if (cli)
+		send_ping_close(cli, threshold);
+
+	/* PING broadcast, to the clients of every server. */
+	else
+	{
+		srv = __atomic_load_n(&instances, __ATOMIC_ACQUIRE);
+		for (; srv; srv = srv->next)
+		{
+			/* clang-format off */
+			pthread_mutex_lock(&srv->mtx);
+				slots = SRV_SLOTS(srv);
+				for (i = 0; i < slots; i++)
+					send_ping_close(SRV_CLIENT_AT(srv, i), threshold);
+			pthread_mutex_unlock(&srv->mtx);
+			/* clang-format on */
+		}
+	}
+}
+
+/**
+ * @brief Gets the round-trip time of a given @p client, measured
+ * from its PONGs (to the heartbeat PINGs or to those sent by
+ * ws_ping()).
+ *
+ * @param client Client connection.
+ * @param rtt    Smoothed round-trip time, in microseconds.
+ * @param jitter Round-trip time variation, in microseconds.
+ *
+ * @return Returns 0 if success, -1 if the client is invalid or did
+ * not answer any PING yet.
+ *
+ * @note Both are estimated as TCP does (RFC 6298): the smoothed RTT
+ * follows each new sample by 1/8, and the variation follows the
+ * difference between both by 1/4. Either pointer may be NULL.
+ */
+int ws_get_rtt(ws_cli_conn_t client, uint32_t *rtt, uint32_t *jitter)
+{
+	struct ws_connection *cli;
+	uint32_t srtt;
+	uint32_t rttvar;
+
+	cli = get_client_by_cid(client);
+	if (!CLIENT_VALID(cli))
+		return (-1);
+
+	/* clang-format off */
+	pthread_mutex_lock(&cli->cold->mtx_ping);
+		srtt   = cli->cold->srtt;
+		rttvar = cli->cold->rttvar;
+	pthread_mutex_unlock(&cli->cold->mtx_ping);
+	/* clang-format on */
+
+	if (!srtt)
+		return (-1);
+
+	if (rtt)
+		*rtt = srtt;
+	if (jitter)
+		*jitter = rttvar;
+	return (0);
+}
+
+/**
+ * @brief Sends a WebSocket text frame.
+ *
+ * @param client Target to be send.
+ * @param msg    Message to be send, null terminated.
+ *
+ * @return Returns the number of bytes written, -1 if error.
+ */
+int ws_sendframe_txt(ws_cli_conn_t client, const char *msg)
+{
+	return ws_sendframe(client, msg, (uint64_t)strlen(msg), WS_FR_OP_TXT);
+}
+
+/**
+ * @brief Sends a broadcast WebSocket text frame.
+ *
+ * @param port Server listen port to broadcast message.
+ * @param msg  Message to be send, null terminated.
+ *
+ * @return Returns the number of bytes written, -1 if error.
+ */
+int ws_sendframe_txt_bcast(uint16_t port, const char *msg)
+{
+	return ws_sendframe_bcast(port, msg, (uint64_t)strlen(msg), WS_FR_OP_TXT);
+}
+
+/**
+ * @brief Sends a WebSocket binary frame.
+ *
+ * @param client Target to be send.
+ * @param msg    Message to be send.
+ * @param size   Binary message size.
+ *
+ * @return Returns the number of bytes written, -1 if error.
+ */
+int ws_sendframe_bin(ws_cli_conn_t client, const char *msg, uint64_t size)
+{
+	return ws_sendframe(client, msg, size, WS_FR_OP_BIN);
+}
+
+/**
+ * @brief Sends a broadcast WebSocket binary frame.
+ *
+ * @param port Server listen port to broadcast message.
+ * @param msg  Message to be send.
+ * @param size Binary message size.
+ *
+ * @return Returns the number of bytes written, -1 if error.
+ */
+int ws_sendframe_bin_bcast(uint16_t port, const char *msg, uint64_t size)
+{
+	return ws_sendframe_bcast(port, msg, size, WS_FR_OP_BIN);
+}
+
+/**
+ * @brief For a given @p client, gets the current state for
+ * the connection, or -1 if invalid.
+ *
+ * @param client Client connection.
+ *
+ * @return Returns the connection state or -1 if
+ * invalid @p client.
+ *
+ * @see WS_STATE_CONNECTING
+ * @see WS_STATE_OPEN
+ * @see WS_STATE_CLOSING
+ * @see WS_STATE_CLOSED
+ */
+int ws_get_state(ws_cli_conn_t client)
+{
+	struct ws_connection *cli = get_client_by_cid(client);
+	if (!CLIENT_VALID(cli))
+		return -1;
+	return (get_client_state(cli));
+}
+
+/**
+ * @brief Gets the handshake request of a given @p client, only
+ * available from its onhandshake and onopen events.
+ *
+ * @param client Client connection.
+ *
+ * @return Returns the frame data holding the parsed request, or
+ * NULL if not available.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static struct ws_frame_data *get_handshake_req(ws_cli_conn_t client)
+{
+	struct ws_connection *cli = get_client_by_cid(client);
+	if (!CLIENT_VALID(cli))
+		return (NULL);
+	return (cli->cold->hs_wfd);
+}
+
+/**
+ * @brief Gets the request target (path and query) of the handshake
+ * request of a given @p client.
+ *
+ * @param client Client connection.
+ * @param len If not NULL, stores the target length.
+ *
+ * @return Returns the target (NUL-terminated), or NULL if the request
+ * is not available.
+ *
+ * @note The handshake request is only available from the
+ * onhandshake and onopen events, and is discarded afterwards.
+ */
+const char *ws_get_path(ws_cli_conn_t client, size_t *len)
+{
+	struct ws_frame_data *wfd = get_handshake_req(client);
+	if (!wfd)
+		return (NULL);
+
+	if (len)
+		*len = wfd->hs.plen;
+	return ((const char *)wfd->frm + wfd->hs.path);
+}
+
+/**
+ * @brief Gets the value of the first header field named @p name
+ * (case insensitive) of the handshake request of a given @p client.
+ *
+ * @param client Client connection.
+ * @param name Field name.
+ * @param len If not NULL, stores the value length.
+ *
+ * @return Returns the value (NUL-terminated, without the surrounding
+ * spaces), or NULL if not found or if the request is not available.
+ *
+ * @note The handshake request is only available from the
+ * onhandshake and onopen events, and is discarded afterwards.
+ */
+const char *ws_get_header(ws_cli_conn_t client, const char *name,
+	size_t *len)
+{
+	struct ws_frame_data *wfd; /* Frame data.   */
+	struct http_header *h;     /* Header field. */
+	int i;                     /* Loop index.   */
+
+	wfd = get_handshake_req(client);
+	if (!wfd || !name)
+		return (NULL);
+
+	for (i = 0; i < wfd->hs.nhdrs; i++)
+	{
+		h = &wfd->hs.hdrs[i];
+		if (!strcasecmp((const char *)wfd->frm + h->name, name))
+		{
+			if (len)
+				*len = h->vlen;
+			return ((const char *)wfd->frm + h->value);
+		}
+	}
+	return (NULL);
+}
+
+/**
+ * @brief Fills @p hdrs with (up to @p max) header fields of the
+ * handshake request of a given @p client, in order: they point into
+ * the request itself, nothing is copied.
+ *
+ * @param client Client connection.
+ * @param hdrs Header fields view.
+ * @param max Max amount of header fields to fill.
+ *
+ * @return Returns the amount of header fields in the request (which
+ * may be greater than @p max), or -1 if the request is not available.
+ *
+ * @note The handshake request is only available from the
+ * onhandshake and onopen events, and is discarded afterwards.
+ */
+int ws_get_headers(ws_cli_conn_t client, struct ws_header *hdrs, int max)
+{
+	struct ws_frame_data *wfd; /* Frame data.   */
+	struct http_header *h;     /* Header field. */
+	int i;                     /* Loop index.   */
+
+	wfd = get_handshake_req(client);
+	if (!wfd)
+		return (-1);
+
+	for (i = 0; hdrs && i < max && i < wfd->hs.nhdrs; i++)
+	{
+		h = &wfd->hs.hdrs[i];
+		hdrs[i].name      = (const char *)wfd->frm + h->name;
+		hdrs[i].value     = (const char *)wfd->frm + h->value;
+		hdrs[i].name_len  = h->nlen;
+		hdrs[i].value_len = h->vlen;
+	}
+	return (wfd->hs.nhdrs);
+}
+
+/**
+ * @brief Checks if the handshake request of a given @p client
+ * offers the subprotocol @p proto (in any Sec-WebSocket-Protocol
+ * field).
+ *
+ * @param client Client connection.
+ * @param proto Subprotocol name.
+ *
+ * @return Returns 1 if offered, 0 if not or if the request is not
+ * available.
+ *
+ * @note The handshake request is only available from the
+ * onhandshake and onopen events, and is discarded afterwards.
+ */
+int ws_has_subprotocol(ws_cli_conn_t client, const char *proto)
+{
+	struct ws_frame_data *wfd; /* Frame data.   */
+	struct http_header *h;     /* Header field. */
+	int i;                     /* Loop index.   */
+
+	wfd = get_handshake_req(client);
+	if (!wfd || !proto || !*proto)
+		return (0);
+
+	for (i = 0; i < wfd->hs.nhdrs; i++)
+	{
+		h = &wfd->hs.hdrs[i];
+		if (h->id == HTTP_HDR_WS_PROTO &&
+			http_list_has((const char *)wfd->frm + h->value, proto))
+		{
+			return (1);
+		}
+	}
+	return (0);
+}
+
+/**
+ * @brief Close the client connection for the given @p
+ * client with normal close code (1000) and no reason
+ * string.
+ *
+ * @param client Client connection.
+ *
+ * @return Returns 0 on success, -1 otherwise.
+ *
+ * @note If the client did not send a close frame in
+ * TIMEOUT_MS milliseconds, the server will close the
+ * connection with error code (1002).
+ */
+int ws_close_client(ws_cli_conn_t client)
+{
+	struct ws_connection *cli = get_client_by_cid(client);
+
+	unsigned char clse_code[2];
+	int cc;
+
+	/* Check if client is a valid and connected client. */
+	if (!CLIENT_VALID(cli) || cli->client_sock == -1)
+		return (-1);
+
+	/*
+	 * Instead of using do_close(), we use this to avoid using
+	 * msg_ctrl buffer from wfd and avoid a race condition
+	 * if this is invoked asynchronously.
+	 */
+	cc = WS_CLSE_NORMAL;
+	clse_code[0] = (cc >> 8);
+	clse_code[1] = (cc & 0xFF);
+	if (ws_sendframe(
+			client, (const char *)clse_code, sizeof(char) * 2, WS_FR_OP_CLSE) < 0)
+	{
+		DEBUG("An error has occurred while sending closing frame!\n");
+		return (-1);
+	}
+
+	/*
+	 * Arms the close time-out: if the client did not send
+	 * a close frame in TIMEOUT_MS milliseconds, the server
+	 * will close the connection with error code (1002).
+	 */
+	start_close_timeout(cli);
+	return (0);
+}
+
+/**
+ * @brief Checks is a given opcode @p frame
+ * belongs to a control frame or not.
+ *
+ * @param frame Frame opcode to be checked.
+ *
+ * @return Returns 1 if is a control frame, 0 otherwise.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static inline int is_control_frame(int frame)
+{
+	return (
+		frame == WS_FR_OP_CLSE || frame == WS_FR_OP_PING || frame == WS_FR_OP_PONG);
+}
+
+/**
+ * @brief Checks is a given opcode @p opcode is valid or not.
+ *
+ * @param opcode Frame opcode to be checked.
+ *
+ * @return Returns 1 if valid, 0 otherwise.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static inline int is_valid_frame(int opcode)
+{
+	return (
+		opcode == WS_FR_OP_TXT  || opcode == WS_FR_OP_BIN  ||
+		opcode == WS_FR_OP_CONT || opcode == WS_FR_OP_PING ||
+		opcode == WS_FR_OP_PONG || opcode == WS_FR_OP_CLSE
+	);
+}
+
+/**
+ * @brief Makes room for more handshake request bytes in the frame
+ * buffer of @p wfd, up to the handshake limit.
+ *
+ * @param wfd Websocket Frame Data.
+ * @param heap Whether the current buffer was allocated (and thus
+ * can be resized) or not.
+ *
+ * @return Returns 0 if success, a negative number otherwise.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int handshake_grow(struct ws_frame_data *wfd, bool heap)
+{
+	unsigned char *frm;
+	size_t size;
+
+	/* The parser fails first if the limit is reached. */
+	size = wfd->frm_size * 2;
+	if (size > wfd->hs.max + 1)
+		size = wfd->hs.max + 1;
+
+	if (heap)
+		frm = realloc(wfd->frm, size);
+	else if ((frm = malloc(size)) != NULL)
+		memcpy(frm, wfd->frm, wfd->amt_read);
+
+	if (!frm)
+	{
+		DEBUG("Cannot allocate memory, requested: %zu\n", size);
+		return (-1);
+	}
+
+	wfd->frm      = frm;
+	wfd->frm_size = size;
+	return (0);
+}
+
+/**
+ * @brief Refuses the handshake request of @p wfd with the HTTP
+ * status code @p status (403 if not a 4xx or 5xx code).
+ *
+ * @param wfd Websocket Frame Data.
+ * @param status HTTP status code.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static void send_handshake_refusal(struct ws_frame_data *wfd, int status)
+{
+	char response[128]; /* Refusal response. */
+	int len;            /* Response length.  */
+
+	if (status < 400 || status > 599)
+		status = 403;
+
+	len = snprintf(response, sizeof(response),
+		"HTTP/1.1 %d %s\r\n"
+		"Connection: close\r\n"
+		"Content-Length: 0\r\n"
+		"\r\n",
+		status, http_reason(status));
+
+	DEBUG("Handshake refused, status: %d\n", status);
+#ifdef AFL_FUZZ
+	(void)wfd;
+#endif
+	SEND(wfd->client, response, (size_t)len);
+}
+
+/**
+ * @brief Answers the handshake request already read (and parsed)
+ * into the frame buffer of @p wfd.
+ *
+ * @param wfd Websocket Frame Data.
+ *
+ * @return Returns 0 if success, a negative number otherwise.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int send_handshake_response(struct ws_frame_data *wfd)
+{
+	char response[WS_HS_RESP_LEN]; /* Handshake response message. */
+	struct pmd_params *want;       /* Wanted deflate parameters.  */
+	struct pmd_params prm;         /* Negotiated parameters.      */
+	const char *proto;             /* Subprotocol chosen.         */
+	int status;                    /* Application answer.         */
+	int len;                       /* Response length.            */
+#ifdef WS_HAS_DEFLATE
+	struct pmd_params cfg;         /* Server deflate parameters.  */
+	struct pmd *pmd;               /* Deflate state.              */
+#endif
+
+	/* Advance our pointers to the first frame. */
+	wfd->cur_pos = wfd->hs.len;
+
+	/* Let the application refuse valid requests before anything else. */
+	proto = NULL;
+	if (wfd->client->srv->ws_srv.evs.onhandshake &&
+		(wfd->hs.flags & HTTP_F_WEBSOCKET) == HTTP_F_WEBSOCKET)
+	{
+		status = wfd->client->srv->ws_srv.evs.onhandshake(
+			wfd->client->client_id, &proto);
+
+		if (!status && proto && (strlen(proto) > WS_HS_PROTO_LEN ||
+			!ws_has_subprotocol(wfd->client->client_id, proto)))
+		{
+			DEBUG("Subprotocol not offered: %s\n", proto);
+			status = 500;
+		}
+
+		if (status)
+		{
+			send_handshake_refusal(wfd, status);
+			return (-1);
+		}
+	}
+
+	/* Get response, negotiating permessage-deflate if wanted. */
+	want = NULL;
+#ifdef WS_HAS_DEFLATE
+	if (wfd->client->srv->ws_srv.deflate)
+	{
+		cfg.server_bits   = wfd->client->srv->ws_srv.deflate_window_bits;
+		cfg.server_no_ctx = wfd->client->srv->ws_srv.deflate_no_context;
+		cfg.client_no_ctx = false;
+		want = &cfg;
+	}
+#endif
+
+	len = get_handshake_response_ext((char *)wfd->frm, &wfd->hs, proto,
+		response, want, &prm);
+	if (len < 0)
+	{
+		DEBUG("Cannot get handshake response, request was: %s\n", wfd->frm);
+		return (-1);
+	}
+
+#ifdef WS_HAS_DEFLATE
+	if (want && prm.server_bits)
+	{
+		pmd = pmd_create(&prm);
+		if (!pmd)
+		{
+			DEBUG("Unable to allocate the permessage-deflate state!\n");
+			return (-1);
+		}
+
+		/* clang-format off */
+		pthread_mutex_lock(&wfd->client->cold->mtx_pmd);
+			__atomic_store_n(&wfd->client->pmd, pmd, __ATOMIC_RELEASE);
+		pthread_mutex_unlock(&wfd->client->cold->mtx_pmd);
+		/* clang-format on */
+	}
+#endif
+
+	/* Valid request. */
+	DEBUG("Handshaked, response: \n"
+		  "------------------------------------\n"
+		  "%s"
+		  "------------------------------------\n",
+		response);
+
+	/* Send handshake. */
+	if (SEND(wfd->client, response, (size_t)len) < 0)
+	{
+		DEBUG("As error has occurred while handshaking!\n");
+		return (-1);
+	}
+
+	/* Change state. */
+	set_client_state(wfd->client, WS_STATE_OPEN);
+
+	/* Start the heartbeat, if any. */
+	if (wfd->client->srv->ws_srv.ping_interval_ms &&
+		timer_add(&wfd->client->cold->tmr_ping,
+			wfd->client->srv->ws_srv.ping_interval_ms) < 0)
+	{
+		DEBUG("Unable to start the heartbeat!\n");
+		return (-1);
+	}
+
+	/* Trigger events. */
+	wfd->client->srv->ws_srv.evs.onopen(wfd->client->client_id);
+	return (0);
+}
+
+/**
+ * @brief Answers the handshake request of @p wfd, keeping the
+ * request available to the application meanwhile (from the
+ * onhandshake and onopen events).
+ *
+ * @param wfd Websocket Frame Data.
+ *
+ * @return Returns 0 if success, a negative number otherwise.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int handle_handshake(struct ws_frame_data *wfd)
+{
+	int ret;
+
+	wfd->client->cold->hs_wfd = wfd;
+	ret = send_handshake_response(wfd);
+	wfd->client->cold->hs_wfd = NULL;
+	return (ret);
+}
+
+/**
+ * @brief Do the handshake process.
+ *
+ * @param wfd Websocket Frame Data.
+ *
+ * @return Returns 0 if success, a negative number otherwise.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int do_handshake(struct ws_frame_data *wfd)
+{
+	unsigned char *frm; /* Initial buffer. */
+	ssize_t n;          /* Read bytes.     */
+	int ret;            /* Parser result.  */
+
+	frm = wfd->frm;
+	http_init(&wfd->hs, wfd->client->srv->ws_srv.handshake_max);
+
+	/* Read until the request is complete, whatever the reads. */
+	do
+	{
+		if (wfd->amt_read == wfd->frm_size - 1 &&
+			handshake_grow(wfd, wfd->frm != frm) < 0)
+		{
+			return (-1);
+		}
+
+		n = RECV(wfd->client, wfd->frm + wfd->amt_read,
+			wfd->frm_size - wfd->amt_read - 1);
+		if (n <= 0)
+			return (-1);
+
+		wfd->amt_read += (size_t)n;
+		ret = http_parse(&wfd->hs, (char *)wfd->frm, wfd->amt_read);
+	} while (ret == HTTP_MORE);
+
+	if (ret != HTTP_DONE)
+	{
+		DEBUG("Invalid handshake request!\n");
+		return (-1);
+	}
+
+	return (handle_handshake(wfd));
+}
+
+/**
+ * @brief Sends a close frame, accordingly with the @p close_code
+ * or the message inside @p wfd.
+ *
+ * @param wfd Websocket Frame Data.
+ * @param close_code Websocket close code.
+ *
+ * @return Returns 0 if success, a negative number otherwise.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int do_close(struct ws_frame_data *wfd, int close_code)
+{
+	int cc; /* Close code.           */
+
+	/* If custom close-code. */
+	if (close_code != -1)
+	{
+		cc = close_code;
+		goto custom_close;
+	}
+
+	/* If empty or have a close reason, just re-send. */
+	if (wfd->frame_size == 0 || wfd->frame_size > 2)
+		goto send;
+
+	/* Parse close code and check if valid, if not, we issue an protocol error.
+	 */
+	if (wfd->frame_size == 1)
+		cc = wfd->msg_ctrl[0];
+	else
+		cc = ((int)wfd->msg_ctrl[0]) << 8 | wfd->msg_ctrl[1];
+
+	/* Check if it's not valid, if so, we send a protocol error (1002). */
+	if ((cc < 1000 || cc > 1003) && (cc < 1007 || cc > 1011) &&
+		(cc < 3000 || cc > 4999))
+	{
+		cc = WS_CLSE_PROTERR;
+
+	custom_close:
+		wfd->msg_ctrl[0] = (cc >> 8);
+		wfd->msg_ctrl[1] = (cc & 0xFF);
+
+		if (ws_sendframe(wfd->client->client_id, (const char *)wfd->msg_ctrl, sizeof(char) * 2,
+				WS_FR_OP_CLSE) < 0)
+		{
+			DEBUG("An error has occurred while sending closing frame!\n");
+			return (-1);
+		}
+		return (0);
+	}
+
+	/* Send the data inside wfd->msg_ctrl. */
+send:
+	if (ws_sendframe(wfd->client->client_id, (const char *)wfd->msg_ctrl, wfd->frame_size,
+			WS_FR_OP_CLSE) < 0)
+	{
+		DEBUG("An error has occurred while sending closing frame!\n");
+		return (-1);
+	}
+	return (0);
+}
+
+/**
+ * @brief Send a pong frame in response to a ping frame.
+ *
+ * Accordingly to the RFC, a pong frame must have the same
+ * data payload as the ping frame, so we just send a
+ * ordinary frame with PONG opcode.
+ *
+ * @param wfd Websocket frame data.
+ *
+ * @param frame_size Pong frame size.
+ *
+ * @return Returns 0 if success and a negative number
+ * otherwise.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int do_pong(struct ws_frame_data *wfd, uint64_t frame_size)
+{
+	if (ws_sendframe(
+			wfd->client->client_id, (const char *)wfd->msg_ctrl, frame_size, WS_FR_OP_PONG) < 0)
+	{
+		wfd->error = 1;
+		DEBUG("An error has occurred while ponging!\n");
+		return (-1);
+	}
+	return (0);
+}
+
+/**
+ * @brief Makes sure that at least @p n (up to the frame buffer
+ * size) unparsed bytes are buffered in @p wfd, reading more if
+ * needed.
+ *
+ * @param wfd Websocket Frame Data.
+ * @param n Amount of bytes needed.
+ *
+ * @return Returns 0 if success, a negative number otherwise.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int frame_fill(struct ws_frame_data *wfd, size_t n)
+{
+	ssize_t r;
+
+	if (wfd->amt_read - wfd->cur_pos >= n)
+		return (0);
+
+	/*
+	 * Event loop connections only parse frames that are
+	 * already buffered, there is nothing else to read.
+	 */
+	if (wfd->client->srv->ws_srv.io_model != WS_IO_THREADS)
+	{
+		wfd->error = 1;
+		return (-1);
+	}
+
+	/* Keep the bytes not parsed yet at the buffer start. */
+	wfd->amt_read -= wfd->cur_pos;
+	memmove(wfd->frm, wfd->frm + wfd->cur_pos, wfd->amt_read);
+	wfd->cur_pos = 0;
+
+	while (wfd->amt_read < n)
+	{
+		r = RECV(wfd->client, wfd->frm + wfd->amt_read,
+			wfd->frm_size - wfd->amt_read);
+
+		if (r <= 0)
+		{
+			wfd->error = 1;
+			DEBUG("An error has occurred while trying to read the frame\n");
+			return (-1);
+		}
+		wfd->amt_read += (size_t)r;
+	}
+	return (0);
+}
+
+/**
+ * @brief Reads (and unmasks) @p len payload bytes into @p dst.
+ *
+ * The bytes already buffered are unmasked straight from the
+ * frame buffer, and the remaining ones (thread I/O model only)
+ * are read directly into @p dst, without passing through the
+ * frame buffer.
+ *
+ * @param wfd Websocket Frame Data.
+ * @param dst Destination buffer.
+ * @param len Amount of bytes.
+ * @param masks Frame masks.
+ *
+ * @return Returns 0 if success, a negative number otherwise.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int read_payload(struct ws_frame_data *wfd, unsigned char *dst,
+	uint64_t len, const uint8_t *masks)
+{
+	uint64_t done; /* Bytes read so far.  */
+	size_t avail;  /* Bytes buffered.     */
+	ssize_t r;     /* Bytes just received. */
+
+	avail = wfd->amt_read - wfd->cur_pos;
+	done  = (len < avail) ? len : avail;
+
+	mask_xor(dst, wfd->frm + wfd->cur_pos, (size_t)done, masks, 0);
+	wfd->cur_pos += (size_t)done;
+
+	if (done == len)
+		return (0);
+
+	if (wfd->client->srv->ws_srv.io_model != WS_IO_THREADS)
+	{
+		wfd->error = 1;
+		return (-1);
+	}
+
+	/* Large payload: read the rest directly into its destination. */
+	avail = (size_t)done;
+	while (done < len)
+	{
+		r = RECV(wfd->client, dst + done, (size_t)(len - done));
+		if (r <= 0)
+		{
+			wfd->error = 1;
+			DEBUG("An error has occurred while trying to read the frame\n");
+			return (-1);
+		}
+		done += (uint64_t)r;
+	}
+
+	mask_xor(dst + avail, dst + avail, (size_t)(len - avail), masks, avail);
+	return (0);
+}
+
+/**
+ * @brief Skips @p frame_size bytes of the current frame.
+ *
+ * @param wfd Websocket Frame Data.
+ * @param frame_size Amount of bytes to be skipped.
+ *
+ * @return Returns 0 if success, a negative number
+ * otherwise.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int skip_frame(struct ws_frame_data *wfd, uint64_t frame_size)
+{
+	size_t n;
+	while (frame_size)
+	{
+		if (frame_fill(wfd, 1) < 0)
+			return (-1);
+
+		n = wfd->amt_read - wfd->cur_pos;
+		if (n > frame_size)
+			n = (size_t)frame_size;
+
+		wfd->cur_pos += n;
+		frame_size   -= n;
+	}
+	return (0);
+}
+
+/**
+ * @brief Adds two uint64_t numbers detecting overflow.
+ *
+ * @param a Left operand.
+ * @param b Right operand.
+ * @param out Result pointer.
+ *
+ * @return Returns true if there is no overflow, false otherwise.
+ */
+static bool checked_add_u64(uint64_t a, uint64_t b, uint64_t *out)
+{
+	if (a > UINT64_MAX - b)
+		return (false);
+	*out = a + b;
+	return (true);
+}
+
+
+/**
+ * @brief Validates TXT frames if UTF8 validation is enabled.
+ * If the content is not valid, the connection is aborted.
+ *
+ * @param wfd WebSocket frame data.
+ * @param fsd Frame state data.
+ *
+ * @return Always 0.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int validate_utf8_txt(struct ws_frame_data *wfd,
+	struct frame_state_data *fsd)
+{
+#ifdef VALIDATE_UTF8
+	/* UTF-8 Validate partial (or not) frame. */
+	if (wfd->frame_type != WS_FR_OP_TXT)
+		return (0);
+
+	if (fsd->is_fin)
+	{
+		if (utf8_validate_state(
+			fsd->msg_data + (fsd->msg_idx_data - fsd->frame_length),
+			fsd->frame_length, fsd->utf8_state) != UTF8_ACCEPT)
+		{
+			DEBUG("Dropping invalid complete message!\n");
+			wfd->error = 1;
+			do_close(wfd, WS_CLSE_INVUTF8);
+		}
+
+		return (0);
+	}
+
+	/* Check current state for a CONT or initial TXT frame. */
+	fsd->utf8_state =
+		utf8_validate_state(fsd->msg_data +
+			(fsd->msg_idx_data - fsd->frame_length),
+			fsd->frame_length, fsd->utf8_state);
+
+	/* We can be in any state, except reject. */
+	if (fsd->utf8_state == UTF8_REJECT)
+	{
+		DEBUG("Dropping invalid cont/initial frame!\n");
+		wfd->error = 1;
+		do_close(wfd, WS_CLSE_INVUTF8);
+	}
+#endif
+	return (0);
+}
+
+/**
+ * @brief Updates the RTT estimation of a given client (whose cold
+ * part is @p cold) with a new sample @p rtt, as TCP does (RFC 6298).
+ *
+ * @param cold Client connection, cold part.
+ * @param rtt RTT sample, in microseconds.
+ *
+ * @note Must be called with the ping lock held.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static void rtt_update(struct ws_conn_cold *cold, uint64_t rtt)
+{
+	int64_t delta;
+
+	if (rtt > UINT32_MAX)
+		rtt = UINT32_MAX;
+	if (!rtt)
+		rtt = 1;
+
+	/* First sample. */
+	if (!cold->srtt)
+	{
+		cold->srtt   = (uint32_t)rtt;
+		cold->rttvar = (uint32_t)(rtt / 2);
+		return;
+	}
+
+	delta = (int64_t)rtt - cold->srtt;
+	cold->rttvar = (uint32_t)((int64_t)cold->rttvar +
+		((delta < 0 ? -delta : delta) - (int64_t)cold->rttvar) / 4);
+	cold->srtt = (uint32_t)((int64_t)cold->srtt + delta / 8);
+	if (!cold->srtt)
+		cold->srtt = 1;
+}
+
+/**
+ * @brief Handle PONG frames in response to our PING
+ * (or not, unsolicited is possible too), measuring the
+ * round-trip time.
+ *
+ * @param wfd WebSocket frame data.
+ * @param fsd Frame state data.
+ *
+ * @return Always 0.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int handle_pong_frame(struct ws_frame_data *wfd,
+	struct frame_state_data *fsd)
+{
+	struct ws_conn_cold *cold = wfd->client->cold;
+
+	fsd->is_fin = 0;
+
+	/* If there is no content and/or differs the size, ignore it. */
+	if (fsd->frame_size != sizeof(cold->last_pong_id))
+		return (0);
+
+	/*
+	 * Our PONG id should be positive and smaller than our
+	 * current PING id. If not, ignore.
+	 */
+	/* clang-format off */
+	pthread_mutex_lock(&cold->mtx_ping);
+		fsd->pong_id = pong_msg_to_int32(fsd->msg_ctrl);
+		if (fsd->pong_id < 0 || fsd->pong_id > cold->current_ping_id)
+		{
+			pthread_mutex_unlock(&cold->mtx_ping);
+			return (0);
+		}
+
+		/* First PONG to a recent PING: measure the RTT. */
+		if (fsd->pong_id > cold->last_pong_id &&
+			cold->current_ping_id - fsd->pong_id < WS_PING_TS)
+		{
+			rtt_update(cold, now_us() -
+				cold->ping_ts[fsd->pong_id & (WS_PING_TS - 1)]);
+		}
+
+		cold->last_pong_id = fsd->pong_id;
+	pthread_mutex_unlock(&cold->mtx_ping);
+	/* clang-format on */
+
+	return (0);
+}
+
+/**
+ * @brief Handle PING frames sending a PONG response.
+ *
+ * @param wfd WebSocket frame data.
+ * @param fsd Frame state data.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int handle_ping_frame(struct ws_frame_data *wfd,
+	struct frame_state_data *fsd)
+{
+	if (do_pong(wfd, fsd->frame_size) < 0)
+		return (-1);
+
+	/* Quick hack to keep our loop. */
+	fsd->is_fin = 0;
+	return (0);
+}
+
+/**
+ * @brief Handle close frames while checking for UTF8
+ * in the close reason.
+ *
+ * @param wfd WebSocket frame data.
+ * @param fsd Frame state data.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int handle_close_frame(struct ws_frame_data *wfd,
+	struct frame_state_data *fsd)
+{
+#ifdef VALIDATE_UTF8
+	/* If there is a close reason, check if it is UTF-8 valid. */
+	if (fsd->frame_size > 2 &&
+		!is_utf8_len(fsd->msg_ctrl + 2, fsd->frame_size - 2))
+	{
+		DEBUG("Invalid close frame payload reason! (not UTF-8)\n");
+		wfd->error = 1;
+		return (-1);
+	}
+#endif
+
+	/*
+	 * Since we're aborting, we can scratch the 'data'-related
+	 * vars here.
+	 */
+	wfd->frame_size = fsd->frame_size;
+	wfd->frame_type = WS_FR_OP_CLSE;
+	free(fsd->msg_data);
+	fsd->msg_data = NULL;
+	return (0);
+}
+
+/**
+ * @brief Delivers a chunk of the streamed message being received
+ * in @p wfd, validating it first, if text.
+ *
+ * @param wfd Websocket Frame Data.
+ * @param data Unmasked payload bytes.
+ * @param len Amount of bytes.
+ * @param last Whether this is the last chunk of the message.
+ *
+ * @return Returns 0 if success, a negative number otherwise (and the
+ * connection is being closed).
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int stream_chunk(struct ws_frame_data *wfd, const unsigned char *data,
+	size_t len, bool last)
+{
+	struct frame_state_data *fsd = &wfd->fsd;
+	struct ws_connection *client = wfd->client;
+
+#ifdef VALIDATE_UTF8
+	/* The message must be valid so far, and complete in the end. */
+	if (wfd->frame_type == WS_FR_OP_TXT)
+	{
+		fsd->utf8_state = utf8_validate_state(data, len, fsd->utf8_state);
+		if (fsd->utf8_state == UTF8_REJECT ||
+			(last && fsd->utf8_state != UTF8_ACCEPT))
+		{
+			DEBUG("Dropping invalid streamed message!\n");
+			wfd->error = 1;
+			do_close(wfd, WS_CLSE_INVUTF8);
+			return (-1);
+		}
+	}
+#endif
+
+	client->srv->ws_srv.evs.onmessage_chunk(client->client_id, data, len,
+		wfd->frame_type, !fsd->stream_sent, last);
+
+	fsd->stream_sent = 1;
+	return (0);
+}
+
+/**
+ * @brief Unmasks and delivers the payload of the current (streamed)
+ * data frame, as it arrives, straight from the frame buffer.
+ *
+ * With the thread I/O model, reads until the frame ends; the event
+ * loops deliver what is buffered and resume on the next read.
+ *
+ * @param wfd Websocket Frame Data.
+ * @param fsd Frame state data.
+ *
+ * @return Returns 0 if success, a negative number otherwise.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int stream_payload(struct ws_frame_data *wfd,
+	struct frame_state_data *fsd)
+{
+	unsigned char *data; /* Chunk start.      */
+	size_t n;            /* Chunk size.       */
+	ssize_t r;           /* Bytes received.   */
+	bool last;           /* Last chunk flag.  */
+
+	do
+	{
+		n = wfd->amt_read - wfd->cur_pos;
+		if (!n && fsd->stream_left)
+		{
+			if (wfd->client->srv->ws_srv.io_model != WS_IO_THREADS)
+				return (0);
+
+			/* Everything buffered was consumed, start over. */
+			r = RECV(wfd->client, wfd->frm, wfd->frm_size);
+			if (r <= 0)
+			{
+				wfd->error = 1;
+				DEBUG("An error has occurred while trying to read the frame\n");
+				return (-1);
+			}
+			wfd->cur_pos  = 0;
+			wfd->amt_read = (size_t)r;
+			n = (size_t)r;
+		}
+
+		if (n > fsd->stream_left)
+			n = (size_t)fsd->stream_left;
+
+		data = wfd->frm + wfd->cur_pos;
+		mask_xor(data, data, n, fsd->masks_data, fsd->stream_off);
+
+		wfd->cur_pos     += n;
+		fsd->stream_left -= n;
+		fsd->stream_off  += n;
+
+		/* Empty frames only matter if they end the message. */
+		last = fsd->is_fin && !fsd->stream_left;
+		if (!n && !last)
+			break;
+
+		if (stream_chunk(wfd, data, n, last) < 0)
+			return (-1);
+	} while (fsd->stream_left);
+
+	return (0);
+}
+
+/**
+ * @brief Reads the current frame isolating data from control frames.
+ * The parameters are changed in order to reflect the current state.
+ *
+ * @param wfd Websocket Frame Data.
+ * @param fsd Frame state data.
+ *
+ * @return Returns 0 if success, a negative number otherwise.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int read_single_frame(struct ws_frame_data *wfd,
+	struct frame_state_data *fsd)
+{
+	uint64_t *frame_size;    /* Curr frame size. */
+	uint64_t next_size = 0;  /* Checked next sz. */
+	uint64_t alloc_size = 0; /* Checked alloc sz.*/
+	unsigned char *tmp;      /* Tmp message.     */
+	unsigned char *msg;      /* Current message. */
+	uint64_t *msg_idx;       /* Message index.   */
+	uint8_t *masks;          /* Current mask.    */
+	unsigned char *frm;      /* Frame header.    */
+	size_t hdr;              /* Header length.   */
+	bool stream;             /* Streamed frame.  */
+	int i;                   /* Loop index.      */
+
+	stream = fsd->stream && !is_control_frame(fsd->opcode);
+
+	/* Decide which mask and msg to use. */
+	if (is_control_frame(fsd->opcode)) {
+		frame_size = &fsd->frame_size;
+		msg_idx = &fsd->msg_idx_ctrl;
+		masks   = fsd->masks_ctrl;
+		msg     = fsd->msg_ctrl;
+	}
+	else {
+		frame_size = &wfd->frame_size;
+		msg_idx = &fsd->msg_idx_data;
+		masks   = fsd->masks_data;
+		msg     = fsd->msg_data;
+	}
+
+	/* Extended payload length and masks, parsed in one go. */
+	hdr = 4;
+	if (fsd->frame_length == 126)
+		hdr += 2;
+	else if (fsd->frame_length == 127)
+		hdr += 8;
+
+	if (frame_fill(wfd, hdr) < 0)
+		return (-1);
+
+	frm = wfd->frm + wfd->cur_pos;
+	wfd->cur_pos += hdr;
+
+	/* 16-bit messages. */
+	if (fsd->frame_length == 126)
+	{
+		fsd->frame_length = ((uint64_t)frm[0] << 8) | frm[1];
+		frm += 2;
+	}
+
+	/* 64-bit messages. */
+	else if (fsd->frame_length == 127)
+	{
+		fsd->frame_length = 0;
+		for (i = 0; i < 8; i++)
+			fsd->frame_length = (fsd->frame_length << 8) | frm[i];
+		frm += 8;
+	}
+
+	/*
+	 * Check frame size
+	 *
+	 * We need to limit the amount supported here, since if
+	 * we follow strictly to the RFC, we have to allow 2^64
+	 * bytes. Also keep in mind that this is still true
+	 * for continuation frames. Streamed messages are never
+	 * buffered, so only their overflow matters.
+	 */
+	if (!checked_add_u64(*frame_size, fsd->frame_length, &next_size) ||
+		(next_size > MAX_FRAME_LENGTH && !stream))
+	{
+		DEBUG("Current frame from client %d, exceeds the maximum\n"
+			  "amount of bytes allowed (%" PRId64 "/%d)!",
+			wfd->client->client_sock, next_size,
+			MAX_FRAME_LENGTH);
+
+		/*
+		 * We are rejecting a too-large message (or a wrapped size).
+		 * RFC 6455 suggests code 1009 for this situation.
+		 */
+		do_close(wfd, WS_CLSE_BIGMSG);
+		wfd->error = 1;
+		return (-1);
+	}
+
+	*frame_size = next_size;
+
+	/* Read masks. */
+	memcpy(masks, frm, 4);
+
+	/* Streamed data frames are never buffered. */
+	if (stream)
+	{
+		fsd->stream_left = fsd->frame_length;
+		fsd->stream_off  = 0;
+		return (stream_payload(wfd, fsd));
+	}
+
+	/*
+	 * Allocate memory.
+	 *
+	 * The statement below will allocate a new chunk of memory
+	 * if msg is NULL with size total_length. Otherwise, it will
+	 * resize the total memory accordingly with the message index
+	 * and if the current frame is a FIN frame or not, if so,
+	 * increment the size by 1 to accommodate the line ending \0.
+	 */
+	if (fsd->frame_length > 0)
+	{
+		if (!is_control_frame(fsd->opcode))
+		{
+			if (!checked_add_u64(*msg_idx, fsd->frame_length, &alloc_size) ||
+				!checked_add_u64(alloc_size, fsd->is_fin, &alloc_size) ||
+				alloc_size > MAX_FRAME_LENGTH + 1)
+			{
+				DEBUG("Cannot allocate frame data: invalid message size "
+					  "(idx=%" PRId64 ", len=%" PRId64 ", fin=%u)\n",
+					*msg_idx, fsd->frame_length, fsd->is_fin);
+				do_close(wfd, WS_CLSE_BIGMSG);
+				wfd->error = 1;
+				return (-1);
+			}
+
+			tmp = realloc(msg, alloc_size);
+			if (!tmp)
+			{
+				DEBUG("Cannot allocate memory, requested: % " PRId64 "\n",
+					alloc_size);
+
+				do_close(wfd, WS_CLSE_BIGMSG);
+				wfd->error = 1;
+				return (-1);
+			}
+			msg = tmp;
+			fsd->msg_data = msg;
+		}
+
+		/* Copy (and unmask) to the proper location. */
+		if (read_payload(wfd, msg + *msg_idx, fsd->frame_length, masks) < 0)
+			return (-1);
+
+		*msg_idx += fsd->frame_length;
+	}
+
+	/* If we're inside a FIN frame, lets... */
+	if (fsd->is_fin && *frame_size > 0)
+	{
+		/* Increase memory if our FIN frame is of length 0. */
+		if (!fsd->frame_length && !is_control_frame(fsd->opcode))
+		{
+			tmp = realloc(msg, *msg_idx + 1);
+			if (!tmp)
+			{
+				DEBUG("Cannot allocate memory, requested: %" PRId64 "\n",
+					(*msg_idx + 1));
+
+				wfd->error = 1;
+				return (-1);
+			}
+			msg = tmp;
+			fsd->msg_data = msg;
+		}
+		msg[*msg_idx] = '\0';
+	}
+
+	return (0);
+}
+
+#ifdef WS_HAS_DEFLATE
+/**
+ * @brief Decompresses the (complete) compressed message read into
+ * @p wfd, and validates it, if text.
+ *
+ * @param wfd Websocket Frame Data.
+ *
+ * @return Returns 0 if success, a negative number otherwise (and the
+ * connection is being closed).
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int inflate_message(struct ws_frame_data *wfd)
+{
+	struct frame_state_data *fsd = &wfd->fsd;
+	unsigned char *msg;
+	size_t len;
+	int ret;
+
+	ret = pmd_decompress(wfd->client->pmd, fsd->msg_data,
+		(size_t)wfd->frame_size, MAX_FRAME_LENGTH, &msg, &len);
+	if (ret < 0)
+	{
+		DEBUG("Cannot inflate message (%d)!\n", ret);
+		do_close(wfd, ret == -2 ? WS_CLSE_BIGMSG : WS_CLSE_PROTERR);
+		return (-1);
+	}
+
+	free(fsd->msg_data);
+	fsd->msg_data   = msg;
+	msg[len]        = '\0';
+	wfd->frame_size = len;
+
+#ifdef VALIDATE_UTF8
+	if (wfd->frame_type == WS_FR_OP_TXT &&
+		utf8_validate_state(msg, len, UTF8_ACCEPT) != UTF8_ACCEPT)
+	{
+		DEBUG("Dropping invalid complete message!\n");
+		do_close(wfd, WS_CLSE_INVUTF8);
+		return (-1);
+	}
+#endif
+
+	return (0);
+}
+#endif
+
+/**
+ * @brief Prepares the frame state of @p wfd to receive a brand
+ * new message.
+ *
+ * @param wfd Websocket Frame Data.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static void reset_frame_state(struct ws_frame_data *wfd)
+{
+	memset(&wfd->fsd, 0, sizeof(wfd->fsd));
+	wfd->fsd.msg_data = NULL;
+	wfd->fsd.msg_ctrl = wfd->msg_ctrl;
+
+#ifdef VALIDATE_UTF8
+	wfd->fsd.utf8_state = UTF8_ACCEPT;
+#endif
+
+	wfd->frame_size =  0;
+	wfd->frame_type = -1;
+	wfd->msg = NULL;
+}
+
+/**
+ * @brief Reads and handles a single frame, whether if a
+ * TXT/BIN/CONT/CLOSE/PING/PONG frame, continuing the message
+ * being received in @p wfd.
+ *
+ * @param wfd Websocket Frame Data.
+ *
+ * @return Returns 1 if a message (or close frame) is complete, 0
+ * if more frames are needed and a negative number if error.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int next_frame(struct ws_frame_data *wfd)
+{
+	struct frame_state_data *fsd = &wfd->fsd;
+
+	/* Streamed frame being received (event loops only): resume it. */
+	if (fsd->stream_left)
+	{
+		if (stream_payload(wfd, fsd) < 0)
+			goto err;
+		return (!fsd->stream_left && fsd->is_fin);
+	}
+
+	/* First two header bytes: FIN/RSV/opcode and mask/length. */
+	if (frame_fill(wfd, 2) < 0)
+		goto err;
+
+	fsd->cur_byte = wfd->frm[wfd->cur_pos];
+	fsd->mask     = wfd->frm[wfd->cur_pos + 1];
+	wfd->cur_pos += 2;
+
+	fsd->is_fin = (fsd->cur_byte & 0xFF) >> WS_FIN_SHIFT;
+	fsd->opcode = (fsd->cur_byte & 0xF);
+
+	/* Client frames must be masked (RFC 6455, section 5.1). */
+	if (!(fsd->mask & 0x80))
+	{
+		DEBUG("Unmasked frame received!\n");
+		wfd->error = 1;
+		goto err;
+	}
+
+	/*
+	 * Check for RSV field: only RSV1 is allowed, on the first frame
+	 * of a message, and only with permessage-deflate.
+	 */
+	if (fsd->cur_byte & 0x70)
+	{
+#ifdef WS_HAS_DEFLATE
+		if ((fsd->cur_byte & 0x70) == WS_RSV1 && wfd->client->pmd &&
+			(fsd->opcode == WS_FR_OP_TXT || fsd->opcode == WS_FR_OP_BIN))
+		{
+			fsd->compressed = 1;
+		}
+		else
+#endif
+		{
+			DEBUG("RSV is set while not negotiated!\n");
+			wfd->error = 1;
+			goto err;
+		}
+	}
+
+	/*
+	 * Check if the current opcode makes sense:
+	 * a) If we're inside a cont frame but no previous data frame
+	 *
+	 * b) If we're handling a data-frame and receive another data
+	 *    frame. (it's expected to receive only CONT or control
+	 *    frames).
+	 *
+	 * It is worth to note that in a), we do not need to check
+	 * if the previous frame was FIN or not: if was FIN, an
+	 * on_message event was triggered and the frame state was
+	 * reset; so the only possibility here is a previous non-FIN
+	 * data frame, ;-).
+	 */
+	if ((wfd->frame_type == -1 && fsd->opcode == WS_FR_OP_CONT) ||
+		(wfd->frame_type != -1 && !is_control_frame(fsd->opcode) &&
+			fsd->opcode != WS_FR_OP_CONT))
+	{
+		DEBUG("Unexpected frame was received!, opcode: %d, previous: %d\n",
+			fsd->opcode, wfd->frame_type);
+		wfd->error = 1;
+		goto err;
+	}
+
+	/* Check if one of the valid opcodes. */
+	if (!is_valid_frame(fsd->opcode))
+	{
+		DEBUG("Unsupported frame opcode: %d\n", fsd->opcode);
+		/* We should consider as error receive an unknown frame. */
+		wfd->frame_type = fsd->opcode;
+		wfd->error = 1;
+		goto err;
+	}
+
+	/* Check our current state: if CLOSING, we only accept close frames. */
+	if (get_client_state(wfd->client) == WS_STATE_CLOSING &&
+		fsd->opcode != WS_FR_OP_CLSE)
+	{
+		DEBUG("Unexpected frame received, expected CLOSE (%d), "
+			  "received: (%d)",
+			WS_FR_OP_CLSE, fsd->opcode);
+		wfd->error = 1;
+		goto err;
+	}
+
+	/*
+	 * Only change frame type if not a CONT frame, and decide how the
+	 * new message is delivered: compressed ones are always buffered.
+	 */
+	if (fsd->opcode != WS_FR_OP_CONT && !is_control_frame(fsd->opcode))
+	{
+		wfd->frame_type = fsd->opcode;
+		fsd->stream = (wfd->client->srv->ws_srv.evs.onmessage_chunk &&
+			!fsd->compressed);
+	}
+
+	fsd->frame_length = fsd->mask & 0x7F;
+	fsd->frame_size   = 0;
+	fsd->msg_idx_ctrl = 0;
+
+	/*
+	 * We should deny non-FIN control frames or that have
+	 * more than 125 octets.
+	 */
+	if (is_control_frame(fsd->opcode) &&
+		(!fsd->is_fin || fsd->frame_length > 125))
+	{
+		DEBUG("Control frame bigger than 125 octets or not a FIN "
+			  "frame!\n");
+		wfd->error = 1;
+		goto err;
+	}
+
+	/* Read a single frame, and then handle accordingly. */
+	if (read_single_frame(wfd, fsd) < 0)
+		goto err;
+
+	/* Handle each frame
+	 * Obs: If BIN, nothing should be done unless we got
+	 * a FIN-frame.
+	 */
+	switch (fsd->opcode) {
+		/* UTF-8 Validate partial (or not) frame. */
+		case WS_FR_OP_CONT:
+		case WS_FR_OP_TXT: {
+			/*
+			 * Compressed messages are validated once inflated, and
+			 * streamed ones chunk by chunk.
+			 */
+			if (!fsd->compressed && !fsd->stream)
+				validate_utf8_txt(wfd, fsd);
+			break;
+		}
+		/*
+		 * We _may_ send a PING frame if the ws_ping() routine was invoked.
+		 *
+		 * If the content is invalid and/or differs the size, ignore it.
+		 * (maybe unsolicited PONG).
+		 */
+		case WS_FR_OP_PONG: {
+			handle_pong_frame(wfd, fsd);
+			return (0);
+		}
+		/* We should answer to a PING frame as soon as possible. */
+		case WS_FR_OP_PING: {
+			if (handle_ping_frame(wfd, fsd) < 0)
+				goto err;
+			return (0);
+		}
+		/* We interrupt the loop as soon as we find a CLOSE frame. */
+		case WS_FR_OP_CLSE: {
+			if (handle_close_frame(wfd, fsd) < 0)
+				goto err;
+			return (1);
+		}
+	}
+
+	/* Check for error. */
+	if (wfd->error)
+		goto err;
+
+	if (!fsd->is_fin || fsd->stream_left)
+		return (0);
+
+#ifdef WS_HAS_DEFLATE
+	if (fsd->compressed && inflate_message(wfd) < 0)
+		goto err;
+#endif
+
+	wfd->msg = fsd->msg_data;
+	fsd->msg_data = NULL;
+	return (1);
+
+err:
+	wfd->error = 1;
+	free(fsd->msg_data);
+	fsd->msg_data = NULL;
+	wfd->msg = NULL;
+	return (-1);
+}
+
+/**
+ * @brief Reads the next frame, whether if a TXT/BIN/CLOSE
+ * of arbitrary size.
+ *
+ * @param wfd Websocket Frame Data.
+ *
+ * @return Returns 0 if success, a negative number otherwise.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int next_complete_frame(struct ws_frame_data *wfd)
+{
+	int ret;
+
+	reset_frame_state(wfd);
+
+	/* Read until find a FIN or a unsupported frame. */
+	while ((ret = next_frame(wfd)) == 0)
+		;
+
+	return (ret < 0 ? -1 : 0);
+}
+
+/**
+ * @brief Triggers the events for a complete message (or close
+ * frame) read into @p wfd and releases it.
+ *
+ * @param wfd Websocket Frame Data.
+ *
+ * @return Returns 0 if the connection should keep going, or
+ * -1 if it should be closed.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int handle_message(struct ws_frame_data *wfd)
+{
+	struct ws_connection *client = wfd->client;
+
+	/*
+	 * Text/binary event: streamed messages were already delivered,
+	 * the compressed ones are delivered as a single chunk.
+	 */
+	if ((wfd->frame_type == WS_FR_OP_TXT ||
+		wfd->frame_type == WS_FR_OP_BIN) && !wfd->error)
+	{
+		if (!client->srv->ws_srv.evs.onmessage_chunk)
+		{
+			client->srv->ws_srv.evs.onmessage(client->client_id, wfd->msg,
+				wfd->frame_size, wfd->frame_type);
+		}
+		else if (!wfd->fsd.stream)
+		{
+			client->srv->ws_srv.evs.onmessage_chunk(client->client_id, wfd->msg,
+				wfd->frame_size, wfd->frame_type, 1, 1);
+		}
+	}
+
+	/* Close event. */
+	else if (wfd->frame_type == WS_FR_OP_CLSE && !wfd->error)
+	{
+		/*
+		 * We only send a CLOSE frame once, if we're already
+		 * in CLOSING state, there is no need to send.
+		 */
+		if (get_client_state(client) != WS_STATE_CLOSING)
+		{
+			set_client_state(client, WS_STATE_CLOSING);
+
+			/* We only send a close frameSend close frame */
+			do_close(wfd, -1);
+		}
+
+		free(wfd->msg);
+		wfd->msg = NULL;
+		return (-1);
+	}
+
+	free(wfd->msg);
+	wfd->msg = NULL;
+	return (0);
+}
+
+/**
+ * @brief Releases a client connection that is no longer being
+ * served: cancels the close time-out (if any) and closes the
+ * connection properly.
+ *
+ * @param client Client connection.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static void finish_client(struct ws_connection *client)
+{
+	bool clse_tmr; /* Close time-out armed. */
+	bool snd_thrd; /* Send queue writer.    */
+	bool pending;  /* Data still queued.    */
+
+	/*
+	 * Let the send queue writer (if any) send what is still
+	 * queued, up to the close time-out.
+	 */
+	/* clang-format off */
+	pthread_mutex_lock(&client->mtx_snd);
+		client->closing = true;
+		snd_thrd = client->snd_thrd;
+		pending  = (client->snd_head != NULL);
+		pthread_cond_signal(&client->cold->cnd_snd);
+	pthread_mutex_unlock(&client->mtx_snd);
+	/* clang-format on */
+
+	if (snd_thrd)
+	{
+		if (pending)
+		{
+			pthread_mutex_lock(&client->cold->mtx_state);
+			arm_close_timeout(client);
+			pthread_mutex_unlock(&client->cold->mtx_state);
+		}
+		pthread_join(client->cold->thrd_snd, NULL);
+	}
+
+	/*
+	 * Mark as closed first, so that the close time-out (if
+	 * any) does nothing if it expires meanwhile.
+	 */
+	/* clang-format off */
+	pthread_mutex_lock(&client->cold->mtx_state);
+		clse_tmr = client->cold->close_armed;
+		__atomic_store_n(&client->state, WS_STATE_CLOSED, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&client->cold->mtx_state);
+	/* clang-format on */
+
+	/* Cancel it (or wait for it, if expiring right now). */
+	if (clse_tmr)
+		timer_cancel(&client->cold->tmr_close);
+
+	/* Stop the heartbeat, if any. */
+	if (client->srv->ws_srv.ping_interval_ms)
+		timer_cancel(&client->cold->tmr_ping);
+
+	/* Close connection properly. */
+	DEBUG("Closing: normal close\n");
+	close_client(client, 1);
+}
+
+/**
+ * @brief Establishes to connection with the client and trigger
+ * events when occurs one.
+ *
+ * @param vclient Client connection.
+ *
+ * @return Returns @p vclient.
+ *
+ * @note This will be run on a different thread.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static void *ws_establishconnection(void *vclient)
+{
+	unsigned char frm[MESSAGE_LENGTH]; /* Frame read buffer.      */
+	struct ws_frame_data wfd;          /* WebSocket frame data.   */
+	struct ws_connection *client;      /* Client structure.       */
+
+	client = vclient;
+
+	/* Prepare frame data. */
+	memset(&wfd, 0, sizeof(wfd));
+	wfd.frm      = frm;
+	wfd.frm_size = sizeof(frm);
+	wfd.client   = client;
+
+	/* Do handshake. */
+	if (do_handshake(&wfd) < 0)
+		goto closed;
+
+	/* Read next frame until client disconnects or an error occur. */
+	while (next_complete_frame(&wfd) >= 0)
+		if (handle_message(&wfd) < 0)
+			break;
+
+	/*
+	 * on_close events always occur, whether for client closure
+	 * or server closure, as the server is expected to
+	 * always know when the client disconnects.
+	 */
+	client->srv->ws_srv.evs.onclose(client->client_id);
+
+closed:
+	/* A large handshake request moves the buffer to the heap. */
+	if (wfd.frm != frm)
+		free(wfd.frm);
+
+	finish_client(client);
+	return (vclient);
+}
+
+#ifdef WS_HAS_EPOLL
+/**
+ * @brief Maximum amount of events handled per epoll_wait().
+ */
+#define WS_EVLOOP_EVENTS 64
+
+#ifdef WS_HAS_URING
+/**
+ * @name io_uring event loops parameters (WS_IO_URING)
+ */
+/**@{*/
+/**
+ * @brief Submission queue size, per event loop.
+ */
+#define WS_URING_ENTRIES 256
+/**
+ * @brief Amount of provided buffers used by the multishot receives,
+ * per event loop (must be a power of 2).
+ */
+#define WS_URING_RECV_BUFS 256
+/**
+ * @brief Size of each provided buffer.
+ */
+#define WS_URING_RECV_BUF_SIZE 4096
+/**@}*/
+
+/**
+ * @name io_uring requests tags, kept in the lower bits of the
+ * 'user_data' field, alongside the client pointer.
+ */
+/**@{*/
+#define WS_URING_RECV     0
+#define WS_URING_SEND     1
+#define WS_URING_TOUT     2
+#define WS_URING_TAG_MASK 3
+/**@}*/
+#endif
+
+/**
+ * @brief Checks if the frame starting with the byte @p b0 is a
+ * data frame whose payload is streamed (see onmessage_chunk).
+ *
+ * @param wfd Websocket Frame Data.
+ * @param b0 First frame byte (FIN/RSV/opcode).
+ *
+ * @return Returns true if streamed, false otherwise.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static bool frame_streamed(struct ws_frame_data *wfd, uint8_t b0)
+{
+	int opcode = b0 & 0xF;
+
+	if (opcode == WS_FR_OP_CONT)
+		return (wfd->fsd.stream);
+
+	return ((opcode == WS_FR_OP_TXT || opcode == WS_FR_OP_BIN) &&
+		!(b0 & WS_RSV1) && wfd->client->srv->ws_srv.evs.onmessage_chunk);
+}
+
+/**
+ * @brief Given the bytes buffered (and not parsed yet) in @p wfd,
+ * checks if there is a complete frame to be read.
+ *
+ * @param wfd Websocket Frame Data.
+ *
+ * @return Returns 0 if there is a complete frame (or at least
+ * enough to refuse it), otherwise, the amount of bytes still
+ * missing.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static uint64_t frame_missing(struct ws_frame_data *wfd)
+{
+	unsigned char *frm; /* Frame start.         */
+	uint64_t length;    /* Payload length.      */
+	uint64_t hdr;       /* Header length.       */
+	size_t avail;       /* Available bytes.     */
+	int i;              /* Loop index.          */
+
+	frm   = wfd->frm + wfd->cur_pos;
+	avail = wfd->amt_read - wfd->cur_pos;
+
+	/* Streamed payload: whatever is buffered can be delivered. */
+	if (wfd->fsd.stream_left)
+		return (avail ? 0 : 1);
+
+	if (avail < 2)
+		return (2 - avail);
+
+	/*
+	 * Frames refused from their first two bytes alone (unmasked,
+	 * unknown opcode, or control frames not FIN or longer than 125
+	 * bytes) go to next_frame() right away: nothing else of them is
+	 * buffered.
+	 */
+	if (!(frm[1] & 0x80) || !is_valid_frame(frm[0] & 0xF) ||
+		(is_control_frame(frm[0] & 0xF) &&
+			(!(frm[0] & WS_FIN) || (frm[1] & 0x7F) > 125)))
+	{
+		return (0);
+	}
+
+	length = frm[1] & 0x7F;
+	hdr    = 2;
+
+	if (length == 126)
+		hdr += 2;
+	else if (length == 127)
+		hdr += 8;
+
+	if (avail < hdr)
+		return (hdr - avail);
+
+	if (length == 126)
+		length = ((uint64_t)frm[2] << 8) | frm[3];
+	else if (length == 127)
+	{
+		length = 0;
+		for (i = 2; i < 10; i++)
+			length = (length << 8) | frm[i];
+	}
+
+	/* Masks. */
+	hdr += 4;
+
+	/* Streamed data frames only need their header. */
+	if (frame_streamed(wfd, frm[0]))
+		return (avail < hdr ? hdr - avail : 0);
+
+	/* Too large frames are refused by next_frame() itself. */
+	if (length > MAX_FRAME_LENGTH)
+		return (0);
+
+	if (avail < hdr + length)
+		return (hdr + length - avail);
+
+	return (0);
+}
+
+/**
+ * @brief Handles the handshake and every complete frame buffered
+ * so far for a given @p client.
+ *
+ * @param client Client connection.
+ *
+ * @return Returns 0 if the connection should keep going, or
+ * -1 if it should be closed.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int evloop_process(struct ws_connection *client)
+{
+	struct ws_frame_data *wfd; /* WebSocket frame data. */
+	unsigned char *frm;        /* New frame buffer.     */
+	uint64_t missing;          /* Missing frame bytes.  */
+	size_t size;               /* New buffer size.      */
+	int ret;                   /* Return value.         */
+
+	wfd = client->wfd;
+
+	/* Wait for the complete handshake request. */
+	if (get_client_state(client) == WS_STATE_CONNECTING)
+	{
+		ret = http_parse(&wfd->hs, (char *)wfd->frm, wfd->amt_read);
+		if (ret == HTTP_MORE)
+		{
+			if (wfd->amt_read + 1 < wfd->frm_size)
+				return (0);
+			return (handshake_grow(wfd, true));
+		}
+
+		if (ret != HTTP_DONE || handle_handshake(wfd) < 0)
+			return (-1);
+
+		reset_frame_state(wfd);
+	}
+
+	/* Handle every complete frame buffered so far. */
+	while ((missing = frame_missing(wfd)) == 0)
+	{
+		ret = next_frame(wfd);
+		if (ret < 0)
+			return (-1);
+
+		if (ret > 0)
+		{
+			if (handle_message(wfd) < 0)
+				return (-1);
+			reset_frame_state(wfd);
+		}
+	}
+
+	/* Keep only the bytes not parsed yet. */
+	wfd->amt_read -= wfd->cur_pos;
+	memmove(wfd->frm, wfd->frm + wfd->cur_pos, wfd->amt_read);
+	wfd->cur_pos = 0;
+
+	/*
+	 * Grow the buffer if the next frame does not fit, or shrink it
+	 * back once a large frame has gone.
+	 */
+	size = wfd->amt_read + missing + 1;
+	if (size < MESSAGE_LENGTH)
+		size = MESSAGE_LENGTH;
+
+	if (size > wfd->frm_size ||
+		(wfd->frm_size > MESSAGE_LENGTH && size == MESSAGE_LENGTH))
+	{
+		frm = realloc(wfd->frm, size);
+		if (!frm)
+		{
+			DEBUG("Cannot allocate memory, requested: %zu\n", size);
+			return (-1);
+		}
+		wfd->frm      = frm;
+		wfd->frm_size = size;
+	}
+
+	return (0);
+}
+
+/**
+ * @brief Reads whatever is available on the socket of @p client
+ * and handles it.
+ *
+ * @param client Client connection.
+ *
+ * @return Returns 0 if the connection should keep going, or
+ * -1 if it should be closed.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int evloop_read(struct ws_connection *client)
+{
+	struct ws_frame_data *wfd = client->wfd;
+	ssize_t n;
+
+	n = RECV(client, wfd->frm + wfd->amt_read,
+		wfd->frm_size - wfd->amt_read - 1);
+
+	if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+		return (0);
+	if (n <= 0)
+		return (-1);
+
+	wfd->amt_read += n;
+	return (evloop_process(client));
+}
+
+/**
+ * @brief Updates the epoll events of a given @p client accordingly
+ * with its state: readable until being torn down, and writable while
+ * there is data queued.
+ *
+ * @param client Client connection.
+ *
+ * @note Must be called with the send lock held.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static void evloop_update(struct ws_connection *client)
+{
+	struct epoll_event ev;
+
+	ev.events   = (client->closing  ? 0 : EPOLLIN) |
+	              (client->snd_head ? EPOLLOUT : 0);
+	ev.data.ptr = client;
+
+	if (ev.events == client->ep_events)
+		return;
+
+	if (!epoll_ctl(client->loop->epfd, EPOLL_CTL_MOD, client->client_sock,
+			&ev))
+	{
+		client->ep_events = ev.events;
+	}
+}
+
+/**
+ * @brief Sends what is queued to a given @p client, as much as its
+ * socket accepts.
+ *
+ * @param client Client connection.
+ *
+ * @return Returns 0 if the connection should keep going, 1 if it is
+ * being torn down (and should not be read anymore), or -1 if it
+ * should be closed (error, or nothing left to be sent to a
+ * connection being torn down).
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int evloop_write(struct ws_connection *client)
+{
+	struct ws_snd *snd;
+	ssize_t n;
+	int ret;
+
+	ret = 0;
+
+	/* clang-format off */
+	pthread_mutex_lock(&client->mtx_snd);
+		while ((snd = client->snd_head) != NULL)
+		{
+			n = send(client->client_sock, snd->buf->data + snd->off,
+				snd->buf->len - snd->off, MSG_NOSIGNAL);
+
+			if (n < 0)
+			{
+				if (errno == EINTR)
+					continue;
+				if (errno == EAGAIN || errno == EWOULDBLOCK)
+					break;
+
+				DEBUG("Unable to send data to the client, closing...\n");
+				sndq_abort(client);
+				break;
+			}
+			sndq_sent(client, (size_t)n);
+		}
+
+		if (client->closing)
+			ret = client->snd_head ? 1 : -1;
+		else
+			evloop_update(client);
+	pthread_mutex_unlock(&client->mtx_snd);
+	/* clang-format on */
+	return (ret);
+}
+
+/**
+ * @brief Allocates the frame data kept across the events of a
+ * given @p client.
+ *
+ * @param client Client connection.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int alloc_frame_data(struct ws_connection *client)
+{
+	struct ws_frame_data *wfd;
+
+	wfd = calloc(1, sizeof(*wfd));
+	if (!wfd)
+		return (-1);
+
+	wfd->frm = malloc(MESSAGE_LENGTH);
+	if (!wfd->frm)
+	{
+		free(wfd);
+		return (-1);
+	}
+	wfd->frm_size = MESSAGE_LENGTH;
+	wfd->client   = client;
+	client->wfd   = wfd;
+	http_init(&wfd->hs, client->srv->ws_srv.handshake_max);
+	return (0);
+}
+
+/**
+ * @brief Releases the frame data of a given @p client.
+ *
+ * @param client Client connection.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static void free_frame_data(struct ws_connection *client)
+{
+	struct ws_frame_data *wfd = client->wfd;
+
+	client->wfd = NULL;
+	free(wfd->fsd.msg_data);
+	free(wfd->msg);
+	free(wfd->frm);
+	free(wfd);
+}
+
+/**
+ * @brief Stops serving a connection handled by an event loop,
+ * triggering the close event if appropriate.
+ *
+ * @param client Client connection.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static void evloop_finish(struct ws_connection *client)
+{
+	/* Only connections that went through the handshake were opened. */
+	if (get_client_state(client) != WS_STATE_CONNECTING)
+		client->srv->ws_srv.evs.onclose(client->client_id);
+
+	free_frame_data(client);
+	finish_client(client);
+}
+
+/**
+ * @brief Stops serving a connection handled by the epoll event
+ * loop @p loop.
+ *
+ * @param loop Event loop.
+ * @param client Client connection.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static void evloop_close(struct ws_evloop *loop, struct ws_connection *client)
+{
+	bool pending;
 
 	/*
-	 * Our PONG id should be positive and smaller than our
-	 * current PING id. If not, ignore.
+	 * Stop reading, but send what is still queued first, up to
+	 * the close time-out.
 	 */
 	/* clang-format off */
-	pthread_mutex_lock(&wfd->client->mtx_ping);
-		fsd->pong_id = pong_msg_to_int32(fsd->msg_ctrl);
-		if (fsd->pong_id < 0 || fsd->pong_id > wfd->client->current_ping_id)
+	pthread_mutex_lock(&client->mtx_snd);
+		client->closing = true;
+		pending = (client->snd_head != NULL);
+		if (pending)
+			evloop_update(client);
+	pthread_mutex_unlock(&client->mtx_snd);
+
+	if (pending)
+	{
+		pthread_mutex_lock(&client->cold->mtx_state);
+			arm_close_timeout(client);
+		pthread_mutex_unlock(&client->cold->mtx_state);
+		return;
+	}
+	/* clang-format on */
+
+	epoll_ctl(loop->epfd, EPOLL_CTL_DEL, client->client_sock, NULL);
+	evloop_finish(client);
+}
+
+/**
+ * @brief Event loop main routine.
+ *
+ * @param data Event loop.
+ *
+ * @return Returns @p data.
+ *
+ * @note This will be run on a different thread.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static void *ws_evloop(void *data)
+{
+	struct epoll_event evs[WS_EVLOOP_EVENTS]; /* Ready events.  */
+	struct ws_connection *client;             /* Client.        */
+	struct ws_evloop *loop;                   /* Event loop.    */
+	int ret;                                  /* Event result.  */
+	int n;                                    /* Ready amount.  */
+	int i;                                    /* Loop index.    */
+
+	loop = data;
+
+	while (1)
+	{
+		n = epoll_wait(loop->epfd, evs, WS_EVLOOP_EVENTS, -1);
+		if (n < 0)
 		{
-			pthread_mutex_unlock(&wfd->client->mtx_ping);
-			return (0);
+			if (errno == EINTR)
+				continue;
+			panic("epoll_wait() failed");
 		}
-		wfd->client->last_pong_id = fsd->pong_id;
-	pthread_mutex_unlock(&wfd->client->mtx_ping);
-	/* clang-format on */
 
+		for (i = 0; i < n; i++)
+		{
+			client = evs[i].data.ptr;
+			ret    = 0;
+
+			/* Writable, or errors/hang ups. */
+			if (evs[i].events & ~EPOLLIN)
+				ret = evloop_write(client);
+
+			/* Errors and hang ups are also seen by the read. */
+			if (!ret && (evs[i].events & (EPOLLIN|EPOLLERR|EPOLLHUP)))
+				ret = evloop_read(client);
+
+			if (ret < 0)
+				evloop_close(loop, client);
+		}
+	}
+
+	return (data);
+}
+
+#ifdef WS_HAS_URING
+/**
+ * @brief Submits all the pending requests of the event loop @p loop,
+ * without waiting for completions.
+ *
+ * @param loop Event loop.
+ *
+ * @note Must be called with the loop mutex held.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static void uring_submit(struct ws_evloop *loop)
+{
+	unsigned pending;
+
+	uring_flush(&loop->ring);
+	pending = uring_sq_pending(&loop->ring);
+	if (!pending)
+		return;
+
+	while (uring_enter(&loop->ring, pending, 0) < 0 && errno == EINTR)
+		;
+}
+
+/**
+ * @brief Ensures that the submission queue of @p loop has room for
+ * (at least) @p n new requests, submitting the pending ones if
+ * necessary.
+ *
+ * @param loop Event loop.
+ * @param n Amount of requests.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ *
+ * @note Must be called with the loop mutex held.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int uring_reserve(struct ws_evloop *loop, unsigned n)
+{
+	if (loop->ring.sq_entries - uring_sq_pending(&loop->ring) >= n)
+		return (0);
+
+	uring_submit(loop);
+	return (loop->ring.sq_entries - uring_sq_pending(&loop->ring) >= n
+		? 0 : -1);
+}
+
+/**
+ * @brief Arms a multishot receive for a given @p client: every
+ * chunk of data received lands in one of the provided buffers
+ * of its event loop, without further submissions.
+ *
+ * @param client Client connection.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ *
+ * @note Must be called with the loop mutex held.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int uring_arm_recv(struct ws_connection *client)
+{
+	struct io_uring_sqe *sqe;
+
+	if (uring_reserve(client->loop, 1) < 0)
+		return (-1);
+
+	sqe            = uring_get_sqe(&client->loop->ring);
+	sqe->opcode    = IORING_OP_RECV;
+	sqe->fd        = client->client_sock;
+	sqe->ioprio    = IORING_RECV_MULTISHOT;
+	sqe->flags     = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = 0;
+	sqe->user_data = (uint64_t)(uintptr_t)client | WS_URING_RECV;
+
+	client->recv_armed = true;
 	return (0);
 }
 
 /**
- * @brief Handle PING frames sending a PONG response.
+ * @brief Sends (what remains of) the data in the head of the
+ * send queue of a given @p client.
  *
- * @param wfd WebSocket frame data.
- * @param fsd Frame state data.
+ * If a send timeout was configured, the send is linked to a
+ * timeout and cancelled if it does not complete in time.
+ *
+ * @param client Client connection.
  *
  * @return Returns 0 if success, -1 otherwise.
  *
+ * @note Must be called with the loop mutex held.
+ *
  * @attention This is part of the internal API and is documented just
  * for completeness.
  */
-static int handle_ping_frame(struct ws_frame_data *wfd,
-	struct frame_state_data *fsd)
+static int uring_send_head(struct ws_connection *client)
 {
-	if (do_pong(wfd, fsd->frame_size) < 0)
+	struct io_uring_sqe *sqe;
+	struct ws_evloop *loop;
+	struct ws_snd *snd;
+
+	loop = client->loop;
+	snd  = client->snd_head;
+
+	if (uring_reserve(loop, client->srv->ws_srv.timeout_ms ? 2 : 1) < 0)
 		return (-1);
 
-	/* Quick hack to keep our loop. */
-	fsd->is_fin = 0;
+	sqe            = uring_get_sqe(&loop->ring);
+	sqe->opcode    = IORING_OP_SEND;
+	sqe->fd        = client->client_sock;
+	sqe->addr      = (uint64_t)(uintptr_t)(snd->buf->data + snd->off);
+	sqe->len       = (uint32_t)(snd->buf->len - snd->off);
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = (uint64_t)(uintptr_t)client | WS_URING_SEND;
+
+	if (client->srv->ws_srv.timeout_ms)
+	{
+		sqe->flags     = IOSQE_IO_LINK;
+		sqe            = uring_get_sqe(&loop->ring);
+		sqe->opcode    = IORING_OP_LINK_TIMEOUT;
+		sqe->fd        = -1;
+		sqe->addr      = (uint64_t)(uintptr_t)&loop->snd_ts;
+		sqe->len       = 1;
+		sqe->user_data = WS_URING_TOUT;
+	}
+
+	client->snd_busy = true;
 	return (0);
 }
 
 /**
- * @brief Handle close frames while checking for UTF8
- * in the close reason.
+ * @brief Queues the send request @p req to be sent to a given
+ * @p client by its event loop.
  *
- * @param wfd WebSocket frame data.
- * @param fsd Frame state data.
+ * The data is copied (once per request, see sndreq_buf()), so the
+ * caller can reuse the buffers as soon as this routine returns. The
+ * data queued to a single client is sent in order, one request at
+ * a time.
+ *
+ * @param client Client connection.
+ * @param req Send request.
+ *
+ * @return Returns the request length if queued, 0 if dropped by
+ * the send queue policy, or -1 if error.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static ssize_t uring_send(struct ws_connection *client,
+	struct ws_sndreq *req)
+{
+	struct ws_evloop *loop;
+	ssize_t ret;
+
+	loop = client->loop;
+	ret  = -1;
+
+	/* clang-format off */
+	pthread_mutex_lock(&loop->mtx_sq);
+		if (client->closing || sndreq_stale(client, req))
+			goto out;
+
+		ret = sndq_push(client, req, 0);
+		if (ret <= 0)
+			goto out;
+
+		if (!client->snd_busy && uring_send_head(client) < 0)
+		{
+			sndq_clear(client);
+			ret = -1;
+			goto out;
+		}
+
+		/*
+		 * The event loop submits everything at once before
+		 * waiting for completions, other threads need to
+		 * submit by themselves.
+		 */
+		if (!pthread_equal(pthread_self(), loop->thread))
+			uring_submit(loop);
+out:
+	pthread_mutex_unlock(&loop->mtx_sq);
+	/* clang-format on */
+	return (ret);
+}
+
+/**
+ * @brief Starts tearing down a connection served by io_uring:
+ * new sends are refused and, once the pending ones are done,
+ * the socket is shut down, ending the multishot receive.
+ *
+ * @param client Client connection.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static void uring_close(struct ws_connection *client)
+{
+	bool shut;
+
+	/* clang-format off */
+	pthread_mutex_lock(&client->loop->mtx_sq);
+		shut = !client->closing && !client->snd_busy;
+		client->closing = true;
+	pthread_mutex_unlock(&client->loop->mtx_sq);
+	/* clang-format on */
+
+	if (shut)
+		shutdown(client->client_sock, SHUT_RDWR);
+}
+
+/**
+ * @brief Releases a connection being torn down once there are no
+ * more requests in flight for it.
+ *
+ * @param client Client connection.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static void uring_try_finish(struct ws_connection *client)
+{
+	bool done;
+
+	/* clang-format off */
+	pthread_mutex_lock(&client->loop->mtx_sq);
+		done = client->closing && !client->recv_armed && !client->snd_busy;
+	pthread_mutex_unlock(&client->loop->mtx_sq);
+	/* clang-format on */
+
+	if (done)
+		evloop_finish(client);
+}
+
+/**
+ * @brief Appends @p len bytes received from a given @p client into
+ * its frame buffer and handles them.
  *
- * @return Returns 0 if success, -1 otherwise.
+ * @param client Client connection.
+ * @param buf Received data.
+ * @param len Data length.
+ *
+ * @return Returns 0 if the connection should keep going, or
+ * -1 if it should be closed.
  *
  * @attention This is part of the internal API and is documented just
  * for completeness.
  */
-static int handle_close_frame(struct ws_frame_data *wfd,
-	struct frame_state_data *fsd)
+static int uring_feed(struct ws_connection *client, const unsigned char *buf,
+	size_t len)
 {
-#ifdef VALIDATE_UTF8
-	/* If there is a close reason, check if it is UTF-8 valid. */
-	if (fsd->frame_size > 2 &&
-		!is_utf8_len(fsd->msg_ctrl + 2, fsd->frame_size - 2))
+	struct ws_frame_data *wfd; /* WebSocket frame data. */
+	unsigned char *frm;        /* New frame buffer.     */
+	size_t size;               /* New buffer size.      */
+
+	wfd  = client->wfd;
+	size = wfd->amt_read + len + 1;
+
+	if (size > wfd->frm_size)
 	{
-		DEBUG("Invalid close frame payload reason! (not UTF-8)\n");
-		wfd->error = 1;
-		return (-1);
+		frm = realloc(wfd->frm, size);
+		if (!frm)
+		{
+			DEBUG("Cannot allocate memory, requested: %zu\n", size);
+			return (-1);
+		}
+		wfd->frm      = frm;
+		wfd->frm_size = size;
 	}
-#endif
 
-	/*
-	 * Since we're aborting, we can scratch the 'data'-related
-	 * vars here.
-	 */
-	wfd->frame_size = fsd->frame_size;
-	wfd->frame_type = WS_FR_OP_CLSE;
-	free(fsd->msg_data);
-	return (0);
+	memcpy(wfd->frm + wfd->amt_read, buf, len);
+	wfd->amt_read += len;
+	return (evloop_process(client));
 }
 
 /**
- * @brief Reads the current frame isolating data from control frames.
- * The parameters are changed in order to reflect the current state.
+ * @brief Handles the completion of a (multishot) receive of a
+ * given @p client.
  *
- * @param wfd Websocket Frame Data.
- * @param fsd Frame state data.
- *
- * @return Returns 0 if success, a negative number otherwise.
+ * @param loop Event loop.
+ * @param client Client connection.
+ * @param res Completion result.
+ * @param flags Completion flags.
  *
  * @attention This is part of the internal API and is documented just
  * for completeness.
  */
-static int read_single_frame(struct ws_frame_data *wfd,
-	struct frame_state_data *fsd)
+static void uring_on_recv(struct ws_evloop *loop,
+	struct ws_connection *client, int res, uint32_t flags)
 {
-	uint64_t *frame_size;    /* Curr frame size. */
-	uint64_t next_size = 0;  /* Checked next sz. */
-	uint64_t alloc_size = 0; /* Checked alloc sz.*/
-	unsigned char *tmp;      /* Tmp message.     */
-	unsigned char *msg;      /* Current message. */
-	uint64_t *msg_idx;       /* Message index.   */
-	uint8_t *masks;          /* Current mask.    */
-	int cur_byte;            /* Curr byte read.  */
-	uint64_t i;              /* Loop index.      */
-
-	/* Decide which mask and msg to use. */
-	if (is_control_frame(fsd->opcode)) {
-		frame_size = &fsd->frame_size;
-		msg_idx = &fsd->msg_idx_ctrl;
-		masks   = fsd->masks_ctrl;
-		msg     = fsd->msg_ctrl;
-	}
-	else {
-		frame_size = &wfd->frame_size;
-		msg_idx = &fsd->msg_idx_data;
-		masks   = fsd->masks_data;
-		msg     = fsd->msg_data;
-	}
+	uint16_t bid;
+	int ret;
 
-	/* Decode masks and length for 16-bit messages. */
-	if (fsd->frame_length == 126)
-		fsd->frame_length = (((uint64_t)next_byte(wfd)) << 8) | next_byte(wfd);
-
-	/* 64-bit messages. */
-	else if (fsd->frame_length == 127)
+	if (flags & IORING_CQE_F_BUFFER)
 	{
-		fsd->frame_length =
-			(((uint64_t)next_byte(wfd)) << 56) | /* frame[2]. */
-			(((uint64_t)next_byte(wfd)) << 48) | /* frame[3]. */
-			(((uint64_t)next_byte(wfd)) << 40) |
-			(((uint64_t)next_byte(wfd)) << 32) |
-			(((uint64_t)next_byte(wfd)) << 24) |
-			(((uint64_t)next_byte(wfd)) << 16) |
-			(((uint64_t)next_byte(wfd)) << 8)  |
-			(((uint64_t)next_byte(wfd))); /* frame[9]. */
+		bid = (uint16_t)(flags >> IORING_CQE_BUFFER_SHIFT);
+		if (res > 0 && !client->closing &&
+			uring_feed(client, uring_buf(&loop->ring, bid), res) < 0)
+		{
+			uring_close(client);
+		}
+		uring_recycle_buf(&loop->ring, bid);
 	}
 
-	/*
-	 * Check frame size
-	 *
-	 * We need to limit the amount supported here, since if
-	 * we follow strictly to the RFC, we have to allow 2^64
-	 * bytes. Also keep in mind that this is still true
-	 * for continuation frames.
-	 */
-	if (!checked_add_u64(*frame_size, fsd->frame_length, &next_size) ||
-		next_size > MAX_FRAME_LENGTH)
+	/* Multishot receive ended, re-arm it unless the peer is gone. */
+	if (!(flags & IORING_CQE_F_MORE))
 	{
-		DEBUG("Current frame from client %d, exceeds the maximum\n"
-			  "amount of bytes allowed (%" PRId64 "/%d)!",
-			wfd->client->client_sock, next_size,
-			MAX_FRAME_LENGTH);
+		ret = -1;
 
-		/*
-		 * We are rejecting a too-large message (or a wrapped size).
-		 * RFC 6455 suggests code 1009 for this situation.
-		 */
-		do_close(wfd, WS_CLSE_BIGMSG);
-		wfd->error = 1;
-		return (-1);
+		/* clang-format off */
+		pthread_mutex_lock(&loop->mtx_sq);
+			client->recv_armed = false;
+			if (!client->closing && (res > 0 || res == -ENOBUFS))
+				ret = uring_arm_recv(client);
+		pthread_mutex_unlock(&loop->mtx_sq);
+		/* clang-format on */
+
+		if (ret < 0)
+			uring_close(client);
 	}
 
-	*frame_size = next_size;
+	uring_try_finish(client);
+}
 
-	/* Read masks. */
-	masks[0] = next_byte(wfd);
-	masks[1] = next_byte(wfd);
-	masks[2] = next_byte(wfd);
-	masks[3] = next_byte(wfd);
+/**
+ * @brief Handles the completion of a send of a given @p client.
+ *
+ * @param loop Event loop.
+ * @param client Client connection.
+ * @param res Completion result.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static void uring_on_send(struct ws_evloop *loop,
+	struct ws_connection *client, int res)
+{
+	bool failed; /* Send failed.     */
+	bool shut;   /* Shutdown socket. */
 
-	/*
-	 * Abort if error.
-	 *
-	 * This is tricky: we may have multiples error codes from the
-	 * previous next_bytes() calls, but, since we're only setting
-	 * variables and flags, there is no major issue in setting
-	 * them wrong _if_ we do not use their values, thing that
-	 * we do here.
-	 */
-	if (wfd->error)
-		return (-1);
+	failed = (res <= 0);
+	shut   = false;
 
-	/*
-	 * Allocate memory.
-	 *
-	 * The statement below will allocate a new chunk of memory
-	 * if msg is NULL with size total_length. Otherwise, it will
-	 * resize the total memory accordingly with the message index
-	 * and if the current frame is a FIN frame or not, if so,
-	 * increment the size by 1 to accommodate the line ending \0.
-	 */
-	if (fsd->frame_length > 0)
-	{
-		if (!is_control_frame(fsd->opcode))
+	/* clang-format off */
+	pthread_mutex_lock(&loop->mtx_sq);
+		if (!failed)
 		{
-			if (!checked_add_u64(*msg_idx, fsd->frame_length, &alloc_size) ||
-				!checked_add_u64(alloc_size, fsd->is_fin, &alloc_size) ||
-				alloc_size > MAX_FRAME_LENGTH + 1)
-			{
-				DEBUG("Cannot allocate frame data: invalid message size "
-					  "(idx=%" PRId64 ", len=%" PRId64 ", fin=%u)\n",
-					*msg_idx, fsd->frame_length, fsd->is_fin);
-				do_close(wfd, WS_CLSE_BIGMSG);
-				wfd->error = 1;
-				return (-1);
-			}
+			sndq_sent(client, (size_t)res);
 
-			tmp = realloc(msg, alloc_size);
-			if (!tmp)
+			if (client->snd_head)
+				failed = (uring_send_head(client) < 0);
+			else
 			{
-				DEBUG("Cannot allocate memory, requested: % " PRId64 "\n",
-					alloc_size);
-
-				do_close(wfd, WS_CLSE_BIGMSG);
-				wfd->error = 1;
-				return (-1);
+				client->snd_busy = false;
+				shut = client->closing;
 			}
-			msg = tmp;
-			fsd->msg_data = msg;
 		}
 
-		/* Copy to the proper location. */
-		for (i = 0; i < fsd->frame_length; i++, (*msg_idx)++)
+		if (failed)
 		{
-			/* We were able to read? .*/
-			cur_byte = next_byte(wfd);
-			if (cur_byte == -1)
-				return (-1);
-
-			msg[*msg_idx] = cur_byte ^ masks[i % 4];
+			DEBUG("Unable to send data to the client, closing...\n");
+			client->snd_busy = false;
+			sndq_clear(client);
+			client->closing = true;
+			shut = true;
 		}
-	}
-
-	/* If we're inside a FIN frame, lets... */
-	if (fsd->is_fin && *frame_size > 0)
-	{
-		/* Increase memory if our FIN frame is of length 0. */
-		if (!fsd->frame_length && !is_control_frame(fsd->opcode))
-		{
-			tmp = realloc(msg, *msg_idx + 1);
-			if (!tmp)
-			{
-				DEBUG("Cannot allocate memory, requested: %" PRId64 "\n",
-					(*msg_idx + 1));
+	pthread_mutex_unlock(&loop->mtx_sq);
+	/* clang-format on */
 
-				wfd->error = 1;
-				return (-1);
-			}
-			msg = tmp;
-			fsd->msg_data = msg;
-		}
-		msg[*msg_idx] = '\0';
-	}
+	if (shut)
+		shutdown(client->client_sock, SHUT_RDWR);
 
-	return (0);
+	uring_try_finish(client);
 }
 
 /**
- * @brief Reads the next frame, whether if a TXT/BIN/CLOSE
- * of arbitrary size.
+ * @brief io_uring event loop main routine.
  *
- * @param wfd Websocket Frame Data.
+ * @param data Event loop.
  *
- * @return Returns 0 if success, a negative number otherwise.
+ * @return Returns @p data.
+ *
+ * @note This will be run on a different thread.
  *
  * @attention This is part of the internal API and is documented just
  * for completeness.
  */
-static int next_complete_frame(struct ws_frame_data *wfd)
+static void *ws_uring_loop(void *data)
 {
-	struct frame_state_data fsd = {0};
-	fsd.msg_data = NULL;
-	fsd.msg_ctrl = wfd->msg_ctrl;
-
-#ifdef VALIDATE_UTF8
-	fsd.utf8_state = UTF8_ACCEPT;
-#endif
+	struct ws_connection *client; /* Client.             */
+	struct io_uring_cqe *cqe;     /* Completion.         */
+	struct ws_evloop *loop;       /* Event loop.         */
+	uint64_t user_data;           /* Completion data.    */
+	uint32_t flags;               /* Completion flags.   */
+	unsigned pending;             /* Pending requests.   */
+	int res;                      /* Completion result.  */
 
-	wfd->frame_size =  0;
-	wfd->frame_type = -1;
-	wfd->msg = NULL;
+	loop = data;
 
-	/* Read until find a FIN or a unsupported frame. */
-	do
+	while (1)
 	{
-		fsd.cur_byte = next_byte(wfd);
-		if (fsd.cur_byte == -1)
-			return (-1);
-
-		fsd.is_fin = (fsd.cur_byte & 0xFF) >> WS_FIN_SHIFT;
-		fsd.opcode = (fsd.cur_byte & 0xF);
-
-		/* Check for RSV field. */
-		if (fsd.cur_byte & 0x70)
-		{
-			DEBUG("RSV is set while wsServer do not negotiate extensions!\n");
-			wfd->error = 1;
-			break;
-		}
-
 		/*
-		 * Check if the current opcode makes sense:
-		 * a) If we're inside a cont frame but no previous data frame
-		 *
-		 * b) If we're handling a data-frame and receive another data
-		 *    frame. (it's expected to receive only CONT or control
-		 *    frames).
-		 *
-		 * It is worth to note that in a), we do not need to check
-		 * if the previous frame was FIN or not: if was FIN, an
-		 * on_message event was triggered and this function returned;
-		 * so the only possibility here is a previous non-FIN data
-		 * frame, ;-).
+		 * Submit everything queued while handling the previous
+		 * completions and wait for new ones, in a single syscall.
 		 */
-		if ((wfd->frame_type == -1 && fsd.opcode == WS_FR_OP_CONT) ||
-			(wfd->frame_type != -1 && !is_control_frame(fsd.opcode) &&
-				fsd.opcode != WS_FR_OP_CONT))
-		{
-			DEBUG("Unexpected frame was received!, opcode: %d, previous: %d\n",
-				fsd.opcode, wfd->frame_type);
-			wfd->error = 1;
-			break;
-		}
-
-		/* Check if one of the valid opcodes. */
-		if (!is_valid_frame(fsd.opcode))
-		{
-			DEBUG("Unsupported frame opcode: %d\n", fsd.opcode);
-			/* We should consider as error receive an unknown frame. */
-			wfd->frame_type = fsd.opcode;
-			wfd->error = 1;
-			break;
-		}
+		/* clang-format off */
+		pthread_mutex_lock(&loop->mtx_sq);
+			uring_flush(&loop->ring);
+			pending = uring_sq_pending(&loop->ring);
+		pthread_mutex_unlock(&loop->mtx_sq);
+		/* clang-format on */
 
-		/* Check our current state: if CLOSING, we only accept close frames. */
-		if (get_client_state(wfd->client) == WS_STATE_CLOSING &&
-			fsd.opcode != WS_FR_OP_CLSE)
+		if (uring_enter(&loop->ring, pending, 1) < 0 &&
+			errno != EINTR && errno != EBUSY)
 		{
-			DEBUG("Unexpected frame received, expected CLOSE (%d), "
-				  "received: (%d)",
-				WS_FR_OP_CLSE, fsd.opcode);
-			wfd->error = 1;
-			break;
+			panic("io_uring_enter() failed");
 		}
 
-		/* Only change frame type if not a CONT frame. */
-		if (fsd.opcode != WS_FR_OP_CONT && !is_control_frame(fsd.opcode))
-			wfd->frame_type = fsd.opcode;
-
-		fsd.mask         = next_byte(wfd);
-		fsd.frame_length = fsd.mask & 0x7F;
-		fsd.frame_size   = 0;
-		fsd.msg_idx_ctrl = 0;
-
-		/*
-		 * We should deny non-FIN control frames or that have
-		 * more than 125 octets.
-		 */
-		if (is_control_frame(fsd.opcode) &&
-			(!fsd.is_fin || fsd.frame_length > 125))
+		while ((cqe = uring_peek_cqe(&loop->ring)) != NULL)
 		{
-			DEBUG("Control frame bigger than 125 octets or not a FIN "
-				  "frame!\n");
-			wfd->error = 1;
-			break;
-		}
+			user_data = cqe->user_data;
+			flags     = cqe->flags;
+			res       = cqe->res;
+			uring_cqe_seen(&loop->ring);
 
-		/* Read a single frame, and then handle accordingly. */
-		if (read_single_frame(wfd, &fsd) < 0)
-			break;
+			client = (struct ws_connection *)(uintptr_t)
+				(user_data & ~(uint64_t)WS_URING_TAG_MASK);
 
-		/* Handle each frame
-		 * Obs: If BIN, nothing should be done unless we got
-		 * a FIN-frame.
-		 */
-		switch (fsd.opcode) {
-			/* UTF-8 Validate partial (or not) frame. */
-			case WS_FR_OP_CONT:
-			case WS_FR_OP_TXT: {
-				validate_utf8_txt(wfd, &fsd);
-				break;
-			}
-			/*
-			 * We _may_ send a PING frame if the ws_ping() routine was invoked.
-			 *
-			 * If the content is invalid and/or differs the size, ignore it.
-			 * (maybe unsolicited PONG).
-			 */
-			case WS_FR_OP_PONG: {
-				handle_pong_frame(wfd, &fsd);
-				goto next_it;
+			switch (user_data & WS_URING_TAG_MASK)
+			{
+			case WS_URING_RECV:
+				uring_on_recv(loop, client, res, flags);
 				break;
-			}
-			/* We should answer to a PING frame as soon as possible. */
-			case WS_FR_OP_PING: {
-				if (handle_ping_frame(wfd, &fsd) < 0)
-					goto done;
+			case WS_URING_SEND:
+				uring_on_send(loop, client, res);
 				break;
-			}
-			/* We interrupt the loop as soon as we find a CLOSE frame. */
-			case WS_FR_OP_CLSE: {
-				if (handle_close_frame(wfd, &fsd) < 0)
-					goto done;
-				return (0);
+			default:
+				/* Send timeouts have nothing to do. */
 				break;
 			}
 		}
+	}
+
+	return (data);
+}
+#endif
+#endif
+
+#ifdef WS_HAS_EPOLL
+#ifdef WS_HAS_URING
+/**
+ * @brief Releases the io_uring resources of a given event @p loop.
+ *
+ * @param loop Event loop.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static void uring_loop_free(struct ws_evloop *loop)
+{
+	uring_free(&loop->ring);
+	pthread_mutex_destroy(&loop->mtx_sq);
+}
+
+/**
+ * @brief Sets up the io_uring instance and the provided buffers
+ * used by the receives of a given event @p loop.
+ *
+ * @param loop Event loop.
+ * @param timeout Send timeout (in ms), 0 if none.
+ *
+ * @return Returns 0 if success, -1 otherwise (such as when io_uring
+ * is not supported by the running kernel).
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int uring_loop_init(struct ws_evloop *loop, uint32_t timeout)
+{
+	if (uring_init(&loop->ring, WS_URING_ENTRIES) < 0)
+		return (-1);
+
+	if (uring_setup_buf_ring(&loop->ring, WS_URING_RECV_BUFS,
+			WS_URING_RECV_BUF_SIZE, 0) < 0)
+	{
+		uring_free(&loop->ring);
+		return (-1);
+	}
+
+	if (pthread_mutex_init(&loop->mtx_sq, NULL))
+		panic("Error on allocating io_uring mutex");
+
+	loop->snd_ts.tv_sec  = timeout / 1000;
+	loop->snd_ts.tv_nsec = (timeout % 1000) * 1000000;
+	loop->epfd = -1;
+	return (0);
+}
+
+/**
+ * @brief Hands a freshly accepted @p client over the io_uring
+ * event @p loop.
+ *
+ * @param loop Event loop.
+ * @param client Client connection.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int uring_add(struct ws_evloop *loop, struct ws_connection *client)
+{
+	int ret;
 
-next_it:;
+	/* clang-format off */
+	pthread_mutex_lock(&loop->mtx_sq);
+		client->loop = loop;
 
-	} while (!fsd.is_fin && !wfd->error);
+		ret = uring_arm_recv(client);
+		if (!ret)
+			uring_submit(loop);
+	pthread_mutex_unlock(&loop->mtx_sq);
+	/* clang-format on */
+	return (ret);
+}
 
-done:
-	/* Check for error. */
-	if (wfd->error)
+/**
+ * @brief Sets up the io_uring resources of all the event loops of
+ * @p srv.
+ *
+ * @param srv Server instance.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int uring_init_loops(struct ws_instance *srv)
+{
+	int i;
+
+	for (i = 0; i < srv->nloops; i++)
 	{
-		free(fsd.msg_data);
-		wfd->msg = NULL;
-		return (-1);
+		if (uring_loop_init(&srv->loops[i], srv->ws_srv.timeout_ms) < 0)
+		{
+			while (i--)
+				uring_loop_free(&srv->loops[i]);
+			return (-1);
+		}
 	}
-
-	wfd->msg = fsd.msg_data;
 	return (0);
 }
+#endif
 
 /**
- * @brief Establishes to connection with the client and trigger
- * events when occurs one.
- *
- * @param vclient Client connection.
+ * @brief Creates the event loops threads accordingly with the
+ * server parameters in @p srv.
  *
- * @return Returns @p vclient.
+ * If io_uring was requested but is not available, epoll is
+ * used instead.
  *
- * @note This will be run on a different thread.
+ * @param srv Server instance.
  *
  * @attention This is part of the internal API and is documented just
  * for completeness.
  */
-static void *ws_establishconnection(void *vclient)
+static void evloop_init(struct ws_instance *srv)
 {
-	struct ws_frame_data wfd;      /* WebSocket frame data.   */
-	struct ws_connection *client;  /* Client structure.       */
-	int clse_thrd;                 /* Time-out close thread.  */
+	void *(*loop_routine)(void *);
+	long nloops;
+	int i;
 
-	client = vclient;
+	nloops = srv->ws_srv.io_threads;
+	if (nloops <= 0)
+		nloops = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nloops <= 0)
+		nloops = 1;
 
-	/* Prepare frame data. */
-	memset(&wfd, 0, sizeof(wfd));
-	wfd.client = client;
+	srv->loops = calloc(nloops, sizeof(*srv->loops));
+	if (!srv->loops)
+		panic("Unable to allocate event loops, out of memory!\n");
 
-	/* Do handshake. */
-	if (do_handshake(&wfd) < 0)
-		goto closed;
+	srv->nloops = (int)nloops;
+	loop_routine   = ws_evloop;
 
-	/* Read next frame until client disconnects or an error occur. */
-	while (next_complete_frame(&wfd) >= 0)
+#ifdef WS_HAS_URING
+	if (srv->ws_srv.io_model == WS_IO_URING)
 	{
-		/* Text/binary event. */
-		if ((wfd.frame_type == WS_FR_OP_TXT ||
-			wfd.frame_type == WS_FR_OP_BIN) && !wfd.error)
+		if (!uring_init_loops(srv))
+			loop_routine = ws_uring_loop;
+		else
 		{
-			client->ws_srv.evs.onmessage(client->client_id, wfd.msg, wfd.frame_size,
-				wfd.frame_type);
+			DEBUG("io_uring not available, falling back to epoll\n");
+			srv->ws_srv.io_model = WS_IO_EPOLL;
 		}
+	}
+#else
+	srv->ws_srv.io_model = WS_IO_EPOLL;
+#endif
 
-		/* Close event. */
-		else if (wfd.frame_type == WS_FR_OP_CLSE && !wfd.error)
+	for (i = 0; i < srv->nloops; i++)
+	{
+		if (srv->ws_srv.io_model == WS_IO_EPOLL)
 		{
-			/*
-			 * We only send a CLOSE frame once, if we're already
-			 * in CLOSING state, there is no need to send.
-			 */
-			if (get_client_state(client) != WS_STATE_CLOSING)
-			{
-				set_client_state(client, WS_STATE_CLOSING);
-
-				/* We only send a close frameSend close frame */
-				do_close(&wfd, -1);
-			}
-
-			free(wfd.msg);
-			break;
+			srv->loops[i].epfd = epoll_create1(EPOLL_CLOEXEC);
+			if (srv->loops[i].epfd < 0)
+				panic("Unable to create epoll instance!\n");
 		}
 
-		free(wfd.msg);
+		if (pthread_create(&srv->loops[i].thread, NULL, loop_routine,
+				&srv->loops[i]))
+		{
+			panic("Could not create the event loop thread!");
+		}
+		pthread_detach(srv->loops[i].thread);
 	}
+}
 
-	/*
-	 * on_close events always occur, whether for client closure
-	 * or server closure, as the server is expected to
-	 * always know when the client disconnects.
-	 */
-	client->ws_srv.evs.onclose(client->client_id);
+/**
+ * @brief Hands a @p client freshly accepted by the @p shard over
+ * one of the event loops, in a round-robin fashion.
+ *
+ * Each shard starts at a different loop and skips the loops of the
+ * other shards, so that (as long as there are enough loops) the
+ * shards do not share them.
+ *
+ * @param shard Accept shard.
+ * @param client Client connection.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static int evloop_add(struct ws_shard *shard, struct ws_connection *client)
+{
+	struct ws_instance *srv = shard->srv;
+	struct epoll_event ev;  /* epoll event.       */
+	struct ws_evloop *loop; /* Target event loop. */
 
-closed:
-	clse_thrd = client->close_thrd;
+	if (alloc_frame_data(client) < 0)
+		return (-1);
 
-	/* Wait for timeout thread if necessary. */
-	if (clse_thrd)
+	loop = &srv->loops[shard->next_loop];
+	shard->next_loop = (shard->next_loop + srv->nshards) % srv->nloops;
+	client->loop     = loop;
+
+#ifdef WS_HAS_URING
+	if (srv->ws_srv.io_model == WS_IO_URING)
 	{
-		pthread_cond_signal(&client->cnd_state_close);
-		pthread_join(client->thrd_tout, NULL);
+		if (uring_add(loop, client) < 0)
+			goto err;
+		return (0);
 	}
+#endif
 
-	/* Close connectin properly. */
-	if (get_client_state(client) != WS_STATE_CLOSED) {
-		DEBUG("Closing: normal close\n");
-		close_client(client, 1);
-	}
+	/* Already non-blocking, see accept_next(). */
+	client->ep_events = EPOLLIN;
 
-	return (vclient);
+	ev.events   = EPOLLIN;
+	ev.data.ptr = client;
+	if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, client->client_sock, &ev) < 0)
+		goto err;
+
+	return (0);
+err:
+	free_frame_data(client);
+	return (-1);
 }
+#endif
+
+/**
+ * @name Accept back-off, when out of file descriptors (or memory).
+ */
+/**@{*/
+#define WS_ACCEPT_BACKOFF_MIN 10   /* ms. */
+#define WS_ACCEPT_BACKOFF_MAX 1000 /* ms. */
+/**@}*/
 
 /**
- * Accept parameters.
+ * @brief Accepts the next pending connection on the listening
+ * socket of a given @p shard, waiting for one if there is none.
+ *
+ * The listening socket is non-blocking: the pending connections
+ * are accepted back to back, and poll() is only invoked once they
+ * are all drained. Running out of file descriptors (or memory) is
+ * not fatal: the connections are left pending and accepted after
+ * a back-off, doubled at each failure.
+ *
+ * @param shard Accept shard.
+ * @param sa Client address.
+ * @param salen Client address length.
+ *
+ * @return Returns the new connection socket, or -1 if none was
+ * accepted (yet).
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
  */
-struct ws_accept_params
+static int accept_next(struct ws_shard *shard, struct sockaddr_storage *sa,
+	socklen_t *salen)
 {
-	int sock;
-	struct ws_server ws_srv;
-};
+	struct timespec ts; /* Back-off time.        */
+	int flags;          /* New socket flags.     */
+	int fd;             /* New socket.           */
+
+	*salen = sizeof(*sa);
+	flags = 0;
+
+#ifdef WS_HAS_ACCEPT4
+	/* The event loops need non-blocking sockets. */
+	flags = SOCK_CLOEXEC;
+	if (shard->srv->ws_srv.io_model == WS_IO_EPOLL)
+		flags |= SOCK_NONBLOCK;
+
+	fd = accept4(shard->sock, (struct sockaddr *)sa, salen, flags);
+#else
+	fd = accept(shard->sock, (struct sockaddr *)sa, salen);
+
+#ifndef _WIN32
+	/* BSDs (and macOS) inherit O_NONBLOCK from the listening socket. */
+	if (fd >= 0 && (flags = fcntl(fd, F_GETFL, 0)) >= 0)
+		fcntl(fd, F_SETFL, flags & ~O_NONBLOCK);
+#else
+	((void)flags);
+#endif
+#endif
+
+	if (fd >= 0)
+	{
+		shard->backoff_ms = 0;
+		return (fd);
+	}
+
+	switch (errno)
+	{
+#ifndef _WIN32
+		/* Drained, wait for the next ones. */
+		case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+		case EWOULDBLOCK:
+#endif
+		{
+			struct pollfd pfd = {.fd = shard->sock, .events = POLLIN};
+			poll(&pfd, 1, -1);
+			break;
+		}
+#endif
+		/* Out of resources, give them some time. */
+		case EMFILE:
+		case ENFILE:
+		case ENOBUFS:
+		case ENOMEM: {
+			if (!shard->backoff_ms)
+				shard->backoff_ms = WS_ACCEPT_BACKOFF_MIN;
+			else if (shard->backoff_ms < WS_ACCEPT_BACKOFF_MAX)
+				shard->backoff_ms *= 2;
+
+			DEBUG("Unable to accept connections (%d), retrying in %u ms\n",
+				errno, shard->backoff_ms);
+
+			ts.tv_sec  = shard->backoff_ms / 1000;
+			ts.tv_nsec = (shard->backoff_ms % 1000) * 1000000L;
+			nanosleep(&ts, NULL);
+			break;
+		}
+		/* Aborted connections, signals and such: just retry. */
+		default:
+			break;
+	}
+	return (-1);
+}
 
 /**
- * @brief Main loop that keeps accepting new connections.
+ * @brief Main loop that keeps accepting new connections on the
+ * listening socket of a given accept shard.
  *
- * @param data Server socket.
+ * @param data Accept shard.
  *
- * @return Returns @p data.
+ * @return Returns NULL.
  *
  * @note This may be run on a different thread.
  *
@@ -1868,30 +6265,40 @@ struct ws_accept_params
  */
 static void *ws_accept(void *data)
 {
-	struct ws_accept_params *ws_prm; /* wsServer parameters. */
+	struct ws_instance *srv;    /* Server instance.       */
+	struct ws_shard *shard;     /* Accept shard.          */
 	struct sockaddr_storage sa; /* Client.                */
+	socklen_t salen;            /* Client address length. */
+	struct ws_connection *cli;  /* New client.            */
 	pthread_t client_thread;    /* Client thread.         */
 	struct timeval time;        /* Client socket timeout. */
-	socklen_t salen;            /* Length of sockaddr.    */
 	int new_sock;               /* New opened connection. */
-	int sock;                   /* Server sock.           */
-	int i;                      /* Loop index.            */
 
-	ws_prm = data;
-	sock   = ws_prm->sock;
-	salen  = sizeof(sa);
+	shard = data;
+	srv   = shard->srv;
+
+#ifdef WS_HAS_STEER
+	/* Run on the CPU whose connections this shard is given. */
+	if (srv->ws_srv.accept_steer)
+	{
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(shard->idx, &cpus);
+		pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	}
+#endif
 
 	while (1)
 	{
 		/* Accept. */
-		new_sock = accept(sock, (struct sockaddr *)&sa, &salen);
+		new_sock = accept_next(shard, &sa, &salen);
 		if (new_sock < 0)
-			panic("Error on accepting connections..");
+			continue;
 
-		if (timeout)
+		if (srv->ws_srv.timeout_ms)
 		{
-			time.tv_sec = timeout / 1000;
-			time.tv_usec = (timeout % 1000) * 1000;
+			time.tv_sec = srv->ws_srv.timeout_ms / 1000;
+			time.tv_usec = (srv->ws_srv.timeout_ms % 1000) * 1000;
 
 			/*
 			 * Socket timeout
@@ -1905,51 +6312,74 @@ static void *ws_accept(void *data)
 				sizeof(struct timeval));
 		}
 
-		/* Adds client socket to socks list. */
-		pthread_mutex_lock(&mutex);
-		for (i = 0; i < MAX_CLIENTS; i++)
+		/*
+		 * Refuse the client if the server is full: the place is
+		 * reserved first, so that concurrent accept shards never
+		 * go over the limit.
+		 */
+		cli = NULL;
+		if (__atomic_fetch_add(&srv->active_clients, 1, __ATOMIC_ACQ_REL) <
+			(unsigned)srv->ws_srv.max_clients)
 		{
-			if (client_socks[i].client_sock == -1)
-			{
-				memcpy(&client_socks[i].ws_srv, &ws_prm->ws_srv,
-					sizeof(struct ws_server));
-
-				client_socks[i].client_sock  = new_sock;
-				client_socks[i].state        = WS_STATE_CONNECTING;
-				client_socks[i].close_thrd   = false;
-				client_socks[i].last_pong_id = -1;
-				client_socks[i].current_ping_id = -1;
-				client_socks[i].client_id = get_next_cid();
-				set_client_address(&client_socks[i]);
-
-				if (pthread_mutex_init(&client_socks[i].mtx_state, NULL))
-					panic("Error on allocating close mutex");
-				if (pthread_cond_init(&client_socks[i].cnd_state_close, NULL))
-					panic("Error on allocating condition var\n");
-				if (pthread_mutex_init(&client_socks[i].mtx_snd, NULL))
-					panic("Error on allocating send mutex");
-				if (pthread_mutex_init(&client_socks[i].mtx_ping, NULL))
-					panic("Error on allocating ping/pong mutex");
-				break;
-			}
+			cli = client_alloc(&shard->part);
 		}
-		pthread_mutex_unlock(&mutex);
 
-		/* Client socket added to socks list ? */
-		if (i != MAX_CLIENTS)
+		if (!cli)
 		{
-			if (pthread_create(
-					&client_thread, NULL, ws_establishconnection, &client_socks[i]))
-				panic("Could not create the client thread!");
+			__atomic_sub_fetch(&srv->active_clients, 1, __ATOMIC_RELEASE);
+			DEBUG("Refusing client, server full!\n");
+			close_socket(new_sock);
+			continue;
+		}
 
-			pthread_detach(client_thread);
+		/* Just keeps the address, nothing is formatted here. */
+		set_client_address(cli, &sa, salen);
+
+		/* Adds client socket to the clients table. */
+		/* clang-format off */
+		pthread_mutex_lock(&srv->mtx);
+			cli->client_sock = new_sock;
+			cli->state       = WS_STATE_CONNECTING;
+			cli->snd_head    = NULL;
+			cli->snd_tail    = NULL;
+			cli->snd_bytes   = 0;
+			cli->snd_busy    = false;
+			cli->snd_thrd    = false;
+			cli->closing     = false;
+#ifdef WS_HAS_DEFLATE
+			cli->pmd         = NULL;
+#endif
+			cli->srv         = srv;
+
+			cli->cold->close_armed     = false;
+			cli->cold->subs            = NULL;
+			cli->cold->subs_closed     = false;
+			cli->cold->last_pong_id    = -1;
+			cli->cold->current_ping_id = -1;
+			cli->cold->srtt            = 0;
+			cli->cold->rttvar          = 0;
+			set_client_id(cli);
+			timer_init(&cli->cold->tmr_close, close_timeout, cli);
+			timer_init(&cli->cold->tmr_ping, heartbeat, cli);
+		pthread_mutex_unlock(&srv->mtx);
+		/* clang-format on */
+
+#ifdef WS_HAS_EPOLL
+		if (srv->ws_srv.io_model != WS_IO_THREADS)
+		{
+			if (evloop_add(shard, cli) < 0)
+				close_client(cli, 1);
+			continue;
 		}
-		else
-			close_socket(new_sock);
+#endif
+		if (pthread_create(
+				&client_thread, NULL, ws_establishconnection, cli))
+			panic("Could not create the client thread!");
+
+		pthread_detach(client_thread);
 	}
 
-	free(data);
-	return (data);
+	return (NULL);
 }
 
 /**
@@ -1958,10 +6388,12 @@ static void *ws_accept(void *data)
  * configurations.
  *
  * @param ws_srv Web Socket configurations.
+ * @param reuseport Whether the port is shared with other sockets
+ * (SO_REUSEPORT), one per accept shard.
  *
  * @return Returns the socket file descriptor.
  */
-static int do_bind_socket(struct ws_server *ws_srv)
+static int do_bind_socket(struct ws_server *ws_srv, int reuseport)
 {
 	struct addrinfo hints, *results, *try;
 	char port[8] = {0};
@@ -1999,6 +6431,17 @@ static int do_bind_socket(struct ws_server *ws_srv)
 			panic("setsockopt(SO_REUSEADDR) failed");
 		}
 
+#ifdef SO_REUSEPORT
+		/* Share the port among the accept shards. */
+		if (reuseport && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT,
+			(const char *)&reuse, sizeof(reuse)) < 0)
+		{
+			panic("setsockopt(SO_REUSEPORT) failed");
+		}
+#else
+		((void)reuseport);
+#endif
+
 		/* Bind. */
 		if (bind(sock, try->ai_addr, try->ai_addrlen) < 0)
 			panic("Bind failed");
@@ -2016,31 +6459,191 @@ static int do_bind_socket(struct ws_server *ws_srv)
 	return (sock);
 }
 
+#ifdef WS_HAS_STEER
 /**
- * @brief Main loop for the server.
+ * @brief Steers each new connection to the accept shard of the CPU
+ * that received it, by attaching a classic BPF program (CPU number
+ * modulo the amount of shards) to the SO_REUSEPORT group of the
+ * listening sockets of @p srv.
  *
- * @param ws_srv Web Socket server parameters.
+ * The program returns the index of the socket in the group, which
+ * is the order the sockets started listening: the shard index.
  *
- * @return If @p thread_loop != 0, returns 0. Otherwise, never
- * returns.
+ * @param srv Server instance.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
  */
-int ws_socket(struct ws_server *ws_srv)
+static void shards_steer(struct ws_instance *srv)
+{
+	struct sock_filter code[] = {
+		{BPF_LD  | BPF_W   | BPF_ABS, 0, 0, SKF_AD_OFF + SKF_AD_CPU},
+		{BPF_ALU | BPF_MOD | BPF_K,   0, 0, (uint32_t)srv->nshards},
+		{BPF_RET | BPF_A,             0, 0, 0}
+	};
+	struct sock_fprog prog;
+
+	prog.len    = sizeof(code) / sizeof(code[0]);
+	prog.filter = code;
+
+	/* Attaching to a single socket is enough for the whole group. */
+	if (setsockopt(srv->shards[0].sock, SOL_SOCKET,
+		SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0)
+	{
+		DEBUG("Unable to steer connections, using the kernel hash!\n");
+	}
+}
+#endif
+
+/**
+ * @brief Creates the listening sockets and the clients table
+ * partitions of all the accept shards of @p srv.
+ *
+ * @param srv Server instance.
+ *
+ * @attention This is part of the internal API and is documented just
+ * for completeness.
+ */
+static void shards_init(struct ws_instance *srv)
 {
-	struct ws_accept_params *ws_prm; /* Accept parameters. */
-	pthread_t accept_thread;   /* Accept thread.         */
-	int sock;                 /* Client sock.           */
+	struct ws_shard *shard;
+	int i;
+
+	srv->nshards = srv->ws_srv.accept_shards;
+	srv->shards  = calloc(srv->nshards, sizeof(*srv->shards));
+	if (!srv->shards)
+		panic("Unable to allocate accept shards, out of memory!\n");
+
+	for (i = 0; i < srv->nshards; i++)
+	{
+		shard            = &srv->shards[i];
+		shard->idx       = i;
+		shard->srv       = srv;
+		shard->part.free = -1;
+		shard->part.srv  = srv;
+
+#ifdef WS_HAS_EPOLL
+		if (srv->ws_srv.io_model != WS_IO_THREADS)
+			shard->next_loop = i % srv->nloops;
+#endif
+
+		if (pthread_mutex_init(&shard->part.mtx, NULL))
+			panic("Error on allocating clients table mutex");
+
+		/* Create socket, bind and listen. */
+		shard->sock = do_bind_socket(&srv->ws_srv, srv->nshards > 1);
+		if (listen(shard->sock, srv->ws_srv.backlog) < 0)
+			panic("Unable to listen!\n");
+
+#ifndef _WIN32
+		/* Non-blocking, so that pending connections can be drained. */
+		if (fcntl(shard->sock, F_SETFL,
+			fcntl(shard->sock, F_GETFL, 0) | O_NONBLOCK) < 0)
+		{
+			panic("Unable to set the listening socket non-blocking!\n");
+		}
+#endif
+
+#ifdef TCP_DEFER_ACCEPT
+		/* Wake up only once the handshake request arrives. */
+		if (srv->ws_srv.defer_accept_ms)
+		{
+			int secs = (int)((srv->ws_srv.defer_accept_ms + 999) / 1000);
+			if (setsockopt(shard->sock, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+				&secs, sizeof(secs)) < 0)
+			{
+				DEBUG("Unable to set TCP_DEFER_ACCEPT!\n");
+			}
+		}
+#endif
+	}
+
+#ifdef WS_HAS_STEER
+	if (srv->ws_srv.accept_steer && srv->nshards > 1)
+		shards_steer(srv);
+#endif
+}
 
-	timeout = ws_srv->timeout_ms;
+/**
+ * @brief Creates a server instance with the parameters in @p ws_srv:
+ * its own clients table, locks, limits and event loops, and its
+ * listening socket(s), already bound and listening.
+ *
+ * Connections are only accepted once ws_start() is invoked.
+ *
+ * @param ws_srv Web Socket server parameters.
+ *
+ * @return Returns the server instance.
+ */
+ws_instance_t *ws_init(struct ws_server *ws_srv)
+{
+	struct ws_instance *srv; /* Server instance. */
 
 	/* Ignore 'unused functions' warnings. */
 	((void)skip_frame);
 
-	/* Allocates our parameters data and copy the ws_server structure. */
-	ws_prm = malloc(sizeof(*ws_prm));
-	if (!ws_prm)
-		panic("Unable to allocate ws parameters, out of memory!\n");
+	/* Allocates the instance and copy the ws_server structure. */
+	srv = calloc(1, sizeof(*srv));
+	if (!srv)
+		panic("Unable to allocate the server instance, out of memory!\n");
+
+	memcpy(&srv->ws_srv, ws_srv, sizeof(*ws_srv));
+	if (pthread_mutex_init(&srv->mtx, NULL))
+		panic("Error on allocating server mutex");
+
+	/*
+	 * Refuse garbage (such as from a structure not zero-initialized)
+	 * instead of taking it as an I/O model or send queue policy.
+	 */
+	if (srv->ws_srv.io_model < WS_IO_THREADS ||
+		srv->ws_srv.io_model > WS_IO_URING)
+	{
+		panic("Invalid I/O model, is struct ws_server zero-initialized?");
+	}
+	if (srv->ws_srv.sndq_policy < WS_SNDQ_DISCONNECT ||
+		srv->ws_srv.sndq_policy > WS_SNDQ_DROP_NEWEST)
+	{
+		panic("Invalid send queue policy, is struct ws_server "
+			"zero-initialized?");
+	}
+
+	if (srv->ws_srv.max_clients <= 0)
+		srv->ws_srv.max_clients = MAX_CLIENTS;
+	if (srv->ws_srv.backlog <= 0)
+		srv->ws_srv.backlog = WS_BACKLOG;
+	if (!srv->ws_srv.sndq_max)
+		srv->ws_srv.sndq_max = WS_SNDQ_MAX;
+	if (srv->ws_srv.ping_threshold <= 0)
+		srv->ws_srv.ping_threshold = WS_PING_THRESHOLD;
+	if (!srv->ws_srv.handshake_max)
+		srv->ws_srv.handshake_max = WS_HANDSHAKE_MAX;
+	if (!srv->ws_srv.deflate_min)
+		srv->ws_srv.deflate_min = WS_DEFLATE_MIN;
+	if (srv->ws_srv.deflate_window_bits <= 0 ||
+		srv->ws_srv.deflate_window_bits > 15)
+		srv->ws_srv.deflate_window_bits = 15;
+	else if (srv->ws_srv.deflate_window_bits < 9)
+		srv->ws_srv.deflate_window_bits = 9;
+
+	/* Multiple listeners need SO_REUSEPORT. */
+#ifdef SO_REUSEPORT
+	if (srv->ws_srv.accept_shards <= 0)
+#endif
+		srv->ws_srv.accept_shards = 1;
 
-	memcpy(&ws_prm->ws_srv, ws_srv, sizeof(*ws_srv));
+	/*
+	 * Start the event loops, if any. I/O models not supported on
+	 * this platform fall back to thread-per-connection.
+	 */
+#ifdef WS_HAS_EPOLL
+	if (srv->ws_srv.io_model == WS_IO_EPOLL ||
+		srv->ws_srv.io_model == WS_IO_URING)
+	{
+		evloop_init(srv);
+	}
+	else
+#endif
+		srv->ws_srv.io_model = WS_IO_THREADS;
 
 #ifdef _WIN32
 	WSADATA wsaData;
@@ -2060,32 +6663,69 @@ int ws_socket(struct ws_server *ws_srv)
 	setvbuf(stdout, NULL, _IONBF, 0);
 #endif
 
-	/* Create socket and bind. */
-	sock = do_bind_socket(ws_srv);
+	/* Create the sockets, bind and listen. */
+	shards_init(srv);
+
+	/* Register the instance, for the broadcasts by port. */
+	/* clang-format off */
+	pthread_mutex_lock(&inst_mutex);
+		srv->next = instances;
+		__atomic_store_n(&instances, srv, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&inst_mutex);
+	/* clang-format on */
+
+	return (srv);
+}
 
-	/* Listen. */
-	if (listen(sock, MAX_CLIENTS) < 0)
-		panic("Unable to listen!\n");
+/**
+ * @brief Starts accepting connections on a server instance created
+ * by ws_init().
+ *
+ * @param srv Server instance.
+ *
+ * @return If @p thread_loop != 0, returns 0. Otherwise, never
+ * returns.
+ */
+int ws_start(ws_instance_t *srv)
+{
+	struct ws_shard *shard; /* Accept shard. */
+	int i;                  /* Loop index.   */
 
 	/* Wait for incoming connections. */
 	printf("Waiting for incoming connections...\n");
-	memset(client_socks, -1, sizeof(client_socks));
-
-	/* Accept connections. */
-	ws_prm->sock = sock;
 
-	if (!ws_srv->thread_loop)
-		ws_accept(ws_prm);
-	else
+	/*
+	 * Accept connections: the first shard runs on this thread, unless
+	 * a non-blocking start was requested.
+	 */
+	for (i = !srv->ws_srv.thread_loop; i < srv->nshards; i++)
 	{
-		if (pthread_create(&accept_thread, NULL, ws_accept, (void *)ws_prm))
-			panic("Could not create the client thread!");
-		pthread_detach(accept_thread);
+		shard = &srv->shards[i];
+		if (pthread_create(&shard->thread, NULL, ws_accept, shard))
+			panic("Could not create the accept thread!");
+		pthread_detach(shard->thread);
 	}
 
+	if (!srv->ws_srv.thread_loop)
+		ws_accept(&srv->shards[0]);
+
 	return (0);
 }
 
+/**
+ * @brief Main loop for the server: creates a server instance and
+ * starts it, just like ws_init() followed by ws_start().
+ *
+ * @param ws_srv Web Socket server parameters.
+ *
+ * @return If @p thread_loop != 0, returns 0. Otherwise, never
+ * returns.
+ */
+int ws_socket(struct ws_server *ws_srv)
+{
+	return (ws_start(ws_init(ws_srv)));
+}
+
 #ifdef AFL_FUZZ
 /**
  * @brief WebSocket fuzzy test routine
@@ -2107,33 +6747,53 @@ int ws_socket(struct ws_server *ws_srv)
  */
 int ws_file(struct ws_events *evs, const char *file)
 {
+	static struct ws_instance srv;
+	static struct ws_part part;
+	struct ws_connection *cli;
 	int sock;
 	sock = open(file, O_RDONLY);
 	if (sock < 0)
 		panic("Invalid file\n");
 
 	/* Copy events. */
-	memcpy(&cli_events, evs, sizeof(struct ws_events));
+	memcpy(&srv.ws_srv.evs, evs, sizeof(struct ws_events));
+	srv.ws_srv.handshake_max = WS_HANDSHAKE_MAX;
+
+#ifdef WS_HAS_DEFLATE
+	/* Accept permessage-deflate, so that its offers are fuzzed too. */
+	srv.ws_srv.deflate             = 1;
+	srv.ws_srv.deflate_window_bits = 15;
+	srv.ws_srv.deflate_min         = WS_DEFLATE_MIN;
+#endif
 
-	/* Clear client socks list. */
-	memset(client_socks, -1, sizeof(client_socks));
+	/* Get a client slot. */
+	part.free = -1;
+	part.srv  = &srv;
+	if (pthread_mutex_init(&part.mtx, NULL) ||
+		pthread_mutex_init(&srv.mtx, NULL))
+	{
+		panic("Error on allocating clients table mutex");
+	}
+	cli = client_alloc(&part);
+	if (!cli)
+		panic("Unable to allocate a client, out of memory!\n");
 
 	/* Set client settings. */
-	client_socks[0].client_sock = sock;
-	client_socks[0].state = WS_STATE_CONNECTING;
-	client_socks[0].close_thrd = false;
-
-	/* Initialize mutexes. */
-	if (pthread_mutex_init(&client_socks[0].mtx_state, NULL))
-		panic("Error on allocating close mutex");
-	if (pthread_cond_init(&client_socks[0].cnd_state_close, NULL))
-		panic("Error on allocating condition var\n");
-	if (pthread_mutex_init(&client_socks[0].mtx_snd, NULL))
-		panic("Error on allocating send mutex");
-	if (pthread_mutex_init(&client_socks[0].mtx_ping, NULL))
-		panic("Error on allocating ping/pong mutex");
+	cli->client_sock = sock;
+	cli->state = WS_STATE_CONNECTING;
+	cli->cold->close_armed = false;
+	cli->srv = &srv;
+	cli->cold->peer_len = 0;
+	cli->cold->peer_fmt = false;
+	srv.active_clients = 1;
+#ifdef WS_HAS_DEFLATE
+	cli->pmd = NULL;
+#endif
+	set_client_id(cli);
+	timer_init(&cli->cold->tmr_close, close_timeout, cli);
+	timer_init(&cli->cold->tmr_ping, heartbeat, cli);
 
-	ws_establishconnection(&client_socks[0]);
+	ws_establishconnection(cli);
 	return (0);
 }
 #endif
@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2016-2024 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+
+/**
+ * @dir tests/bench/
+ * @brief wsServer benchmarks folder
+ *
+ * @file bench.c
+ * @brief Helpers shared by the wsServer benchmarks.
+ */
+
+/**
+ * @brief Handshake request sent by the benchmarks clients.
+ */
+static const char handshake_req[] =
+	"GET / HTTP/1.1\r\n"
+	"Host: 127.0.0.1\r\n"
+	"Upgrade: websocket\r\n"
+	"Connection: Upgrade\r\n"
+	"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+	"Sec-WebSocket-Version: 13\r\n"
+	"\r\n";
+
+/**
+ * @brief Returns a monotonic timestamp, in seconds.
+ */
+double bench_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+/**
+ * @brief Writes all the @p len bytes of @p buf into @p fd.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+int bench_write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t r;
+
+	while (len)
+	{
+		r = send(fd, p, len, MSG_NOSIGNAL);
+		if (r < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		p   += r;
+		len -= r;
+	}
+	return (0);
+}
+
+/**
+ * @brief Connects to the server at 127.0.0.1:@p port, retrying
+ * for a while, so the server has the time to start.
+ *
+ * @return Returns the socket, or -1 if error.
+ */
+int bench_connect(uint16_t port)
+{
+	struct sockaddr_in sa;
+	struct timespec ts;
+	int tries;
+	int one;
+	int fd;
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family      = AF_INET;
+	sa.sin_port        = htons(port);
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	ts.tv_sec  = 0;
+	ts.tv_nsec = 10 * 1000 * 1000;
+
+	for (tries = 0; tries < 500; tries++)
+	{
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0)
+			return (-1);
+
+		if (!connect(fd, (struct sockaddr *)&sa, sizeof(sa)))
+		{
+			one = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			return (fd);
+		}
+
+		close(fd);
+		if (errno != ECONNREFUSED)
+			return (-1);
+		nanosleep(&ts, NULL);
+	}
+	return (-1);
+}
+
+/**
+ * @brief Performs the opening handshake on the connected socket
+ * @p fd.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+int bench_handshake(int fd)
+{
+	char buf[1024];
+	size_t len;
+	ssize_t r;
+
+	if (bench_write_all(fd, handshake_req, sizeof(handshake_req) - 1) < 0)
+		return (-1);
+
+	/* Read the response, byte by byte, to not consume any frame. */
+	len = 0;
+	while (len < sizeof(buf) - 1)
+	{
+		r = recv(fd, buf + len, 1, 0);
+		if (r <= 0)
+			return (-1);
+		len++;
+		if (len >= 4 && !memcmp(buf + len - 4, "\r\n\r\n", 4))
+			break;
+	}
+
+	buf[len] = '\0';
+	return (strstr(buf, " 101 ") ? 0 : -1);
+}
+
+/**
+ * @brief Connects to the server at 127.0.0.1:@p port and performs
+ * the opening handshake.
+ *
+ * @return Returns the socket, or -1 if error.
+ */
+int bench_open(uint16_t port)
+{
+	int fd;
+
+	fd = bench_connect(port);
+	if (fd < 0)
+		return (-1);
+
+	if (bench_handshake(fd) < 0)
+	{
+		close(fd);
+		return (-1);
+	}
+	return (fd);
+}
+
+/**
+ * @brief Builds a masked client frame with opcode @p opcode and
+ * the @p len bytes of @p payload into @p out, which must have room
+ * for at least BENCH_FRAME_HDR + @p len bytes.
+ *
+ * @return Returns the frame size.
+ */
+size_t bench_frame(unsigned char *out, int opcode, const void *payload,
+	size_t len)
+{
+	static const unsigned char mask[4] = {0x12, 0x34, 0x56, 0x78};
+	const unsigned char *p = payload;
+	size_t hdr;
+	size_t i;
+	int j;
+
+	out[0] = 0x80 | (opcode & 0xF);
+	if (len <= 125)
+	{
+		out[1] = 0x80 | (unsigned char)len;
+		hdr    = 2;
+	}
+	else if (len <= 65535)
+	{
+		out[1] = 0x80 | 126;
+		out[2] = (unsigned char)(len >> 8);
+		out[3] = (unsigned char)len;
+		hdr    = 4;
+	}
+	else
+	{
+		out[1] = 0x80 | 127;
+		for (j = 0; j < 8; j++)
+			out[2 + j] = (unsigned char)((uint64_t)len >> (56 - 8 * j));
+		hdr = 10;
+	}
+
+	memcpy(out + hdr, mask, 4);
+	hdr += 4;
+
+	for (i = 0; i < len; i++)
+		out[hdr + i] = p[i] ^ mask[i & 3];
+
+	return (hdr + len);
+}
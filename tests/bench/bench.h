@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2016-2024 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/**
+ * @file bench.h
+ * @brief Helpers shared by the wsServer benchmarks: a tiny blocking
+ * WebSocket client and timing routines.
+ */
+#ifndef BENCH_H
+#define BENCH_H
+
+	#include <stddef.h>
+	#include <stdint.h>
+
+	/**
+	 * @brief Maximum header size of a client (masked) frame.
+	 */
+	#define BENCH_FRAME_HDR 14
+
+	extern double bench_now(void);
+	extern int bench_connect(uint16_t port);
+	extern int bench_handshake(int fd);
+	extern int bench_open(uint16_t port);
+	extern size_t bench_frame(unsigned char *out, int opcode,
+		const void *payload, size_t len);
+	extern int bench_write_all(int fd, const void *buf, size_t len);
+
+#endif /* BENCH_H */
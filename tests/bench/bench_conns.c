@@ -0,0 +1,268 @@
+/*
+ * Copyright (C) 2016-2024 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <ws.h>
+
+#include "bench.h"
+
+/**
+ * @file bench_conns.c
+ * @brief Idle connections benchmark: server memory (RSS) per idle
+ * connection and connection setup rate, for each I/O model.
+ *
+ * The server runs in a child process, so that its RSS can be read
+ * from /proc before and after opening the connections.
+ */
+
+/**
+ * @brief Benchmark parameters.
+ */
+static struct bench_params
+{
+	int conns;     /**< Amount of connections. */
+	uint16_t port; /**< Base port.             */
+} prm = {1000, 8100};
+
+/**
+ * @brief Echo server: message event.
+ */
+static void onmessage(ws_cli_conn_t client,
+	const unsigned char *msg, uint64_t size, int type)
+{
+	ws_sendframe(client, (const char *)msg, size, type);
+}
+
+/**
+ * @brief Echo server: open/close events.
+ */
+static void onevent(ws_cli_conn_t client)
+{
+	((void)client);
+}
+
+/**
+ * @brief Runs the echo server with a given I/O @p model, never
+ * returns.
+ */
+static void run_server(int model, uint16_t port)
+{
+	ws_socket(&(struct ws_server){
+		.host = "127.0.0.1",
+		.port = port,
+		.thread_loop   = 0,
+		.timeout_ms    = 1000,
+		.io_model      = model,
+		.io_threads    = 1,
+		.max_clients   = prm.conns + 1,
+		.evs.onopen    = &onevent,
+		.evs.onclose   = &onevent,
+		.evs.onmessage = &onmessage
+	});
+	_exit(1);
+}
+
+/**
+ * @brief Reads the resident set size (in kB) of a given process.
+ *
+ * @return Returns the RSS, or -1 if error.
+ */
+static long read_rss(pid_t pid)
+{
+	char path[64];
+	char line[256];
+	long rss;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/proc/%d/status", (int)pid);
+	f = fopen(path, "r");
+	if (!f)
+		return (-1);
+
+	rss = -1;
+	while (fgets(line, sizeof(line), f))
+		if (sscanf(line, "VmRSS: %ld kB", &rss) == 1)
+			break;
+
+	fclose(f);
+	return (rss);
+}
+
+/**
+ * @brief Waits a bit, so that the server settles down.
+ */
+static void settle(void)
+{
+	struct timespec ts = {0, 300 * 1000 * 1000};
+	nanosleep(&ts, NULL);
+}
+
+/**
+ * @brief Runs the benchmark for a given I/O model.
+ *
+ * @param model I/O model.
+ * @param port Server port.
+ * @param per_conn Server memory (in bytes) per idle connection.
+ * @param rate Connections (with handshake) per second.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+static int bench_model(int model, uint16_t port, double *per_conn,
+	double *rate)
+{
+	double start;
+	long rss0;
+	long rss1;
+	pid_t pid;
+	int *fds;
+	int ret;
+	int i;
+
+	ret = -1;
+	fds = calloc(prm.conns + 1, sizeof(int));
+	if (!fds)
+		return (-1);
+
+	pid = fork();
+	if (pid < 0)
+		goto out;
+	if (!pid)
+		run_server(model, port);
+
+	/* Warm up: the first connection allocates the server structures. */
+	fds[0] = bench_open(port);
+	if (fds[0] < 0)
+		goto kill;
+
+	settle();
+	rss0 = read_rss(pid);
+
+	start = bench_now();
+	for (i = 1; i <= prm.conns; i++)
+	{
+		fds[i] = bench_open(port);
+		if (fds[i] < 0)
+		{
+			fprintf(stderr, "Unable to open connection #%d\n", i);
+			goto kill;
+		}
+	}
+	*rate = prm.conns / (bench_now() - start);
+
+	settle();
+	rss1 = read_rss(pid);
+	if (rss0 < 0 || rss1 < 0)
+		goto kill;
+
+	*per_conn = (rss1 - rss0) * 1024.0 / prm.conns;
+	ret = 0;
+kill:
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	for (i = 0; i <= prm.conns; i++)
+		if (fds[i] > 0)
+			close(fds[i]);
+out:
+	free(fds);
+	return (ret);
+}
+
+/**
+ * @brief Shows the usage.
+ */
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -m <threads|epoll|uring|all>  I/O model (default: all)\n"
+		"  -c <n>  Idle connections (default: %d)\n"
+		"  -p <n>  Base port (default: %d)\n",
+		prog, prm.conns, prm.port);
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Main routine.
+ */
+int main(int argc, char **argv)
+{
+	static const char *names[] = {"threads", "epoll", "uring"};
+	struct rlimit rl;
+	double per_conn;
+	double rate;
+	int model;
+	int first;
+	int last;
+	int c;
+
+	first = WS_IO_THREADS;
+	last  = WS_IO_URING;
+
+	while ((c = getopt(argc, argv, "m:c:p:h")) != -1)
+	{
+		switch (c)
+		{
+		case 'm':
+			for (model = WS_IO_THREADS; model <= WS_IO_URING; model++)
+				if (!strcmp(optarg, names[model]))
+					first = last = model;
+			if (strcmp(optarg, "all") && first != last)
+				usage(argv[0]);
+			break;
+		case 'c': prm.conns = atoi(optarg); break;
+		case 'p': prm.port  = atoi(optarg); break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (prm.conns <= 0)
+		usage(argv[0]);
+
+	/* Both client and server need a fd per connection. */
+	if (!getrlimit(RLIMIT_NOFILE, &rl))
+	{
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+		if (rl.rlim_cur < (rlim_t)prm.conns + 64)
+			fprintf(stderr, "Warning: RLIMIT_NOFILE (%ld) may be too low!\n",
+				(long)rl.rlim_cur);
+	}
+
+	printf("%d idle connections\n", prm.conns);
+	printf("%-8s %16s %14s\n", "model", "bytes/conn (RSS)", "conns/s");
+
+	for (model = first; model <= last; model++)
+	{
+		if (bench_model(model, prm.port + model, &per_conn, &rate) < 0)
+		{
+			printf("%-8s failed\n", names[model]);
+			continue;
+		}
+		printf("%-8s %16.0f %14.0f\n", names[model], per_conn, rate);
+	}
+
+	return (0);
+}
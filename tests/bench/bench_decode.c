@@ -0,0 +1,291 @@
+/*
+ * Copyright (C) 2016-2024 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#define _GNU_SOURCE
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <ws.h>
+
+#include "bench.h"
+
+/**
+ * @file bench_decode.c
+ * @brief Frame decoder benchmark: how fast (in MB/s of payload) the
+ * server decodes the incoming messages, for a few message sizes and
+ * each I/O model.
+ *
+ * The server runs in a child process and drops every message. The
+ * client streams a batch of messages followed by a PING: since the
+ * frames are handled in order, the PONG marks the end of the batch.
+ */
+
+/**
+ * @brief Approximate size of the client send buffer.
+ */
+#define SEND_BUFFER (1 << 20)
+
+/**
+ * @brief Benchmark parameters.
+ */
+static struct bench_params
+{
+	size_t size;   /**< Message size, 0 for the defaults. */
+	long mbytes;   /**< Payload (in MB) per run.          */
+	uint16_t port; /**< Base port.                        */
+} prm = {0, 256, 8110};
+
+/**
+ * @brief Default message sizes.
+ */
+static const size_t sizes[] = {16, 1 << 10, 64 << 10, 16 << 20};
+
+/**
+ * @brief Sink server: message event.
+ */
+static void onmessage(ws_cli_conn_t client,
+	const unsigned char *msg, uint64_t size, int type)
+{
+	((void)client);
+	((void)msg);
+	((void)size);
+	((void)type);
+}
+
+/**
+ * @brief Sink server: open/close events.
+ */
+static void onevent(ws_cli_conn_t client)
+{
+	((void)client);
+}
+
+/**
+ * @brief Runs the sink server with a given I/O @p model, never
+ * returns.
+ */
+static void run_server(int model, uint16_t port)
+{
+	ws_socket(&(struct ws_server){
+		.host = "127.0.0.1",
+		.port = port,
+		.thread_loop   = 0,
+		.timeout_ms    = 1000,
+		.io_model      = model,
+		.io_threads    = 1,
+		.evs.onopen    = &onevent,
+		.evs.onclose   = &onevent,
+		.evs.onmessage = &onmessage
+	});
+	_exit(1);
+}
+
+/**
+ * @brief Sends a PING and waits for its PONG.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+static int ping_pong(int fd)
+{
+	unsigned char frame[BENCH_FRAME_HDR + 4];
+	unsigned char buf[2 + 125];
+	size_t need;
+	size_t len;
+	ssize_t r;
+
+	len = bench_frame(frame, WS_FR_OP_PING, "sync", 4);
+	if (bench_write_all(fd, frame, len) < 0)
+		return (-1);
+
+	/* Server frames are not masked and a PONG fits in 125 bytes. */
+	need = 2;
+	len  = 0;
+	while (len < need)
+	{
+		r = recv(fd, buf + len, need - len, 0);
+		if (r <= 0)
+			return (-1);
+		len += r;
+		if (len == 2)
+			need += buf[1] & 0x7F;
+	}
+	return ((buf[0] & 0xF) == WS_FR_OP_PONG ? 0 : -1);
+}
+
+/**
+ * @brief Runs the benchmark for a given I/O model and message size.
+ *
+ * @param model I/O model.
+ * @param port Server port.
+ * @param size Message size.
+ * @param mbs Decoded payload, in MB/s.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+static int bench_model(int model, uint16_t port, size_t size, double *mbs)
+{
+	unsigned char *payload;
+	unsigned char *buf;
+	size_t per_buf;
+	size_t frame;
+	size_t len;
+	double start;
+	long total;
+	long sent;
+	pid_t pid;
+	size_t i;
+	int ret;
+	int fd;
+
+	ret     = -1;
+	fd      = -1;
+	frame   = BENCH_FRAME_HDR + size;
+	per_buf = SEND_BUFFER / frame ? SEND_BUFFER / frame : 1;
+	total   = (prm.mbytes << 20) / (long)size;
+	if (total < 1)
+		total = 1;
+
+	payload = malloc(size);
+	buf     = malloc(per_buf * frame);
+	if (!payload || !buf)
+		goto out;
+
+	for (i = 0; i < size; i++)
+		payload[i] = 'a' + (i % 26);
+
+	/* Many binary messages back to back. */
+	len = 0;
+	for (i = 0; i < per_buf; i++)
+		len += bench_frame(buf + len, WS_FR_OP_BIN, payload, size);
+
+	pid = fork();
+	if (pid < 0)
+		goto out;
+	if (!pid)
+		run_server(model, port);
+
+	fd = bench_open(port);
+	if (fd < 0)
+		goto kill;
+
+	/* Warm up. */
+	if (bench_write_all(fd, buf, len) < 0 || ping_pong(fd) < 0)
+		goto kill;
+
+	start = bench_now();
+	for (sent = 0; sent < total; sent += per_buf)
+		if (bench_write_all(fd, buf, len) < 0)
+			goto kill;
+	if (ping_pong(fd) < 0)
+		goto kill;
+
+	*mbs = (double)sent * size / (bench_now() - start) / (1 << 20);
+	ret  = 0;
+kill:
+	if (fd >= 0)
+		close(fd);
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+out:
+	free(payload);
+	free(buf);
+	return (ret);
+}
+
+/**
+ * @brief Shows the usage.
+ */
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -m <threads|epoll|uring|all>  I/O model (default: all)\n"
+		"  -s <n>  Message size (default: 16, 1K, 64K and 16M)\n"
+		"  -b <n>  Payload (in MB) per run (default: %ld)\n"
+		"  -p <n>  Base port (default: %d)\n",
+		prog, prm.mbytes, prm.port);
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Main routine.
+ */
+int main(int argc, char **argv)
+{
+	static const char *names[] = {"threads", "epoll", "uring"};
+	size_t nsizes;
+	size_t s;
+	double mbs;
+	int model;
+	int first;
+	int last;
+	int c;
+
+	first = WS_IO_THREADS;
+	last  = WS_IO_URING;
+
+	while ((c = getopt(argc, argv, "m:s:b:p:h")) != -1)
+	{
+		switch (c)
+		{
+		case 'm':
+			for (model = WS_IO_THREADS; model <= WS_IO_URING; model++)
+				if (!strcmp(optarg, names[model]))
+					first = last = model;
+			if (strcmp(optarg, "all") && first != last)
+				usage(argv[0]);
+			break;
+		case 's': prm.size   = atol(optarg); break;
+		case 'b': prm.mbytes = atol(optarg); break;
+		case 'p': prm.port   = atoi(optarg); break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (prm.size > MAX_FRAME_LENGTH || prm.mbytes <= 0)
+		usage(argv[0]);
+
+	nsizes = prm.size ? 1 : sizeof(sizes) / sizeof(sizes[0]);
+
+	printf("%ld MB per run, decoded MB/s\n", prm.mbytes);
+	printf("%-10s", "size");
+	for (model = first; model <= last; model++)
+		printf(" %10s", names[model]);
+	printf("\n");
+
+	for (s = 0; s < nsizes; s++)
+	{
+		size_t size = prm.size ? prm.size : sizes[s];
+		printf("%-10zu", size);
+		for (model = first; model <= last; model++)
+		{
+			if (bench_model(model, prm.port + model, size, &mbs) < 0)
+				printf(" %10s", "failed");
+			else
+				printf(" %10.1f", mbs);
+			fflush(stdout);
+		}
+		printf("\n");
+	}
+
+	return (0);
+}
@@ -0,0 +1,328 @@
+/*
+ * Copyright (C) 2016-2024 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <ws.h>
+
+#include "bench.h"
+
+/**
+ * @file bench_handshake.c
+ * @brief Handshake rate benchmark: handshake responses built per
+ * second (in memory) and complete handshakes per second (connect,
+ * upgrade and close), for each I/O model.
+ *
+ * The server runs in a child process, with one or more accept
+ * shards; the clients abort their connections (RST), so that no
+ * TIME_WAIT socket is left behind.
+ */
+
+/**
+ * @brief Benchmark parameters.
+ */
+static struct bench_params
+{
+	int clients;   /**< Client threads.                  */
+	int secs;      /**< Duration (in seconds) per model. */
+	long builds;   /**< Responses built (in memory).     */
+	uint16_t port; /**< Base port.                       */
+	int shards;    /**< Server accept shards.            */
+	int steer;     /**< Steer connections by CPU, if 1.  */
+} prm = {4, 2, 1000000, 8200, 1, 0};
+
+/**
+ * @brief Typical browser upgrade request.
+ */
+static const char browser_req[] =
+	"GET /chat HTTP/1.1\r\n"
+	"Host: 127.0.0.1:8080\r\n"
+	"Connection: Upgrade\r\n"
+	"Pragma: no-cache\r\n"
+	"Cache-Control: no-cache\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "
+	"(KHTML, like Gecko) Chrome/120.0.0.0 Safari/537.36\r\n"
+	"Upgrade: websocket\r\n"
+	"Origin: http://127.0.0.1:8080\r\n"
+	"Sec-WebSocket-Version: 13\r\n"
+	"Accept-Encoding: gzip, deflate, br\r\n"
+	"Accept-Language: en-US,en;q=0.9\r\n"
+	"Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+	"\r\n";
+
+/**
+ * @brief Client thread state.
+ */
+struct bench_client
+{
+	pthread_t thread; /**< Thread.                 */
+	uint16_t port;    /**< Server port.            */
+	double end;       /**< Deadline.               */
+	long done;        /**< Handshakes done.        */
+	int error;        /**< Failed handshake, if 1. */
+};
+
+/**
+ * @brief Echo server: message event.
+ */
+static void onmessage(ws_cli_conn_t client,
+	const unsigned char *msg, uint64_t size, int type)
+{
+	ws_sendframe(client, (const char *)msg, size, type);
+}
+
+/**
+ * @brief Echo server: open/close events.
+ */
+static void onevent(ws_cli_conn_t client)
+{
+	((void)client);
+}
+
+/**
+ * @brief Runs the echo server with a given I/O @p model, never
+ * returns.
+ */
+static void run_server(int model, uint16_t port)
+{
+	ws_socket(&(struct ws_server){
+		.host = "127.0.0.1",
+		.port = port,
+		.thread_loop   = 0,
+		.timeout_ms    = 1000,
+		.io_model      = model,
+		.io_threads    = 1,
+		.max_clients   = 4096,
+		.accept_shards = prm.shards,
+		.accept_steer  = prm.steer,
+		.evs.onopen    = &onevent,
+		.evs.onclose   = &onevent,
+		.evs.onmessage = &onmessage
+	});
+	_exit(1);
+}
+
+/**
+ * @brief Builds the handshake response of the browser request
+ * prm.builds times.
+ *
+ * @return Returns the responses built per second, or -1 if error.
+ */
+static double run_builds(void)
+{
+	char response[WS_HS_RESP_LEN];
+	char req[sizeof(browser_req)];
+	double start;
+	long i;
+
+	start = bench_now();
+	for (i = 0; i < prm.builds; i++)
+	{
+		/* The request is parsed (and modified) in place. */
+		memcpy(req, browser_req, sizeof(req));
+		if (get_handshake_response(req, response) < 0)
+			return (-1);
+	}
+	return (prm.builds / (bench_now() - start));
+}
+
+/**
+ * @brief Client thread: connects, upgrades and aborts connections
+ * until the deadline.
+ */
+static void *client_thread(void *p)
+{
+	struct bench_client *cli = p;
+	struct linger lg = {1, 0};
+	int fd;
+
+	while (bench_now() < cli->end)
+	{
+		fd = bench_open(cli->port);
+		if (fd < 0)
+		{
+			cli->error = 1;
+			break;
+		}
+
+		setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+		close(fd);
+		cli->done++;
+	}
+	return (NULL);
+}
+
+/**
+ * @brief Runs the benchmark for a given I/O model.
+ *
+ * @param model I/O model.
+ * @param port Server port.
+ *
+ * @return Returns the handshakes per second, or -1 if error.
+ */
+static double bench_model(int model, uint16_t port)
+{
+	struct bench_client *clis;
+	double start;
+	double ret;
+	long done;
+	pid_t pid;
+	int fd;
+	int i;
+
+	ret  = -1;
+	clis = calloc(prm.clients, sizeof(*clis));
+	if (!clis)
+		return (-1);
+
+	pid = fork();
+	if (pid < 0)
+		goto out;
+	if (!pid)
+		run_server(model, port);
+
+	/* Wait for the server to be ready. */
+	fd = bench_open(port);
+	if (fd < 0)
+		goto kill;
+	close(fd);
+
+	start = bench_now();
+	for (i = 0; i < prm.clients; i++)
+	{
+		clis[i].port = port;
+		clis[i].end  = start + prm.secs;
+		if (pthread_create(&clis[i].thread, NULL, client_thread, &clis[i]))
+		{
+			/* Let the ones already running finish. */
+			prm.clients = i;
+			break;
+		}
+	}
+
+	done = 0;
+	ret  = 0;
+	for (i = 0; i < prm.clients; i++)
+	{
+		pthread_join(clis[i].thread, NULL);
+		done += clis[i].done;
+		if (clis[i].error)
+			ret = -1;
+	}
+
+	if (!ret)
+		ret = done / (bench_now() - start);
+kill:
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+out:
+	free(clis);
+	return (ret);
+}
+
+/**
+ * @brief Shows the usage.
+ */
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -m <threads|epoll|uring|all>  I/O model (default: all)\n"
+		"  -c <n>  Client threads (default: %d)\n"
+		"  -d <n>  Duration (in seconds) per model (default: %d)\n"
+		"  -b <n>  Responses built in memory (default: %ld)\n"
+		"  -p <n>  Base port (default: %d)\n"
+		"  -s <n>  Server accept shards (default: %d)\n"
+		"  -S      Steer connections to the shard of their CPU\n",
+		prog, prm.clients, prm.secs, prm.builds, prm.port, prm.shards);
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Main routine.
+ */
+int main(int argc, char **argv)
+{
+	static const char *names[] = {"threads", "epoll", "uring"};
+	double rate;
+	int model;
+	int first;
+	int last;
+	int c;
+
+	first = WS_IO_THREADS;
+	last  = WS_IO_URING;
+
+	while ((c = getopt(argc, argv, "m:c:d:b:p:s:Sh")) != -1)
+	{
+		switch (c)
+		{
+		case 'm':
+			for (model = WS_IO_THREADS; model <= WS_IO_URING; model++)
+				if (!strcmp(optarg, names[model]))
+					first = last = model;
+			if (strcmp(optarg, "all") && first != last)
+				usage(argv[0]);
+			break;
+		case 'c': prm.clients = atoi(optarg); break;
+		case 'd': prm.secs    = atoi(optarg); break;
+		case 'b': prm.builds  = atol(optarg); break;
+		case 'p': prm.port    = atoi(optarg); break;
+		case 's': prm.shards  = atoi(optarg); break;
+		case 'S': prm.steer   = 1; break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (prm.clients <= 0 || prm.secs <= 0 || prm.builds <= 0 ||
+		prm.shards <= 0)
+		usage(argv[0]);
+
+	rate = run_builds();
+	if (rate < 0)
+	{
+		fprintf(stderr, "Unable to build the handshake response!\n");
+		return (1);
+	}
+	printf("%ld responses built in memory: %.0f responses/s\n\n",
+		prm.builds, rate);
+
+	printf("%d clients, %d s per model, %d accept shard(s)%s\n",
+		prm.clients, prm.secs, prm.shards, prm.steer ? " (steered)" : "");
+	printf("%-8s %14s\n", "model", "handshakes/s");
+
+	for (model = first; model <= last; model++)
+	{
+		rate = bench_model(model, prm.port + model);
+		if (rate < 0)
+		{
+			printf("%-8s failed\n", names[model]);
+			continue;
+		}
+		printf("%-8s %14.0f\n", names[model], rate);
+	}
+
+	return (0);
+}
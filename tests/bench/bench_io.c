@@ -0,0 +1,470 @@
+/*
+ * Copyright (C) 2016-2024 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ptrace.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <ws.h>
+
+#include "bench.h"
+
+/**
+ * @file bench_io.c
+ * @brief I/O models benchmark: echo throughput and syscalls per
+ * message of the server, for each I/O model.
+ *
+ * The server runs in a child process, serving a few clients that
+ * keep a window of messages in flight each. Each I/O model is run
+ * twice: once for the throughput and once under ptrace(2), which
+ * counts every syscall made by the server (all threads) while the
+ * messages are exchanged.
+ */
+
+/**
+ * @brief Maximum amount of client connections.
+ */
+#define MAX_CONNS 64
+
+/**
+ * @brief Benchmark parameters.
+ */
+static struct bench_params
+{
+	int conns;       /**< Amount of connections.          */
+	int window;      /**< Messages in flight, per client. */
+	long msgs;       /**< Messages, throughput run.       */
+	long msgs_trace; /**< Messages, traced run.           */
+	size_t size;     /**< Message size.                   */
+	uint16_t port;   /**< Base port.                      */
+} prm = {4, 16, 200000, 20000, 64, 8090};
+
+/**
+ * @brief Client state.
+ */
+struct bench_conn
+{
+	int fd;               /**< Socket.                  */
+	long sent;            /**< Messages sent.           */
+	long recvd;           /**< Messages received.       */
+	size_t rlen;          /**< Bytes buffered.          */
+	unsigned char *rbuf;  /**< Receive buffer.          */
+};
+
+/**
+ * @brief Client run phase: 0 = connecting, 1 = exchanging
+ * messages, 2 = done. Syscalls are only counted in phase 1.
+ */
+static int phase;
+
+/**
+ * @brief Echo server: message event.
+ */
+static void onmessage(ws_cli_conn_t client,
+	const unsigned char *msg, uint64_t size, int type)
+{
+	ws_sendframe(client, (const char *)msg, size, type);
+}
+
+/**
+ * @brief Echo server: open/close events.
+ */
+static void onevent(ws_cli_conn_t client)
+{
+	((void)client);
+}
+
+/**
+ * @brief Runs the echo server with a given I/O @p model, never
+ * returns.
+ */
+static void run_server(int model, uint16_t port)
+{
+	ws_socket(&(struct ws_server){
+		.host = "127.0.0.1",
+		.port = port,
+		.thread_loop   = 0,
+		.timeout_ms    = 1000,
+		.io_model      = model,
+		.io_threads    = 1,
+		.max_clients   = MAX_CONNS,
+		.evs.onopen    = &onevent,
+		.evs.onclose   = &onevent,
+		.evs.onmessage = &onmessage
+	});
+	_exit(1);
+}
+
+/**
+ * @brief Parses the (unmasked) frames buffered on @p c.
+ *
+ * @return Returns the amount of complete frames consumed.
+ */
+static int parse_frames(struct bench_conn *c)
+{
+	size_t off, hdr;
+	uint64_t len;
+	int frames;
+	int i;
+
+	off    = 0;
+	frames = 0;
+
+	while (c->rlen - off >= 2)
+	{
+		len = c->rbuf[off + 1] & 0x7F;
+		hdr = 2;
+		if (len == 126)
+			hdr = 4;
+		else if (len == 127)
+			hdr = 10;
+
+		if (c->rlen - off < hdr)
+			break;
+
+		if (len == 126)
+			len = ((uint64_t)c->rbuf[off + 2] << 8) | c->rbuf[off + 3];
+		else if (len == 127)
+			for (len = 0, i = 2; i < 10; i++)
+				len = (len << 8) | c->rbuf[off + i];
+
+		if (c->rlen - off < hdr + len)
+			break;
+
+		off += hdr + len;
+		frames++;
+	}
+
+	memmove(c->rbuf, c->rbuf + off, c->rlen - off);
+	c->rlen -= off;
+	return (frames);
+}
+
+/**
+ * @brief Exchanges @p msgs messages with the echo server at @p port.
+ *
+ * @return Returns the elapsed time (in seconds) of the messages
+ * exchange, or a negative number if error.
+ */
+static double run_client(uint16_t port, long msgs)
+{
+	struct bench_conn conns[MAX_CONNS];
+	struct pollfd pfds[MAX_CONNS];
+	unsigned char *payload;
+	unsigned char *frame;
+	size_t frame_len;
+	size_t rsize;
+	double start;
+	double ret;
+	long quota;
+	long done;
+	ssize_t n;
+	int i, j;
+
+	ret   = -1.0;
+	quota = msgs / prm.conns;
+	rsize = (prm.size + BENCH_FRAME_HDR) * prm.window * 2;
+	memset(conns, 0, sizeof(conns));
+
+	payload = malloc(prm.size);
+	frame   = malloc(prm.size + BENCH_FRAME_HDR);
+	if (!payload || !frame)
+		goto out;
+
+	memset(payload, 'a', prm.size);
+	frame_len = bench_frame(frame, WS_FR_OP_BIN, payload, prm.size);
+
+	for (i = 0; i < prm.conns; i++)
+	{
+		conns[i].fd   = bench_open(port);
+		conns[i].rbuf = malloc(rsize);
+		if (conns[i].fd < 0 || !conns[i].rbuf)
+		{
+			fprintf(stderr, "Unable to connect to port %d\n", port);
+			goto out;
+		}
+		pfds[i].fd     = conns[i].fd;
+		pfds[i].events = POLLIN;
+	}
+
+	__atomic_store_n(&phase, 1, __ATOMIC_SEQ_CST);
+	start = bench_now();
+
+	/* Fill the windows. */
+	for (i = 0; i < prm.conns; i++)
+	{
+		for (j = 0; j < prm.window && conns[i].sent < quota; j++)
+		{
+			if (bench_write_all(conns[i].fd, frame, frame_len) < 0)
+				goto out;
+			conns[i].sent++;
+		}
+	}
+
+	for (done = 0; done < quota * prm.conns; )
+	{
+		if (poll(pfds, prm.conns, 5000) <= 0)
+		{
+			fprintf(stderr, "Server stopped responding!\n");
+			goto out;
+		}
+
+		for (i = 0; i < prm.conns; i++)
+		{
+			if (!(pfds[i].revents & POLLIN))
+				continue;
+
+			n = recv(conns[i].fd, conns[i].rbuf + conns[i].rlen,
+				rsize - conns[i].rlen, 0);
+			if (n <= 0)
+				goto out;
+
+			conns[i].rlen += n;
+			n = parse_frames(&conns[i]);
+			conns[i].recvd += n;
+			done += n;
+
+			/* Keep the window full. */
+			for (; n > 0 && conns[i].sent < quota; n--)
+			{
+				if (bench_write_all(conns[i].fd, frame, frame_len) < 0)
+					goto out;
+				conns[i].sent++;
+			}
+		}
+	}
+
+	ret = bench_now() - start;
+	__atomic_store_n(&phase, 2, __ATOMIC_SEQ_CST);
+out:
+	for (i = 0; i < prm.conns; i++)
+	{
+		if (conns[i].fd > 0)
+			close(conns[i].fd);
+		free(conns[i].rbuf);
+	}
+	free(payload);
+	free(frame);
+	return (ret);
+}
+
+/**
+ * @brief Traced client arguments and results.
+ */
+struct traced_client
+{
+	pid_t server;   /**< Server pid.     */
+	uint16_t port;  /**< Server port.    */
+	double elapsed; /**< Client result.  */
+};
+
+/**
+ * @brief Traced run client thread: runs the client and then kills
+ * the server, so the tracer loop ends.
+ */
+static void *traced_client(void *p)
+{
+	struct traced_client *tc = p;
+	tc->elapsed = run_client(tc->port, prm.msgs_trace);
+	kill(tc->server, SIGKILL);
+	return (NULL);
+}
+
+/**
+ * @brief Runs the benchmark for a given I/O model, with the server
+ * traced, in order to count its syscalls.
+ *
+ * @return Returns the amount of syscalls per message, or a
+ * negative number if error.
+ */
+static double bench_syscalls(int model, uint16_t port)
+{
+	struct traced_client tc;
+	pthread_t thread;
+	long syscalls;
+	int inject;
+	pid_t pid;
+	int st;
+
+	pid = fork();
+	if (pid < 0)
+		return (-1.0);
+	if (!pid)
+	{
+		ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+		raise(SIGSTOP);
+		run_server(model, port);
+	}
+
+	if (waitpid(pid, &st, 0) < 0 || !WIFSTOPPED(st))
+		return (-1.0);
+
+	ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *)(long)
+		(PTRACE_O_TRACESYSGOOD|PTRACE_O_TRACECLONE|PTRACE_O_EXITKILL));
+	ptrace(PTRACE_SYSCALL, pid, NULL, NULL);
+
+	__atomic_store_n(&phase, 0, __ATOMIC_SEQ_CST);
+	tc.server = pid;
+	tc.port   = port;
+	if (pthread_create(&thread, NULL, traced_client, &tc))
+	{
+		kill(pid, SIGKILL);
+		return (-1.0);
+	}
+
+	/* Every syscall of every server thread stops twice: entry and exit. */
+	syscalls = 0;
+	while ((pid = waitpid(-1, &st, __WALL)) > 0)
+	{
+		if (!WIFSTOPPED(st))
+			continue;
+
+		inject = 0;
+		if (WSTOPSIG(st) == (SIGTRAP|0x80))
+		{
+			if (__atomic_load_n(&phase, __ATOMIC_SEQ_CST) == 1)
+				syscalls++;
+		}
+		else if (WSTOPSIG(st) != SIGTRAP && WSTOPSIG(st) != SIGSTOP)
+			inject = WSTOPSIG(st);
+
+		ptrace(PTRACE_SYSCALL, pid, NULL, (void *)(long)inject);
+	}
+
+	pthread_join(thread, NULL);
+	if (tc.elapsed < 0)
+		return (-1.0);
+
+	return ((syscalls / 2.0) / (prm.msgs_trace / prm.conns * prm.conns));
+}
+
+/**
+ * @brief Runs the benchmark for a given I/O model, untraced.
+ *
+ * @return Returns the elapsed time, or a negative number if error.
+ */
+static double bench_throughput(int model, uint16_t port)
+{
+	double elapsed;
+	pid_t pid;
+
+	pid = fork();
+	if (pid < 0)
+		return (-1.0);
+	if (!pid)
+		run_server(model, port);
+
+	elapsed = run_client(port, prm.msgs);
+	kill(pid, SIGKILL);
+	waitpid(pid, NULL, 0);
+	return (elapsed);
+}
+
+/**
+ * @brief Shows the usage.
+ */
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -m <threads|epoll|uring|all>  I/O model (default: all)\n"
+		"  -c <n>  Connections (default: %d, max: %d)\n"
+		"  -w <n>  Messages in flight per connection (default: %d)\n"
+		"  -n <n>  Messages (default: %ld)\n"
+		"  -N <n>  Messages of the traced run (default: %ld)\n"
+		"  -s <n>  Message size (default: %zu)\n"
+		"  -p <n>  Base port (default: %d)\n",
+		prog, prm.conns, MAX_CONNS, prm.window, prm.msgs, prm.msgs_trace,
+		prm.size, prm.port);
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Main routine.
+ */
+int main(int argc, char **argv)
+{
+	static const char *names[] = {"threads", "epoll", "uring"};
+	double elapsed;
+	double sys;
+	int model;
+	int first;
+	int last;
+	int c;
+
+	first = WS_IO_THREADS;
+	last  = WS_IO_URING;
+
+	while ((c = getopt(argc, argv, "m:c:w:n:N:s:p:h")) != -1)
+	{
+		switch (c)
+		{
+		case 'm':
+			for (model = WS_IO_THREADS; model <= WS_IO_URING; model++)
+				if (!strcmp(optarg, names[model]))
+					first = last = model;
+			if (strcmp(optarg, "all") && first != last)
+				usage(argv[0]);
+			break;
+		case 'c': prm.conns      = atoi(optarg);    break;
+		case 'w': prm.window     = atoi(optarg);    break;
+		case 'n': prm.msgs       = atol(optarg);    break;
+		case 'N': prm.msgs_trace = atol(optarg);    break;
+		case 's': prm.size       = atol(optarg);    break;
+		case 'p': prm.port       = atoi(optarg);    break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (prm.conns <= 0 || prm.conns > MAX_CONNS || prm.window <= 0 ||
+		prm.msgs < prm.conns || prm.msgs_trace < prm.conns)
+	{
+		usage(argv[0]);
+	}
+
+	/* Each connection exchanges the same amount of messages. */
+	prm.msgs = prm.msgs / prm.conns * prm.conns;
+
+	printf("%d connections, %d messages in flight each, %zu bytes/msg\n",
+		prm.conns, prm.window, prm.size);
+	printf("%-8s %12s %10s %14s\n", "model", "msgs/s", "MB/s", "syscalls/msg");
+
+	for (model = first; model <= last; model++)
+	{
+		elapsed = bench_throughput(model, prm.port + model * 2);
+		sys     = bench_syscalls(model, prm.port + model * 2 + 1);
+		if (elapsed < 0 || sys < 0)
+		{
+			printf("%-8s failed\n", names[model]);
+			continue;
+		}
+
+		printf("%-8s %12.0f %10.2f %14.2f\n", names[model],
+			prm.msgs / elapsed, prm.msgs * prm.size / elapsed / 1e6, sys);
+	}
+
+	return (0);
+}
@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2016-2024 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <base64.h>
+#include <sha1.h>
+#include <ws.h>
+
+#include "bench.h"
+
+/**
+ * @file bench_sha1.c
+ * @brief SHA-1 benchmark: checks the block routine in use against
+ * the reference one for a fuzzed set of keys (and messages), then
+ * compares their speed.
+ *
+ * Everything runs in memory, no server is involved.
+ */
+
+/**
+ * @brief Benchmark parameters.
+ */
+static struct bench_params
+{
+	long keys;      /**< Fuzzed keys checked.     */
+	long accepts;   /**< Accept values per run.   */
+	uint64_t seed;  /**< Random generator seed.   */
+} prm = {100000, 1000000, 42};
+
+/**
+ * @brief xorshift64 pseudo-random generator.
+ */
+static uint64_t rnd(void)
+{
+	prm.seed ^= prm.seed << 13;
+	prm.seed ^= prm.seed >> 7;
+	prm.seed ^= prm.seed << 17;
+	return (prm.seed);
+}
+
+/**
+ * @brief SHA-1 of the @p len bytes of @p msg with the reference
+ * block routine only.
+ */
+static void sha1_ref(const uint8_t *msg, size_t len,
+	uint8_t out[SHA1HashSize])
+{
+	uint32_t H[SHA1HashSize / 4] = {
+		0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0
+	};
+	uint8_t blk[64];
+	uint64_t bits;
+	size_t i;
+	size_t n;
+
+	for (i = 0; i + 64 <= len; i += 64)
+		SHA1ProcessBlock(H, msg + i);
+
+	/* Padding: 0x80, zeros and the length in bits. */
+	n = len - i;
+	memset(blk, 0, sizeof(blk));
+	memcpy(blk, msg + i, n);
+	blk[n] = 0x80;
+	if (n >= 56)
+	{
+		SHA1ProcessBlock(H, blk);
+		memset(blk, 0, sizeof(blk));
+	}
+
+	bits = (uint64_t)len * 8;
+	for (i = 0; i < 8; i++)
+		blk[63 - i] = (uint8_t)(bits >> (8 * i));
+	SHA1ProcessBlock(H, blk);
+
+	for (i = 0; i < SHA1HashSize; i++)
+		out[i] = (uint8_t)(H[i / 4] >> (24 - 8 * (i % 4)));
+}
+
+/**
+ * @brief SHA-1 of the @p len bytes of @p msg with the block routine
+ * in use.
+ */
+static void sha1_msg(const uint8_t *msg, size_t len,
+	uint8_t out[SHA1HashSize])
+{
+	SHA1Context ctx;
+	SHA1Reset(&ctx);
+	SHA1Input(&ctx, msg, (unsigned)len);
+	SHA1Result(&ctx, out);
+}
+
+/**
+ * @brief Builds a random Sec-WebSocket-Key followed by the magic
+ * string into @p out (WS_KEYMS_LEN bytes).
+ */
+static void fuzz_key(uint8_t out[WS_KEYMS_LEN + 1])
+{
+	unsigned char nonce[16];
+	size_t i;
+
+	for (i = 0; i < sizeof(nonce); i++)
+		nonce[i] = (unsigned char)rnd();
+
+	base64_encode_buf(nonce, sizeof(nonce), out);
+	memcpy(out + WS_KEY_LEN, MAGIC_STRING, WS_MS_LEN);
+}
+
+/**
+ * @brief Checks the block routine in use against the reference one,
+ * for prm.keys fuzzed keys and as many random messages (up to 4
+ * blocks).
+ *
+ * @return Returns the amount of mismatches.
+ */
+static long check(void)
+{
+	uint8_t ref[SHA1HashSize];
+	uint8_t out[SHA1HashSize];
+	uint8_t msg[256];
+	long errors;
+	size_t len;
+	size_t j;
+	long i;
+
+	errors = 0;
+	for (i = 0; i < prm.keys; i++)
+	{
+		fuzz_key(msg);
+		sha1_ref(msg, WS_KEYMS_LEN, ref);
+		sha1_msg(msg, WS_KEYMS_LEN, out);
+		errors += !!memcmp(ref, out, sizeof(ref));
+
+		len = rnd() % sizeof(msg);
+		for (j = 0; j < len; j++)
+			msg[j] = (uint8_t)rnd();
+		sha1_ref(msg, len, ref);
+		sha1_msg(msg, len, out);
+		errors += !!memcmp(ref, out, sizeof(ref));
+	}
+	return (errors);
+}
+
+/**
+ * @brief Computes prm.accepts SHA-1 of a key followed by the magic
+ * string, with the reference block routine (@p ref == 1) or the
+ * one in use.
+ *
+ * @return Returns the hashes per second.
+ */
+static double run(int ref)
+{
+	uint8_t msg[WS_KEYMS_LEN + 1];
+	uint8_t out[SHA1HashSize];
+	double start;
+	long i;
+
+	fuzz_key(msg);
+	start = bench_now();
+	for (i = 0; i < prm.accepts; i++)
+	{
+		if (ref)
+			sha1_ref(msg, WS_KEYMS_LEN, out);
+		else
+			sha1_msg(msg, WS_KEYMS_LEN, out);
+
+		/* Chain the hashes, so nothing is optimized away. */
+		msg[i % WS_KEY_LEN] ^= out[0];
+	}
+	return (prm.accepts / (bench_now() - start));
+}
+
+/**
+ * @brief Shows the usage.
+ */
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -k <n>  Fuzzed keys checked (default: %ld)\n"
+		"  -a <n>  Hashes per run (default: %ld)\n"
+		"  -s <n>  Random seed (default: %llu)\n",
+		prog, prm.keys, prm.accepts, (unsigned long long)prm.seed);
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Main routine.
+ */
+int main(int argc, char **argv)
+{
+	double hw;
+	double sw;
+	long errors;
+	int c;
+
+	while ((c = getopt(argc, argv, "k:a:s:h")) != -1)
+	{
+		switch (c)
+		{
+		case 'k': prm.keys    = atol(optarg); break;
+		case 'a': prm.accepts = atol(optarg); break;
+		case 's': prm.seed    = strtoull(optarg, NULL, 10); break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (prm.keys < 0 || prm.accepts <= 0 || !prm.seed)
+		usage(argv[0]);
+
+	printf("SHA-1 block routine: %s\n", sha1_kernel());
+
+	errors = check();
+	printf("%ld fuzzed keys (and messages) checked: %ld mismatches\n",
+		prm.keys, errors);
+	if (errors)
+		return (1);
+
+	sw = run(1);
+	hw = run(0);
+	printf("%-10s %14s\n", "routine", "key hashes/s");
+	printf("%-10s %14.0f\n", "ref", sw);
+	printf("%-10s %14.0f (%.1fx)\n", sha1_kernel(), hw, hw / sw);
+	return (0);
+}
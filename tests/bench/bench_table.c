@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2016-2024 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+/*
+ * The clients table is private to ws.c: it is built into the
+ * benchmark (instead of being linked from libws).
+ */
+#include "../../src/ws.c"
+
+#include "bench.h"
+
+/**
+ * @file bench_table.c
+ * @brief Clients table benchmark: bytes per connection and the time
+ * a broadcast takes to scan the clients table, with a large amount
+ * of connections.
+ *
+ * Everything runs in memory, no server is involved: the clients
+ * are put straight into the table of a server instance, and none
+ * of them has completed its handshake, so a broadcast only scans
+ * the table and sends nothing.
+ */
+
+/**
+ * @brief Benchmark parameters.
+ */
+static struct bench_params
+{
+	long conns;    /**< Amount of connections. */
+	long rounds;   /**< Broadcasts timed.      */
+	uint16_t port; /**< Instance port.         */
+} prm = {100000, 100, 8200};
+
+/**
+ * @brief Fills the table of a fake server instance with prm.conns
+ * clients, as ws_accept() would.
+ *
+ * @return Returns 0 if success, -1 otherwise.
+ */
+static int fill_table(void)
+{
+	static struct ws_part part;
+	struct ws_connection *cli;
+	struct ws_instance *srv;
+	long i;
+
+	srv = calloc(1, sizeof(*srv));
+	if (!srv)
+		return (-1);
+
+	srv->ws_srv.port        = prm.port;
+	srv->ws_srv.max_clients = (int)prm.conns;
+	if (pthread_mutex_init(&srv->mtx, NULL))
+		return (-1);
+
+	part.free = -1;
+	part.srv  = srv;
+	if (pthread_mutex_init(&part.mtx, NULL))
+		return (-1);
+
+	for (i = 0; i < prm.conns; i++)
+	{
+		cli = client_alloc(&part);
+		if (!cli)
+			return (-1);
+
+		cli->client_sock = (int)i + 3;
+		cli->state       = WS_STATE_CONNECTING;
+		cli->srv         = srv;
+		set_client_id(cli);
+	}
+
+	srv->active_clients = (unsigned)prm.conns;
+	instances = srv;
+	return (0);
+}
+
+/**
+ * @brief Broadcasts a frame prm.rounds times to the instance port.
+ *
+ * @return Returns the average time of a broadcast, in seconds.
+ */
+static double run(void)
+{
+	ws_frame_t *frame;
+	double elapsed;
+	double start;
+	long i;
+
+	frame = ws_frame_create("bench", 5, WS_FR_OP_TXT);
+	if (!frame)
+		return (-1);
+
+	/* Warm up. */
+	ws_frame_send_bcast(prm.port, frame);
+
+	start = bench_now();
+	for (i = 0; i < prm.rounds; i++)
+		ws_frame_send_bcast(prm.port, frame);
+	elapsed = bench_now() - start;
+
+	ws_frame_release(frame);
+	return (elapsed / prm.rounds);
+}
+
+/**
+ * @brief Shows the usage.
+ */
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -c <n>  Connections (default: %ld)\n"
+		"  -r <n>  Broadcasts timed (default: %ld)\n",
+		prog, prm.conns, prm.rounds);
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Main routine.
+ */
+int main(int argc, char **argv)
+{
+	size_t hot;
+	size_t cold;
+	double scan;
+	int c;
+
+	while ((c = getopt(argc, argv, "c:r:h")) != -1)
+	{
+		switch (c)
+		{
+		case 'c': prm.conns  = atol(optarg); break;
+		case 'r': prm.rounds = atol(optarg); break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (prm.conns <= 0 || prm.rounds <= 0 ||
+		prm.conns > (long)WS_MAX_CHUNKS * WS_CHUNK_SIZE)
+	{
+		usage(argv[0]);
+	}
+
+	if (fill_table() < 0)
+	{
+		fprintf(stderr, "Unable to fill the clients table!\n");
+		return (1);
+	}
+
+	hot  = sizeof(struct ws_connection);
+	cold = sizeof(struct ws_conn_cold);
+	scan = run();
+	if (scan < 0)
+		return (1);
+
+	printf("%ld connections\n", prm.conns);
+	printf("%-24s %10zu (hot: %zu, cold: %zu)\n", "bytes/conn", hot + cold,
+		hot, cold);
+	printf("%-24s %10.1f\n", "broadcast scan (us)", scan * 1e6);
+	printf("%-24s %10.2f\n", "broadcast scan/conn (ns)",
+		scan * 1e9 / prm.conns);
+	return (0);
+}
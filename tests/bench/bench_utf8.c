@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2016-2024 Davidson Francis <davidsondfgl@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>
+ */
+
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <utf8.h>
+
+#include "bench.h"
+
+/**
+ * @file bench_utf8.c
+ * @brief UTF-8 validation benchmark: byte-at-a-time DFA versus the
+ * vectorized validator, for a few kinds of text and message sizes.
+ *
+ * Everything runs in memory, no server is involved.
+ */
+
+/**
+ * @brief Benchmark parameters.
+ */
+static struct bench_params
+{
+	long mbytes; /**< Text (in MB) validated per run. */
+} prm = {256};
+
+/**
+ * @brief Kinds of text: each one is repeated to fill the buffers.
+ */
+static const struct bench_text
+{
+	const char *name; /**< Text name.  */
+	const char *text; /**< Text chunk. */
+} texts[] = {
+	{"ascii-json",
+		"{\"id\":12345,\"name\":\"sensor-42\",\"values\":[1.5,2.25,3.0],"
+		"\"ok\":true,\"tags\":[\"temp\",\"room\"]}"},
+	{"latin",
+		"Ol\xc3\xa1, pr\xc3\xa9-estr\xc3\xa9ia: a\xc3\xa7\xc3\xa3o e "
+		"informa\xc3\xa7\xc3\xa3o n\xc3\xa3o s\xc3\xa3o f\xc3\xa1" "ceis. "},
+	{"cjk",
+		"\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e\xe3\x81\xae\xe6\x96\x87"
+		"\xe7\xab\xa0\xe3\x81\xa7\xe3\x81\x99\xe3\x80\x82\xf0\x9f\x98\x80"}
+};
+
+/**
+ * @brief Message sizes.
+ */
+static const size_t sizes[] = {64, 1 << 10, 64 << 10};
+
+/**
+ * @brief Fills @p buf with @p len bytes of @p text, without cutting
+ * a multi-byte sequence in the end (spaces fill the gap).
+ */
+static void fill(unsigned char *buf, size_t len, const char *text)
+{
+	uint32_t st;
+	size_t tlen;
+	size_t last;
+	size_t n;
+
+	tlen = strlen(text);
+	for (n = 0; n < len; n++)
+		buf[n] = (unsigned char)text[n % tlen];
+
+	/* Find the end of the last complete character. */
+	st   = UTF8_ACCEPT;
+	last = 0;
+	for (n = 0; n < len; n++)
+	{
+		st = is_utf8_len_state(buf + n, 1, st);
+		if (st == UTF8_ACCEPT)
+			last = n + 1;
+	}
+	memset(buf + last, ' ', len - last);
+}
+
+/**
+ * @brief Validates @p len bytes of @p buf, until @p total bytes
+ * are validated, with the DFA (@p simd == 0) or the vectorized
+ * validator.
+ *
+ * @return Returns the throughput, in MB/s, or -1 if the text was
+ * (unexpectedly) refused.
+ */
+static double run(unsigned char *buf, size_t len, long total, int simd)
+{
+	double start;
+	uint32_t st;
+	long done;
+
+	start = bench_now();
+	for (done = 0; done < total; done += (long)len)
+	{
+		if (simd)
+			st = utf8_validate_state(buf, len, UTF8_ACCEPT);
+		else
+			st = is_utf8_len_state(buf, len, UTF8_ACCEPT);
+
+		if (st != UTF8_ACCEPT)
+			return (-1);
+	}
+	return (done / (bench_now() - start) / (1 << 20));
+}
+
+/**
+ * @brief Shows the usage.
+ */
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [options]\n"
+		"  -b <n>  Text (in MB) validated per run (default: %ld)\n",
+		prog, prm.mbytes);
+	exit(EXIT_FAILURE);
+}
+
+/**
+ * @brief Main routine.
+ */
+int main(int argc, char **argv)
+{
+	unsigned char *buf;
+	double simd;
+	double dfa;
+	size_t t;
+	size_t s;
+	int c;
+
+	while ((c = getopt(argc, argv, "b:h")) != -1)
+	{
+		switch (c)
+		{
+		case 'b': prm.mbytes = atol(optarg); break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (prm.mbytes <= 0)
+		usage(argv[0]);
+
+	buf = malloc(sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]);
+	if (!buf)
+		return (1);
+
+	printf("%ld MB per run, kernel: %s\n", prm.mbytes, utf8_kernel());
+	printf("%-12s %-8s %12s %12s %8s\n", "text", "size", "DFA MB/s",
+		"SIMD MB/s", "speedup");
+
+	for (t = 0; t < sizeof(texts) / sizeof(texts[0]); t++)
+	{
+		for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++)
+		{
+			fill(buf, sizes[s], texts[t].text);
+			dfa  = run(buf, sizes[s], prm.mbytes << 20, 0);
+			simd = run(buf, sizes[s], prm.mbytes << 20, 1);
+			if (dfa < 0 || simd < 0)
+			{
+				printf("%-12s %-8zu failed\n", texts[t].name, sizes[s]);
+				continue;
+			}
+			printf("%-12s %-8zu %12.0f %12.0f %7.1fx\n", texts[t].name,
+				sizes[s], dfa, simd, simd / dfa);
+		}
+	}
+
+	free(buf);
+	return (0);
+}
@@ -96,9 +96,11 @@ int main(int argc, char **argv)
 	}
 
 	struct ws_events evs;
-	evs.onopen    = &onopen;
-	evs.onclose   = &onclose;
-	evs.onmessage = &onmessage;
+	evs.onopen          = &onopen;
+	evs.onclose         = &onclose;
+	evs.onmessage       = &onmessage;
+	evs.onhandshake     = NULL;
+	evs.onmessage_chunk = NULL;
 	ws_file(&evs, argv[1]);
 	return (0);
 }
@@ -35,6 +35,9 @@ else
 	ECHO_BIN="$WSDIR/examples/echo/echo"
 fi
 
+# I/O model to be tested (optional), e.g: 'epoll' or 'uring'
+ECHO_ARGS="${2:-}"
+
 # AFL Fuzzing
 if [ -z "$TRAVIS" ]
 then
@@ -68,7 +71,7 @@ printf "\n[+] Running Autobahn...\n"
 # First spawn echo and get its pid
 if [ -f "$ECHO_BIN" ]
 then
-	"$ECHO_BIN" &
+	"$ECHO_BIN" $ECHO_ARGS &
 	SR=$!
 elif [ -f "$ECHO_BIN.exe" ]
 then
@@ -79,7 +82,7 @@ then
 		rm -rf "$WINEPREFIX"
 		/usr/lib/wine/wine64 wineboot
 	fi
-	/usr/lib/wine/wine64 "$ECHO_BIN.exe" &
+	/usr/lib/wine/wine64 "$ECHO_BIN.exe" $ECHO_ARGS &
 	SR=$!
 else
 	echo "Error, echo[.exe] not found!"